@@ -0,0 +1,236 @@
+/*
+ * Scenario files for headless MulticopterSim
+ *
+ * A scenario is a text file of "key = value" lines; # starts a comment.
+ * Recognized keys (all optional):
+ *
+ *   vehicle     = phantom        vehicle name (see Vehicles.hpp)
+ *   rate        = 1000           physics update rate [Hz]
+ *   integrator  = explicit       explicit or semiimplicit Euler
+ *   duration    = 10             simulated time [s]
+ *   altitude    = 0              initial height above ground [m]; > 0 starts airborne
+ *   phi         = 0              initial Euler angles [rad]
+ *   theta       = 0
+ *   psi         = 0
+ *   controller  = udp            udp, shm, or constant
+ *   motors      = 0.6            motor value for constant controller
+ *   host        = 127.0.0.1      controller host for udp
+ *   motorport   = 5000           UDP port on which motor values arrive
+ *   telemport   = 5001           UDP port to which telemetry is sent
+ *   shm         = /multicoptersim  shared-memory name for shm
+ *   attachtimeout = 10           seconds to wait for the shm controller's first reply
+ *   logevery    = 1              log every Nth physics step; 0 disables logging
+ *   disturbance = t0 t1 ax ay az NED acceleration [m/s^2] applied for t0 <= t < t1; may repeat
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <Dynamics.hpp>
+
+class Scenario {
+
+    public:
+
+        static const uint8_t MAX_DISTURBANCES = 32;
+
+        typedef struct {
+
+            double start;
+            double stop;
+            double accel[3];
+
+        } disturbance_t;
+
+        char     vehicle[32] = "phantom";
+        char     controller[32] = "udp";
+        char     host[64] = "127.0.0.1";
+        uint16_t motorPort = 5000;
+        uint16_t telemPort = 5001;
+        char     shmName[64] = "/multicoptersim";
+        double   attachTimeout = 10;
+        double   rate = 1000;
+        Dynamics::integrator_t integrator = Dynamics::INTEGRATOR_EXPLICIT_EULER;
+        double   duration = 10;
+        double   altitude = 0;
+        double   rotation[3] = {};
+        double   motors = 0;
+        uint32_t logEvery = 1;
+
+        disturbance_t disturbances[MAX_DISTURBANCES] = {};
+        uint8_t       disturbanceCount = 0;
+
+    private:
+
+        static void trim(char * s)
+        {
+            char * hash = strchr(s, '#');
+            if (hash) {
+                *hash = 0;
+            }
+
+            size_t n = strlen(s);
+            while (n > 0 && (s[n-1] == ' ' || s[n-1] == '\t' || s[n-1] == '\n' || s[n-1] == '\r')) {
+                s[--n] = 0;
+            }
+        }
+
+    public:
+
+        /**
+         * Sets a single key/value pair, as from a scenario line or the command line.
+         * @return true on success, false on unknown key or bad value
+         */
+        bool set(const char * key, const char * value)
+        {
+            if (!strcmp(key, "vehicle")) {
+                snprintf(vehicle, sizeof(vehicle), "%s", value);
+            }
+            else if (!strcmp(key, "controller")) {
+                snprintf(controller, sizeof(controller), "%s", value);
+            }
+            else if (!strcmp(key, "host")) {
+                snprintf(host, sizeof(host), "%s", value);
+            }
+            else if (!strcmp(key, "motorport")) {
+                motorPort = (uint16_t)atoi(value);
+            }
+            else if (!strcmp(key, "telemport")) {
+                telemPort = (uint16_t)atoi(value);
+            }
+            else if (!strcmp(key, "shm")) {
+                snprintf(shmName, sizeof(shmName), "%s", value);
+            }
+            else if (!strcmp(key, "attachtimeout")) {
+                attachTimeout = atof(value);
+            }
+            else if (!strcmp(key, "rate")) {
+                rate = atof(value);
+            }
+            else if (!strcmp(key, "integrator")) {
+                if (!strcmp(value, "explicit")) {
+                    integrator = Dynamics::INTEGRATOR_EXPLICIT_EULER;
+                }
+                else if (!strcmp(value, "semiimplicit")) {
+                    integrator = Dynamics::INTEGRATOR_SEMI_IMPLICIT_EULER;
+                }
+                else {
+                    return false;
+                }
+            }
+            else if (!strcmp(key, "duration")) {
+                duration = atof(value);
+            }
+            else if (!strcmp(key, "altitude")) {
+                altitude = atof(value);
+            }
+            else if (!strcmp(key, "phi")) {
+                rotation[0] = atof(value);
+            }
+            else if (!strcmp(key, "theta")) {
+                rotation[1] = atof(value);
+            }
+            else if (!strcmp(key, "psi")) {
+                rotation[2] = atof(value);
+            }
+            else if (!strcmp(key, "motors")) {
+                motors = atof(value);
+            }
+            else if (!strcmp(key, "logevery")) {
+                logEvery = atoi(value);
+            }
+            else if (!strcmp(key, "disturbance")) {
+                if (disturbanceCount == MAX_DISTURBANCES) {
+                    return false;
+                }
+                disturbance_t & d = disturbances[disturbanceCount];
+                if (sscanf(value, "%lf %lf %lf %lf %lf", &d.start, &d.stop, &d.accel[0], &d.accel[1], &d.accel[2]) != 5) {
+                    return false;
+                }
+                disturbanceCount++;
+            }
+            else {
+                return false;
+            }
+
+            return rate > 0;
+        }
+
+        /**
+         * Loads a scenario file, reporting errors on stderr.
+         * @return true on success, false otherwise
+         */
+        bool load(const char * filename)
+        {
+            FILE * fp = fopen(filename, "r");
+
+            if (!fp) {
+                fprintf(stderr, "Unable to open scenario file %s\n", filename);
+                return false;
+            }
+
+            char line[256];
+            uint32_t lineno = 0;
+            bool ok = true;
+
+            while (fgets(line, sizeof(line), fp)) {
+
+                lineno++;
+
+                trim(line);
+
+                char * eq = strchr(line, '=');
+
+                if (!eq) {
+                    if (strspn(line, " \t") != strlen(line)) {
+                        fprintf(stderr, "%s:%u: expected key = value\n", filename, lineno);
+                        ok = false;
+                    }
+                    continue;
+                }
+
+                *eq = 0;
+
+                char key[64] = {};
+                sscanf(line, "%63s", key);
+
+                char * value = eq + 1;
+                while (*value == ' ' || *value == '\t') {
+                    value++;
+                }
+
+                if (!set(key, value)) {
+                    fprintf(stderr, "%s:%u: bad setting for %s\n", filename, lineno, key);
+                    ok = false;
+                }
+            }
+
+            fclose(fp);
+
+            return ok;
+        }
+
+        // Sums the disturbances active at a given time
+        void getDisturbance(double time, double accel[3])
+        {
+            accel[0] = accel[1] = accel[2] = 0;
+
+            for (uint8_t k=0; k<disturbanceCount; ++k) {
+                const disturbance_t & d = disturbances[k];
+                if (time >= d.start && time < d.stop) {
+                    for (uint8_t i=0; i<3; ++i) {
+                        accel[i] += d.accel[i];
+                    }
+                }
+            }
+        }
+
+}; // class Scenario
@@ -0,0 +1,191 @@
+/*
+ * Shared-memory telemetry/motor channel for headless MulticopterSim
+ *
+ * Carries the same messages as the UDP interface (telemetry = time + 12D
+ * state out, motor values in) through a POSIX shared-memory block, avoiding
+ * the kernel round trip on every physics step.  Each side spins on a
+ * sequence number written by the other:
+ *
+ *   sim:        write telemetry, telemetrySeq++,  wait for motorSeq == telemetrySeq, read motors
+ *   controller: wait for telemetrySeq != motorSeq, read telemetry, write motors, motorSeq = telemetrySeq
+ *
+ * Since the controller answers whatever telemetry it has not yet answered,
+ * it can attach after the sim has sent its first frame; the sim waits for
+ * the first reply with a longer timeout than for the rest.  A telemetry
+ * time of -1 tells the controller that the sim is done.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+class ShmChannel {
+
+    public:
+
+        static const uint8_t MAX_MOTORS = 16;
+
+    private:
+
+        typedef struct {
+
+            std::atomic<uint32_t> telemetrySeq;
+            std::atomic<uint32_t> motorSeq;
+            double telemetry[13];
+            double motors[MAX_MOTORS];
+
+        } block_t;
+
+        // Spin this many times before yielding the CPU
+        static const uint32_t SPIN_COUNT = 10000;
+
+        block_t * _block = NULL;
+
+        char _name[64] = {};
+
+        bool _owner = false;
+
+        uint32_t _seq = 0;
+
+        // Waits for a sequence number to reach a value; returns false on timeout
+        static bool waitFor(std::atomic<uint32_t> & seq, uint32_t value, double timeout, bool equal)
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            for (uint32_t k=0; ; ++k) {
+
+                uint32_t current = seq.load(std::memory_order_acquire);
+
+                if (equal ? current == value : current != value) {
+                    return true;
+                }
+
+                if (k > SPIN_COUNT) {
+                    std::this_thread::yield();
+                    if (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > timeout) {
+                        return false;
+                    }
+                }
+            }
+        }
+
+    public:
+
+        /**
+         * Opens a channel.
+         *
+         * @param name shared-memory name, e.g. "/multicoptersim0"
+         * @param create true on the sim side (creates the block), false on the controller side
+         */
+        ShmChannel(const char * name, bool create)
+        {
+            snprintf(_name, sizeof(_name), "%s", name);
+
+            _owner = create;
+
+            int fd = create ? shm_open(name, O_CREAT | O_RDWR, 0600) : shm_open(name, O_RDWR, 0600);
+
+            if (fd < 0) {
+                return;
+            }
+
+            if (create && ftruncate(fd, sizeof(block_t)) != 0) {
+                close(fd);
+                return;
+            }
+
+            void * p = mmap(NULL, sizeof(block_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            close(fd);
+
+            if (p == MAP_FAILED) {
+                return;
+            }
+
+            _block = (block_t *)p;
+
+            if (create) {
+                memset(p, 0, sizeof(block_t));
+            }
+
+            // The sim starts from nothing sent; the controller from the last frame answered, so
+            // that a frame sent before it attached is still new to it
+            _seq = create ? 0 : _block->motorSeq.load(std::memory_order_acquire);
+        }
+
+        ~ShmChannel(void)
+        {
+            if (_block) {
+                munmap(_block, sizeof(block_t));
+            }
+
+            if (_owner) {
+                shm_unlink(_name);
+            }
+        }
+
+        bool isOpen(void)
+        {
+            return _block != NULL;
+        }
+
+        // Sim side ------------------------------------------------------------------------
+
+        void sendTelemetry(const double telemetry[13])
+        {
+            memcpy(_block->telemetry, telemetry, sizeof(_block->telemetry));
+            _block->telemetrySeq.store(++_seq, std::memory_order_release);
+        }
+
+        /**
+         * Waits for the controller's reply to the last telemetry.
+         * @param timeout seconds; the first reply, which waits for the controller to attach, may need longer
+         * @return false on timeout
+         */
+        bool receiveMotors(double * motors, uint8_t count, double timeout=1.0)
+        {
+            if (!waitFor(_block->motorSeq, _seq, timeout, true)) {
+                return false;
+            }
+
+            memcpy(motors, _block->motors, count * sizeof(double));
+
+            return true;
+        }
+
+        // Controller side -----------------------------------------------------------------
+
+        bool receiveTelemetry(double telemetry[13], double timeout=1.0)
+        {
+            if (!waitFor(_block->telemetrySeq, _seq, timeout, false)) {
+                return false;
+            }
+
+            _seq = _block->telemetrySeq.load(std::memory_order_acquire);
+
+            memcpy(telemetry, _block->telemetry, sizeof(_block->telemetry));
+
+            return true;
+        }
+
+        void sendMotors(const double * motors, uint8_t count)
+        {
+            memcpy(_block->motors, motors, count * sizeof(double));
+            _block->motorSeq.store(_seq, std::memory_order_release);
+        }
+
+}; // class ShmChannel
@@ -0,0 +1,77 @@
+/*
+ * Vehicle dynamics selection for headless MulticopterSim
+ *
+ * Parameters match the vehicle helper classes in Source/MainModule/vehicles
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <string.h>
+
+#include <dynamics/QuadXAP.hpp>
+#include <dynamics/OctoXAP.hpp>
+#include <dynamics/ThrustVector.hpp>
+
+class Vehicles {
+
+    private:
+
+        static Dynamics::vehicle_params_t & phantomParams(void)
+        {
+            static Dynamics::vehicle_params_t vparams = {
+
+                // Estimated
+                5.E-06, // b force constatnt [F=b*w^2]
+                2.E-06, // d torque constant [T=d*w^2]
+
+                // https://www.dji.com/phantom-4/info
+                1.380,  // m mass [kg]
+
+                // Estimated
+                2,      // Ix [kg*m^2] 
+                2,      // Iy [kg*m^2] 
+                3,      // Iz [kg*m^2] 
+                38E-04, // Jr prop inertial [kg*m^2] 
+
+                0.350,  // l arm length [m]
+
+                15000 // maxrpm
+            };
+
+            return vparams;
+        }
+
+        // Same as Source/MainModule/vehicles/multirotors/Rocket.hpp
+        static constexpr double ROCKET_NOZZLE_MAX_ANGLE = 45;
+
+    public:
+
+        /**
+         * Makes dynamics for a named vehicle.
+         *
+         * @param name phantom, tinywhoop, ingenuity, octo, or rocket
+         * @return new dynamics object, or NULL for an unknown name
+         */
+        static Dynamics * create(const char * name)
+        {
+            // Phantom, TinyWhoop, and Ingenuity currently share quad-X parameters
+            if (!strcmp(name, "phantom") || !strcmp(name, "tinywhoop") || !strcmp(name, "ingenuity")) {
+                return new QuadXAPDynamics(phantomParams());
+            }
+
+            if (!strcmp(name, "octo")) {
+                return new OctoXAPDynamics(phantomParams());
+            }
+
+            if (!strcmp(name, "rocket")) {
+                return new ThrustVectorDynamics(phantomParams(), ROCKET_NOZZLE_MAX_ANGLE);
+            }
+
+            return NULL;
+        }
+
+}; // class Vehicles
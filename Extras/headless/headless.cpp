@@ -0,0 +1,341 @@
+/*
+   Headless MulticopterSim: runs vehicle dynamics at a fixed step, with no
+   Unreal Engine, talking to a controller over UDP or shared memory
+
+   Usage: headless [-o LOGFILE] [-r REPLAYFILE] [KEY=VALUE ...] [SCENARIO]
+
+   KEY=VALUE settings override those in the scenario file (see Scenario.hpp).
+   The log is CSV: time, 12D state vector (Bouabdallah 2004), motor values.
+   The replay file journals every step's inputs for Extras/replay.
+
+   Copyright(C) 2021 Simon D.Levy
+
+   MIT License
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+
+#include "../../Source/SocketModule/sockets/TwoWayUdp.hpp"
+
+#include <LoopStats.hpp>
+#include <Replay.hpp>
+
+#include "Scenario.hpp"
+#include "Vehicles.hpp"
+#include "ShmChannel.hpp"
+
+static const uint8_t MAX_MOTORS = 16;
+
+class Controller {
+
+    public:
+
+        // Returns false when controller halts or stops responding
+        virtual bool getMotors(const double telemetry[13], double * motorvals, uint8_t nmotors) = 0;
+
+        // Tells controller we're done
+        virtual void finish(void) { }
+
+        virtual ~Controller(void) { }
+
+}; // class Controller
+
+class ConstantController : public Controller {
+
+    private:
+
+        double _value = 0;
+
+    public:
+
+        ConstantController(double value)
+        {
+            _value = value;
+        }
+
+        virtual bool getMotors(const double telemetry[13], double * motorvals, uint8_t nmotors) override
+        {
+            (void)telemetry;
+
+            for (uint8_t k=0; k<nmotors; ++k) {
+                motorvals[k] = _value;
+            }
+
+            return true;
+        }
+
+}; // class ConstantController
+
+class UdpController : public Controller {
+
+    private:
+
+        TwoWayUdp _twoWayUdp;
+
+    public:
+
+        UdpController(const char * host, uint16_t motorPort, uint16_t telemPort)
+            : _twoWayUdp(host, telemPort, motorPort)
+        {
+        }
+
+        virtual bool getMotors(const double telemetry[13], double * motorvals, uint8_t nmotors) override
+        {
+            _twoWayUdp.send((void *)telemetry, 13*sizeof(double));
+
+            _twoWayUdp.receive(motorvals, nmotors*sizeof(double));
+
+            // Control program sends a -1 to halt
+            return motorvals[0] != -1;
+        }
+
+        virtual void finish(void) override
+        {
+            // Send a bogus time value to tell remote server we're done
+            double telemetry[13] = {-1};
+            _twoWayUdp.send(telemetry, sizeof(telemetry));
+        }
+
+}; // class UdpController
+
+class ShmController : public Controller {
+
+    private:
+
+        ShmChannel _channel;
+
+        // Seconds to wait for the first reply, while the controller attaches
+        double _attachTimeout = 0;
+
+        bool _attached = false;
+
+    public:
+
+        ShmController(const char * name, double attachTimeout)
+            : _channel(name, true)
+        {
+            _attachTimeout = attachTimeout;
+        }
+
+        bool isOpen(void)
+        {
+            return _channel.isOpen();
+        }
+
+        virtual bool getMotors(const double telemetry[13], double * motorvals, uint8_t nmotors) override
+        {
+            _channel.sendTelemetry(telemetry);
+
+            if (!_channel.receiveMotors(motorvals, nmotors, _attached ? 1.0 : _attachTimeout)) {
+                if (!_attached) {
+                    fprintf(stderr, "No controller attached within %g seconds\n", _attachTimeout);
+                }
+                return false;
+            }
+
+            _attached = true;
+
+            return motorvals[0] != -1;
+        }
+
+        virtual void finish(void) override
+        {
+            double telemetry[13] = {-1};
+            _channel.sendTelemetry(telemetry);
+        }
+
+}; // class ShmController
+
+static Controller * makeController(Scenario & scenario)
+{
+    if (!strcmp(scenario.controller, "constant")) {
+        return new ConstantController(scenario.motors);
+    }
+
+    if (!strcmp(scenario.controller, "udp")) {
+        return new UdpController(scenario.host, scenario.motorPort, scenario.telemPort);
+    }
+
+    if (!strcmp(scenario.controller, "shm")) {
+        ShmController * controller = new ShmController(scenario.shmName, scenario.attachTimeout);
+        if (!controller->isOpen()) {
+            fprintf(stderr, "Unable to open shared memory %s\n", scenario.shmName);
+            delete controller;
+            return NULL;
+        }
+        return controller;
+    }
+
+    fprintf(stderr, "Unknown controller %s\n", scenario.controller);
+
+    return NULL;
+}
+
+static void usage(const char * progname)
+{
+    fprintf(stderr, "Usage: %s [-o LOGFILE] [-r REPLAYFILE] [KEY=VALUE ...] [SCENARIO]\n", progname);
+}
+
+int main(int argc, char ** argv)
+{
+    Scenario scenario;
+
+    const char * logname = NULL;
+    const char * replayname = NULL;
+
+    // Load scenario file first, so that command-line settings can override it
+    for (int k=1; k<argc; ++k) {
+        if (!strcmp(argv[k], "-o") || !strcmp(argv[k], "-r")) {
+            k++;
+        }
+        else if (!strchr(argv[k], '=') && !scenario.load(argv[k])) {
+            return 1;
+        }
+    }
+
+    for (int k=1; k<argc; ++k) {
+
+        if (!strcmp(argv[k], "-o")) {
+            if (k == argc-1) {
+                usage(argv[0]);
+                return 1;
+            }
+            logname = argv[++k];
+        }
+
+        else if (!strcmp(argv[k], "-r")) {
+            if (k == argc-1) {
+                usage(argv[0]);
+                return 1;
+            }
+            replayname = argv[++k];
+        }
+
+        else if (argv[k][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        }
+
+        else if (strchr(argv[k], '=')) {
+            char key[64] = {};
+            const char * eq = strchr(argv[k], '=');
+            snprintf(key, sizeof(key), "%.*s", (int)(eq-argv[k]), argv[k]);
+            if (!scenario.set(key, eq+1)) {
+                fprintf(stderr, "Bad setting %s\n", argv[k]);
+                return 1;
+            }
+        }
+    }
+
+    Dynamics * dynamics = Vehicles::create(scenario.vehicle);
+
+    if (!dynamics) {
+        fprintf(stderr, "Unknown vehicle %s\n", scenario.vehicle);
+        return 1;
+    }
+
+    uint8_t nmotors = dynamics->motorCount();
+
+    FILE * logfp = NULL;
+
+    if (logname && scenario.logEvery) {
+        logfp = fopen(logname, "w");
+        if (!logfp) {
+            fprintf(stderr, "Unable to open log file %s\n", logname);
+            return 1;
+        }
+    }
+
+    ReplayRecorder replay;
+
+    if (replayname && !replay.open(replayname, scenario.vehicle, dynamics)) {
+        fprintf(stderr, "Unable to open replay file %s\n", replayname);
+        return 1;
+    }
+
+    Controller * controller = makeController(scenario);
+
+    if (!controller) {
+        return 1;
+    }
+
+    // Start level (or at scenario rotation) at scenario altitude above flat ground
+    dynamics->init(scenario.rotation, scenario.altitude > 0);
+
+    double dt = 1 / scenario.rate;
+
+    uint64_t nsteps = (uint64_t)(scenario.duration * scenario.rate + 0.5);
+
+    double motorvals[MAX_MOTORS] = {};
+
+    // Wall-clock timing of physics steps
+    LoopStats loopStats(0);
+
+    auto wallStart = std::chrono::steady_clock::now();
+
+    uint64_t step = 0;
+
+    for (step=0; step<nsteps; ++step) {
+
+        double time = step * dt;
+
+        loopStats.update(std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count());
+
+        // Time + 12D state vector
+        double telemetry[13] = {time};
+        for (uint8_t k=0; k<12; ++k) {
+            telemetry[k+1] = dynamics->x(k);
+        }
+
+        if (!controller->getMotors(telemetry, motorvals, nmotors)) {
+            break;
+        }
+
+        if (logfp && step % scenario.logEvery == 0) {
+            fprintf(logfp, "%f", time);
+            for (uint8_t k=0; k<12; ++k) {
+                fprintf(logfp, ",%f", telemetry[k+1]);
+            }
+            for (uint8_t k=0; k<nmotors; ++k) {
+                fprintf(logfp, ",%f", motorvals[k]);
+            }
+            fprintf(logfp, "\n");
+        }
+
+        double disturbance[3] = {};
+        scenario.getDisturbance(time, disturbance);
+        dynamics->setDisturbance(disturbance);
+
+        // Flat ground, with NED Z negative upward
+        dynamics->setAgl(scenario.altitude - dynamics->x(Dynamics::STATE_Z));
+
+        dynamics->setMotors(motorvals);
+
+        replay.record(dynamics, time, dt, scenario.integrator, motorvals);
+
+        dynamics->update(dt, scenario.integrator);
+    }
+
+    double wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    controller->finish();
+
+    if (logfp) {
+        fclose(logfp);
+    }
+
+    double simTime = step * dt;
+
+    // One machine-readable summary line on stdout
+    printf("vehicle=%s steps=%llu simtime=%f walltime=%f speedup=%f maxstep=%e z=%f\n",
+            scenario.vehicle, (unsigned long long)step, simTime, wallTime, 
+            wallTime > 0 ? simTime / wallTime : 0, loopStats.getMaxPeriod(), dynamics->x(Dynamics::STATE_Z));
+
+    delete controller;
+    delete dynamics;
+
+    return 0;
+}
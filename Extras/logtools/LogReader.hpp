@@ -0,0 +1,367 @@
+/*
+ * Memory-mapped reader for MulticopterSim flight-recorder files
+ *
+ * A sparse index of time ranges is built on first open and kept in a sidecar
+ * file (FILE.idx), so later time-range queries touch only the parts of the
+ * recording they need.  The index is rebuilt whenever the recording's size
+ * or modification time differs from the one it was built for, or a hash of
+ * the recording's first and last index strides does not match, so an index
+ * is not trusted for a recording rewritten to the same length.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <string>
+
+#include <FlightRecorder.hpp>
+
+#include "MappedFile.hpp"
+
+class LogReader {
+
+    public:
+
+        // Records per index entry
+        static const uint32_t INDEX_STRIDE = 1024;
+
+        static const uint32_t INDEX_VERSION = 2;
+
+        typedef struct {
+
+            double   minTime;
+            double   maxTime;
+            uint64_t vehicles;   // bit (vehicle % 64) set for each vehicle present
+
+        } index_entry_t;
+
+        typedef struct {
+
+            char     magic[8];   // "MSIMIDX"
+            uint32_t version;
+            uint32_t stride;
+            uint64_t fileSize;   // of the recording this index describes
+            uint64_t fileTime;   // its modification time, nanoseconds
+            uint64_t checksum;   // FNV-1a of its header and first and last strides of records
+            uint64_t entryCount;
+
+        } index_header_t;
+
+        // A channel is one double-valued column of a record, such as z or a motor value
+        typedef struct {
+
+            const char * name;
+            uint16_t     offset;
+            uint8_t      type;    // FlightRecorder::type_t
+
+        } channel_t;
+
+    private:
+
+        MappedFile _file;
+
+        const FlightRecorder::header_t * _header = NULL;
+
+        const FlightRecorder::record_t * _records = NULL;
+
+        uint64_t _count = 0;
+
+        std::vector<index_entry_t> _index;
+
+        static const char * MAGIC(void)
+        {
+            return "MSIMIDX";
+        }
+
+        static uint64_t vehicleBit(uint32_t vehicle)
+        {
+            return (uint64_t)1 << (vehicle & 63);
+        }
+
+        static uint64_t fnv1a(uint64_t hash, const uint8_t * bytes, size_t size)
+        {
+            for (size_t k=0; k<size; ++k) {
+                hash = (hash ^ bytes[k]) * 0x100000001b3;
+            }
+            return hash;
+        }
+
+        uint64_t checksum(void)
+        {
+            uint64_t stride = _count < INDEX_STRIDE ? _count : INDEX_STRIDE;
+
+            const uint8_t * first = (const uint8_t *)_records;
+            const uint8_t * last = (const uint8_t *)(_records + _count - stride);
+
+            uint64_t hash = fnv1a(0xcbf29ce484222325, _file.data(), _header->headerSize);
+            hash = fnv1a(hash, first, stride * sizeof(FlightRecorder::record_t));
+            return fnv1a(hash, last, stride * sizeof(FlightRecorder::record_t));
+        }
+
+        bool loadIndex(const std::string & filename)
+        {
+            FILE * fp = fopen(filename.c_str(), "rb");
+
+            if (!fp) {
+                return false;
+            }
+
+            index_header_t header = {};
+
+            bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+                !memcmp(header.magic, MAGIC(), 8) &&
+                header.version == INDEX_VERSION &&
+                header.stride == INDEX_STRIDE &&
+                header.fileSize == _file.size() &&
+                header.fileTime == _file.mtime() &&
+                header.checksum == checksum() &&
+                header.entryCount == (_count + INDEX_STRIDE - 1) / INDEX_STRIDE;
+
+            if (ok) {
+                _index.resize(header.entryCount);
+                ok = fread(_index.data(), sizeof(index_entry_t), _index.size(), fp) == _index.size();
+            }
+
+            fclose(fp);
+
+            return ok;
+        }
+
+        void buildIndex(void)
+        {
+            _index.resize((_count + INDEX_STRIDE - 1) / INDEX_STRIDE);
+
+            for (uint64_t e=0; e<_index.size(); ++e) {
+
+                index_entry_t & entry = _index[e];
+
+                uint64_t first = e * INDEX_STRIDE;
+                uint64_t last = first + INDEX_STRIDE < _count ? first + INDEX_STRIDE : _count;
+
+                entry.minTime = _records[first].time;
+                entry.maxTime = _records[first].time;
+                entry.vehicles = 0;
+
+                for (uint64_t k=first; k<last; ++k) {
+                    const FlightRecorder::record_t & r = _records[k];
+                    if (r.time < entry.minTime) {
+                        entry.minTime = r.time;
+                    }
+                    if (r.time > entry.maxTime) {
+                        entry.maxTime = r.time;
+                    }
+                    entry.vehicles |= vehicleBit(r.vehicle);
+                }
+            }
+        }
+
+        // An unwritable sidecar is not an error; the index is just rebuilt next time
+        void saveIndex(const std::string & filename)
+        {
+            FILE * fp = fopen(filename.c_str(), "wb");
+
+            if (!fp) {
+                return;
+            }
+
+            index_header_t header = {};
+            memcpy(header.magic, MAGIC(), 8);
+            header.version = INDEX_VERSION;
+            header.stride = INDEX_STRIDE;
+            header.fileSize = _file.size();
+            header.fileTime = _file.mtime();
+            header.checksum = checksum();
+            header.entryCount = _index.size();
+
+            fwrite(&header, sizeof(header), 1, fp);
+            fwrite(_index.data(), sizeof(index_entry_t), _index.size(), fp);
+
+            fclose(fp);
+        }
+
+    public:
+
+        /**
+         * Opens a recording, loading or building its index; reports errors on stderr.
+         * @return true on success, false otherwise
+         */
+        bool open(const char * filename)
+        {
+            if (!_file.open(filename)) {
+                return false;
+            }
+
+            const FlightRecorder::header_t * header = (const FlightRecorder::header_t *)_file.data();
+
+            if (_file.size() < sizeof(*header) || memcmp(header->magic, FlightRecorder::magic(), 8) ||
+                    header->version != FlightRecorder::VERSION ||
+                    header->recordSize != sizeof(FlightRecorder::record_t) ||
+                    header->headerSize > _file.size()) {
+                fprintf(stderr, "%s is not a version %u flight-recorder file\n", filename, FlightRecorder::VERSION);
+                _file.close();
+                return false;
+            }
+
+            _header = header;
+            _records = (const FlightRecorder::record_t *)(_file.data() + header->headerSize);
+            _count = (_file.size() - header->headerSize) / sizeof(FlightRecorder::record_t);
+
+            std::string indexname = std::string(filename) + ".idx";
+
+            if (!loadIndex(indexname)) {
+                _file.sequential();
+                buildIndex();
+                saveIndex(indexname);
+            }
+
+            return true;
+        }
+
+        const FlightRecorder::record_t * records(void)
+        {
+            return _records;
+        }
+
+        uint64_t count(void)
+        {
+            return _count;
+        }
+
+        // Field table from the file header, describing the record layout
+        const FlightRecorder::field_t * fields(uint32_t & count)
+        {
+            count = _header->fieldCount;
+            return (const FlightRecorder::field_t *)(_header + 1);
+        }
+
+        /**
+         * Finds records for a vehicle within a time range, reading only index entries that may hold them.
+         * @param vehicle vehicle ID, or -1 for all
+         * @param t0 start time, inclusive
+         * @param t1 end time, inclusive
+         * @param visit called with the index of each matching record, in file order
+         * @return number of matching records
+         */
+        template <typename Visitor>
+        uint64_t query(int64_t vehicle, double t0, double t1, Visitor visit)
+        {
+            uint64_t bit = vehicle < 0 ? ~(uint64_t)0 : vehicleBit((uint32_t)vehicle);
+
+            uint64_t found = 0;
+
+            for (uint64_t e=0; e<_index.size(); ++e) {
+
+                const index_entry_t & entry = _index[e];
+
+                if (entry.maxTime < t0 || entry.minTime > t1 || !(entry.vehicles & bit)) {
+                    continue;
+                }
+
+                uint64_t first = e * INDEX_STRIDE;
+                uint64_t last = first + INDEX_STRIDE < _count ? first + INDEX_STRIDE : _count;
+
+                for (uint64_t k=first; k<last; ++k) {
+                    const FlightRecorder::record_t & r = _records[k];
+                    if ((vehicle < 0 || r.vehicle == (uint32_t)vehicle) && r.time >= t0 && r.time <= t1) {
+                        visit(k);
+                        found++;
+                    }
+                }
+            }
+
+            return found;
+        }
+
+        /**
+         * Looks up a channel by name: time, agl, airborne, vehicle, a state
+         * variable (x, dx, y, dy, z, dz, phi, dphi, theta, dtheta, psi, dpsi),
+         * u1-u4, or m1-m16 for motors.
+         * @return true on success, false on unknown name
+         */
+        static bool channel(const char * name, channel_t & channel)
+        {
+            static const char * STATE_NAMES[12] = {
+                "x", "dx", "y", "dy", "z", "dz", "phi", "dphi", "theta", "dtheta", "psi", "dpsi"
+            };
+
+            channel.name = name;
+            channel.type = FlightRecorder::TYPE_F64;
+
+            int k = 0;
+
+            if (!strcmp(name, "time")) {
+                channel.offset = offsetof(FlightRecorder::record_t, time);
+                return true;
+            }
+
+            if (!strcmp(name, "agl")) {
+                channel.offset = offsetof(FlightRecorder::record_t, agl);
+                return true;
+            }
+
+            if (!strcmp(name, "airborne")) {
+                channel.offset = offsetof(FlightRecorder::record_t, airborne);
+                channel.type = FlightRecorder::TYPE_U8;
+                return true;
+            }
+
+            if (!strcmp(name, "vehicle")) {
+                channel.offset = offsetof(FlightRecorder::record_t, vehicle);
+                channel.type = FlightRecorder::TYPE_U32;
+                return true;
+            }
+
+            for (k=0; k<12; ++k) {
+                if (!strcmp(name, STATE_NAMES[k])) {
+                    channel.offset = (uint16_t)(offsetof(FlightRecorder::record_t, x) + k*sizeof(double));
+                    return true;
+                }
+            }
+
+            if (sscanf(name, "u%d", &k) == 1 && k >= 1 && k <= 4) {
+                channel.offset = (uint16_t)(offsetof(FlightRecorder::record_t, u) + (k-1)*sizeof(double));
+                return true;
+            }
+
+            if (sscanf(name, "m%d", &k) == 1 && k >= 1 && k <= FlightRecorder::MAX_MOTORS) {
+                channel.offset = (uint16_t)(offsetof(FlightRecorder::record_t, motors) + (k-1)*sizeof(float));
+                channel.type = FlightRecorder::TYPE_F32;
+                return true;
+            }
+
+            return false;
+        }
+
+        static double value(const FlightRecorder::record_t & record, const channel_t & channel)
+        {
+            const uint8_t * p = (const uint8_t *)&record + channel.offset;
+
+            switch (channel.type) {
+                case FlightRecorder::TYPE_F32: {
+                    float f = 0;
+                    memcpy(&f, p, sizeof(f));
+                    return f;
+                }
+                case FlightRecorder::TYPE_U32: {
+                    uint32_t u = 0;
+                    memcpy(&u, p, sizeof(u));
+                    return u;
+                }
+                case FlightRecorder::TYPE_U8:
+                    return *p;
+                default: {
+                    double d = 0;
+                    memcpy(&d, p, sizeof(d));
+                    return d;
+                }
+            }
+        }
+
+}; // class LogReader
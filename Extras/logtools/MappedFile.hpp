@@ -0,0 +1,103 @@
+/*
+ * Read-only memory-mapped file for MulticopterSim log tools (POSIX)
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+class MappedFile {
+
+    private:
+
+        uint8_t * _data = NULL;
+        size_t    _size = 0;
+        uint64_t  _mtime = 0;   // nanoseconds
+
+    public:
+
+        /**
+         * Maps a whole file, reporting errors on stderr.
+         * @return true on success, false otherwise
+         */
+        bool open(const char * filename)
+        {
+            close();
+
+            int fd = ::open(filename, O_RDONLY);
+
+            if (fd < 0) {
+                fprintf(stderr, "Unable to open %s\n", filename);
+                return false;
+            }
+
+            struct stat st = {};
+            fstat(fd, &st);
+
+            _size = (size_t)st.st_size;
+            _mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000 + (uint64_t)st.st_mtim.tv_nsec;
+
+            if (_size > 0) {
+                void * data = mmap(NULL, _size, PROT_READ, MAP_SHARED, fd, 0);
+                _data = data == MAP_FAILED ? NULL : (uint8_t *)data;
+            }
+
+            ::close(fd);
+
+            if (!_data) {
+                fprintf(stderr, "Unable to map %s\n", filename);
+                _size = 0;
+                return false;
+            }
+
+            return true;
+        }
+
+        // Hints that the mapping will be read front to back
+        void sequential(void)
+        {
+            if (_data) {
+                madvise(_data, _size, MADV_SEQUENTIAL);
+            }
+        }
+
+        const uint8_t * data(void) const
+        {
+            return _data;
+        }
+
+        size_t size(void) const
+        {
+            return _size;
+        }
+
+        // Modification time when opened, in nanoseconds since the epoch
+        uint64_t mtime(void) const
+        {
+            return _mtime;
+        }
+
+        void close(void)
+        {
+            if (_data) {
+                munmap(_data, _size);
+                _data = NULL;
+                _size = 0;
+            }
+        }
+
+        ~MappedFile(void)
+        {
+            close();
+        }
+
+}; // class MappedFile
@@ -0,0 +1,101 @@
+/*
+ * C interface to the MulticopterSim flight-recorder reader (libsimlog)
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include "simlog.h"
+#include "LogReader.hpp"
+
+struct simlog {
+
+    LogReader reader;
+
+};
+
+simlog_t * simlog_open(const char * filename)
+{
+    simlog_t * log = new simlog_t;
+
+    if (!log->reader.open(filename)) {
+        delete log;
+        return NULL;
+    }
+
+    return log;
+}
+
+void simlog_close(simlog_t * log)
+{
+    delete log;
+}
+
+const void * simlog_records(simlog_t * log)
+{
+    return log->reader.records();
+}
+
+uint64_t simlog_count(simlog_t * log)
+{
+    return log->reader.count();
+}
+
+uint32_t simlog_record_size(void)
+{
+    return sizeof(FlightRecorder::record_t);
+}
+
+int simlog_field(simlog_t * log, uint32_t k, const char ** name, uint8_t * type, uint8_t * count, uint16_t * offset)
+{
+    uint32_t fieldCount = 0;
+    const FlightRecorder::field_t * fields = log->reader.fields(fieldCount);
+
+    if (k >= fieldCount) {
+        return 0;
+    }
+
+    *name = fields[k].name;
+    *type = fields[k].type;
+    *count = fields[k].count;
+    *offset = fields[k].offset;
+
+    return 1;
+}
+
+uint64_t simlog_query(simlog_t * log, int64_t vehicle, double t0, double t1, uint64_t * indices, uint64_t max)
+{
+    uint64_t n = 0;
+
+    return log->reader.query(vehicle, t0, t1, [&](uint64_t k) {
+        if (indices && n < max) {
+            indices[n++] = k;
+        }
+    });
+}
+
+int64_t simlog_extract(simlog_t * log, int64_t vehicle, double t0, double t1,
+        const char ** channels, uint32_t channelCount, double * out, uint64_t max)
+{
+    std::vector<LogReader::channel_t> columns(channelCount);
+
+    for (uint32_t c=0; c<channelCount; ++c) {
+        if (!LogReader::channel(channels[c], columns[c])) {
+            return -1;
+        }
+    }
+
+    const FlightRecorder::record_t * records = log->reader.records();
+
+    uint64_t n = 0;
+
+    return (int64_t)log->reader.query(vehicle, t0, t1, [&](uint64_t k) {
+        if (out && n < max) {
+            for (uint32_t c=0; c<channelCount; ++c) {
+                out[n*channelCount + c] = LogReader::value(records[k], columns[c]);
+            }
+            n++;
+        }
+    });
+}
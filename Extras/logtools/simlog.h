@@ -0,0 +1,51 @@
+/*
+ * C interface to the MulticopterSim flight-recorder reader (libsimlog)
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct simlog simlog_t;
+
+// Opens a recording, building its index if needed; NULL on failure
+simlog_t * simlog_open(const char * filename);
+
+void simlog_close(simlog_t * log);
+
+// Base of the memory-mapped record array, for zero-copy access
+const void * simlog_records(simlog_t * log);
+
+uint64_t simlog_count(simlog_t * log);
+
+uint32_t simlog_record_size(void);
+
+// Describes field k of a record, from the file's field table; returns 0 when k is out of range
+int simlog_field(simlog_t * log, uint32_t k, const char ** name, uint8_t * type, uint8_t * count, uint16_t * offset);
+
+/*
+ * Finds records for a vehicle (-1 for all) with t0 <= time <= t1, writing
+ * up to max record indices to indices (which may be NULL to just count).
+ * Returns the total number of matching records.
+ */
+uint64_t simlog_query(simlog_t * log, int64_t vehicle, double t0, double t1, uint64_t * indices, uint64_t max);
+
+/*
+ * Copies named channels (see LogReader::channel) of matching records into
+ * out, row by row, up to max rows.  Returns the total number of matching
+ * records, or -1 for an unknown channel.
+ */
+int64_t simlog_extract(simlog_t * log, int64_t vehicle, double t0, double t1,
+        const char ** channels, uint32_t channelCount, double * out, uint64_t max);
+
+#ifdef __cplusplus
+}
+#endif
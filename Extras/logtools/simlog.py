@@ -0,0 +1,162 @@
+'''
+Python access to MulticopterSim flight recordings through libsimlog
+
+The whole recording is exposed as a numpy structured array that views the
+memory-mapped file directly, with no copying; queries return record indices
+from the recording's time index, so only the requested part is read.
+
+    from simlog import SimLog
+
+    log = SimLog('flight.simrec')
+    rows = log.query(vehicle=0, t0=10, t1=20)  # indices of matching records
+    t = log.records['time'][rows]
+    z = log.records['x'][rows, 4]
+
+log.records and any slices of it share the mapping, and keep it open for as
+long as they are in use, even after log.close() or once log itself is gone;
+indexing with query() results, as above, makes copies.
+
+Copyright (C) 2021 Simon D. Levy
+
+MIT License
+'''
+
+import ctypes
+import os
+
+import numpy as np
+
+_TYPES = {0: np.float64, 1: np.float32, 2: np.uint32, 3: np.uint8}
+
+
+def _load():
+
+    lib = ctypes.CDLL(os.path.join(os.path.dirname(os.path.abspath(__file__)), 'libsimlog.so'))
+
+    lib.simlog_open.restype = ctypes.c_void_p
+    lib.simlog_open.argtypes = [ctypes.c_char_p]
+    lib.simlog_close.argtypes = [ctypes.c_void_p]
+    lib.simlog_records.restype = ctypes.c_void_p
+    lib.simlog_records.argtypes = [ctypes.c_void_p]
+    lib.simlog_count.restype = ctypes.c_uint64
+    lib.simlog_count.argtypes = [ctypes.c_void_p]
+    lib.simlog_record_size.restype = ctypes.c_uint32
+    lib.simlog_record_size.argtypes = []
+    lib.simlog_field.restype = ctypes.c_int
+    lib.simlog_field.argtypes = [ctypes.c_void_p, ctypes.c_uint32,
+                                 ctypes.POINTER(ctypes.c_char_p),
+                                 ctypes.POINTER(ctypes.c_uint8),
+                                 ctypes.POINTER(ctypes.c_uint8),
+                                 ctypes.POINTER(ctypes.c_uint16)]
+    lib.simlog_query.restype = ctypes.c_uint64
+    lib.simlog_query.argtypes = [ctypes.c_void_p, ctypes.c_int64, ctypes.c_double, ctypes.c_double,
+                                 ctypes.POINTER(ctypes.c_uint64), ctypes.c_uint64]
+
+    return lib
+
+
+class _Handle(object):
+    '''
+    Owns a libsimlog handle, closing it (and unmapping the recording) when the
+    last reference goes: the SimLog, or a numpy array viewing the mapping
+    '''
+
+    def __init__(self, lib, value):
+        self.lib = lib
+        self.value = value
+
+    def __del__(self):
+        if self.value:
+            self.lib.simlog_close(self.value)
+            self.value = None
+
+
+class SimLog(object):
+
+    _lib = None
+
+    def __init__(self, filename):
+
+        if SimLog._lib is None:
+            SimLog._lib = _load()
+
+        lib = SimLog._lib
+
+        handle = lib.simlog_open(filename.encode())
+
+        if not handle:
+            raise IOError('Unable to open %s' % filename)
+
+        self._handle = _Handle(lib, handle)
+
+        self.dtype = self._dtype()
+
+        count = lib.simlog_count(handle)
+        base = lib.simlog_records(handle)
+
+        # Zero-copy view of the mapped records; the array's base is the ctypes buffer,
+        # which holds the handle, so the mapping outlives every view of it
+        if count:
+            buffer = (ctypes.c_char * (count * self.dtype.itemsize)).from_address(base)
+            buffer.handle = self._handle
+        else:
+            buffer = b''
+        self.records = np.frombuffer(buffer, dtype=self.dtype, count=count)
+
+    def _dtype(self):
+
+        lib = SimLog._lib
+
+        names, formats, offsets = [], [], []
+
+        name = ctypes.c_char_p()
+        kind = ctypes.c_uint8()
+        count = ctypes.c_uint8()
+        offset = ctypes.c_uint16()
+
+        k = 0
+        while lib.simlog_field(self._handle.value, k, ctypes.byref(name), ctypes.byref(kind),
+                               ctypes.byref(count), ctypes.byref(offset)):
+            names.append(name.value.decode())
+            formats.append((_TYPES[kind.value], count.value) if count.value > 1 else _TYPES[kind.value])
+            offsets.append(offset.value)
+            k += 1
+
+        return np.dtype({'names': names, 'formats': formats, 'offsets': offsets,
+                         'itemsize': lib.simlog_record_size()})
+
+    def query(self, vehicle=-1, t0=-np.inf, t1=np.inf):
+        '''
+        Returns indices into self.records of a vehicle's records (all vehicles
+        for -1) with t0 <= time <= t1, in file order
+        '''
+        lib = SimLog._lib
+        count = lib.simlog_query(self._handle.value, vehicle, t0, t1, None, 0)
+        indices = np.empty(count, dtype=np.uint64)
+        lib.simlog_query(self._handle.value, vehicle, t0, t1,
+                         indices.ctypes.data_as(ctypes.POINTER(ctypes.c_uint64)), count)
+        return indices
+
+    def close(self):
+        '''
+        Drops this object's hold on the recording, which is closed once no
+        views of log.records remain
+        '''
+        self.records = None
+        self._handle = None
+
+
+if __name__ == '__main__':
+
+    # Plots altitude for one vehicle: simlog.py RECORDING [VEHICLE]
+
+    from sys import argv
+    import matplotlib.pyplot as plt
+
+    log = SimLog(argv[1])
+    rows = log.query(int(argv[2]) if len(argv) > 2 else 0)
+
+    plt.plot(log.records['time'][rows], -log.records['x'][rows, 4])
+    plt.xlabel('time (sec)')
+    plt.ylabel('altitude (m)')
+    plt.show()
@@ -0,0 +1,209 @@
+/*
+   Converts MulticopterSim flight-recorder files to and from the compressed
+   log format (see Source/MainModule/LogCodec.hpp)
+
+   Usage:
+
+     simpack [-p GROUP=PRECISION ...] [-z LEVEL] [-b RECORDS] INPUT.simrec OUTPUT.simlog
+     simpack -d INPUT.simlog OUTPUT.simrec
+
+   GROUP is time, x, u, agl, or motors; PRECISION 0 keeps the group lossless.
+   LEVEL is the zstd level (0 for none; needs a build with ZSTD=1).
+
+   Copyright(C) 2021 Simon D.Levy
+
+   MIT License
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include <LogCodec.hpp>
+
+#include "MappedFile.hpp"
+
+static void usage(const char * progname)
+{
+    fprintf(stderr, "Usage: %s [-p GROUP=PRECISION ...] [-z LEVEL] [-b RECORDS] INPUT.simrec OUTPUT.simlog\n", progname);
+    fprintf(stderr, "       %s -d INPUT.simlog OUTPUT.simrec\n", progname);
+    exit(1);
+}
+
+static double seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static int pack(const char * inname, const char * outname, const LogCodec::config_t & config, int level, uint32_t blockRecords)
+{
+    MappedFile input;
+
+    if (!input.open(inname)) {
+        return 1;
+    }
+
+    const FlightRecorder::header_t * header = (const FlightRecorder::header_t *)input.data();
+
+    if (input.size() < sizeof(*header) || memcmp(header->magic, FlightRecorder::magic(), 8) ||
+            header->recordSize != sizeof(FlightRecorder::record_t)) {
+        fprintf(stderr, "%s is not a compatible flight-recorder file\n", inname);
+        return 1;
+    }
+
+    const FlightRecorder::record_t * records = (const FlightRecorder::record_t *)(input.data() + header->headerSize);
+    size_t count = (input.size() - header->headerSize) / sizeof(FlightRecorder::record_t);
+
+    LogEncoder encoder;
+
+    if (!encoder.open(outname, config, level, blockRecords)) {
+        fprintf(stderr, "Unable to open %s\n", outname);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t k=0; k<count; ++k) {
+        if (!encoder.write(records[k])) {
+            fprintf(stderr, "Record %llu has an unsupported vehicle ID or motor count\n", (unsigned long long)k);
+            return 1;
+        }
+    }
+
+    encoder.close();
+
+    double time = seconds(start);
+
+    printf("records=%llu ratio=%.1f encode=%.0fMB/s\n", (unsigned long long)count, encoder.getRatio(),
+            time > 0 ? count * sizeof(FlightRecorder::record_t) / time / 1e6 : 0);
+
+    return 0;
+}
+
+static int unpack(const char * inname, const char * outname)
+{
+    MappedFile input;
+
+    if (!input.open(inname)) {
+        return 1;
+    }
+
+    LogDecoder decoder;
+
+    if (!decoder.open(input.data(), input.size())) {
+        return 1;
+    }
+
+    FILE * fp = fopen(outname, "wb");
+
+    if (!fp) {
+        fprintf(stderr, "Unable to open %s\n", outname);
+        return 1;
+    }
+
+    FlightRecorder::writeHeader(fp);
+
+    static const uint32_t CHUNK = 4096;
+    static FlightRecorder::record_t records[CHUNK];
+
+    uint64_t count = 0;
+    uint32_t n = 0;
+
+    double decodeTime = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    while (true) {
+
+        bool ok = decoder.read(records[n]);
+
+        if (ok) {
+            n++;
+        }
+
+        if (n == CHUNK || (!ok && n > 0)) {
+            decodeTime += seconds(start);
+            fwrite(records, sizeof(FlightRecorder::record_t), n, fp);
+            count += n;
+            n = 0;
+            start = std::chrono::steady_clock::now();
+        }
+
+        if (!ok) {
+            break;
+        }
+    }
+
+    fclose(fp);
+
+    printf("records=%llu decode=%.0fMB/s\n", (unsigned long long)count,
+            decodeTime > 0 ? count * sizeof(FlightRecorder::record_t) / decodeTime / 1e6 : 0);
+
+    return 0;
+}
+
+int main(int argc, char ** argv)
+{
+    LogCodec::config_t config = LogCodec::defaultConfig();
+    int level = 3;
+    uint32_t blockRecords = LogCodec::DEFAULT_BLOCK_RECORDS;
+    bool decode = false;
+
+    const char * names[2] = {};
+    uint8_t nameCount = 0;
+
+    for (int k=1; k<argc; ++k) {
+
+        if (!strcmp(argv[k], "-d")) {
+            decode = true;
+        }
+
+        else if (argv[k][0] == '-' && strlen(argv[k]) == 2 && k < argc-1) {
+
+            const char * value = argv[++k];
+
+            switch (argv[k-1][1]) {
+
+                case 'p': {
+                    char group[16] = {};
+                    const char * eq = strchr(value, '=');
+                    if (!eq) {
+                        usage(argv[0]);
+                    }
+                    snprintf(group, sizeof(group), "%.*s", (int)(eq-value), value);
+                    if (!LogCodec::setQuantum(config, group, atof(eq+1))) {
+                        fprintf(stderr, "Unknown channel group %s\n", group);
+                        return 1;
+                    }
+                    break;
+                }
+
+                case 'z':
+                    level = atoi(value);
+                    break;
+
+                case 'b':
+                    blockRecords = (uint32_t)atoi(value);
+                    break;
+
+                default:
+                    usage(argv[0]);
+            }
+        }
+
+        else if (nameCount < 2 && argv[k][0] != '-') {
+            names[nameCount++] = argv[k];
+        }
+
+        else {
+            usage(argv[0]);
+        }
+    }
+
+    if (nameCount != 2 || blockRecords == 0) {
+        usage(argv[0]);
+    }
+
+    return decode ? unpack(names[0], names[1]) : pack(names[0], names[1], config, level, blockRecords);
+}
@@ -0,0 +1,142 @@
+/*
+   Prints channels of a MulticopterSim flight recording as CSV, for one
+   vehicle over a time range, using the memory-mapped reader and its index
+
+   Usage: simquery [-v VEHICLE] [-t T0:T1] [-c CHANNEL,...] RECORDING
+
+   Channels are time, agl, airborne, vehicle, x, dx, y, dy, z, dz, phi, dphi,
+   theta, dtheta, psi, dpsi, u1-u4, and m1-m16 (default time,z).  With no
+   -v, all vehicles are printed.  With no channels or range, a summary of the
+   recording is printed instead.
+
+   Copyright(C) 2021 Simon D.Levy
+
+   MIT License
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <vector>
+
+#include "LogReader.hpp"
+
+static void usage(const char * progname)
+{
+    fprintf(stderr, "Usage: %s [-v VEHICLE] [-t T0:T1] [-c CHANNEL,...] RECORDING\n", progname);
+    exit(1);
+}
+
+static void summarize(LogReader & reader)
+{
+    const FlightRecorder::record_t * records = reader.records();
+
+    uint32_t vehicles = 0;
+    double t0 = DBL_MAX, t1 = -DBL_MAX;
+
+    for (uint64_t k=0; k<reader.count(); ++k) {
+        if (records[k].vehicle >= vehicles) {
+            vehicles = records[k].vehicle + 1;
+        }
+        if (records[k].time < t0) {
+            t0 = records[k].time;
+        }
+        if (records[k].time > t1) {
+            t1 = records[k].time;
+        }
+    }
+
+    printf("records=%llu vehicles=%u start=%f end=%f\n", (unsigned long long)reader.count(), vehicles,
+            reader.count() ? t0 : 0, reader.count() ? t1 : 0);
+}
+
+int main(int argc, char ** argv)
+{
+    int64_t vehicle = -1;
+    double t0 = -DBL_MAX, t1 = DBL_MAX;
+    const char * channelList = NULL;
+    const char * filename = NULL;
+    bool summary = true;
+
+    for (int k=1; k<argc; ++k) {
+
+        if (argv[k][0] == '-' && strlen(argv[k]) == 2 && k < argc-1) {
+
+            const char * value = argv[++k];
+
+            switch (argv[k-1][1]) {
+                case 'v':
+                    vehicle = atoi(value);
+                    break;
+                case 't':
+                    if (sscanf(value, "%lf:%lf", &t0, &t1) != 2) {
+                        usage(argv[0]);
+                    }
+                    break;
+                case 'c':
+                    channelList = value;
+                    break;
+                default:
+                    usage(argv[0]);
+            }
+
+            summary = false;
+        }
+
+        else if (!filename && argv[k][0] != '-') {
+            filename = argv[k];
+        }
+
+        else {
+            usage(argv[0]);
+        }
+    }
+
+    if (!filename) {
+        usage(argv[0]);
+    }
+
+    LogReader reader;
+
+    if (!reader.open(filename)) {
+        return 1;
+    }
+
+    if (summary) {
+        summarize(reader);
+        return 0;
+    }
+
+    // Parse comma-separated channel names
+    static char names[1024];
+    snprintf(names, sizeof(names), "%s", channelList ? channelList : "time,z");
+
+    std::vector<LogReader::channel_t> channels;
+
+    for (char * name = strtok(names, ","); name; name = strtok(NULL, ",")) {
+        LogReader::channel_t channel = {};
+        if (!LogReader::channel(name, channel)) {
+            fprintf(stderr, "Unknown channel %s\n", name);
+            return 1;
+        }
+        channels.push_back(channel);
+    }
+
+    for (size_t c=0; c<channels.size(); ++c) {
+        printf("%s%s", c ? "," : "", channels[c].name);
+    }
+    printf("\n");
+
+    const FlightRecorder::record_t * records = reader.records();
+
+    reader.query(vehicle, t0, t1, [&](uint64_t k) {
+        for (size_t c=0; c<channels.size(); ++c) {
+            printf("%s%.9g", c ? "," : "", LogReader::value(records[k], channels[c]));
+        }
+        printf("\n");
+    });
+
+    return 0;
+}
@@ -0,0 +1,292 @@
+/*
+   Replays a MulticopterSim replay journal through fresh vehicle dynamics, as
+   fast as the CPU allows, stopping at the first divergence
+
+   Usage: replay [-s STEP] [-n STEPS] [-c REFERENCE] [-v VEHICLE] [-o LOGFILE] REPLAYFILE
+
+   -s STEP       start at STEP, restoring state from the nearest keyframe
+   -n STEPS      play at most STEPS steps
+   -c REFERENCE  compare every step with the state in a flight-recorder (.simrec) file
+   -v VEHICLE    vehicle ID in the flight-recorder file (default 0)
+   -o LOGFILE    CSV log: time, 12D state vector, motor values
+
+   The replayed state is always checked against the journal's own keyframes.
+
+   Copyright(C) 2021 Simon D.Levy
+
+   MIT License
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include <Replay.hpp>
+#include <FlightRecorder.hpp>
+
+#include "../headless/Vehicles.hpp"
+
+// Sequential reader for one vehicle's records in a flight-recorder file
+class RecorderReader {
+
+    private:
+
+        FILE *   _fp = NULL;
+        uint32_t _vehicle = 0;
+        bool     _atEnd = false;
+
+    public:
+
+        bool open(const char * filename, uint32_t vehicle)
+        {
+            _fp = fopen(filename, "rb");
+
+            if (!_fp) {
+                fprintf(stderr, "Unable to open reference file %s\n", filename);
+                return false;
+            }
+
+            FlightRecorder::header_t header = {};
+
+            if (fread(&header, sizeof(header), 1, _fp) != 1 ||
+                    memcmp(header.magic, FlightRecorder::magic(), 8) ||
+                    header.recordSize != sizeof(FlightRecorder::record_t)) {
+                fprintf(stderr, "%s is not a compatible flight-recorder file\n", filename);
+                return false;
+            }
+
+            fseek(_fp, header.headerSize, SEEK_SET);
+
+            _vehicle = vehicle;
+
+            return true;
+        }
+
+        /**
+         * Finds the vehicle's record at a given time.  A record for a later
+         * time is left for the next call, since the recorder writes one per
+         * iteration and the journal has one per dynamics sub-step.
+         * @return true if found, false if there is none
+         */
+        bool find(double time, FlightRecorder::record_t & record)
+        {
+            while (fread(&record, sizeof(record), 1, _fp) == 1) {
+
+                if (record.vehicle != _vehicle || record.time < time) {
+                    continue;
+                }
+
+                if (record.time > time) {
+                    fseek(_fp, -(long)sizeof(record), SEEK_CUR);
+                    return false;
+                }
+
+                return true;
+            }
+
+            _atEnd = true;
+
+            return false;
+        }
+
+        // No records left for the vehicle
+        bool atEnd(void)
+        {
+            return _atEnd;
+        }
+
+        ~RecorderReader(void)
+        {
+            if (_fp) {
+                fclose(_fp);
+            }
+        }
+
+}; // class RecorderReader
+
+static const char * STATE_NAMES[12] = {
+    "x", "dx", "y", "dy", "z", "dz", "phi", "dphi", "theta", "dtheta", "psi", "dpsi"
+};
+
+static void reportDivergence(uint64_t step, double time, const double expected[12], Dynamics * dynamics)
+{
+    printf("diverged at step=%llu time=%f\n", (unsigned long long)step, time);
+
+    for (uint8_t k=0; k<12; ++k) {
+        double actual = dynamics->x(k);
+        if (memcmp(&actual, &expected[k], sizeof(double))) {
+            printf("  %-6s expected=%.17g replayed=%.17g\n", STATE_NAMES[k], expected[k], actual);
+        }
+    }
+}
+
+static void usage(const char * progname)
+{
+    fprintf(stderr, "Usage: %s [-s STEP] [-n STEPS] [-c REFERENCE] [-v VEHICLE] [-o LOGFILE] REPLAYFILE\n", progname);
+    exit(1);
+}
+
+int main(int argc, char ** argv)
+{
+    uint64_t start = 0;
+    uint64_t count = UINT64_MAX;
+    const char * refname = NULL;
+    uint32_t vehicle = 0;
+    const char * logname = NULL;
+    const char * replayname = NULL;
+
+    for (int k=1; k<argc; ++k) {
+
+        if (argv[k][0] == '-') {
+
+            if (k == argc-1 || strlen(argv[k]) != 2) {
+                usage(argv[0]);
+            }
+
+            const char * value = argv[++k];
+
+            switch (argv[k-1][1]) {
+                case 's':
+                    start = strtoull(value, NULL, 10);
+                    break;
+                case 'n':
+                    count = strtoull(value, NULL, 10);
+                    break;
+                case 'c':
+                    refname = value;
+                    break;
+                case 'v':
+                    vehicle = (uint32_t)atoi(value);
+                    break;
+                case 'o':
+                    logname = value;
+                    break;
+                default:
+                    usage(argv[0]);
+            }
+        }
+
+        else {
+            replayname = argv[k];
+        }
+    }
+
+    if (!replayname) {
+        usage(argv[0]);
+    }
+
+    ReplayPlayer player;
+
+    if (!player.open(replayname)) {
+        return 1;
+    }
+
+    const Replay::header_t & header = player.getHeader();
+
+    Dynamics * dynamics = Vehicles::create(header.vehicle);
+
+    if (!dynamics) {
+        fprintf(stderr, "Unknown vehicle %s\n", header.vehicle);
+        return 1;
+    }
+
+    if (memcmp(&dynamics->params(), &header.params, sizeof(header.params))) {
+        fprintf(stderr, "Warning: %s parameters differ from those recorded; replay will diverge\n", header.vehicle);
+    }
+
+    RecorderReader reference;
+
+    if (refname && !reference.open(refname, vehicle)) {
+        return 1;
+    }
+
+    FILE * logfp = NULL;
+
+    if (logname) {
+        logfp = fopen(logname, "w");
+        if (!logfp) {
+            fprintf(stderr, "Unable to open log file %s\n", logname);
+            return 1;
+        }
+    }
+
+    if (!player.seek(dynamics, start)) {
+        fprintf(stderr, "Cannot seek to step %llu of %llu\n", 
+                (unsigned long long)start, (unsigned long long)player.getStepCount());
+        return 1;
+    }
+
+    auto wallStart = std::chrono::steady_clock::now();
+
+    double simTime = 0;
+    uint64_t played = 0;
+    bool diverged = false;
+
+    Replay::step_t step = {};
+
+    while (played < count && player.next(dynamics, &step)) {
+
+        played++;
+        simTime += step.dt;
+
+        if (logfp) {
+            fprintf(logfp, "%f", step.time);
+            for (uint8_t k=0; k<12; ++k) {
+                fprintf(logfp, ",%f", dynamics->x(k));
+            }
+            for (uint8_t k=0; k<header.motorCount; ++k) {
+                fprintf(logfp, ",%f", step.motors[k]);
+            }
+            fprintf(logfp, "\n");
+        }
+
+        // Check against the reference log, which holds the state after the last sub-step of each iteration
+        if (refname) {
+            FlightRecorder::record_t record = {};
+            if (!reference.find(step.time, record)) {
+                if (reference.atEnd()) {
+                    fprintf(stderr, "No reference record for vehicle %u at time %f\n", vehicle, step.time);
+                    refname = NULL;
+                }
+            }
+            else {
+                double x[12] = {};
+                for (uint8_t k=0; k<12; ++k) {
+                    x[k] = dynamics->x(k);
+                }
+                if (memcmp(x, record.x, sizeof(x))) {
+                    reportDivergence(player.getStep()-1, step.time, record.x, dynamics);
+                    diverged = true;
+                    break;
+                }
+            }
+        }
+
+        // Check against our own keyframes, which hold the state before each chunk
+        Dynamics::snapshot_t expected = {}, actual = {};
+        if (player.getKeyframe(expected)) {
+            dynamics->getSnapshot(actual);
+            if (!Replay::sameState(expected, actual)) {
+                reportDivergence(player.getStep()-1, step.time, expected.x, dynamics);
+                diverged = true;
+                break;
+            }
+        }
+    }
+
+    double wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    if (logfp) {
+        fclose(logfp);
+    }
+
+    printf("vehicle=%s start=%llu steps=%llu simtime=%f walltime=%f speedup=%f diverged=%d\n",
+            header.vehicle, (unsigned long long)start, (unsigned long long)played, simTime, wallTime,
+            wallTime > 0 ? simTime / wallTime : 0, diverged);
+
+    delete dynamics;
+
+    return diverged ? 2 : 0;
+}
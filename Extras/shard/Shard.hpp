@@ -0,0 +1,355 @@
+/*
+ * One shard of a swarm split across processes, for the MulticopterSim shard tool
+ *
+ * A shard steps the dynamics of the vehicles it owns.  It owns either the
+ * vehicles in a slab of the world along X (PARTITION_REGION), handing a
+ * vehicle over to another shard when it crosses into that shard's slab, or a
+ * fixed subset of the vehicles (PARTITION_SUBSET).  After each step it
+ * publishes the vehicles it is handing over, and ghosts (id and position)
+ * of those other shards may need for finding vehicles near each other.
+ *
+ * A handed-over vehicle carries its complete dynamics snapshot, so its
+ * trajectory is the same whichever shard steps it.  Each close pair is
+ * counted by the shard owning the vehicle with the lower id, so the counts
+ * add up to those of a single shard owning every vehicle.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+
+#include <SpatialHash.hpp>
+
+#include "../headless/Scenario.hpp"
+#include "../headless/Vehicles.hpp"
+
+class Shard {
+
+    public:
+
+        static const uint32_t MAX_SHARDS = 64;
+
+        static const uint8_t MAX_MOTORS = 16;
+
+        typedef enum {
+
+            PARTITION_REGION,   // slabs along X; vehicles move between shards
+            PARTITION_SUBSET    // vehicle k stays with shard k % shards
+
+        } partition_t;
+
+        // How the world is split, the same for every shard
+        typedef struct {
+
+            uint8_t  partition;             // partition_t
+            uint32_t shardCount;
+            double   bounds[MAX_SHARDS+1];  // shard k owns bounds[k] <= X < bounds[k+1]
+            double   nearMiss;              // meters between centers that make a close pair
+
+        } layout_t;
+
+        // A vehicle's complete state, as handed from one shard to another
+        typedef struct {
+
+            uint32_t             id;
+            uint32_t             shard;      // where it is going, when handed over
+            double               origin[3];  // world NED position of its start, meters
+            double               drift[3];   // steady NED acceleration, m/s^2
+            Dynamics::snapshot_t snapshot;
+
+        } vehicle_t;
+
+        // Where another shard's vehicle is
+        typedef struct {
+
+            uint32_t id;
+            uint32_t shard;         // owner after this step's hand-overs
+            float    position[3];   // world NED, meters
+
+        } ghost_t;
+
+    private:
+
+        typedef struct {
+
+            vehicle_t  state;     // snapshot filled in only when handed over
+            Dynamics * dynamics;
+
+        } owned_t;
+
+        Scenario _scenario;
+
+        layout_t _layout = {};
+
+        uint32_t _index = 0;
+
+        std::vector<owned_t> _owned;
+
+        // Ghosts from other shards for this step's pair count
+        std::vector<ghost_t> _ghosts;
+
+        // Scratch for the pair count: owned vehicles first, then ghosts
+        SpatialHash                      _grid;
+        std::vector<float>               _positions;
+        std::vector<uint32_t>            _ids;
+        std::vector<SpatialHash::pair_t> _pairs;
+
+        uint64_t _closePairs = 0;
+
+        static void position(const owned_t & vehicle, float position[3])
+        {
+            for (uint8_t i=0; i<3; ++i) {
+                position[i] = (float)(vehicle.state.origin[i] + vehicle.dynamics->x(2*i));
+            }
+        }
+
+        static uint32_t owner(const layout_t & layout, uint32_t id, double x)
+        {
+            if (layout.partition == PARTITION_SUBSET) {
+                return id % layout.shardCount;
+            }
+
+            uint32_t shard = 0;
+            while (shard+1 < layout.shardCount && x >= layout.bounds[shard+1]) {
+                shard++;
+            }
+
+            return shard;
+        }
+
+        // Ghosts reach twice the near-miss distance past a boundary, so that
+        // rounding positions to float never loses a pair
+        double ghostMargin(void) const
+        {
+            return 2 * _layout.nearMiss;
+        }
+
+        // Whether another shard might have a vehicle within near-miss distance of one at X
+        bool nearBoundary(double x) const
+        {
+            if (_layout.partition == PARTITION_SUBSET) {
+                return true;
+            }
+
+            return (_index > 0 && x < _layout.bounds[_index] + ghostMargin()) ||
+                (_index+1 < _layout.shardCount && x >= _layout.bounds[_index+1] - ghostMargin());
+        }
+
+        // Whether a ghost at X might be within near-miss distance of one of ours
+        bool nearRegion(double x) const
+        {
+            if (_layout.partition == PARTITION_SUBSET) {
+                return true;
+            }
+
+            return (_index == 0 || x >= _layout.bounds[_index] - ghostMargin()) &&
+                (_index+1 == _layout.shardCount || x < _layout.bounds[_index+1] + ghostMargin());
+        }
+
+    public:
+
+        /**
+         * @param scenario vehicle, rate, motors and disturbances
+         * @param layout how the world is split
+         * @param index this shard
+         */
+        Shard(const Scenario & scenario, const layout_t & layout, uint32_t index)
+        {
+            _scenario = scenario;
+            _layout = layout;
+            _index = index;
+            _grid.setCellSize(2 * layout.nearMiss);
+        }
+
+        ~Shard(void)
+        {
+            for (owned_t & vehicle : _owned) {
+                delete vehicle.dynamics;
+            }
+        }
+
+        // Shard that owns a vehicle at the start
+        static uint32_t startingShard(const layout_t & layout, const vehicle_t & vehicle)
+        {
+            return owner(layout, vehicle.id, vehicle.origin[0] + vehicle.snapshot.x[Dynamics::STATE_X]);
+        }
+
+        /**
+         * Takes over a vehicle, at the start or from another shard.
+         * @return false if the scenario's vehicle is unknown, true otherwise
+         */
+        bool adopt(const vehicle_t & state)
+        {
+            owned_t vehicle = {state, Vehicles::create(_scenario.vehicle)};
+
+            if (!vehicle.dynamics) {
+                return false;
+            }
+
+            vehicle.dynamics->setSnapshot(state.snapshot);
+            _owned.push_back(vehicle);
+
+            return true;
+        }
+
+        /**
+         * Steps every vehicle, then hands over those that have left this
+         * shard's region and lists those other shards may need as ghosts.
+         * @param time seconds
+         * @param dt seconds
+         * @param handovers output: vehicles now owned by other shards
+         * @param handoverCount output
+         * @param ghosts output
+         * @param ghostCount output
+         */
+        void step(double time, double dt, vehicle_t * handovers, uint32_t & handoverCount, ghost_t * ghosts, uint32_t & ghostCount)
+        {
+            double motors[MAX_MOTORS] = {};
+            for (double & motor : motors) {
+                motor = _scenario.motors;
+            }
+
+            double disturbance[3] = {};
+            _scenario.getDisturbance(time, disturbance);
+
+            handoverCount = 0;
+            ghostCount = 0;
+
+            size_t kept = 0;
+
+            for (owned_t & vehicle : _owned) {
+
+                Dynamics * dynamics = vehicle.dynamics;
+
+                double accel[3] = {};
+                for (uint8_t i=0; i<3; ++i) {
+                    accel[i] = disturbance[i] + vehicle.state.drift[i];
+                }
+                dynamics->setDisturbance(accel);
+
+                // Flat ground at world Z = 0, with NED Z negative upward
+                dynamics->setAgl(-(vehicle.state.origin[2] + dynamics->x(Dynamics::STATE_Z)));
+
+                dynamics->setMotors(motors);
+
+                dynamics->update(dt);
+
+                double x = vehicle.state.origin[0] + dynamics->x(Dynamics::STATE_X);
+
+                uint32_t shard = owner(_layout, vehicle.state.id, x);
+
+                if (shard != _index || nearBoundary(x)) {
+                    ghost_t & ghost = ghosts[ghostCount++];
+                    ghost.id = vehicle.state.id;
+                    ghost.shard = shard;
+                    position(vehicle, ghost.position);
+                }
+
+                if (shard != _index) {
+
+                    // Still needed here for pairs with the vehicles this shard keeps
+                    _ghosts.push_back(ghosts[ghostCount-1]);
+
+                    vehicle_t & handover = handovers[handoverCount++];
+                    handover = vehicle.state;
+                    handover.shard = shard;
+                    dynamics->getSnapshot(handover.snapshot);
+                    delete dynamics;
+                    continue;
+                }
+
+                _owned[kept++] = vehicle;
+            }
+
+            _owned.resize(kept);
+        }
+
+        // Takes over the vehicles another shard has handed to this one, and keeps its ghosts near this one's region
+        void receive(const vehicle_t * handovers, uint32_t handoverCount, const ghost_t * ghosts, uint32_t ghostCount)
+        {
+            for (uint32_t k=0; k<handoverCount; ++k) {
+                if (handovers[k].shard == _index) {
+                    adopt(handovers[k]);
+                }
+            }
+
+            for (uint32_t k=0; k<ghostCount; ++k) {
+                if (ghosts[k].shard != _index && nearRegion(ghosts[k].position[0])) {
+                    _ghosts.push_back(ghosts[k]);
+                }
+            }
+        }
+
+        /**
+         * Counts the pairs within near-miss distance that this shard is
+         * responsible for, among its own vehicles and the ghosts received
+         * since the last count.
+         */
+        void countPairs(void)
+        {
+            uint32_t ownedCount = (uint32_t)_owned.size();
+            uint32_t count = ownedCount + (uint32_t)_ghosts.size();
+
+            _positions.resize(3 * count);
+            _ids.resize(count);
+
+            for (uint32_t k=0; k<ownedCount; ++k) {
+                position(_owned[k], &_positions[3*k]);
+                _ids[k] = _owned[k].state.id;
+            }
+
+            for (uint32_t k=ownedCount; k<count; ++k) {
+                const ghost_t & ghost = _ghosts[k-ownedCount];
+                for (uint8_t i=0; i<3; ++i) {
+                    _positions[3*k+i] = ghost.position[i];
+                }
+                _ids[k] = ghost.id;
+            }
+
+            _grid.build(_positions.data(), count);
+
+            _pairs.clear();
+            _grid.pairs((float)_layout.nearMiss, _pairs);
+
+            for (const SpatialHash::pair_t & pair : _pairs) {
+
+                bool ownA = pair.a < ownedCount;
+                bool ownB = pair.b < ownedCount;
+
+                // Ours if we own both, or own the one with the lower id
+                if ((ownA && ownB) || (ownA && _ids[pair.a] < _ids[pair.b]) || (ownB && _ids[pair.b] < _ids[pair.a])) {
+                    _closePairs++;
+                }
+            }
+
+            _ghosts.clear();
+        }
+
+        // Steps at which a pair of vehicles was within near-miss distance, summed over pairs
+        uint64_t getClosePairs(void)
+        {
+            return _closePairs;
+        }
+
+        uint32_t getVehicleCount(void)
+        {
+            return (uint32_t)_owned.size();
+        }
+
+        // Current state of every vehicle this shard owns
+        void getVehicles(vehicle_t * vehicles)
+        {
+            for (size_t k=0; k<_owned.size(); ++k) {
+                vehicles[k] = _owned[k].state;
+                vehicles[k].shard = _index;
+                _owned[k].dynamics->getSnapshot(vehicles[k].snapshot);
+            }
+        }
+
+}; // class Shard
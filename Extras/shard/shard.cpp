@@ -0,0 +1,523 @@
+/*
+   Sharded MulticopterSim: runs one large swarm's dynamics split across
+   several worker processes, kept in lockstep by a coordinator
+
+   Usage: shard [-w WORKERS] [-n VEHICLES] [-p region|subset] [-s SPACING]
+                [-d DRIFT] [-m NEARMISS] [-o OUTFILE] [KEY=VALUE ...] [SCENARIO]
+
+   -w WORKERS   worker processes (default 4); 1 runs everything in this process
+   -n VEHICLES  vehicles, on a square grid (default 1000)
+   -p           split the world into slabs along X (region, the default), with
+                vehicles handed over as they cross, or the vehicles into fixed subsets
+   -s SPACING   grid spacing, meters (default 2)
+   -d DRIFT     steady horizontal acceleration of each vehicle, in a direction
+                set by its id, m/s^2 (default 0.5)
+   -m NEARMISS  distance between centers counted as a close pair, meters (default 1)
+   -o OUTFILE   CSV of every vehicle's final state, by id: id, world X,Y,Z, 12D state
+
+   The scenario is as for Extras/headless (vehicle, rate, duration, altitude,
+   motors, disturbances); every vehicle is under the constant controller,
+   whatever the scenario's controller setting.
+
+   Workers exchange state through shared memory.  On each step the
+   coordinator has every worker step its vehicles and publish hand-overs and
+   ghosts, then has every worker take in the others' hand-overs and count
+   close pairs.  The final states and counts match a run with one worker.
+
+   Copyright(C) 2021 Simon D.Levy
+
+   MIT License
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "Shard.hpp"
+
+// Per-worker mailbox in shared memory, followed by its hand-over and ghost arrays
+typedef struct {
+
+    std::atomic<uint64_t> done;       // last phase finished
+    uint32_t              handoverCount;
+    uint32_t              ghostCount;
+    uint32_t              vehicleCount;
+    uint64_t              closePairs;
+    uint64_t              handovers;  // total so far
+
+} mailbox_t;
+
+typedef struct {
+
+    std::atomic<uint64_t> phase;      // 2*step+1: step; 2*step+2: exchange; FINAL_PHASE: report and exit
+
+} control_t;
+
+static const uint64_t FINAL_PHASE = UINT64_MAX;
+
+// Spin this many times before yielding the CPU
+static const uint32_t SPIN_COUNT = 1000;
+
+// Seconds to wait for another process before giving up on it
+static constexpr double TIMEOUT = 10;
+
+class SharedMemory {
+
+    private:
+
+        uint8_t * _base = NULL;
+        size_t    _size = 0;
+
+        uint32_t  _workers = 0;
+        uint32_t  _capacity = 0;
+
+        size_t    _mailboxSize = 0;
+
+    public:
+
+        // Mapped before forking, so every worker shares it
+        bool open(uint32_t workers, uint32_t capacity)
+        {
+            _workers = workers;
+            _capacity = capacity;
+
+            _mailboxSize = sizeof(mailbox_t) + capacity * (sizeof(Shard::vehicle_t) + sizeof(Shard::ghost_t));
+            _mailboxSize = (_mailboxSize + 63) & ~(size_t)63;
+
+            _size = 64 + workers * _mailboxSize;
+
+            void * p = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+            if (p == MAP_FAILED) {
+                return false;
+            }
+
+            _base = (uint8_t *)p;
+
+            new (control()) control_t();
+            control()->phase = 0;
+
+            for (uint32_t k=0; k<workers; ++k) {
+                new (mailbox(k)) mailbox_t();
+                mailbox(k)->done = 0;
+            }
+
+            return true;
+        }
+
+        ~SharedMemory(void)
+        {
+            if (_base) {
+                munmap(_base, _size);
+            }
+        }
+
+        control_t * control(void)
+        {
+            return (control_t *)_base;
+        }
+
+        mailbox_t * mailbox(uint32_t k)
+        {
+            return (mailbox_t *)(_base + 64 + k * _mailboxSize);
+        }
+
+        // Hand-overs during the run; every vehicle the worker owns at the end
+        Shard::vehicle_t * vehicles(uint32_t k)
+        {
+            return (Shard::vehicle_t *)(mailbox(k) + 1);
+        }
+
+        Shard::ghost_t * ghosts(uint32_t k)
+        {
+            return (Shard::ghost_t *)(vehicles(k) + _capacity);
+        }
+
+}; // class SharedMemory
+
+// Waits for a counter to reach a value; returns false on timeout
+static bool waitFor(std::atomic<uint64_t> & counter, uint64_t value)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t k=0; ; ++k) {
+
+        if (counter.load(std::memory_order_acquire) == value) {
+            return true;
+        }
+
+        if (k > SPIN_COUNT) {
+            std::this_thread::yield();
+            if (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > TIMEOUT) {
+                return false;
+            }
+        }
+    }
+}
+
+// Waits for the coordinator to move past a phase; returns the new one, or FINAL_PHASE on timeout
+static uint64_t waitForPhase(control_t * control, uint64_t phase)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t k=0; ; ++k) {
+
+        uint64_t current = control->phase.load(std::memory_order_acquire);
+
+        if (current != phase) {
+            return current;
+        }
+
+        if (k > SPIN_COUNT) {
+            std::this_thread::yield();
+            if (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() > TIMEOUT) {
+                return FINAL_PHASE;
+            }
+        }
+    }
+}
+
+static void workerMain(SharedMemory & memory, Shard & shard, uint32_t index, uint32_t workers, double dt)
+{
+    mailbox_t * mailbox = memory.mailbox(index);
+
+    uint64_t phase = 0;
+
+    while (true) {
+
+        phase = waitForPhase(memory.control(), phase);
+
+        if (phase == FINAL_PHASE) {
+            shard.getVehicles(memory.vehicles(index));
+            mailbox->vehicleCount = shard.getVehicleCount();
+            mailbox->closePairs = shard.getClosePairs();
+            mailbox->done.store(phase, std::memory_order_release);
+            return;
+        }
+
+        // Step, publishing hand-overs and ghosts
+        if (phase & 1) {
+            uint64_t step = phase / 2;
+            shard.step(step * dt, dt, memory.vehicles(index), mailbox->handoverCount, memory.ghosts(index), mailbox->ghostCount);
+            mailbox->handovers += mailbox->handoverCount;
+        }
+
+        // Take in the other workers' hand-overs and ghosts, then count close pairs
+        else {
+            for (uint32_t k=0; k<workers; ++k) {
+                if (k != index) {
+                    mailbox_t * other = memory.mailbox(k);
+                    shard.receive(memory.vehicles(k), other->handoverCount, memory.ghosts(k), other->ghostCount);
+                }
+            }
+            shard.countPairs();
+        }
+
+        mailbox->done.store(phase, std::memory_order_release);
+    }
+}
+
+// Runs every phase in turn, waiting for all workers to finish each; returns false if one has died
+static bool coordinate(SharedMemory & memory, uint32_t workers, uint64_t nsteps)
+{
+    for (uint64_t step=0; step<nsteps; ++step) {
+
+        for (uint64_t phase=2*step+1; phase<=2*step+2; ++phase) {
+
+            memory.control()->phase.store(phase, std::memory_order_release);
+
+            for (uint32_t k=0; k<workers; ++k) {
+                if (!waitFor(memory.mailbox(k)->done, phase)) {
+                    fprintf(stderr, "Worker %u stopped responding at step %llu\n", k, (unsigned long long)step);
+                    return false;
+                }
+            }
+        }
+    }
+
+    memory.control()->phase.store(FINAL_PHASE, std::memory_order_release);
+
+    for (uint32_t k=0; k<workers; ++k) {
+        if (!waitFor(memory.mailbox(k)->done, FINAL_PHASE)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Steps every vehicle on this process, for checking a sharded run against
+static void runSingle(Shard & shard, uint64_t nsteps, double dt, uint32_t capacity, std::vector<Shard::vehicle_t> & results, uint64_t & closePairs)
+{
+    std::vector<Shard::vehicle_t> handovers(capacity);
+    std::vector<Shard::ghost_t> ghosts(capacity);
+
+    for (uint64_t step=0; step<nsteps; ++step) {
+        uint32_t handoverCount = 0, ghostCount = 0;
+        shard.step(step * dt, dt, handovers.data(), handoverCount, ghosts.data(), ghostCount);
+        shard.countPairs();
+    }
+
+    results.resize(shard.getVehicleCount());
+    shard.getVehicles(results.data());
+
+    closePairs = shard.getClosePairs();
+}
+
+static bool idLess(const Shard::vehicle_t & a, const Shard::vehicle_t & b)
+{
+    return a.id < b.id;
+}
+
+static void usage(const char * progname)
+{
+    fprintf(stderr, "Usage: %s [-w WORKERS] [-n VEHICLES] [-p region|subset] [-s SPACING] [-d DRIFT] [-m NEARMISS] "
+            "[-o OUTFILE] [KEY=VALUE ...] [SCENARIO]\n", progname);
+}
+
+int main(int argc, char ** argv)
+{
+    Scenario scenario;
+
+    uint32_t workers = 4;
+    uint32_t count = 1000;
+    double spacing = 2;
+    double drift = 0.5;
+    const char * outname = NULL;
+
+    Shard::layout_t layout = {};
+    layout.partition = Shard::PARTITION_REGION;
+    layout.nearMiss = 1;
+
+    // Load scenario file first, so that command-line settings can override it
+    for (int k=1; k<argc; ++k) {
+        if (argv[k][0] == '-') {
+            k++;
+        }
+        else if (!strchr(argv[k], '=') && !scenario.load(argv[k])) {
+            return 1;
+        }
+    }
+
+    for (int k=1; k<argc; ++k) {
+
+        if (argv[k][0] == '-') {
+
+            if (k == argc-1 || argv[k][1] == 0 || argv[k][2] != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+
+            const char * value = argv[++k];
+
+            switch (argv[k-1][1]) {
+                case 'w':
+                    workers = atoi(value);
+                    break;
+                case 'n':
+                    count = atoi(value);
+                    break;
+                case 'p':
+                    layout.partition = strcmp(value, "subset") ? Shard::PARTITION_REGION : Shard::PARTITION_SUBSET;
+                    break;
+                case 's':
+                    spacing = atof(value);
+                    break;
+                case 'd':
+                    drift = atof(value);
+                    break;
+                case 'm':
+                    layout.nearMiss = atof(value);
+                    break;
+                case 'o':
+                    outname = value;
+                    break;
+                default:
+                    usage(argv[0]);
+                    return 1;
+            }
+        }
+
+        else if (strchr(argv[k], '=')) {
+            char key[64] = {};
+            const char * eq = strchr(argv[k], '=');
+            snprintf(key, sizeof(key), "%.*s", (int)(eq-argv[k]), argv[k]);
+            if (!scenario.set(key, eq+1)) {
+                fprintf(stderr, "Bad setting %s\n", argv[k]);
+                return 1;
+            }
+        }
+    }
+
+    if (workers < 1 || workers > Shard::MAX_SHARDS || count < 1 || layout.nearMiss <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Dynamics * prototype = Vehicles::create(scenario.vehicle);
+
+    if (!prototype) {
+        fprintf(stderr, "Unknown vehicle %s\n", scenario.vehicle);
+        return 1;
+    }
+
+    // Vehicles on a square grid at the scenario altitude, each drifting its own way
+    uint32_t columns = (uint32_t)ceil(sqrt((double)count));
+
+    prototype->init(scenario.rotation, scenario.altitude > 0);
+
+    std::vector<Shard::vehicle_t> vehicles(count);
+
+    for (uint32_t k=0; k<count; ++k) {
+
+        Shard::vehicle_t & vehicle = vehicles[k];
+
+        vehicle.id = k;
+        vehicle.origin[0] = (k % columns) * spacing;
+        vehicle.origin[1] = (k / columns) * spacing;
+        vehicle.origin[2] = -scenario.altitude;
+
+        // Golden-angle directions spread the drifts evenly
+        double angle = k * 2.39996323;
+        vehicle.drift[0] = drift * cos(angle);
+        vehicle.drift[1] = drift * sin(angle);
+
+        prototype->getSnapshot(vehicle.snapshot);
+    }
+
+    delete prototype;
+
+    // Equal slabs across the starting grid; the outer two reach to infinity
+    layout.shardCount = workers;
+    for (uint32_t k=0; k<=workers; ++k) {
+        layout.bounds[k] = (columns - 1) * spacing * k / workers;
+    }
+
+    double dt = 1 / scenario.rate;
+
+    uint64_t nsteps = (uint64_t)(scenario.duration * scenario.rate + 0.5);
+
+    std::vector<Shard::vehicle_t> results;
+    uint64_t closePairs = 0;
+    uint64_t handovers = 0;
+
+    auto wallStart = std::chrono::steady_clock::now();
+
+    if (workers == 1) {
+        Shard shard(scenario, layout, 0);
+        for (const Shard::vehicle_t & vehicle : vehicles) {
+            shard.adopt(vehicle);
+        }
+        runSingle(shard, nsteps, dt, count, results, closePairs);
+    }
+
+    else {
+
+        SharedMemory memory;
+
+        if (!memory.open(workers, count)) {
+            fprintf(stderr, "Unable to map shared memory for %u workers\n", workers);
+            return 1;
+        }
+
+        std::vector<pid_t> pids;
+
+        for (uint32_t k=0; k<workers; ++k) {
+
+            pid_t pid = fork();
+
+            if (pid < 0) {
+                fprintf(stderr, "Unable to start worker %u\n", k);
+                for (pid_t other : pids) {
+                    kill(other, SIGKILL);
+                }
+                return 1;
+            }
+
+            if (pid == 0) {
+                Shard shard(scenario, layout, k);
+                for (const Shard::vehicle_t & vehicle : vehicles) {
+                    if (Shard::startingShard(layout, vehicle) == k) {
+                        shard.adopt(vehicle);
+                    }
+                }
+                workerMain(memory, shard, k, workers, dt);
+                _exit(0);
+            }
+
+            pids.push_back(pid);
+        }
+
+        bool ok = coordinate(memory, workers, nsteps);
+
+        if (!ok) {
+            for (pid_t pid : pids) {
+                kill(pid, SIGKILL);
+            }
+        }
+
+        for (pid_t pid : pids) {
+            waitpid(pid, NULL, 0);
+        }
+
+        if (!ok) {
+            return 1;
+        }
+
+        for (uint32_t k=0; k<workers; ++k) {
+            mailbox_t * mailbox = memory.mailbox(k);
+            results.insert(results.end(), memory.vehicles(k), memory.vehicles(k) + mailbox->vehicleCount);
+            closePairs += mailbox->closePairs;
+            handovers += mailbox->handovers;
+        }
+    }
+
+    double wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    std::sort(results.begin(), results.end(), idLess);
+
+    if (outname) {
+
+        FILE * fp = fopen(outname, "w");
+
+        if (!fp) {
+            fprintf(stderr, "Unable to open output file %s\n", outname);
+            return 1;
+        }
+
+        // Full precision, so that runs can be compared exactly
+        for (const Shard::vehicle_t & vehicle : results) {
+            fprintf(fp, "%u", vehicle.id);
+            for (uint8_t i=0; i<3; ++i) {
+                fprintf(fp, ",%.17g", vehicle.origin[i] + vehicle.snapshot.x[2*i]);
+            }
+            for (uint8_t k=0; k<12; ++k) {
+                fprintf(fp, ",%.17g", vehicle.snapshot.x[k]);
+            }
+            fprintf(fp, "\n");
+        }
+
+        fclose(fp);
+    }
+
+    double simTime = nsteps * dt;
+
+    // One machine-readable summary line on stdout
+    printf("vehicles=%u workers=%u steps=%llu simtime=%f walltime=%f speedup=%f closepairs=%llu handovers=%llu\n",
+            (unsigned)results.size(), workers, (unsigned long long)nsteps, simTime, wallTime,
+            wallTime > 0 ? simTime / wallTime : 0, (unsigned long long)closePairs, (unsigned long long)handovers);
+
+    return results.size() == count ? 0 : 1;
+}
@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+'''
+Runs many headless MulticopterSim instances at once, one per CPU core
+
+Each instance gets its own UDP ports and shared-memory name, so instances never
+collide, and is pinned to its own core.  When all have finished, their summary
+lines are combined into one report.
+
+Arguments after the options are passed to each instance (KEY=VALUE settings
+and a scenario file).  In those and in the controller command, {index},
+{host}, {motorport}, {telemport} and {shm} are replaced with the instance's
+values; for example:
+
+    ./simfarm.py -n 64 controller=constant motors=0.6 'altitude={index}' \\
+        ../headless/scenarios/gust.txt
+
+    ./simfarm.py -n 8 -c 'python3 mycontroller.py {motorport} {telemport}' \\
+        controller=udp ../headless/scenarios/hover.txt
+
+Copyright (C) 2021 Simon D. Levy
+
+MIT License
+'''
+
+import argparse
+import os
+import shlex
+import subprocess
+import sys
+import time
+
+# Ports per instance: motors, telemetry, camera, LiDAR (as in SocketPorts.hpp)
+PORT_STRIDE = 4
+
+
+def parse_summary(line):
+    '''
+    Parses a headless summary line of KEY=VALUE pairs into a dictionary
+    '''
+    summary = {}
+    for item in line.split():
+        if '=' in item:
+            key, value = item.split('=', 1)
+            try:
+                summary[key] = float(value)
+            except ValueError:
+                summary[key] = value
+    return summary
+
+
+class Instance(object):
+
+    def __init__(self, index, core, args):
+
+        self.index = index
+        self.core = core
+
+        motorport = args.base_port + PORT_STRIDE * index
+
+        self.values = {
+            'index': index,
+            'host': args.host,
+            'motorport': motorport,
+            'telemport': motorport + 1,
+            'shm': '%s.%d' % (args.shm_prefix, index),
+        }
+
+        self.command = [args.headless]
+
+        if args.logdir is not None:
+            self.command += ['-o', os.path.join(args.logdir, 'run%03d.csv' % index)]
+
+        self.command += ['host=%(host)s' % self.values,
+                         'motorport=%(motorport)d' % self.values,
+                         'telemport=%(telemport)d' % self.values,
+                         'shm=%(shm)s' % self.values]
+
+        self.command += [arg.format(**self.values) for arg in args.simargs]
+
+        self.controllerCommand = (shlex.split(args.controller.format(**self.values))
+                                  if args.controller is not None else None)
+
+        self.process = None
+        self.controller = None
+        self.summary = None
+        self.status = None
+
+    def _pin(self):
+        if self.core is not None:
+            os.sched_setaffinity(0, {self.core})
+
+    def start(self):
+
+        # Start the sim first, so a shared-memory controller finds its channel
+        self.process = subprocess.Popen(self.command, stdout=subprocess.PIPE,
+                                        universal_newlines=True,
+                                        preexec_fn=self._pin)
+
+        if self.controllerCommand is not None:
+            self.controller = subprocess.Popen(self.controllerCommand,
+                                               stdout=subprocess.DEVNULL,
+                                               preexec_fn=self._pin)
+
+    def wait(self):
+
+        output, _ = self.process.communicate()
+        self.status = self.process.returncode
+
+        for line in output.splitlines():
+            if line.startswith('vehicle='):
+                self.summary = parse_summary(line)
+
+        if self.controller is not None:
+            try:
+                self.controller.wait(timeout=1)
+            except subprocess.TimeoutExpired:
+                self.controller.terminate()
+                self.controller.wait()
+
+    def ok(self):
+        return self.status == 0 and self.summary is not None
+
+
+def main():
+
+    cores = sorted(os.sched_getaffinity(0))
+
+    parser = argparse.ArgumentParser(
+        formatter_class=argparse.RawDescriptionHelpFormatter,
+        description=__doc__.split('Copyright')[0])
+
+    parser.add_argument('-n', '--instances', type=int, default=len(cores),
+                        help='number of instances (default: one per core)')
+    parser.add_argument('-c', '--controller',
+                        help='controller command to start with each instance')
+    parser.add_argument('-o', '--logdir',
+                        help='directory for per-instance CSV logs')
+    parser.add_argument('--headless',
+                        default=os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                             '..', 'headless', 'headless'),
+                        help='headless sim executable')
+    parser.add_argument('--host', default='127.0.0.1',
+                        help='controller host (default: %(default)s)')
+    parser.add_argument('--base-port', type=int, default=5000,
+                        help='first instance\'s motor port (default: %(default)s)')
+    parser.add_argument('--shm-prefix', default='/multicoptersim',
+                        help='shared-memory name prefix (default: %(default)s)')
+    parser.add_argument('--no-pin', action='store_true',
+                        help='do not pin instances to cores')
+    parser.add_argument('simargs', nargs=argparse.REMAINDER,
+                        help='KEY=VALUE settings and scenario file for each instance')
+
+    args = parser.parse_args()
+
+    if args.base_port + PORT_STRIDE * args.instances > 65535:
+        print('Too many instances for base port %d' % args.base_port, file=sys.stderr)
+        exit(1)
+
+    if args.logdir is not None:
+        os.makedirs(args.logdir, exist_ok=True)
+
+    instances = [Instance(k, None if args.no_pin else cores[k % len(cores)], args)
+                 for k in range(args.instances)]
+
+    start = time.time()
+
+    for instance in instances:
+        instance.start()
+
+    for instance in instances:
+        instance.wait()
+
+    walltime = time.time() - start
+
+    # Per-instance report
+    for instance in instances:
+        if instance.ok():
+            s = instance.summary
+            print('run=%03d core=%s motorport=%d shm=%s simtime=%f walltime=%f speedup=%f maxstep=%e z=%f' %
+                  (instance.index, instance.core, instance.values['motorport'], instance.values['shm'],
+                   s['simtime'], s['walltime'], s['speedup'], s['maxstep'], s['z']))
+        else:
+            print('run=%03d core=%s FAILED status=%s' % (instance.index, instance.core, instance.status))
+
+    # Combined report
+    summaries = [instance.summary for instance in instances if instance.ok()]
+
+    simtime = sum(s['simtime'] for s in summaries)
+    steps = sum(s['steps'] for s in summaries)
+    speedups = [s['speedup'] for s in summaries]
+
+    print('runs=%d failed=%d steps=%d simtime=%f walltime=%f throughput=%f minspeedup=%f maxspeedup=%f maxstep=%e' %
+          (len(instances), len(instances) - len(summaries), steps, simtime, walltime,
+           simtime / walltime if walltime > 0 else 0,
+           min(speedups) if speedups else 0,
+           max(speedups) if speedups else 0,
+           max(s['maxstep'] for s in summaries) if summaries else 0))
+
+    exit(0 if len(summaries) == len(instances) else 1)
+
+
+main()
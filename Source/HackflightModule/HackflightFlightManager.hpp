@@ -10,7 +10,7 @@
 
 #include "../MainModule/FlightManager.hpp"
 #include "../MainModule/Dynamics.hpp"
-#include "../MainModule/Transforms.hpp"
+#include "../MainModule/RateScheduler.hpp"
 
 #include <hackflight.hpp>
 
@@ -27,11 +27,44 @@
 #include "SimBoard.hpp"
 #include "SimMotor.hpp"
 #include "SimSensors.hpp"
+#include "SimRangefinder.hpp"
+#include "SimOpticalFlow.hpp"
 
 class FHackflightFlightManager : public FFlightManager {
 
+    public:
+
+        // Default rates, Hz; see construct() for the options that change them
+        static constexpr double DYNAMICS_RATE = 4000;
+        static constexpr double IMU_RATE = 1000;
+        static constexpr double ATTITUDE_RATE = 200;
+        static constexpr double FLOW_RATE = 100;
+        static constexpr double RANGEFINDER_RATE = 50;
+        static constexpr double RECEIVER_RATE = 50;
+        static constexpr double FIRMWARE_RATE = 500;
+
     private:
 
+        // Run by _scheduler on the simulation clock
+        typedef enum {
+
+            TASK_IMU,
+            TASK_ATTITUDE,
+            TASK_FLOW,
+            TASK_RANGEFINDER,
+            TASK_RECEIVER,
+            TASK_FIRMWARE
+
+        } task_t;
+
+        RateScheduler _scheduler;
+
+        static double getRate(const char * option, double rate)
+        {
+            PlatformOptions::get(option, rate);
+            return rate;
+        }
+
         // PID tuning
 
 		// Rate
@@ -62,6 +95,8 @@ class FHackflightFlightManager : public FFlightManager {
 
         // Sensors"
         SimSensors* _sensors = NULL;
+        SimRangefinder * _rangefinder = NULL;
+        SimOpticalFlow * _opticalFlow = NULL;
 
         // Helps us access individual motors
         SimMotor* _motors = NULL;
@@ -69,24 +104,37 @@ class FHackflightFlightManager : public FFlightManager {
         // Main firmware
         hf::Hackflight * _hackflight = NULL;
 
-    public:
-
-        // Constructor
-        FHackflightFlightManager(APawn * pawn, hf::Mixer * mixer, SimMotor * motors, Dynamics * dynamics, 
-                bool pidsEnabled=true) 
-            : FFlightManager(dynamics) 
+        void construct(hf::Mixer * mixer, SimMotor * motors, bool pidsEnabled, uint64_t sensorSeed)
         {
             _motors = motors;
 
-            // Pass PlayerController to receiver constructor in case we have no joystick / game-controller
-            _receiver = new SimReceiver(UGameplayStatics::GetPlayerController(pawn->GetWorld(), 0));
-
             _hackflight = new hf::Hackflight(&_board, _receiver, mixer);
 
-            // Add simulated sensor suite
-            _sensors = new SimSensors(_dynamics);
+            // Add simulated sensor suite, with errors scaled by -simsensornoise=S (0 for none)
+            // and seeded by -simnoiseseed=N plus the vehicle's own seed
+            double noise = 1;
+            PlatformOptions::get("simsensornoise=", noise);
+            double baseSeed = 0;
+            PlatformOptions::get("simnoiseseed=", baseSeed);
+            _sensors = new SimSensors(_dynamics, (uint64_t)baseSeed + sensorSeed, noise);
             _hackflight->addSensor(_sensors);
 
+            // Height and horizontal velocity over the ground, replacing the true ones when the ground is in range
+            _rangefinder = new SimRangefinder(_dynamics);
+            _hackflight->addSensor(_rangefinder);
+            _opticalFlow = new SimOpticalFlow(_dynamics, _sensors, _rangefinder);
+            _hackflight->addSensor(_opticalFlow);
+
+            // Dynamics sub-stepped at -simdynamicshz=HZ, with firmware and sensors
+            // running between sub-steps at their own rates
+            setDynamicsRate(getRate("simdynamicshz=", DYNAMICS_RATE));
+            _scheduler.add(TASK_IMU, getRate("simgyrohz=", IMU_RATE));
+            _scheduler.add(TASK_ATTITUDE, getRate("simattitudehz=", ATTITUDE_RATE));
+            _scheduler.add(TASK_FLOW, getRate("simflowhz=", FLOW_RATE));
+            _scheduler.add(TASK_RANGEFINDER, getRate("simrangehz=", RANGEFINDER_RATE));
+            _scheduler.add(TASK_RECEIVER, getRate("simreceiverhz=", RECEIVER_RATE));
+            _scheduler.add(TASK_FIRMWARE, getRate("simfirmwarehz=", FIRMWARE_RATE));
+
             if (pidsEnabled) {
 
                 // Add altitude-hold PID controller in switch position 1 or greater
@@ -104,6 +152,43 @@ class FHackflightFlightManager : public FFlightManager {
             _hackflight->begin(true);
         }
 
+    public:
+
+#ifndef MULTICOPTERSIM_NATIVE
+
+        // Constructor
+        FHackflightFlightManager(APawn * pawn, hf::Mixer * mixer, SimMotor * motors, Dynamics * dynamics, 
+                bool pidsEnabled=true) 
+            : FFlightManager(dynamics) 
+        {
+            // Pass PlayerController to receiver constructor in case we have no joystick / game-controller
+            _receiver = new SimReceiver(UGameplayStatics::GetPlayerController(pawn->GetWorld(), 0));
+
+            // Seeded by name, which stays the same from run to run of a level
+            construct(mixer, motors, pidsEnabled, GetTypeHash(pawn->GetName()));
+        }
+
+#else
+
+        // Constructor for running without Unreal Engine; unthreaded by default, so the caller
+        // can step it with iterate() as fast as it likes
+        FHackflightFlightManager(hf::Mixer * mixer, SimMotor * motors, Dynamics * dynamics, 
+                bool threaded=false, bool pidsEnabled=true, uint64_t sensorSeed=0) 
+            : FFlightManager(dynamics, threaded) 
+        {
+            _receiver = new SimReceiver();
+
+            construct(mixer, motors, pidsEnabled, sensorSeed);
+        }
+
+        // For setting stick values
+        SimReceiver * getReceiver(void)
+        {
+            return _receiver;
+        }
+
+#endif
+
         virtual ~FHackflightFlightManager(void)
         {
             delete _hackflight;
@@ -111,35 +196,39 @@ class FHackflightFlightManager : public FFlightManager {
 
         virtual void getMotors(const double time, double * motorvals) override
         {
-            // Zero on success, nonzero otherwise
-            uint16_t joystickError = _receiver->update();
-
-            double angularVel[3] = {
-                _dynamics->x(Dynamics::STATE_PHI_DOT),
-                _dynamics->x(Dynamics::STATE_THETA_DOT),
-                _dynamics->x(Dynamics::STATE_PSI_DOT) 
-            };
-
-            double eulerAngles[3] = {
-                _dynamics->x(Dynamics::STATE_PHI),
-                _dynamics->x(Dynamics::STATE_THETA),
-                _dynamics->x(Dynamics::STATE_PSI) 
-            };
-
-            double quaternion[4] = {};
-            Transforms::eulerToQuaternion(eulerAngles, quaternion);
-
-            // If joystick missing or bad, use keypad
-            if (joystickError) {
-            }
+            // Run whatever is due, highest rate first
+            for (uint8_t task=_scheduler.next(time); task!=RateScheduler::NONE; task=_scheduler.next(time)) {
+
+                switch (task) {
+
+                    case TASK_IMU:
+                        _sensors->sampleImu(time);
+                        break;
 
-            _hackflight->update();
+                    case TASK_ATTITUDE:
+                        _sensors->sampleAttitude();
+                        break;
 
-            _board.set(time);
+                    case TASK_FLOW:
+                        _opticalFlow->sample();
+                        break;
 
-            // _imu.set(quaternion, angularVel);
+                    case TASK_RANGEFINDER:
+                        _rangefinder->sample(time);
+                        break;
+
+                    case TASK_RECEIVER:
+                        _receiver->update();
+                        break;
+
+                    case TASK_FIRMWARE:
+                        _board.set(time);
+                        _hackflight->update();
+                        break;
+                }
+            }
 
-            //  Get motor values
+            // Motor values hold between firmware updates
             for (uint8_t i=0; i < _nmotors; ++i) {
                 motorvals[i] = _motors->getValue(i);
             }
@@ -14,13 +14,9 @@ class SimIMU : public hf::IMU {
 
     private:
    
-		static const uint8_t Q_DIVISOR = 5; // this many gyro readings per quaternion reading
-
         double _quat[4] = {0};
         double _gyro[3] = {0};
 
-        uint8_t _qcount = 0;
-
     public:
 
         virtual bool getGyrometer(float & gx, float & gy, float & gz) override
@@ -36,10 +32,7 @@ class SimIMU : public hf::IMU {
         {
             (void)time;	
 
-            _qcount = ((_qcount+1) % Q_DIVISOR);
-
-            if (_qcount) return false;
-
+            // Rates are up to whoever calls set(); see FHackflightFlightManager
             qw =   _quat[0];
             qx = - _quat[1];// invert X
             qy = - _quat[2];// invert Y
@@ -0,0 +1,156 @@
+/*
+   Downward-looking optical-flow sensor for MulticopterSim, computed from vehicle dynamics
+
+   Instead of tracking features in camera images, works out the angular rate
+   at which the ground below appears to move: body-frame velocity divided by
+   the distance to the ground, plus the body's own rotation.  Like firmware
+   using a real flow sensor, it then takes the gyro's reading of that
+   rotation back out, and multiplies by the rangefinder's distance to get
+   velocity over the ground.
+
+   Signs follow the PX4 convention: flow about body X is p - vy/d, and flow
+   about body Y is q + vx/d, with d the distance along the body's down axis.
+
+   Copyright(C) 2021 Simon D.Levy
+
+   MIT License
+*/
+
+#pragma once
+
+#include <math.h>
+
+#include "../MainModule/Dynamics.hpp"
+#include "../MainModule/Transforms.hpp"
+
+#include "SimSensors.hpp"
+#include "SimRangefinder.hpp"
+
+#include <state.hpp>
+#include <RFT_sensor.hpp>
+
+class SimOpticalFlow : public rft::Sensor {
+
+    public:
+
+        // Along the lines of a PMW3901, rad/s
+        static constexpr double MAX_FLOW = 7.4;
+
+    private:
+
+        Dynamics * _dynamics;
+
+        // Gyro for compensation, and distance to the ground
+        SimSensors * _imu;
+        SimRangefinder * _rangefinder;
+
+        // Latest reading, taken at the flow sensor's rate by the flight manager
+        double _flow[2] = {};          // about body X and Y, rad/s
+        double _compensated[2] = {};   // less the gyro's rates
+        double _velocity[2] = {};      // over the ground, body X and Y, m/s
+        bool   _valid = false;
+
+    protected:
+
+        virtual bool ready(float time) override
+        {
+            (void) time;
+            return _valid;
+        }
+
+        // Replaces the horizontal velocities with those from the flow, rotated by yaw into the state's frame
+        virtual void modifyState(rft::State * state, float time)
+        {
+            (void) time;
+
+            hf::State * hfstate = (hf::State *)state;
+
+            double psi = hfstate->x[Dynamics::STATE_PSI];
+
+            hfstate->x[Dynamics::STATE_X_DOT] = cos(psi) * _velocity[0] - sin(psi) * _velocity[1];
+            hfstate->x[Dynamics::STATE_Y_DOT] = sin(psi) * _velocity[0] + cos(psi) * _velocity[1];
+        }
+
+    public:
+
+        /**
+         * @param dynamics the vehicle
+         * @param imu supplies the gyro readings taken out of the flow
+         * @param rangefinder supplies the distance to the ground
+         */
+        SimOpticalFlow(Dynamics * dynamics, SimSensors * imu, SimRangefinder * rangefinder)
+        {
+            _dynamics = dynamics;
+            _imu = imu;
+            _rangefinder = rangefinder;
+        }
+
+        // Takes a reading, using the latest gyro and rangefinder readings
+        void sample(void)
+        {
+            _valid = false;
+
+            double range = 0;
+
+            if (!_rangefinder->getRange(range)) {
+                return;
+            }
+
+            double inertial[3] = {
+                _dynamics->x(Dynamics::STATE_X_DOT),
+                _dynamics->x(Dynamics::STATE_Y_DOT),
+                _dynamics->x(Dynamics::STATE_Z_DOT)
+            };
+            double euler[3] = {
+                _dynamics->x(Dynamics::STATE_PHI),
+                _dynamics->x(Dynamics::STATE_THETA),
+                _dynamics->x(Dynamics::STATE_PSI)
+            };
+            double body[3] = {};
+            Transforms::inertialToBody(inertial, euler, body);
+
+            // Distance along the optical axis to the ground under the vehicle now
+            double tilt = cos(euler[0]) * cos(euler[1]);
+            double distance = _dynamics->agl() / tilt;
+
+            // On the ground, or tilted too far to see the ground below
+            if (tilt < cos(SimRangefinder::MAX_TILT) || !(distance > 0)) {
+                return;
+            }
+
+            _flow[0] = _dynamics->x(Dynamics::STATE_PHI_DOT) - body[1] / distance;
+            _flow[1] = _dynamics->x(Dynamics::STATE_THETA_DOT) + body[0] / distance;
+
+            if (!isfinite(_flow[0]) || !isfinite(_flow[1]) || fabs(_flow[0]) > MAX_FLOW || fabs(_flow[1]) > MAX_FLOW) {
+                return;
+            }
+
+            double gyro[3] = {};
+            _imu->getGyrometer(gyro);
+
+            _compensated[0] = _flow[0] - gyro[0];
+            _compensated[1] = _flow[1] - gyro[1];
+
+            _velocity[0] = _compensated[1] * range;
+            _velocity[1] = -_compensated[0] * range;
+
+            _valid = true;
+        }
+
+        /**
+         * Latest reading.
+         * @param flow output: flow about body X and Y, rad/s, as the sensor reports it
+         * @param compensated output: the same less the gyro's rates
+         * @return true if the reading is good
+         */
+        bool getFlow(double flow[2], double compensated[2])
+        {
+            for (uint8_t i=0; i<2; ++i) {
+                flow[i] = _flow[i];
+                compensated[i] = _compensated[i];
+            }
+
+            return _valid;
+        }
+
+}; // class SimOpticalFlow
@@ -0,0 +1,122 @@
+/*
+   Downward-looking rangefinder for MulticopterSim, computed from vehicle dynamics
+
+   Works out the distance along the body's down axis to the ground from the
+   vehicle's height above the terrain beneath it (Dynamics::agl(), from the
+   flight manager's heightfield when it has one) and its tilt, treating the
+   ground as locally flat.  No traces or images are involved, so a reading
+   costs a few multiplies on the physics thread.
+
+   Copyright(C) 2021 Simon D.Levy
+
+   MIT License
+*/
+
+#pragma once
+
+#include <math.h>
+
+#include "../MainModule/Dynamics.hpp"
+
+#include <state.hpp>
+#include <RFT_sensor.hpp>
+
+class SimRangefinder : public rft::Sensor {
+
+    public:
+
+        // Along the lines of a VL53L1X time-of-flight sensor
+        static constexpr double MIN_RANGE = 0.04;   // meters
+        static constexpr double MAX_RANGE = 4.0;    // meters
+        static constexpr double MAX_TILT = 1.05;    // radians off vertical; about 60 degrees
+
+    private:
+
+        Dynamics * _dynamics;
+
+        // Latest reading, taken at the rangefinder's rate by the flight manager
+        double _range = 0;
+        double _height = 0;
+        bool   _valid = false;
+
+        // For the climb rate
+        double _previousHeight = 0;
+        double _previousTime = -1;
+        double _climbRate = 0;
+
+    protected:
+
+        virtual bool ready(float time) override
+        {
+            (void) time;
+            return _valid;
+        }
+
+        // Replaces the height with the measured height above ground, and the climb rate with its derivative
+        virtual void modifyState(rft::State * state, float time)
+        {
+            (void) time;
+
+            hf::State * hfstate = (hf::State *)state;
+
+            hfstate->x[hf::State::Z] = _height;
+            hfstate->x[hf::State::DZ] = _climbRate;
+        }
+
+    public:
+
+        SimRangefinder(Dynamics * dynamics)
+        {
+            _dynamics = dynamics;
+        }
+
+        /**
+         * Takes a reading.
+         * @param time simulation time in seconds
+         */
+        void sample(double time)
+        {
+            double phi = _dynamics->x(Dynamics::STATE_PHI);
+            double theta = _dynamics->x(Dynamics::STATE_THETA);
+
+            // Cosine of the angle between the body's down axis and the vertical
+            double tilt = cos(phi) * cos(theta);
+
+            double agl = _dynamics->agl();
+
+            _valid = false;
+
+            if (tilt < cos(MAX_TILT) || agl <= 0) {
+                return;
+            }
+
+            _range = agl / tilt;
+
+            if (_range < MIN_RANGE || _range > MAX_RANGE) {
+                return;
+            }
+
+            _height = _range * tilt;
+
+            double dt = time - _previousTime;
+
+            _climbRate = _previousTime >= 0 && dt > 0 ? (_height - _previousHeight) / dt : 0;
+
+            _previousHeight = _height;
+            _previousTime = time;
+
+            _valid = true;
+        }
+
+        /**
+         * Latest reading.
+         * @param range output: meters along the body's down axis
+         * @return true if the ground was in range
+         */
+        bool getRange(double & range)
+        {
+            range = _range;
+            return _valid;
+        }
+
+}; // class SimRangefinder
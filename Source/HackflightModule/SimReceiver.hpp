@@ -13,8 +13,10 @@
 #include <receiver.hpp>
 #include <RFT_debugger.hpp>
 
+#ifndef MULTICOPTERSIM_NATIVE
 #include "../MainModule/joystick/Joystick.h"
 #include "../MainModule/Keypad.hpp"
+#endif
 
 class SimReceiver : public hf::Receiver {
 
@@ -25,15 +27,16 @@ class SimReceiver : public hf::Receiver {
 		static constexpr uint8_t DEFAULT_CHANNEL_MAP[6] = { 0, 1, 2, 3, 4, 5 };
 		static constexpr float DEMAND_SCALE = 1.0f;
 
+#ifndef MULTICOPTERSIM_NATIVE
         // We use a joystick (game controller) if one is available
 		IJoystick * _joystick = NULL;
 
         // Otherwise, use use the numeric keypad
         Keypad * _keypad = NULL;
+#endif
 
-		// Helps mock up periodic availability of new data frame (output data rate; ODR)
-		double _deltaT;
-		double _previousTime;
+		// Set by each update(), which the flight manager calls at the receiver's frame rate
+		bool _newFrame = false;
 
     protected:
 
@@ -49,41 +52,55 @@ class SimReceiver : public hf::Receiver {
 
     public:
 
-		SimReceiver(APlayerController * playerController, uint16_t updateFrequency=50)
+#ifndef MULTICOPTERSIM_NATIVE
+		SimReceiver(APlayerController * playerController)
 			: Receiver(DEFAULT_CHANNEL_MAP, DEMAND_SCALE)
 		{
 			_joystick = new IJoystick();
 
             _keypad = new Keypad(playerController);
-
-			_deltaT = 1./updateFrequency;
-			_previousTime = 0;
 		}
-
-		bool gotNewFrame(void)
+#else
+        // Without a joystick or keypad, stick values come from setRawvals()
+		SimReceiver(void)
+			: Receiver(DEFAULT_CHANNEL_MAP, DEMAND_SCALE)
 		{
-			// Get a high-fidelity current time value from the OS
-			double currentTime = FPlatformTime::Seconds();
+		}
 
-			if (currentTime-_previousTime > _deltaT) {
-				_previousTime = currentTime;
-				static uint32_t count;
-				return true;
-			}
+        void setRawvals(const float * values, uint8_t count)
+        {
+            for (uint8_t k=0; k<count; ++k) {
+                rawvals[k] = values[k];
+            }
+        }
+#endif
 
-			return false;
+		// Each frame is new to the firmware once
+		bool gotNewFrame(void)
+		{
+			bool newFrame = _newFrame;
+			_newFrame = false;
+			return newFrame;
 		}
 
+		// Reads a frame; call at the receiver's frame rate, on the simulation clock
 		uint16_t update(void)
 		{
+			_newFrame = true;
+
+#ifndef MULTICOPTERSIM_NATIVE
 			// Joystick::poll() returns zero (okay) or a postive value (error)
 			return _joystick->poll(rawvals);
-
+#else
+            return 0;
+#endif
  		}
 
         void tick(void)
         {
+#ifndef MULTICOPTERSIM_NATIVE
             _keypad->tick(rawvals);
+#endif
         }
 
 }; // class SimReceiver
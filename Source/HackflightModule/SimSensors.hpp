@@ -10,6 +10,7 @@
 
 #include "../MainModule/Dynamics.hpp"
 #include "../MainModule/Transforms.hpp"
+#include "../MainModule/SensorNoise.hpp"
 
 #include <state.hpp>
 #include <RFT_sensor.hpp>
@@ -34,36 +35,111 @@ class SimSensors : public rft::Sensor {
         // We do all dynamcics => state conversion; subclasses just return sensor values
         Dynamics * _dynamics;
 
+        // Errors of the simulated IMU
+        SensorNoise _gyroNoise;
+        SensorNoise _accelNoise;
+
+        // Latest readings, each taken at its own rate by the flight manager
+        double _state[Dynamics::STATE_SIZE] = {};
+        double _gyro[3] = {};
+        double _accel[3] = {};   // body frame, m/s^2
+
+        double _gyroTime = -1;
+
         virtual bool ready(float time) override
         {
             (void) time;
             return true;
         }
 
+        // Gives the firmware the latest readings
         virtual void modifyState(rft::State * state, float time)
         {
-            (void)time;
+            (void) time;
 
             hf::State * hfstate = (hf::State *)state;
 
-            // Use vehicle state to modify Hackflight state values
             for (uint8_t k=0; k<Dynamics::STATE_SIZE; ++k) {
-                hfstate->x[k] = _dynamics->x(k);
+                hfstate->x[k] = _state[k];
             }
 
+            // Angular rates come from the gyro
+            hfstate->x[Dynamics::STATE_PHI_DOT] = _gyro[0];
+            hfstate->x[Dynamics::STATE_THETA_DOT] = _gyro[1];
+            hfstate->x[Dynamics::STATE_PSI_DOT] = _gyro[2];
+
             // Negate for NED => ENU conversion
             hfstate->x[hf::State::Z] *= -1;
             hfstate->x[hf::State::DZ] *= -1;
-
-            // Rotate inertial velocity into body frame for simulating optical flow
-            //inertialToBody(state.inertialVel, dynamicsState.pose.rotation, state.bodyVel);
         }
 
     public:
 
-        SimSensors(Dynamics * dynamics)
+        /**
+         * @param dynamics the vehicle
+         * @param seed the same seed gives the same sensor errors
+         * @param noise multiplies every sensor error; 0 for perfect sensors
+         */
+        SimSensors(Dynamics * dynamics, uint64_t seed=0, double noise=1)
+            : _gyroNoise(SensorNoise::gyro(), 2*seed, noise), _accelNoise(SensorNoise::accel(), 2*seed+1, noise)
         {
             _dynamics = dynamics;
         }
 
+        /**
+         * Reads the gyro and accelerometer.
+         * @param time simulation time in seconds
+         */
+        void sampleImu(double time)
+        {
+            double dt = _gyroTime < 0 ? 0 : time - _gyroTime;
+            _gyroTime = time;
+
+            double rates[3] = {
+                _dynamics->x(Dynamics::STATE_PHI_DOT),
+                _dynamics->x(Dynamics::STATE_THETA_DOT),
+                _dynamics->x(Dynamics::STATE_PSI_DOT)
+            };
+            _gyroNoise.apply(rates, _gyro, dt);
+
+            // Accelerometer senses inertial acceleration less gravity, in the body frame
+            double inertial[3] = {
+                _dynamics->inertialAccel(0),
+                _dynamics->inertialAccel(1),
+                _dynamics->inertialAccel(2)
+            };
+            double euler[3] = {
+                _dynamics->x(Dynamics::STATE_PHI),
+                _dynamics->x(Dynamics::STATE_THETA),
+                _dynamics->x(Dynamics::STATE_PSI)
+            };
+            double body[3] = {};
+            Transforms::inertialToBody(inertial, euler, body);
+            _accelNoise.apply(body, _accel, dt);
+        }
+
+        // Takes the attitude (and position and velocity) estimate, here the vehicle's true state
+        void sampleAttitude(void)
+        {
+            for (uint8_t k=0; k<Dynamics::STATE_SIZE; ++k) {
+                _state[k] = _dynamics->x(k);
+            }
+        }
+
+        // Last gyro reading, body frame, rad/s
+        void getGyrometer(double gyro[3])
+        {
+            for (uint8_t i=0; i<3; ++i) {
+                gyro[i] = _gyro[i];
+            }
+        }
+
+        // Last accelerometer reading, body frame, m/s^2
+        void getAccelerometer(double accel[3])
+        {
+            for (uint8_t i=0; i<3; ++i) {
+                accel[i] = _accel[i];
+            }
+        }
+
 }; // class SimSensor
@@ -9,6 +9,47 @@
 #pragma once
 
 #include "Utils.hpp"
+#include "Trace.hpp"
+#include "ImageSource.hpp"
+
+#ifndef MULTICOPTERSIM_NATIVE
+
+#include "SimStats.hpp"
+#include "RenderTargets.hpp"
+
+// Reads pixels from a UE4 render target
+class RenderTargetImageSource : public ImageSource {
+
+    private:
+
+        FRenderTarget * _renderTarget = NULL;
+
+        // Kept between reads, so that each frame reuses its allocation
+        TArray<FColor> _pixels;
+
+    public:
+
+        RenderTargetImageSource(FRenderTarget * renderTarget)
+        {
+            _renderTarget = renderTarget;
+        }
+
+        virtual bool read(uint8_t * bytes, uint16_t rows, uint16_t cols) override
+        {
+            // Read the pixels from the RenderTarget, which may fail or come back short of a whole image
+            if (!_renderTarget->ReadPixels(_pixels) || _pixels.Num() != (int32)rows*cols) {
+                return false;
+            }
+
+            // Copy the RBGA pixels to the caller's image
+            FMemory::Memcpy(bytes, _pixels.GetData(), rows*cols*4);
+
+            return true;
+        }
+
+}; // class RenderTargetImageSource
+
+#endif
 
 class Camera {
 
@@ -21,10 +62,10 @@ class Camera {
         static constexpr float Y = 0.0;
         static constexpr float Z = 0.3;
 
-        // Arbitrary array limits supporting statically declared assets
-        static const uint8_t MAX_CAMERAS = 10; 
+        // Cameras per vehicle
+        static const uint8_t MAX_CAMERAS = 32;
 
-        // Supported resolutions
+        // Resolutions with render-target assets; cameras of other sizes get created targets
         typedef enum {
 
             RES_640x480,
@@ -36,15 +77,37 @@ class Camera {
 
     private:
 
+        static uint16_t resolutionRows(Resolution_t resolution)
+        {
+            static const uint16_t rows[RES_COUNT] = {480, 720, 1080};
+            return rows[resolution];
+        }
+
+        static uint16_t resolutionCols(Resolution_t resolution)
+        {
+            static const uint16_t cols[RES_COUNT] = {640, 1280, 1920};
+            return cols[resolution];
+        }
+
         float _x = 0;
         float _y = 0;
         float _z = 0;
 
-        Resolution_t _res;
-
         // Byte array for RGBA image
         uint8_t * _imageBytes = NULL;
 
+#ifndef MULTICOPTERSIM_NATIVE
+        // For "stat MulticopterSim"
+        TStatId _statId;
+
+        // From the RenderTargets pool, while the vehicle is in play
+        UTextureRenderTarget2D  * _renderTarget = NULL;
+        RenderTargetImageSource * _renderTargetSource = NULL;
+#endif
+
+        // Where images come from: a render target, or a synthetic source when running headless
+        ImageSource * _imageSource = NULL;
+
     protected:
 
         // Image size and field of view, set in constructor
@@ -54,19 +117,16 @@ class Camera {
         // Initial FOV can be overridden by setFov()
         float    _fov  = 0;
 
+#ifndef MULTICOPTERSIM_NATIVE
         // UE4 resources, set in Vehicle::addCamera()
         USceneCaptureComponent2D * _captureComponent = NULL;
         UCameraComponent         * _cameraComponent = NULL;
-        FRenderTarget            * _renderTarget = NULL;
+#endif
 
-        Camera(float fov, Resolution_t resolution, float x=Camera::X, float y=Camera::Y, float z=Camera::Z)
+        Camera(float fov, uint16_t cols, uint16_t rows, float x=Camera::X, float y=Camera::Y, float z=Camera::Z)
         {
-            uint16_t rowss[3] = {480, 720, 1080};
-            uint16_t colss[3] = {640, 1280, 1920};
-
-            _rows = rowss[resolution];
-            _cols = colss[resolution];
-            _res  = resolution;
+            _rows = rows;
+            _cols = cols;
             _fov = fov;
 
             // Set position w.r.t. vehicle
@@ -77,77 +137,77 @@ class Camera {
             // Create a byte array sufficient to hold the RGBA image
             _imageBytes = new uint8_t [_rows*_cols*4]();
 
+#ifndef MULTICOPTERSIM_NATIVE
             // These will be set in Vehicle::addCamera()
             _captureComponent = NULL;
             _cameraComponent = NULL;
-            _renderTarget = NULL;
+#endif
+            _imageSource = NULL;
         }
 
-        // Called by Vehicle::addCamera()
+        Camera(float fov, Resolution_t resolution, float x=Camera::X, float y=Camera::Y, float z=Camera::Z)
+            : Camera(fov, resolutionCols(resolution), resolutionRows(resolution), x, y, z)
+        {
+        }
+
+#ifndef MULTICOPTERSIM_NATIVE
+
+        // Called by Vehicle::addCamera(), from the pawn's constructor
         virtual void addToVehicle(APawn * pawn, USpringArmComponent * springArm, uint8_t id)
         {
-            // Get static assets for all render targets.  This provides less
-            // flexibility than creating it dynamically, but acquiring the
-            // pixels seems to run twice as fast.
-            static ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>
-                cameraTextureObjects[RES_COUNT][MAX_CAMERAS] =
-            { 
-                {
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_640x480_1")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_640x480_2")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_640x480_3")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_640x480_4")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_640x480_5")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_640x480_6")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_640x480_7")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_640x480_8")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_640x480_9")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_640x480_10")) 
-                },
-                {
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1280x720_1")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1280x720_2")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1280x720_3")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1280x720_4")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1280x720_5")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1280x720_6")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1280x720_7")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1280x720_8")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1280x720_9")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1280x720_10")) 
-                },
-                {
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1920x1080_1")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1920x1080_2")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1920x1080_3")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1920x1080_4")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1920x1080_5")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1920x1080_6")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1920x1080_7")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1920x1080_8")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1920x1080_9")),
-                    ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D>(TEXT("/Game/MulticopterSim/RenderTargets/renderTarget_1920x1080_10")) 
-                }
-            };
-
-            UTextureRenderTarget2D * textureRenderTarget2D = cameraTextureObjects[_res][id].Object;
-
-            // Create a scene-capture component and set its target to the render target
+            // Each camera gets its own cycle counter
+            _statId = makeCameraStatId(id);
+
+            // Create a scene-capture component; it gets a render target when play begins
             _captureComponent = pawn->CreateDefaultSubobject<USceneCaptureComponent2D >(makeName("Capture", id));
             _captureComponent->SetWorldScale3D(FVector(0.1,0.1,0.1));
             _captureComponent->SetupAttachment(springArm, USpringArmComponent::SocketName);
             _captureComponent->SetRelativeLocation(100*FVector(_x, _y, _z));  // m => cm
-            _captureComponent->TextureTarget = textureRenderTarget2D;
 
-            // Get the render target resource for copying the image pixels
-            _renderTarget = textureRenderTarget2D->GameThread_GetRenderTargetResource();
-            
             // Set the initial FOV
             setFov(_fov);
         }
 
-        // Override this method for your video application
-        virtual void processImageBytes(uint8_t * bytes) { (void)bytes; }
+        // Called by Vehicle::BeginPlay(), so that only vehicles in play hold render targets
+        void acquireRenderTarget(void)
+        {
+            if (_renderTarget) {
+                return;
+            }
+
+            // This camera's own target, recycled from a camera that has ended play if there was one
+            _renderTarget = RenderTargets::acquire(_cols, _rows);
+
+            _captureComponent->TextureTarget = _renderTarget;
+
+            // Get the render target resource for copying the image pixels
+            _renderTargetSource = new RenderTargetImageSource(_renderTarget->GameThread_GetRenderTargetResource());
+
+            // A source set with setImageSource() takes precedence
+            if (!_imageSource) {
+                _imageSource = _renderTargetSource;
+            }
+        }
+
+        // Called by Vehicle::EndPlay(): gives the render target back to the pool
+        void releaseRenderTarget(void)
+        {
+            if (!_renderTarget) {
+                return;
+            }
+
+            _captureComponent->TextureTarget = NULL;
+
+            if (_imageSource == _renderTargetSource) {
+                _imageSource = NULL;
+            }
+
+            delete _renderTargetSource;
+            _renderTargetSource = NULL;
+
+            RenderTargets::release(_renderTarget);
+            _renderTarget = NULL;
+        }
 
         // Sets current FOV
         void setFov(float fov)
@@ -155,24 +215,42 @@ class Camera {
             _captureComponent->FOVAngle = fov;
         }
 
+#endif
+
+        // Override this method for your video application
+        virtual void processImageBytes(uint8_t * bytes) { (void)bytes; }
+
     public:
 
         // Called on main thread
         void grabImage(void)
         {
-            // Read the pixels from the RenderTarget
-            TArray<FColor> renderTargetPixels;
-            _renderTarget->ReadPixels(renderTargetPixels);
+            TRACE_SCOPE("Camera::grabImage");
+#ifndef MULTICOPTERSIM_NATIVE
+            FScopeCycleCounter cycleCounter(_statId);
+#endif
 
             // Copy the RBGA pixels to the private image
-            FMemory::Memcpy(_imageBytes, renderTargetPixels.GetData(), _rows*_cols*4);
+            if (!_imageSource || !_imageSource->read(_imageBytes, _rows, _cols)) {
+                return;
+            }
 
             // Virtual method implemented in subclass
             processImageBytes(_imageBytes);
         }
 
+        // Replaces the image source, e.g. with a SyntheticImageSource when running headless
+        void setImageSource(ImageSource * imageSource)
+        {
+            _imageSource = imageSource;
+        }
+
+        // Touches no UE4 objects, which may already have been collected; EndPlay() has released the target
         virtual ~Camera()
         {
+#ifndef MULTICOPTERSIM_NATIVE
+            delete _renderTargetSource;
+#endif
             delete _imageBytes;
         }
 
@@ -35,6 +35,7 @@
 
 // #include "Utils.hpp"
 #include "Transforms.hpp"
+#include "Trace.hpp"
 
 class Dynamics {
 
@@ -87,19 +88,51 @@ class Dynamics {
         };
 
 
+        /**
+         * Everything update() carries from one step to the next, for saving and
+         * restoring (e.g., replay keyframes).  Motor-derived values are not
+         * included, since setMotors() recomputes them before every update().
+         */
+        typedef struct {
+
+            double x[STATE_SIZE];
+            double inertialAccel[3];
+            double disturbance[3];
+            double agl;
+            bool   airborne;
+
+        } snapshot_t;
+
+        // How update() integrates the state derivative
+        typedef enum {
+
+            INTEGRATOR_EXPLICIT_EULER,       // positions and velocities from the old velocities
+            INTEGRATOR_SEMI_IMPLICIT_EULER   // velocities first, then positions from the new ones
+
+        } integrator_t;
+
         /**
          * Updates state.
          *
          * @param dt time in seconds since previous update
+         * @param integrator semi-implicit Euler keeps oscillations from gaining
+         * energy at longer time steps, as explicit Euler would
          */
-        void update(double dt) 
+        void update(double dt, integrator_t integrator=INTEGRATOR_EXPLICIT_EULER)
         {
+            TRACE_SCOPE("Dynamics::update");
+
             // Use the current Euler angles to rotate the orthogonal thrust vector into the inertial frame.
             // Negate to use NED.
             double euler[3] = { _x[6], _x[8], _x[10] };
             double accelNED[3] = {};
             Transforms::bodyZToInertial(-_U1 / _vparams.m, euler, accelNED);
 
+            // Add any external disturbance (e.g., wind gust)
+            for (uint8_t i = 0; i < 3; ++i) {
+                accelNED[i] += _disturbance[i];
+            }
+
             // We're airborne once net downward acceleration goes below zero
             double netz = accelNED[2] + g;
 
@@ -133,8 +166,20 @@ class Dynamics {
                 computeStateDerivative(accelNED, netz);
 
                 // Compute state as first temporal integral of first temporal derivative
-                for (uint8_t i = 0; i < 12; ++i) {
-                    _x[i] += dt * _dxdt[i];
+                if (integrator == INTEGRATOR_EXPLICIT_EULER) {
+                    for (uint8_t i = 0; i < 12; ++i) {
+                        _x[i] += dt * _dxdt[i];
+                    }
+                }
+
+                // Velocities first, then positions and angles from the new velocities
+                else {
+                    for (uint8_t i = 1; i < 12; i += 2) {
+                        _x[i] += dt * _dxdt[i];
+                    }
+                    for (uint8_t i = 0; i < 12; i += 2) {
+                        _x[i] += dt * _x[i+1];
+                    }
                 }
 
                 // Once airborne, inertial-frame acceleration is same as NED acceleration
@@ -158,6 +203,59 @@ class Dynamics {
             return _x[k];
         }
 
+        // Inertial-frame (NED) acceleration accessor, less gravity: what an accelerometer senses
+        double inertialAccel(uint8_t k)
+        {
+            return _inertialAccel[k];
+        }
+
+        // Thrust/torque accessor: U1 (k=0) through U4 (k=3), as set by setMotors()
+        double u(uint8_t k)
+        {
+            const double U[4] = {_U1, _U2, _U3, _U4};
+            return U[k];
+        }
+
+        // Height above ground as set by setAgl()
+        double agl(void)
+        {
+            return _agl;
+        }
+
+        bool airborne(void)
+        {
+            return _airborne;
+        }
+
+        // True if thrust as of setMotors(), with any disturbance, is too little to lift off level ground
+        bool belowLiftoff(void)
+        {
+            return -_U1 / _vparams.m + _disturbance[2] + g >= 0;
+        }
+
+        const vehicle_params_t & params(void)
+        {
+            return _vparams;
+        }
+
+        void getSnapshot(snapshot_t & snapshot)
+        {
+            memcpy(snapshot.x, _x, sizeof(_x));
+            memcpy(snapshot.inertialAccel, _inertialAccel, sizeof(_inertialAccel));
+            memcpy(snapshot.disturbance, _disturbance, sizeof(_disturbance));
+            snapshot.agl = _agl;
+            snapshot.airborne = _airborne;
+        }
+
+        void setSnapshot(const snapshot_t & snapshot)
+        {
+            memcpy(_x, snapshot.x, sizeof(_x));
+            memcpy(_inertialAccel, snapshot.inertialAccel, sizeof(_inertialAccel));
+            memcpy(_disturbance, snapshot.disturbance, sizeof(_disturbance));
+            _agl = snapshot.agl;
+            _airborne = snapshot.airborne;
+        }
+
     private:
 
         static constexpr world_params_t EARTH_PARAMS = { 
@@ -240,6 +338,9 @@ class Dynamics {
         // Height above ground, set by kinematics
         double _agl = 0;
 
+        // External disturbance as NED acceleration [m/s^2], set by simulation scenario
+        double _disturbance[3] = {};
+
         // universal constants
         static constexpr double g = 9.80665; // might want to allow this to vary!
 
@@ -395,6 +496,18 @@ class Dynamics {
             _agl = agl;
         }
 
+        /**
+         * Sets an external disturbance, such as a wind gust, that persists until changed.
+         *
+         * @param accelNED acceleration in NED inertial frame [m/s^2]
+         */
+        void setDisturbance(const double accelNED[3])
+        {
+            for (uint8_t i = 0; i < 3; ++i) {
+                _disturbance[i] = accelNED[i];
+            }
+        }
+
         // Rotor direction for animation
         virtual int8_t rotorDirection(uint8_t i) { (void)i; return 0; }
 
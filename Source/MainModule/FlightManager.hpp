@@ -10,8 +10,17 @@
 
 #include "Dynamics.hpp"
 #include "ThreadedManager.hpp"
+#include "FlightRecorder.hpp"
+#include "Replay.hpp"
+#include "Heightfield.hpp"
+#include "Obstacles.hpp"
+#include "SwarmProximity.hpp"
 
-class FFlightManager : public FThreadedManager {
+#include <atomic>
+#include <mutex>
+#include <math.h>
+
+class FFlightManager : public FThreadedManager, public SwarmProximity::Member {
 
     private:
 
@@ -21,8 +30,169 @@ class FFlightManager : public FThreadedManager {
         // For computing deltaT
         double   _previousTime = 0;
 
+        // Longest dynamics step; zero for one step per iteration
+        double   _dynamicsPeriod = 0;
+
+        // Set by the scheduler through tierChanged(); only touched between ticks and on our step
+        Dynamics::integrator_t _integrator = Dynamics::INTEGRATOR_EXPLICIT_EULER;
+        uint32_t _tierInterval = 1;   // ticks per step, stretching the dynamics period to match
+
         bool _running = false;
 
+        // Time spent in getMotors() each iteration, for reporting on the game thread
+        std::atomic<double> _controllerLatency;
+
+        // Tags this vehicle's records in the flight recorder
+        uint32_t _recorderId = 0;
+
+        // Latest AGL from the game thread, applied once per step so the step sees a single value
+        std::atomic<double> _agl;
+
+        // Terrain for computing AGL on the physics thread; _agl is the fallback where it has no tile or an overhang
+        std::atomic<Heightfield *> _heightfield;
+        double _terrainOrigin[3] = {};
+
+        double computeAgl(void)
+        {
+            Heightfield * heightfield = _heightfield.load(std::memory_order_acquire);
+
+            if (heightfield) {
+
+                double x = _terrainOrigin[0] + _dynamics->x(Dynamics::STATE_X);
+                double y = _terrainOrigin[1] + _dynamics->x(Dynamics::STATE_Y);
+
+                double height = 0;
+                if (heightfield->getHeight(x, y, height)) {
+
+                    // Z is down in the vehicle frame, up in the world
+                    double agl = _terrainOrigin[2] - height - _dynamics->x(Dynamics::STATE_Z);
+
+                    // Under an overhang (e.g., a bridge), the game thread traces down from the vehicle instead
+                    if (agl > -OVERHANG_DEPTH) {
+                        return agl;
+                    }
+                }
+            }
+
+            return _agl.load(std::memory_order_relaxed);
+        }
+
+        // Sphere checked against static obstacles each step; zero radius turns checking off
+        std::atomic<double> _obstacleRadius;
+        double _obstacleOrigin[3] = {};
+        bool _touchingObstacle = false;
+        std::atomic<uint32_t> _obstacleContacts;
+
+        void checkObstacles(void)
+        {
+            double radius = _obstacleRadius.load(std::memory_order_acquire);
+
+            Obstacles::Reader reader;
+            const Obstacles * obstacles = reader.get();
+
+            if (radius <= 0 || !obstacles) {
+                return;
+            }
+
+            // NED => world
+            double center[3] = {
+                _obstacleOrigin[0] + _dynamics->x(Dynamics::STATE_X),
+                _obstacleOrigin[1] + _dynamics->x(Dynamics::STATE_Y),
+                _obstacleOrigin[2] - _dynamics->x(Dynamics::STATE_Z)
+            };
+
+            Obstacles::contact_t contact = {};
+            bool touching = obstacles->sphere(center, radius, contact);
+
+            // Count each new contact once
+            if (touching && !_touchingObstacle) {
+                _obstacleContacts.store(_obstacleContacts.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+            }
+
+            _touchingObstacle = touching;
+        }
+
+        // Other vehicles, when in a swarm
+        bool _inSwarm = false;
+        double _swarmOrigin[3] = {};
+        std::atomic<uint32_t> _vehicleCollisions;
+        std::atomic<uint32_t> _nearMisses;
+
+        // Called by SwarmProximity once every vehicle has stepped
+        virtual void getSwarmPosition(float position[3]) override
+        {
+            // NED => world
+            position[0] = (float)(_swarmOrigin[0] + _dynamics->x(Dynamics::STATE_X));
+            position[1] = (float)(_swarmOrigin[1] + _dynamics->x(Dynamics::STATE_Y));
+            position[2] = (float)(_swarmOrigin[2] - _dynamics->x(Dynamics::STATE_Z));
+        }
+
+        virtual void swarmEvent(const SwarmProximity::event_t & event) override
+        {
+            std::atomic<uint32_t> & counter = event.type == SwarmProximity::EVENT_COLLISION ? _vehicleCollisions : _nearMisses;
+            counter.store(counter.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+        }
+
+        // Disturbance from the caller's thread, applied at the start of the next step
+        std::mutex _disturbanceMutex;
+        std::atomic<bool> _disturbancePending;
+        double _pendingDisturbance[3] = {};
+
+        void applyDisturbance(void)
+        {
+            if (_disturbancePending.load(std::memory_order_acquire)) {
+                std::lock_guard<std::mutex> lock(_disturbanceMutex);
+                _dynamics->setDisturbance(_pendingDisturbance);
+                _disturbancePending = false;
+            }
+        }
+
+        // Resting on the ground since _restStart with the same motor values and AGL; sleeps after SLEEP_DELAY
+        double   _restStart = -1;
+        double   _restAgl = 0;
+        double * _restMotorvals = NULL;
+
+        void updateRest(double currentTime)
+        {
+            bool resting = !_dynamics->airborne() && _dynamics->belowLiftoff() &&
+                fabs(_dynamics->agl() - _restAgl) < AGL_TOLERANCE;
+
+            for (uint8_t j=0; resting && j<_nmotors; ++j) {
+                resting = fabs(_motorvals[j] - _restMotorvals[j]) < MOTOR_TOLERANCE;
+            }
+
+            if (!resting || _restStart < 0) {
+
+                _restStart = currentTime;
+                _restAgl = _dynamics->agl();
+
+                for (uint8_t j=0; j<_nmotors; ++j) {
+                    _restMotorvals[j] = _motorvals[j];
+                }
+            }
+        }
+
+        // Replay journal: opened by the caller's thread, adopted and closed by the physics thread
+        std::atomic<ReplayRecorder *> _replayPending;
+        std::atomic<bool> _replayStopRequested;
+        ReplayRecorder * _replayRecorder = NULL;
+
+        // Runs on physics thread
+        void updateReplayRecorder(void)
+        {
+            if (_replayStopRequested.exchange(false)) {
+                delete _replayRecorder;
+                _replayRecorder = NULL;
+            }
+
+            ReplayRecorder * pending = _replayPending.exchange(NULL);
+
+            if (pending) {
+                delete _replayRecorder;
+                _replayRecorder = pending;
+            }
+        }
+
         /**
          * Flight-control method running repeatedly on its own thread.  
          * Override this method to implement your own flight controller.
@@ -39,15 +209,21 @@ class FFlightManager : public FThreadedManager {
 
         Dynamics * _dynamics = NULL;
 
-        // Constructor, called main thread
-        FFlightManager(Dynamics * dynamics) 
-            : FThreadedManager()
+        // Constructor, called main thread; see FThreadedManager for threaded
+        FFlightManager(Dynamics * dynamics, bool threaded=true) 
+            : FFlightManager(dynamics, threaded ? MODE_SCHEDULED : MODE_MANUAL)
+        {
+        }
+
+        FFlightManager(Dynamics * dynamics, mode_t mode) 
+            : FThreadedManager(mode)
         {
             // Constant
             _nmotors = dynamics->motorCount();
 
             // Allocate array for motor values
             _motorvals = new double[_nmotors];
+            _restMotorvals = new double[_nmotors]();
 
             // Store dynamics for performTask()
             _dynamics = dynamics;
@@ -55,38 +231,304 @@ class FFlightManager : public FThreadedManager {
             // For periodic update
             _previousTime = 0;
 
+            _controllerLatency = 0;
+
+            _recorderId = FlightRecorder::newVehicle();
+
+            _agl = 0;
+            _heightfield = NULL;
+
+            _obstacleRadius = 0;
+            _obstacleContacts = 0;
+
+            _vehicleCollisions = 0;
+            _nearMisses = 0;
+
+            _replayPending = NULL;
+            _replayStopRequested = false;
+
+            _disturbancePending = false;
+
             _running = true;
         }
 
+        /**
+         * Integrates the dynamics at a fixed rate, in sub-steps of each
+         * iteration, calling getMotors() after every sub-step with its time.
+         * In a lower physics tier the rate is divided by the tier's interval,
+         * so that a step has as many sub-steps as at the full rate.
+         * Call from the subclass constructor.
+         * @param rate Hz; zero for one dynamics step per iteration
+         */
+        void setDynamicsRate(double rate)
+        {
+            _dynamicsPeriod = rate > 0 ? 1 / rate : 0;
+        }
+
+        // Lower tiers take longer steps in as many sub-steps as the full tier, integrating with semi-implicit Euler
+        virtual void tierChanged(uint8_t tier, double interval) override
+        {
+            FThreadedManager::tierChanged(tier, interval);
+
+            _tierInterval = PhysicsScheduler::getTierInterval(tier);
+
+            _integrator = tier == PhysicsScheduler::TIER_FULL ?
+                Dynamics::INTEGRATOR_EXPLICIT_EULER : Dynamics::INTEGRATOR_SEMI_IMPLICIT_EULER;
+        }
+
         // Called repeatedly on worker thread to compute dynamics and run flight controller (PID)
         void performTask(double currentTime)
         {
+            TRACE_SCOPE("FFlightManager::performTask");
+
             if (!_running) return;
 
             // Compute time deltay in seconds
 			double dt = currentTime - _previousTime;
 
-            // Send current motor values to dynamics
-            _dynamics->setMotors(_motorvals);
+            // Send current AGL and disturbance to dynamics
+            _dynamics->setAgl(computeAgl());
+            applyDisturbance();
+
+            updateReplayRecorder();
+
+            // Sub-steps no longer than the dynamics period (stretched for a lower tier), with the controller run between them
+            double period = _dynamicsPeriod * _tierInterval;
+            uint32_t substeps = period > 0 && dt > period ? (uint32_t)ceil(dt / period - 1e-6) : 1;
+            double h = dt / substeps;
+
+            double controllerTime = 0;
+
+            for (uint32_t k=1; k<=substeps; ++k) {
+
+                double time = k < substeps ? _previousTime + k * h : currentTime;
+
+                _dynamics->setMotors(_motorvals);
 
-            // Update dynamics
-            _dynamics->update(dt);
+                // Journal the exact inputs to this step if replay recording is on
+                if (_replayRecorder) {
+                    _replayRecorder->record(_dynamics, time, h, _integrator, _motorvals);
+                }
+
+                // Update dynamics
+                _dynamics->update(h, _integrator);
+
+                if (k < substeps) {
+                    double controllerStart = PlatformTime::seconds();
+                    this->getMotors(time, _motorvals);
+                    controllerTime += PlatformTime::seconds() - controllerStart;
+                }
+            }
+
+            checkObstacles();
+
+            // Capture this step if flight recorder is running; one record per iteration, at the last sub-step
+            FlightRecorder::record(_recorderId, currentTime, _dynamics, _motorvals);
 
             // PID controller: update the flight manager (e.g., HackflightManager) with
             // the dynamics state, getting back the motor values
+            double controllerStart = PlatformTime::seconds();
             this->getMotors(currentTime, _motorvals);
+            controllerTime += PlatformTime::seconds() - controllerStart;
+            _controllerLatency.store(controllerTime, std::memory_order_relaxed);
+
+            updateRest(currentTime);
 
             // Track previous time for deltaT
             _previousTime = currentTime;
         }
 
+        // Landed with motors idle and nothing changing for a while: stop stepping until a poll or wake()
+        virtual bool canSleep(void) override
+        {
+            return _running && _restStart >= 0 && _previousTime - _restStart >= SLEEP_DELAY;
+        }
+
+        // Asleep: runs only the controller, waking if the motor command or AGL has changed
+        virtual bool poll(double time) override
+        {
+            this->getMotors(time, _motorvals);
+
+            for (uint8_t j=0; j<_nmotors; ++j) {
+                if (fabs(_motorvals[j] - _restMotorvals[j]) >= MOTOR_TOLERANCE) {
+                    return true;
+                }
+            }
+
+            return fabs(computeAgl() - _restAgl) >= AGL_TOLERANCE;
+        }
+
+        // Pick up from the wake-up step as though no time had passed
+        virtual void resume(double currentTime) override
+        {
+            _previousTime = currentTime - PhysicsScheduler::getPeriod();
+            _restStart = currentTime;
+        }
+
 
     public:
 
         static const uint8_t MAX_MOTORS = 16;
 
+        // Time at rest on the ground before sleeping, seconds
+        static constexpr double SLEEP_DELAY = 0.25;
+
+        // Changes smaller than these leave a resting vehicle at rest
+        static constexpr double MOTOR_TOLERANCE = 1e-4;
+        static constexpr double AGL_TOLERANCE = 1e-4;   // meters
+
+        // Heightfield terrain more than this far above the vehicle is an overhang, not ground; meters
+        static constexpr double OVERHANG_DEPTH = 0.5;
+
         ~FFlightManager(void)
         {
+            if (_inSwarm) {
+                SwarmProximity::remove(this);
+            }
+
+            delete _replayPending.exchange(NULL);
+            delete _replayRecorder;
+            delete[] _restMotorvals;
+        }
+
+        /**
+         * Sets an external disturbance, such as a wind gust, for the next step
+         * on, waking the vehicle if asleep.  Safe to call from any thread.
+         * @param accelNED acceleration in NED inertial frame [m/s^2]
+         */
+        void setDisturbance(const double accelNED[3])
+        {
+            {
+                std::lock_guard<std::mutex> lock(_disturbanceMutex);
+
+                for (uint8_t i=0; i<3; ++i) {
+                    _pendingDisturbance[i] = accelNED[i];
+                }
+
+                _disturbancePending.store(true, std::memory_order_release);
+            }
+
+            wake();
+        }
+
+        // Safe to call from any thread
+        void setAgl(double agl)
+        {
+            _agl.store(agl, std::memory_order_relaxed);
+        }
+
+        /**
+         * Has the physics thread compute AGL from a heightfield, at the
+         * vehicle's current position on every step.  Call once, from the game thread.
+         * @param heightfield terrain, kept paged in around the vehicle by the caller; NULL to stop
+         * @param originX world X of the vehicle's starting position, meters
+         * @param originY world Y of the vehicle's starting position, meters
+         * @param originHeight terrain height there, meters, where AGL is zero
+         */
+        void setHeightfield(Heightfield * heightfield, double originX, double originY, double originHeight)
+        {
+            _heightfield.store(NULL, std::memory_order_release);
+
+            _terrainOrigin[0] = originX;
+            _terrainOrigin[1] = originY;
+            _terrainOrigin[2] = originHeight;
+
+            _heightfield.store(heightfield, std::memory_order_release);
+        }
+
+        /**
+         * Has the physics thread check a sphere around the vehicle against the
+         * current static-obstacle map (Obstacles::publish()) on every step.
+         * Call once, from the game thread.
+         * @param radius meters
+         * @param originX world X of the vehicle's starting position, meters
+         * @param originY world Y of the vehicle's starting position, meters
+         * @param originZ world Z of the vehicle's starting position, meters
+         */
+        void setObstacleRadius(double radius, double originX, double originY, double originZ)
+        {
+            _obstacleOrigin[0] = originX;
+            _obstacleOrigin[1] = originY;
+            _obstacleOrigin[2] = originZ;
+
+            _obstacleRadius.store(radius, std::memory_order_release);
+        }
+
+        // Number of times the vehicle has come into contact with static geometry, ground included; safe to call from any thread
+        uint32_t getObstacleContacts(void)
+        {
+            return _obstacleContacts.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Adds the vehicle to the swarm, so that other vehicles coming near it
+         * or touching it are counted.  Only vehicles stepped by the physics
+         * scheduler can join.  Call once, from the game thread.
+         * @param radius of the vehicle's bounding sphere, meters
+         * @param originX world X of the vehicle's starting position, meters
+         * @param originY world Y of the vehicle's starting position, meters
+         * @param originZ world Z of the vehicle's starting position, meters
+         * @return true if the vehicle joined
+         */
+        bool joinSwarm(double radius, double originX, double originY, double originZ)
+        {
+            if (getMode() != MODE_SCHEDULED || _inSwarm) {
+                return false;
+            }
+
+            _swarmOrigin[0] = originX;
+            _swarmOrigin[1] = originY;
+            _swarmOrigin[2] = originZ;
+
+            SwarmProximity::add(this, radius);
+
+            _inSwarm = true;
+
+            return true;
+        }
+
+        // Number of times another vehicle has touched this one; safe to call from any thread
+        uint32_t getVehicleCollisions(void)
+        {
+            return _vehicleCollisions.load(std::memory_order_relaxed);
+        }
+
+        // Number of times another vehicle has come within near-miss range; safe to call from any thread
+        uint32_t getNearMisses(void)
+        {
+            return _nearMisses.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Starts journaling physics-step inputs for deterministic replay; safe to call from any thread.
+         * @param filename output file
+         * @param vehicle name of vehicle, for the replay tool
+         * @return true on success, false if file could not be opened
+         */
+        bool startReplayRecording(const char * filename, const char * vehicle)
+        {
+            ReplayRecorder * recorder = new ReplayRecorder();
+
+            if (!recorder->open(filename, vehicle, _dynamics)) {
+                delete recorder;
+                return false;
+            }
+
+            delete _replayPending.exchange(recorder);
+
+            return true;
+        }
+
+        // Safe to call from any thread
+        void stopReplayRecording(void)
+        {
+            delete _replayPending.exchange(NULL);
+            _replayStopRequested = true;
+        }
+
+        uint32_t getRecorderId(void)
+        {
+            return _recorderId;
         }
 
         // Called by VehiclePawn::Tick() method to propeller animation/sound (motorvals)
@@ -98,6 +540,12 @@ class FFlightManager : public FThreadedManager {
             }
         }
 
+        // Safe to call from any thread
+        double getControllerLatency(void)
+        {
+            return _controllerLatency.load(std::memory_order_relaxed);
+        }
+
         void stop(void)
         {
             _running = false;
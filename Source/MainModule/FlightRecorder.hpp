@@ -0,0 +1,483 @@
+/*
+ * Header-only binary flight recorder for MulticopterSim
+ *
+ * Captures every physics step of every vehicle as a fixed-size record.  Each
+ * physics thread writes into its own lock-free ring buffer; a background
+ * thread drains the rings into large blocks and writes them sequentially,
+ * outside the lock, so a slow disk never holds up attachThread().  Records
+ * that find their ring full are dropped and counted (droppedCount()).
+ *
+ * Usage:
+ *
+ *   FlightRecorder::start("flight.simrec");
+ *   ...
+ *   FlightRecorder::record(vehicleId, time, dynamics, motorvals);  // physics thread
+ *   ...
+ *   FlightRecorder::stop();
+ *
+ * File layout (little-endian):
+ *
+ *   header_t                        magic, version, sizes, field count
+ *   field_t[fieldCount]             name, type, count and offset of each record field
+ *   record_t ...                    records in order of writing; per vehicle, in time order
+ *
+ * Only whole records are ever written, so a file cut short by quitting the
+ * sim is still readable.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "Platform.hpp"
+#include "Dynamics.hpp"
+
+class FlightRecorder {
+
+    public:
+
+        static const uint8_t MAX_MOTORS = 16;
+
+        typedef struct {
+
+            double   time;               // seconds since flight manager start
+            double   x[12];              // Dynamics state vector
+            double   u[4];               // U1 (thrust) through U4 (yaw torque)
+            double   agl;                // meters
+            float    motors[MAX_MOTORS]; // motor values applied for this step
+            uint32_t vehicle;            // from newVehicle()
+            uint8_t  motorCount;
+            uint8_t  airborne;
+            uint8_t  reserved[2];
+
+        } record_t;
+
+        // Identifies the file type; eight bytes including the terminating zero
+        static const char * magic(void)
+        {
+            return "MSIMREC";
+        }
+
+        static const uint32_t VERSION = 1;
+
+        typedef enum {
+
+            TYPE_F64,
+            TYPE_F32,
+            TYPE_U32,
+            TYPE_U8
+
+        } type_t;
+
+        typedef struct {
+
+            char     magic[8];
+            uint32_t version;
+            uint32_t headerSize;  // including field table
+            uint32_t recordSize;
+            uint32_t fieldCount;
+
+        } header_t;
+
+        typedef struct {
+
+            char     name[24];
+            uint8_t  type;        // type_t
+            uint8_t  count;
+            uint16_t offset;
+
+        } field_t;
+
+    private:
+
+        // Single-producer (physics thread), single-consumer (writer) ring
+        class Buffer {
+
+            public:
+
+                // Power of two; eight seconds of a 4 kHz physics thread, about 7 MB, so a
+                // stalled disk write costs nothing short of that
+                static const uint32_t CAPACITY = 1<<15;
+
+                record_t records[CAPACITY];
+
+                std::atomic<uint32_t> head; // written by producer
+                std::atomic<uint32_t> tail; // written by consumer
+                std::atomic<uint32_t> dropped;
+
+                Buffer(void)
+                {
+                    head = 0;
+                    tail = 0;
+                    dropped = 0;
+                }
+
+                // Returns the next free slot, or NULL if full
+                record_t * claim(void)
+                {
+                    uint32_t h = head.load(std::memory_order_relaxed);
+
+                    if (h - tail.load(std::memory_order_acquire) >= CAPACITY) {
+                        dropped.store(dropped.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+                        return NULL;
+                    }
+
+                    return &records[h & (CAPACITY-1)];
+                }
+
+                void publish(void)
+                {
+                    head.store(head.load(std::memory_order_relaxed)+1, std::memory_order_release);
+                }
+
+        }; // class Buffer
+
+        // Drains the rings into a block and writes it out when full or stale
+        class Writer : public PlatformThread {
+
+            public:
+
+                static const uint32_t BLOCK_RECORDS = 4096; // about 900 kB
+
+                static constexpr double IDLE_SLEEP = 0.002;
+
+                // Bounds what is lost if the sim is killed
+                static constexpr double MAX_BLOCK_AGE = 0.25;
+
+                std::atomic<bool> running;
+
+                record_t * block = NULL;
+                uint32_t   blockCount = 0;
+                double     blockTime = 0;
+
+                size_t     firstBuffer = 0;
+
+                Writer(void)
+                {
+                    running = false;
+                    block = new record_t[BLOCK_RECORDS];
+                }
+
+            protected:
+
+                virtual void threadMain(void) override
+                {
+                    while (running.load(std::memory_order_relaxed)) {
+
+                        uint32_t drained = drainAll();
+
+                        if (blockCount == BLOCK_RECORDS ||
+                                (blockCount > 0 && PlatformTime::seconds() - blockTime > MAX_BLOCK_AGE)) {
+                            writeBlock();
+                        }
+
+                        if (!drained) {
+                            PlatformTime::sleep(IDLE_SLEEP);
+                        }
+                    }
+
+                    // Whatever is left, a block at a time
+                    while (drainAll()) {
+                        writeBlock();
+                    }
+                    writeBlock();
+                }
+
+            public:
+
+                // The file is opened before this thread starts and closed after it is joined,
+                // so the write needs no lock
+                void writeBlock(void)
+                {
+                    if (blockCount > 0) {
+                        fwrite(block, sizeof(record_t), blockCount, state().file);
+                        blockCount = 0;
+                    }
+                    blockTime = PlatformTime::seconds();
+                }
+
+                // Fills the block from the rings, stopping when it is full; returns number of records drained
+                uint32_t drainAll(void)
+                {
+                    state_t & s = state();
+
+                    std::lock_guard<std::mutex> lock(s.mutex);
+
+                    uint32_t total = 0;
+
+                    // Start each pass one ring further along, so a busy ring can't starve the rest
+                    size_t count = s.buffers.size();
+
+                    for (size_t k=0; k<count; ++k) {
+
+                        Buffer * b = s.buffers[(firstBuffer + k) % count];
+
+                        uint32_t t = b->tail.load(std::memory_order_relaxed);
+                        uint32_t h = b->head.load(std::memory_order_acquire);
+
+                        while (t != h && blockCount < BLOCK_RECORDS) {
+
+                            // Copy the largest contiguous run that fits in the block
+                            uint32_t index = t & (Buffer::CAPACITY-1);
+                            uint32_t n = h - t;
+                            if (n > Buffer::CAPACITY - index) {
+                                n = Buffer::CAPACITY - index;
+                            }
+                            if (n > BLOCK_RECORDS - blockCount) {
+                                n = BLOCK_RECORDS - blockCount;
+                            }
+
+                            memcpy(&block[blockCount], &b->records[index], n*sizeof(record_t));
+                            blockCount += n;
+                            t += n;
+                            total += n;
+
+                            b->tail.store(t, std::memory_order_release);
+                        }
+                    }
+
+                    firstBuffer++;
+
+                    s.written += total;
+
+                    return total;
+                }
+
+        }; // class Writer
+
+        // Process-wide state, held in a function-local static so this can stay header-only
+        typedef struct {
+
+            std::atomic<bool>      enabled;
+            std::atomic<uint32_t>  vehicleCount;
+            std::mutex             mutex;     // guards buffers list; never taken on hot path
+            std::vector<Buffer *>  buffers;   // never freed: threads may outlive a recording
+            Writer *               writer;    // never freed, so no thread is left joinable at exit
+            FILE *                 file;
+            uint64_t               written;
+
+        } state_t;
+
+        static state_t & state(void)
+        {
+            static state_t s;
+            return s;
+        }
+
+        static Buffer * & localBuffer(void)
+        {
+            static thread_local Buffer * buffer = NULL;
+            return buffer;
+        }
+
+        static void addField(field_t * fields, uint32_t & count, const char * name, type_t type, uint8_t n, size_t offset)
+        {
+            field_t & f = fields[count++];
+            memset(&f, 0, sizeof(f));
+            snprintf(f.name, sizeof(f.name), "%s", name);
+            f.type = (uint8_t)type;
+            f.count = n;
+            f.offset = (uint16_t)offset;
+        }
+
+    public:
+
+        // Writes the header and field table; also used by tools that produce recorder files
+        static void writeHeader(FILE * fp)
+        {
+            field_t fields[8];
+            uint32_t count = 0;
+
+            addField(fields, count, "time",       TYPE_F64, 1,          offsetof(record_t, time));
+            addField(fields, count, "x",          TYPE_F64, 12,         offsetof(record_t, x));
+            addField(fields, count, "u",          TYPE_F64, 4,          offsetof(record_t, u));
+            addField(fields, count, "agl",        TYPE_F64, 1,          offsetof(record_t, agl));
+            addField(fields, count, "motors",     TYPE_F32, MAX_MOTORS, offsetof(record_t, motors));
+            addField(fields, count, "vehicle",    TYPE_U32, 1,          offsetof(record_t, vehicle));
+            addField(fields, count, "motorCount", TYPE_U8,  1,          offsetof(record_t, motorCount));
+            addField(fields, count, "airborne",   TYPE_U8,  1,          offsetof(record_t, airborne));
+
+            header_t header = {};
+            memcpy(header.magic, magic(), 8);
+            header.version = VERSION;
+            header.headerSize = (uint32_t)(sizeof(header_t) + count*sizeof(field_t));
+            header.recordSize = sizeof(record_t);
+            header.fieldCount = count;
+
+            fwrite(&header, sizeof(header), 1, fp);
+            fwrite(fields, sizeof(field_t), count, fp);
+        }
+
+        /**
+         * Starts recording to a file, or restarts it if already running.
+         * @param filename output file
+         * @return true on success, false if file could not be opened
+         */
+        static bool start(const char * filename)
+        {
+            stop();
+
+            state_t & s = state();
+
+            {
+                std::lock_guard<std::mutex> lock(s.mutex);
+
+                s.file = fopen(filename, "wb");
+                if (!s.file) {
+                    return false;
+                }
+
+                // Discard anything left over from a previous recording
+                for (Buffer * b : s.buffers) {
+                    b->tail.store(b->head.load(std::memory_order_acquire), std::memory_order_release);
+                    b->dropped = 0;
+                }
+
+                s.written = 0;
+
+                writeHeader(s.file);
+            }
+
+            if (!s.writer) {
+                s.writer = new Writer();
+            }
+
+            s.writer->running = true;
+            s.writer->blockTime = PlatformTime::seconds();
+            s.writer->startThread("FlightRecorder");
+
+            s.enabled.store(true, std::memory_order_release);
+
+            return true;
+        }
+
+        /**
+         * Stops recording, writing any remaining records and closing the file.
+         */
+        static void stop(void)
+        {
+            state_t & s = state();
+
+            if (!s.enabled.exchange(false)) {
+                return;
+            }
+
+            s.writer->running = false;
+            s.writer->joinThread();
+
+            std::lock_guard<std::mutex> lock(s.mutex);
+
+            fclose(s.file);
+            s.file = NULL;
+        }
+
+        static bool enabled(void)
+        {
+            return state().enabled.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Allocates the calling thread's ring buffer, so that the first
+         * record() call on a physics thread does not allocate.
+         */
+        static void attachThread(void)
+        {
+            Buffer * & buffer = localBuffer();
+
+            if (!buffer) {
+                state_t & s = state();
+                std::lock_guard<std::mutex> lock(s.mutex);
+                buffer = new Buffer();
+                s.buffers.push_back(buffer);
+            }
+        }
+
+        // Returns a process-wide unique ID for tagging a vehicle's records
+        static uint32_t newVehicle(void)
+        {
+            return state().vehicleCount.fetch_add(1);
+        }
+
+        /**
+         * Records one physics step.  Call from the physics thread after Dynamics::update().
+         * @param vehicle ID from newVehicle()
+         * @param time seconds
+         * @param dynamics vehicle dynamics, already updated for this step
+         * @param motorvals motor values applied for this step
+         */
+        static void record(uint32_t vehicle, double time, Dynamics * dynamics, const double * motorvals)
+        {
+            if (!enabled()) {
+                return;
+            }
+
+            attachThread();
+
+            Buffer * buffer = localBuffer();
+
+            record_t * r = buffer->claim();
+
+            if (!r) {
+                return;
+            }
+
+            r->time = time;
+
+            for (uint8_t k=0; k<12; ++k) {
+                r->x[k] = dynamics->x(k);
+            }
+
+            for (uint8_t k=0; k<4; ++k) {
+                r->u[k] = dynamics->u(k);
+            }
+
+            r->agl = dynamics->agl();
+
+            uint8_t nmotors = dynamics->motorCount();
+            if (nmotors > MAX_MOTORS) {
+                nmotors = MAX_MOTORS;
+            }
+
+            for (uint8_t k=0; k<MAX_MOTORS; ++k) {
+                r->motors[k] = k < nmotors ? (float)motorvals[k] : 0;
+            }
+
+            r->vehicle = vehicle;
+            r->motorCount = nmotors;
+            r->airborne = dynamics->airborne();
+            r->reserved[0] = r->reserved[1] = 0;
+
+            buffer->publish();
+        }
+
+        // Records dropped because a ring buffer was full
+        static uint32_t droppedCount(void)
+        {
+            state_t & s = state();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            uint32_t count = 0;
+            for (Buffer * b : s.buffers) {
+                count += b->dropped.load(std::memory_order_relaxed);
+            }
+            return count;
+        }
+
+        // Records handed to the file so far in this recording
+        static uint64_t writtenCount(void)
+        {
+            state_t & s = state();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            return s.written;
+        }
+
+}; // class FlightRecorder
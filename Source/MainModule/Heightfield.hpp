@@ -0,0 +1,541 @@
+/*
+ * Header-only tiled heightfield for MulticopterSim
+ *
+ * Caches terrain height in square tiles of samples, so the physics thread can
+ * get height above ground at any rate without calling into the engine.  The
+ * game thread pages tiles in around the vehicle from a HeightfieldSource
+ * (line traces, or a precomputed file); the physics thread reads them with
+ * bilinear interpolation through getHeight().  Neither side blocks or
+ * allocates after construction.
+ *
+ * Coordinates are world meters with Z up.  Tile (tx,ty) holds the samples at
+ * ((tx*TILE_CELLS + i)*spacing, (ty*TILE_CELLS + j)*spacing) for i,j in
+ * 0..TILE_CELLS, so neighboring tiles share an edge and every interpolation
+ * cell lies in a single tile.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <atomic>
+
+// Supplies the samples of a tile; called on the game thread only
+class HeightfieldSource {
+
+    public:
+
+        /**
+         * Fills a tile with terrain heights.
+         * @param tx tile X index
+         * @param ty tile Y index
+         * @param spacing meters between samples
+         * @param cells cells per tile side; there are (cells+1)^2 samples, X varying fastest
+         * @param heights output: height of each sample in meters, NAN where there is no ground
+         * @return true on success, false if the tile is unavailable
+         */
+        virtual bool getTile(int32_t tx, int32_t ty, double spacing, uint32_t cells, float * heights) = 0;
+
+        /**
+         * For a source that fills a tile over several calls: true while the
+         * tile of the last getTile() is unfinished.  Heightfield::update()
+         * then stops, asking for the same tile again on its next call.
+         */
+        virtual bool busy(void)
+        {
+            return false;
+        }
+
+        virtual ~HeightfieldSource(void) { }
+
+}; // class HeightfieldSource
+
+class Heightfield {
+
+    public:
+
+        static const uint32_t TILE_CELLS = 32;
+
+        static const uint32_t TILE_SAMPLES = (TILE_CELLS+1) * (TILE_CELLS+1);
+
+        static constexpr double DEFAULT_SPACING = 0.5;
+
+        static const uint32_t DEFAULT_TILE_COUNT = 16;
+
+    private:
+
+        // A tile slot, written under a sequence lock: version is odd while the game
+        // thread is filling the slot, and readers retry or give up if it changes
+        typedef struct {
+
+            std::atomic<uint32_t> version;
+            std::atomic<int64_t>  key;
+            float                 heights[TILE_SAMPLES];
+
+        } slot_t;
+
+        static const int64_t EMPTY = INT64_MIN;
+
+        double _spacing = DEFAULT_SPACING;
+
+        slot_t * _slots = NULL;
+        uint32_t _slotCount = 0;
+
+        // Staging area, so sources can be slow without holding a slot locked
+        float _staging[TILE_SAMPLES];
+
+        HeightfieldSource * _source = NULL;
+
+        // Slot of the last successful lookup on the physics thread
+        std::atomic<uint32_t> _hint;
+
+        static int64_t makeKey(int32_t tx, int32_t ty)
+        {
+            return (int64_t)(((uint64_t)(uint32_t)tx << 32) | (uint32_t)ty);
+        }
+
+        static int32_t keyX(int64_t key)
+        {
+            return (int32_t)(uint32_t)((uint64_t)key >> 32);
+        }
+
+        static int32_t keyY(int64_t key)
+        {
+            return (int32_t)(uint32_t)key;
+        }
+
+        int32_t tileIndex(double coordinate)
+        {
+            return (int32_t)floor(coordinate / (_spacing * TILE_CELLS));
+        }
+
+        int32_t findSlot(int64_t key)
+        {
+            for (uint32_t k=0; k<_slotCount; ++k) {
+                if (_slots[k].key.load(std::memory_order_relaxed) == key) {
+                    return (int32_t)k;
+                }
+            }
+
+            return -1;
+        }
+
+        // Empty slot, or else the one farthest from (tx,ty) outside the radius
+        int32_t victimSlot(int32_t tx, int32_t ty, int32_t radius)
+        {
+            int32_t best = -1;
+            int64_t bestDistance = radius;
+
+            for (uint32_t k=0; k<_slotCount; ++k) {
+
+                int64_t key = _slots[k].key.load(std::memory_order_relaxed);
+
+                if (key == EMPTY) {
+                    return (int32_t)k;
+                }
+
+                int64_t dx = llabs((int64_t)keyX(key) - tx);
+                int64_t dy = llabs((int64_t)keyY(key) - ty);
+                int64_t distance = dx > dy ? dx : dy;
+
+                if (distance > bestDistance) {
+                    best = (int32_t)k;
+                    bestDistance = distance;
+                }
+            }
+
+            return best;
+        }
+
+        void fillSlot(int32_t index, int64_t key)
+        {
+            slot_t & slot = _slots[index];
+
+            uint32_t version = slot.version.load(std::memory_order_relaxed);
+
+            slot.version.store(version+1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            slot.key.store(key, std::memory_order_relaxed);
+            memcpy(slot.heights, _staging, sizeof(_staging));
+
+            slot.version.store(version+2, std::memory_order_release);
+        }
+
+    public:
+
+        /**
+         * @param source where tiles come from; not owned
+         * @param spacing meters between samples
+         * @param tileCount number of tiles kept in memory
+         */
+        Heightfield(HeightfieldSource * source=NULL, double spacing=DEFAULT_SPACING, uint32_t tileCount=DEFAULT_TILE_COUNT)
+        {
+            _source = source;
+            _spacing = spacing;
+            _slotCount = tileCount;
+            _slots = new slot_t[tileCount];
+            _hint = 0;
+
+            for (uint32_t k=0; k<tileCount; ++k) {
+                _slots[k].version = 0;
+                _slots[k].key = EMPTY;
+            }
+        }
+
+        ~Heightfield(void)
+        {
+            delete[] _slots;
+        }
+
+        // Game thread only, before tiles are paged in
+        void setSource(HeightfieldSource * source)
+        {
+            _source = source;
+        }
+
+        double getSpacing(void)
+        {
+            return _spacing;
+        }
+
+        /**
+         * Pages in missing tiles around a point, nearest first, replacing the
+         * tiles farthest away.  Call from the game thread.
+         * @param x world X in meters
+         * @param y world Y in meters
+         * @param radius tiles on each side of the one containing (x,y)
+         * @param maxLoads most tiles to fetch in this call, bounding the time spent
+         * @return number of tiles fetched
+         */
+        uint32_t update(double x, double y, int32_t radius=1, uint32_t maxLoads=1)
+        {
+            if (!_source) {
+                return 0;
+            }
+
+            int32_t cx = tileIndex(x);
+            int32_t cy = tileIndex(y);
+
+            uint32_t loads = 0;
+
+            // Rings of increasing distance from the center tile
+            for (int32_t r=0; r<=radius && loads<maxLoads; ++r) {
+
+                for (int32_t ty=cy-r; ty<=cy+r && loads<maxLoads; ++ty) {
+
+                    for (int32_t tx=cx-r; tx<=cx+r && loads<maxLoads; ++tx) {
+
+                        if (tx != cx-r && tx != cx+r && ty != cy-r && ty != cy+r) {
+                            continue;
+                        }
+
+                        int64_t key = makeKey(tx, ty);
+
+                        if (findSlot(key) >= 0) {
+                            continue;
+                        }
+
+                        int32_t victim = victimSlot(cx, cy, radius);
+
+                        // Everything resident is needed: the pool is too small for this radius
+                        if (victim < 0) {
+                            return loads;
+                        }
+
+                        if (!_source->getTile(tx, ty, _spacing, TILE_CELLS, _staging)) {
+                            if (_source->busy()) {
+                                return loads;
+                            }
+                            continue;
+                        }
+
+                        fillSlot(victim, key);
+
+                        loads++;
+                    }
+                }
+            }
+
+            return loads;
+        }
+
+        /**
+         * Gets interpolated terrain height.  Safe to call from any thread.
+         * @param x world X in meters
+         * @param y world Y in meters
+         * @param height output: meters
+         * @return true on success, false if the tile is not resident or has no ground there
+         */
+        bool getHeight(double x, double y, double & height)
+        {
+            double fx = x / _spacing;
+            double fy = y / _spacing;
+
+            double cellx = floor(fx);
+            double celly = floor(fy);
+
+            int32_t tx = (int32_t)floor(cellx / TILE_CELLS);
+            int32_t ty = (int32_t)floor(celly / TILE_CELLS);
+
+            uint32_t i = (uint32_t)(cellx - (double)tx * TILE_CELLS);
+            uint32_t j = (uint32_t)(celly - (double)ty * TILE_CELLS);
+
+            double u = fx - cellx;
+            double v = fy - celly;
+
+            int64_t key = makeKey(tx, ty);
+
+            uint32_t index = _hint.load(std::memory_order_relaxed);
+
+            if (index >= _slotCount || _slots[index].key.load(std::memory_order_relaxed) != key) {
+                int32_t found = findSlot(key);
+                if (found < 0) {
+                    return false;
+                }
+                index = (uint32_t)found;
+                _hint.store(index, std::memory_order_relaxed);
+            }
+
+            slot_t & slot = _slots[index];
+
+            uint32_t version = slot.version.load(std::memory_order_acquire);
+
+            if ((version & 1) || slot.key.load(std::memory_order_relaxed) != key) {
+                return false;
+            }
+
+            const float * row0 = &slot.heights[j*(TILE_CELLS+1) + i];
+            const float * row1 = row0 + (TILE_CELLS+1);
+
+            double h00 = row0[0];
+            double h10 = row0[1];
+            double h01 = row1[0];
+            double h11 = row1[1];
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            // Slot was refilled while we read it
+            if (slot.version.load(std::memory_order_relaxed) != version) {
+                return false;
+            }
+
+            height = (1-v) * ((1-u)*h00 + u*h10) + v * ((1-u)*h01 + u*h11);
+
+            return !isnan(height);
+        }
+
+        // Whether the tile containing (x,y) is resident
+        bool resident(double x, double y)
+        {
+            return findSlot(makeKey(tileIndex(x), tileIndex(y))) >= 0;
+        }
+
+}; // class Heightfield
+
+/**
+ * Precomputed heightfield, read one tile at a time as the game thread asks
+ * for it.  File layout (native byte order):
+ *
+ *   header_t
+ *   entry_t[tileCount]                   tile index, sorted by key
+ *   float[TILE_SAMPLES] per tile          in the order of the index
+ */
+class HeightfieldFile : public HeightfieldSource {
+
+    public:
+
+        static const uint32_t VERSION = 1;
+
+        // Identifies the file type; eight bytes including the terminating zero
+        static const char * magic(void)
+        {
+            return "MSIMHGT";
+        }
+
+        typedef struct {
+
+            char     magic[8];
+            uint32_t version;
+            uint32_t tileCells;
+            double   spacing;
+            uint64_t tileCount;
+
+        } header_t;
+
+        typedef struct {
+
+            int32_t  tx;
+            int32_t  ty;
+
+        } entry_t;
+
+    private:
+
+        FILE * _fp = NULL;
+
+        header_t _header = {};
+
+        entry_t * _entries = NULL;
+
+        static bool before(const entry_t & a, const entry_t & b)
+        {
+            return a.tx < b.tx || (a.tx == b.tx && a.ty < b.ty);
+        }
+
+        int64_t find(int32_t tx, int32_t ty)
+        {
+            entry_t target = {tx, ty};
+
+            uint64_t lo = 0;
+            uint64_t hi = _header.tileCount;
+
+            while (lo < hi) {
+                uint64_t mid = (lo + hi) / 2;
+                if (before(_entries[mid], target)) {
+                    lo = mid + 1;
+                }
+                else {
+                    hi = mid;
+                }
+            }
+
+            return lo < _header.tileCount && !before(target, _entries[lo]) ? (int64_t)lo : -1;
+        }
+
+    public:
+
+        /**
+         * Opens a heightfield file, reporting errors on stderr.
+         * @return true on success, false otherwise
+         */
+        bool open(const char * filename)
+        {
+            close();
+
+            _fp = fopen(filename, "rb");
+
+            if (!_fp) {
+                return false;
+            }
+
+            if (fread(&_header, sizeof(_header), 1, _fp) != 1 ||
+                    memcmp(_header.magic, magic(), 8) ||
+                    _header.version != VERSION ||
+                    _header.tileCells != Heightfield::TILE_CELLS ||
+                    !(_header.spacing > 0)) {
+                fprintf(stderr, "%s is not a version %u heightfield file with %u-cell tiles\n",
+                        filename, VERSION, Heightfield::TILE_CELLS);
+                close();
+                return false;
+            }
+
+            _entries = new entry_t[_header.tileCount];
+
+            if (fread(_entries, sizeof(entry_t), _header.tileCount, _fp) != _header.tileCount) {
+                fprintf(stderr, "%s is truncated\n", filename);
+                close();
+                return false;
+            }
+
+            return true;
+        }
+
+        void close(void)
+        {
+            if (_fp) {
+                fclose(_fp);
+                _fp = NULL;
+            }
+
+            delete[] _entries;
+            _entries = NULL;
+
+            _header.tileCount = 0;
+        }
+
+        // Sample spacing of the file, for constructing a matching Heightfield
+        double getSpacing(void)
+        {
+            return _header.spacing;
+        }
+
+        virtual bool getTile(int32_t tx, int32_t ty, double spacing, uint32_t cells, float * heights) override
+        {
+            if (!_fp || spacing != _header.spacing || cells != _header.tileCells) {
+                return false;
+            }
+
+            int64_t index = find(tx, ty);
+
+            if (index < 0) {
+                return false;
+            }
+
+            long offset = (long)(sizeof(header_t) + _header.tileCount*sizeof(entry_t) + index*Heightfield::TILE_SAMPLES*sizeof(float));
+
+            return !fseek(_fp, offset, SEEK_SET) && fread(heights, sizeof(float), Heightfield::TILE_SAMPLES, _fp) == Heightfield::TILE_SAMPLES;
+        }
+
+        /**
+         * Samples a rectangle of tiles from a source and writes them to a file.
+         * @param filename output file
+         * @param source where tiles come from, e.g. line traces
+         * @param spacing meters between samples
+         * @param tx0, ty0, tx1, ty1 first and last tile indices, inclusive
+         * @return number of tiles written, or -1 if the file could not be written
+         */
+        static int64_t save(const char * filename, HeightfieldSource * source, double spacing,
+                int32_t tx0, int32_t ty0, int32_t tx1, int32_t ty1)
+        {
+            FILE * fp = fopen(filename, "wb");
+
+            if (!fp) {
+                return -1;
+            }
+
+            header_t header = {};
+            memcpy(header.magic, magic(), 8);
+            header.version = VERSION;
+            header.tileCells = Heightfield::TILE_CELLS;
+            header.spacing = spacing;
+
+            // Tiles are gathered first, since the index must precede them and the source may skip some
+            uint64_t maxTiles = (uint64_t)(tx1-tx0+1) * (uint64_t)(ty1-ty0+1);
+            entry_t * entries = new entry_t[maxTiles];
+            float * heights = new float[maxTiles * Heightfield::TILE_SAMPLES];
+
+            for (int32_t tx=tx0; tx<=tx1; ++tx) {
+                for (int32_t ty=ty0; ty<=ty1; ++ty) {
+                    if (source->getTile(tx, ty, spacing, Heightfield::TILE_CELLS, &heights[header.tileCount*Heightfield::TILE_SAMPLES])) {
+                        entry_t entry = {tx, ty};
+                        entries[header.tileCount++] = entry;
+                    }
+                }
+            }
+
+            bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                fwrite(entries, sizeof(entry_t), header.tileCount, fp) == header.tileCount &&
+                fwrite(heights, sizeof(float)*Heightfield::TILE_SAMPLES, header.tileCount, fp) == header.tileCount;
+
+            ok = !fclose(fp) && ok;
+
+            delete[] entries;
+            delete[] heights;
+
+            return ok ? (int64_t)header.tileCount : -1;
+        }
+
+        ~HeightfieldFile(void)
+        {
+            close();
+        }
+
+}; // class HeightfieldFile
@@ -0,0 +1,54 @@
+/*
+ * Abstract image source for MulticopterSim cameras
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+class ImageSource {
+
+    public:
+
+        /**
+         * Copies the current image into a byte array.
+         * @param bytes RGBA pixels, rows*cols*4 bytes (output)
+         * @return true if an image was available, false otherwise
+         */
+        virtual bool read(uint8_t * bytes, uint16_t rows, uint16_t cols) = 0;
+
+        virtual ~ImageSource(void) { }
+
+}; // class ImageSource
+
+// Diagonal red stripe that moves one column per frame; useful for testing without a renderer
+class SyntheticImageSource : public ImageSource {
+
+    private:
+
+        uint32_t _frame = 0;
+
+    public:
+
+        virtual bool read(uint8_t * bytes, uint16_t rows, uint16_t cols) override
+        {
+            memset(bytes, 0, rows*cols*4);
+
+            for (uint16_t j=0; j<rows; ++j) {
+                uint16_t k = ((uint32_t)j * cols / rows + _frame) % cols;
+                uint8_t * pixel = &bytes[(j*cols+k)*4];
+                pixel[0] = 255; // red
+                pixel[3] = 255; // alpha
+            }
+
+            _frame++;
+
+            return true;
+        }
+
+}; // class SyntheticImageSource
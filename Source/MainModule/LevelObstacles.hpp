@@ -0,0 +1,205 @@
+/*
+ * Extracts static collision geometry from a UE4 level into an Obstacles map
+ *
+ * Simple collision (boxes and convex hulls) is used where a mesh has it.
+ * Otherwise the mesh's own triangles are read from its coarsest render LOD,
+ * which a cooked build keeps in CPU memory only for meshes marked Allow CPU
+ * Access; other meshes fall back to their world-space bounding box.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "Utils.hpp"
+#include "Obstacles.hpp"
+
+#include "PhysicsEngine/BodySetup.h"
+
+#include <vector>
+
+class LevelObstacles {
+
+    private:
+
+        // Scratch geometry for one component, in world meters; reused to avoid reallocating
+        std::vector<float>    _vertices;
+        std::vector<uint32_t> _indices;
+
+        void addVertex(const FVector & v)
+        {
+            // cm => m
+            _vertices.push_back(v.X / 100);
+            _vertices.push_back(v.Y / 100);
+            _vertices.push_back(v.Z / 100);
+        }
+
+        void addTriangle(uint32_t base, uint32_t a, uint32_t b, uint32_t c)
+        {
+            _indices.push_back(base + a);
+            _indices.push_back(base + b);
+            _indices.push_back(base + c);
+        }
+
+        // Corner k is at the max along X, Y, Z where bits 4, 2, 1 of k are set
+        void addBoxCorners(const FVector corners[8])
+        {
+            static const uint32_t faces[12][3] = {
+                {0,1,3}, {0,3,2}, {4,6,7}, {4,7,5}, {0,4,5}, {0,5,1},
+                {2,3,7}, {2,7,6}, {0,2,6}, {0,6,4}, {1,5,7}, {1,7,3}
+            };
+
+            uint32_t base = (uint32_t)(_vertices.size() / 3);
+
+            for (uint8_t k=0; k<8; ++k) {
+                addVertex(corners[k]);
+            }
+
+            for (uint8_t k=0; k<12; ++k) {
+                addTriangle(base, faces[k][0], faces[k][1], faces[k][2]);
+            }
+        }
+
+        void addBox(const FKBoxElem & box, const FTransform & transform)
+        {
+            FTransform boxTransform = box.GetTransform() * transform;
+
+            FVector corners[8];
+
+            for (uint8_t k=0; k<8; ++k) {
+                FVector corner((k&4 ? .5f : -.5f) * box.X, (k&2 ? .5f : -.5f) * box.Y, (k&1 ? .5f : -.5f) * box.Z);
+                corners[k] = boxTransform.TransformPosition(corner);
+            }
+
+            addBoxCorners(corners);
+        }
+
+        // Axis-aligned world-space bounds, for meshes whose triangles can't be read
+        void addBounds(UStaticMeshComponent * component)
+        {
+            FBox box = component->Bounds.GetBox();
+
+            FVector corners[8];
+
+            for (uint8_t k=0; k<8; ++k) {
+                corners[k] = FVector(k&4 ? box.Max.X : box.Min.X, k&2 ? box.Max.Y : box.Min.Y, k&1 ? box.Max.Z : box.Min.Z);
+            }
+
+            addBoxCorners(corners);
+        }
+
+        void addConvex(const FKConvexElem & convex, const FTransform & transform)
+        {
+            FTransform convexTransform = convex.GetTransform() * transform;
+
+            uint32_t base = (uint32_t)(_vertices.size() / 3);
+
+            for (const FVector & v : convex.VertexData) {
+                addVertex(convexTransform.TransformPosition(v));
+            }
+
+            for (int32 k=0; k+2<convex.IndexData.Num(); k+=3) {
+                addTriangle(base, convex.IndexData[k], convex.IndexData[k+1], convex.IndexData[k+2]);
+            }
+        }
+
+        // Coarsest render LOD, for meshes that collide with their own triangles; false if it's not in CPU memory
+        bool addRenderMesh(UStaticMesh * mesh, const FTransform & transform)
+        {
+            if (!mesh->RenderData || mesh->RenderData->LODResources.Num() == 0) {
+                return false;
+            }
+
+            // Cooked builds drop the CPU copy of render data once it is on the GPU, unless asked not to
+            if (FPlatformProperties::RequiresCookedData() && !mesh->bAllowCPUAccess) {
+                return false;
+            }
+
+            const FStaticMeshLODResources & lod = mesh->RenderData->LODResources.Last();
+
+            const FPositionVertexBuffer & positions = lod.VertexBuffers.PositionVertexBuffer;
+
+            if (!positions.GetVertexData() || positions.GetNumVertices() == 0 || lod.IndexBuffer.GetNumIndices() == 0) {
+                return false;
+            }
+
+            uint32_t base = (uint32_t)(_vertices.size() / 3);
+
+            for (uint32 k=0; k<positions.GetNumVertices(); ++k) {
+                addVertex(transform.TransformPosition(positions.VertexPosition(k)));
+            }
+
+            for (int32 k=0; k+2<lod.IndexBuffer.GetNumIndices(); k+=3) {
+                addTriangle(base, lod.IndexBuffer.GetIndex(k), lod.IndexBuffer.GetIndex(k+1), lod.IndexBuffer.GetIndex(k+2));
+            }
+
+            return true;
+        }
+
+        void addComponent(UStaticMeshComponent * component)
+        {
+            UStaticMesh * mesh = component->GetStaticMesh();
+
+            FTransform transform = component->GetComponentTransform();
+
+            UBodySetup * body = mesh->GetBodySetup();
+
+            // Spheres and capsules in simple collision are not extracted
+            if (body && body->CollisionTraceFlag != CTF_UseComplexAsSimple &&
+                    (body->AggGeom.BoxElems.Num() > 0 || body->AggGeom.ConvexElems.Num() > 0)) {
+
+                for (const FKBoxElem & box : body->AggGeom.BoxElems) {
+                    addBox(box, transform);
+                }
+
+                for (const FKConvexElem & convex : body->AggGeom.ConvexElems) {
+                    addConvex(convex, transform);
+                }
+            }
+
+            else if (!addRenderMesh(mesh, transform)) {
+                addBounds(component);
+            }
+        }
+
+    public:
+
+        /**
+         * Adds the collision geometry of every static, colliding static-mesh
+         * component in a world to a builder, one mesh per component.  Pawns
+         * are skipped.  Call from the game thread between begin() and finish().
+         */
+        void scan(UWorld * world, ObstacleBuilder & builder)
+        {
+            for (TActorIterator<AActor> actorItr(world); actorItr; ++actorItr) {
+
+                AActor * actor = *actorItr;
+
+                if (actor->IsA(APawn::StaticClass())) {
+                    continue;
+                }
+
+                TInlineComponentArray<UStaticMeshComponent *> components;
+                actor->GetComponents(components);
+
+                for (UStaticMeshComponent * component : components) {
+
+                    if (component->Mobility != EComponentMobility::Static ||
+                            component->GetCollisionEnabled() == ECollisionEnabled::NoCollision ||
+                            !component->GetStaticMesh()) {
+                        continue;
+                    }
+
+                    _vertices.clear();
+                    _indices.clear();
+
+                    addComponent(component);
+
+                    builder.addMesh(_vertices.data(), (uint32_t)(_vertices.size()/3), _indices.data(), (uint32_t)(_indices.size()/3));
+                }
+            }
+        }
+
+}; // class LevelObstacles
@@ -0,0 +1,265 @@
+/*
+ * Abstract scanning LiDAR class for MulticopterSim
+ *
+ * A head of beams fanned out in elevation (channels) spins about the
+ * vehicle's vertical axis, firing each channel at a fixed set of azimuths
+ * (columns) per sweep.  Each tick, the LiDAR traces the columns the head has
+ * swept through since the last tick, through the world's asynchronous trace
+ * queue rather than one blocking trace at a time, so thousands of rays per
+ * sweep cost the game thread little more than queueing them.  The results
+ * are read on the next tick, into a packet allocated once up front, which
+ * goes to processPacket(): a header_t, then one 16-bit range per beam,
+ * column by column.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "Engine/World.h"
+#include "GameFramework/Pawn.h"
+
+#include "Utils.hpp"
+#include "Trace.hpp"
+
+class Lidar {
+
+    friend class Vehicle;
+
+    public:
+
+        // LiDARs per vehicle
+        static const uint8_t MAX_LIDARS = 4;
+
+        // Meters per count of a range; zero means no return
+        static constexpr float RANGE_UNIT = 0.01;
+
+        // Starts each packet; beam b is channel b % channels of column b / channels
+        typedef struct {
+
+            uint32_t sweep;       // counting from zero
+            uint32_t firstBeam;
+            uint32_t beamCount;   // ranges that follow
+            uint16_t channels;
+            uint16_t columns;     // per sweep
+
+        } header_t;
+
+    private:
+
+        uint16_t _channels = 0;
+        uint16_t _columns = 0;
+
+        float _sweepRate = 0;   // Hz
+        float _maxRange = 0;    // meters
+
+        // Position w.r.t. vehicle, meters
+        float _x = 0;
+        float _y = 0;
+        float _z = 0;
+
+        // Allocated in constructor: unit vector of each beam in the vehicle frame, a
+        // trace handle for each beam, and a packet big enough for a whole sweep
+        FVector      * _directions = NULL;
+        FTraceHandle * _handles = NULL;
+        uint8_t      * _packet = NULL;
+
+        // Set in Vehicle::addLidar()
+        APawn * _pawn = NULL;
+        FCollisionQueryParams _traceParams;
+
+        // Reused for each result
+        FTraceDatum _datum;
+
+        // Columns queued on the last tick, whose results come in on this one
+        uint32_t _batchSweep = 0;
+        uint16_t _batchFirst = 0;
+        uint16_t _batchCount = 0;
+
+        // Where the head is in its sweep
+        uint32_t _sweep = 0;
+        uint16_t _nextColumn = 0;
+        double   _columnsDue = 0;
+        float    _previousTime = -1;
+
+        void collect(UWorld * world)
+        {
+            uint32_t beamCount = (uint32_t)_batchCount * _channels;
+
+            uint16_t * ranges = (uint16_t *)(_packet + sizeof(header_t));
+
+            for (uint32_t k=0; k<beamCount; ++k) {
+
+                uint16_t range = 0;
+
+                if (world->QueryTraceData(_handles[k], _datum) && _datum.OutHits.Num() > 0 && _datum.OutHits[0].bBlockingHit) {
+                    float counts = _datum.OutHits[0].Distance / 100 / RANGE_UNIT + 0.5f; // cm => counts
+                    range = counts < 1 ? 1 : counts > 65535 ? 65535 : (uint16_t)counts;
+                }
+
+                ranges[k] = range;
+            }
+
+            header_t header = {};
+            header.sweep = _batchSweep;
+            header.firstBeam = (uint32_t)_batchFirst * _channels;
+            header.beamCount = beamCount;
+            header.channels = _channels;
+            header.columns = _columns;
+            memcpy(_packet, &header, sizeof(header));
+
+            processPacket(_packet, sizeof(header) + beamCount*sizeof(uint16_t));
+
+            _batchCount = 0;
+        }
+
+        void submit(UWorld * world, uint16_t count)
+        {
+            FVector origin = _pawn->GetActorLocation();
+            FQuat rotation = _pawn->GetActorQuat();
+
+            origin += rotation.RotateVector(100 * FVector(_x, _y, _z)); // m => cm
+
+            float reach = 100 * _maxRange; // m => cm
+
+            uint32_t firstBeam = (uint32_t)_nextColumn * _channels;
+            uint32_t beamCount = (uint32_t)count * _channels;
+
+            for (uint32_t k=0; k<beamCount; ++k) {
+                FVector end = origin + reach * rotation.RotateVector(_directions[firstBeam+k]);
+                _handles[k] = world->AsyncLineTraceByChannel(EAsyncTraceType::Single, origin, end, ECC_Visibility, _traceParams);
+            }
+
+            _batchSweep = _sweep;
+            _batchFirst = _nextColumn;
+            _batchCount = count;
+
+            _nextColumn += count;
+
+            if (_nextColumn == _columns) {
+                _nextColumn = 0;
+                _sweep++;
+            }
+        }
+
+    protected:
+
+        /**
+         * @param channels beams in the fan
+         * @param columns firings of the fan per sweep, evenly spaced in azimuth
+         * @param minElevation lowest beam, degrees above horizontal
+         * @param maxElevation highest beam, degrees above horizontal
+         * @param sweepRate sweeps per second
+         * @param maxRange meters; at most 65535 * RANGE_UNIT
+         */
+        Lidar(uint16_t channels, uint16_t columns, float minElevation, float maxElevation, float sweepRate, float maxRange,
+                float x=0, float y=0, float z=0)
+        {
+            _channels = channels;
+            _columns = columns;
+            _sweepRate = sweepRate;
+            _maxRange = maxRange;
+
+            _x = x;
+            _y = y;
+            _z = z;
+
+            uint32_t beams = (uint32_t)channels * columns;
+
+            _directions = new FVector [beams];
+            _handles = new FTraceHandle [beams];
+            _packet = new uint8_t [sizeof(header_t) + beams*sizeof(uint16_t)]();
+
+            for (uint16_t c=0; c<columns; ++c) {
+
+                float azimuth = 2 * M_PI * c / columns;
+
+                for (uint16_t k=0; k<channels; ++k) {
+
+                    float elevation = channels > 1 ?
+                        minElevation + (maxElevation - minElevation) * k / (channels - 1) : minElevation;
+                    elevation *= M_PI / 180;
+
+                    // X forward, Y right, Z up; azimuth clockwise from forward seen from above
+                    _directions[c*channels+k] = FVector(cos(elevation)*cos(azimuth), cos(elevation)*sin(azimuth), sin(elevation));
+                }
+            }
+        }
+
+        // Called by Vehicle::addLidar()
+        void addToVehicle(APawn * pawn)
+        {
+            _pawn = pawn;
+
+            // Don't hit the vehicle itself
+            _traceParams = FCollisionQueryParams(FName(TEXT("Lidar Trace")), false, pawn);
+        }
+
+        // Called by Vehicle::EndPlay(): drops the columns in flight and stops scanning
+        void removeFromVehicle(void)
+        {
+            _pawn = NULL;
+            _batchCount = 0;
+            _previousTime = -1;
+        }
+
+        // Override this method to send or store the points
+        virtual void processPacket(const uint8_t * bytes, uint32_t size) { (void)bytes; (void)size; }
+
+    public:
+
+        // Called on main thread each tick
+        void scan(void)
+        {
+            TRACE_SCOPE("Lidar::scan");
+
+            if (!_pawn) {
+                return;
+            }
+
+            UWorld * world = _pawn->GetWorld();
+
+            if (_batchCount) {
+                collect(world);
+            }
+
+            float time = world->GetTimeSeconds();
+
+            if (_previousTime >= 0) {
+                _columnsDue += (time - _previousTime) * _sweepRate * _columns;
+            }
+
+            _previousTime = time;
+
+            // A stalled frame can't be traced after the fact, so skip any backlog past a sweep
+            if (_columnsDue > _columns) {
+                _columnsDue = _columns;
+            }
+
+            // One batch a tick, ending at the end of the sweep; the rest follow next tick
+            uint16_t count = (uint16_t)_columnsDue;
+
+            if (count > _columns - _nextColumn) {
+                count = _columns - _nextColumn;
+            }
+
+            if (count > 0) {
+                submit(world, count);
+                _columnsDue -= count;
+            }
+        }
+
+        virtual ~Lidar()
+        {
+            delete[] _directions;
+            delete[] _handles;
+            delete[] _packet;
+        }
+
+}; // class Lidar
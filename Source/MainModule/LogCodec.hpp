@@ -0,0 +1,718 @@
+/*
+ * Header-only compressed encoding for flight-recorder logs
+ *
+ * Each numeric channel of a FlightRecorder record is either quantized to a
+ * configured precision and delta-encoded, or (with precision zero) kept
+ * lossless by XOR-ing its bits with the previous sample's.  Smooth channels
+ * use second-order deltas (residual from linear extrapolation), noisy ones
+ * first-order.  Both leave small integers, which are zigzag/varint packed.
+ * Predictors are kept per vehicle and reset at every block, so decoding can
+ * start at any block boundary.  The decoder checks every read against the
+ * end of its block, and rejects motor counts and vehicle IDs out of range,
+ * so a corrupt or hostile log ends the read rather than the reader.
+ * Blocks can additionally be zstd-compressed by defining MULTICOPTERSIM_ZSTD
+ * and linking with libzstd; readers without zstd still read uncompressed
+ * blocks.
+ *
+ * File layout (little-endian):
+ *
+ *   header_t                       magic, version, block size, channel precisions and orders
+ *   block_header_t, payload        repeated; payload is storedSize bytes
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#ifdef MULTICOPTERSIM_ZSTD
+#include <zstd.h>
+#endif
+
+#include "FlightRecorder.hpp"
+
+class LogCodec {
+
+    public:
+
+        // time, x[12], u[4], agl, motors[16]
+        static const uint8_t CHANNEL_COUNT = 1 + 12 + 4 + 1 + FlightRecorder::MAX_MOTORS;
+
+        static const uint8_t CHANNEL_TIME   = 0;
+        static const uint8_t CHANNEL_X      = 1;
+        static const uint8_t CHANNEL_U      = 13;
+        static const uint8_t CHANNEL_AGL    = 17;
+        static const uint8_t CHANNEL_MOTORS = 18;
+
+        static const uint32_t VERSION = 1;
+
+        static const uint32_t DEFAULT_BLOCK_RECORDS = 4096;
+
+        static const uint32_t BLOCK_SYNC = 0x4b4c424d; // "MBLK"
+
+        // Vehicle IDs from zero up to this, exclusive; predictors take 544 bytes per ID below the highest seen
+        static const uint32_t MAX_VEHICLES = 1<<16;
+
+        typedef enum {
+
+            COMPRESSION_NONE,
+            COMPRESSION_ZSTD
+
+        } compression_t;
+
+        // Precision of each channel (zero means lossless) and delta order (1 or 2) of quantized channels
+        typedef struct {
+
+            double  quantum[CHANNEL_COUNT];
+            uint8_t order[CHANNEL_COUNT];
+
+        } config_t;
+
+        typedef struct {
+
+            char     magic[8];
+            uint32_t version;
+            uint32_t channelCount;
+            uint32_t blockRecords;
+            uint32_t reserved;
+            double   quantum[CHANNEL_COUNT];
+            uint8_t  order[CHANNEL_COUNT];
+
+        } header_t;
+
+        typedef struct {
+
+            uint32_t sync;          // BLOCK_SYNC
+            uint8_t  compression;   // compression_t
+            uint8_t  reserved[3];
+            uint32_t recordCount;
+            uint32_t rawSize;       // bytes of varint data
+            uint32_t storedSize;    // bytes of payload following this header
+            uint32_t reserved2;
+            double   startTime;     // of first and last record in block
+            double   endTime;
+
+        } block_header_t;
+
+        // Identifies the file type; eight bytes including the terminating zero
+        static const char * magic(void)
+        {
+            return "MSIMLOG";
+        }
+
+        /**
+         * Default precisions: 100 ns for time, 1 um / 1 urad for state,
+         * 1e-4 for thrust and torques, 0.1 mm for AGL, 1e-5 for motors.
+         * Motor values, and the thrust and torques computed from them, are
+         * typically noisy, so they get first-order deltas.
+         */
+        static config_t defaultConfig(void)
+        {
+            config_t config = {};
+
+            setQuantum(config, "time",   1e-7);
+            setQuantum(config, "x",      1e-6);
+            setQuantum(config, "u",      1e-4);
+            setQuantum(config, "agl",    1e-4);
+            setQuantum(config, "motors", 1e-5);
+
+            for (uint8_t k=0; k<CHANNEL_COUNT; ++k) {
+                config.order[k] = k < CHANNEL_U || k == CHANNEL_AGL ? 2 : 1;
+            }
+
+            return config;
+        }
+
+        /**
+         * Sets precision for a group of channels.
+         * @param config configuration to modify
+         * @param group time, x, u, agl, or motors
+         * @param quantum precision; zero for lossless
+         * @return true on success, false on unknown group
+         */
+        static bool setQuantum(config_t & config, const char * group, double quantum)
+        {
+            uint8_t first = 0, count = 0;
+
+            if (!groupChannels(group, first, count)) {
+                return false;
+            }
+
+            for (uint8_t k=first; k<first+count; ++k) {
+                config.quantum[k] = quantum;
+            }
+
+            return true;
+        }
+
+        // Sets delta order (1 or 2) for a group of channels
+        static bool setOrder(config_t & config, const char * group, uint8_t order)
+        {
+            uint8_t first = 0, count = 0;
+
+            if (order < 1 || order > 2 || !groupChannels(group, first, count)) {
+                return false;
+            }
+
+            for (uint8_t k=first; k<first+count; ++k) {
+                config.order[k] = order;
+            }
+
+            return true;
+        }
+
+        static bool groupChannels(const char * group, uint8_t & first, uint8_t & count)
+        {
+            if (!strcmp(group, "time")) {
+                first = CHANNEL_TIME; count = 1;
+            }
+            else if (!strcmp(group, "x")) {
+                first = CHANNEL_X; count = 12;
+            }
+            else if (!strcmp(group, "u")) {
+                first = CHANNEL_U; count = 4;
+            }
+            else if (!strcmp(group, "agl")) {
+                first = CHANNEL_AGL; count = 1;
+            }
+            else if (!strcmp(group, "motors")) {
+                first = CHANNEL_MOTORS; count = FlightRecorder::MAX_MOTORS;
+            }
+            else {
+                return false;
+            }
+
+            return true;
+        }
+
+        static void putVarint(uint8_t * & p, uint64_t value)
+        {
+            while (value >= 0x80) {
+                *p++ = (uint8_t)(value | 0x80);
+                value >>= 7;
+            }
+            *p++ = (uint8_t)value;
+        }
+
+        /**
+         * Reads a varint.
+         * @param p input pointer, advanced past the varint
+         * @param end end of input
+         * @param value output
+         * @return false if the varint runs past end or past 64 bits
+         */
+        static bool getVarint(const uint8_t * & p, const uint8_t * end, uint64_t & value)
+        {
+            if (p == end) {
+                return false;
+            }
+
+            value = *p++;
+
+            if (value < 0x80) {
+                return true;
+            }
+
+            value &= 0x7f;
+
+            for (uint8_t shift=7; shift<64; shift+=7) {
+                if (p == end) {
+                    return false;
+                }
+                uint64_t b = *p++;
+                value |= (b & 0x7f) << shift;
+                if (b < 0x80) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        static uint64_t zigzag(int64_t value)
+        {
+            return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+        }
+
+        static int64_t unzigzag(uint64_t value)
+        {
+            return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+        }
+
+        static uint64_t bits(double value)
+        {
+            uint64_t b = 0;
+            memcpy(&b, &value, 8);
+            return b;
+        }
+
+        static double fromBits(uint64_t b)
+        {
+            double value = 0;
+            memcpy(&value, &b, 8);
+            return value;
+        }
+
+        // Worst-case varint bytes per record
+        static const uint32_t MAX_RECORD_BYTES = 10 * (CHANNEL_COUNT + 2);
+
+        // Per-vehicle predictor: previous two quantized values, or previous bits for lossless channels
+        class Predictor {
+
+            private:
+
+                std::vector<uint64_t> _previous;
+
+            public:
+
+                // Returns previous values for each channel, as pairs (newest first); vehicle must be below MAX_VEHICLES
+                uint64_t * get(uint32_t vehicle)
+                {
+                    if ((vehicle+1) * 2 * CHANNEL_COUNT > _previous.size()) {
+                        _previous.resize((vehicle+1) * 2 * CHANNEL_COUNT, 0);
+                    }
+                    return &_previous[vehicle * 2 * CHANNEL_COUNT];
+                }
+
+                void reset(void)
+                {
+                    std::fill(_previous.begin(), _previous.end(), 0);
+                }
+
+        }; // class Predictor
+
+        // Wraparound arithmetic, so encoder and decoder agree even on overflow
+        static int64_t predict(uint8_t order, const uint64_t * prev)
+        {
+            return (int64_t)(order == 2 ? 2*prev[0] - prev[1] : prev[0]);
+        }
+
+        /**
+         * Varint-encodes one record.
+         * @param p output pointer, advanced past the encoded bytes (at most MAX_RECORD_BYTES)
+         * @return false, writing nothing, if the record's vehicle ID or motor count is out of range
+         */
+        static bool encodeRecord(const config_t & config, const double * scale, Predictor & predictor,
+                const FlightRecorder::record_t & r, uint8_t * & p)
+        {
+            if (r.vehicle >= MAX_VEHICLES || r.motorCount > FlightRecorder::MAX_MOTORS) {
+                return false;
+            }
+
+            putVarint(p, r.vehicle);
+            putVarint(p, (uint64_t)r.motorCount | ((uint64_t)r.airborne << 5));
+
+            uint64_t * previous = predictor.get(r.vehicle);
+
+            double values[CHANNEL_COUNT];
+            values[CHANNEL_TIME] = r.time;
+            memcpy(&values[CHANNEL_X], r.x, sizeof(r.x));
+            memcpy(&values[CHANNEL_U], r.u, sizeof(r.u));
+            values[CHANNEL_AGL] = r.agl;
+            for (uint8_t k=0; k<r.motorCount; ++k) {
+                values[CHANNEL_MOTORS+k] = r.motors[k];
+            }
+
+            uint8_t count = CHANNEL_MOTORS + r.motorCount;
+
+            for (uint8_t k=0; k<count; ++k) {
+
+                uint64_t * prev = &previous[2*k];
+
+                if (config.quantum[k] > 0) {
+                    int64_t q = llround(values[k] * scale[k]);
+                    putVarint(p, zigzag(q - predict(config.order[k], prev)));
+                    prev[1] = prev[0];
+                    prev[0] = (uint64_t)q;
+                }
+                else {
+                    uint64_t b = bits(values[k]);
+                    putVarint(p, b ^ prev[0]);
+                    prev[0] = b;
+                }
+            }
+
+            return true;
+        }
+
+        /**
+         * Decodes one record.
+         * @param p input pointer, advanced past the encoded bytes
+         * @param end end of the block's encoded bytes
+         * @return false if the record is truncated or out of range
+         */
+        static bool decodeRecord(const config_t & config, Predictor & predictor,
+                const uint8_t * & p, const uint8_t * end, FlightRecorder::record_t & r)
+        {
+            uint64_t vehicle = 0, flags = 0;
+
+            if (!getVarint(p, end, vehicle) || vehicle >= MAX_VEHICLES || !getVarint(p, end, flags) ||
+                    (flags & 0x1f) > FlightRecorder::MAX_MOTORS) {
+                return false;
+            }
+
+            r.vehicle = (uint32_t)vehicle;
+            r.motorCount = (uint8_t)(flags & 0x1f);
+            r.airborne = (uint8_t)(flags >> 5);
+            r.reserved[0] = r.reserved[1] = 0;
+
+            uint64_t * previous = predictor.get(r.vehicle);
+
+            double values[CHANNEL_COUNT];
+
+            uint8_t count = CHANNEL_MOTORS + r.motorCount;
+
+            for (uint8_t k=0; k<count; ++k) {
+
+                uint64_t v = 0;
+
+                if (!getVarint(p, end, v)) {
+                    return false;
+                }
+
+                uint64_t * prev = &previous[2*k];
+
+                if (config.quantum[k] > 0) {
+                    int64_t q = predict(config.order[k], prev) + unzigzag(v);
+                    prev[1] = prev[0];
+                    prev[0] = (uint64_t)q;
+                    values[k] = q * config.quantum[k];
+                }
+                else {
+                    uint64_t b = v ^ prev[0];
+                    prev[0] = b;
+                    values[k] = fromBits(b);
+                }
+            }
+
+            r.time = values[CHANNEL_TIME];
+            memcpy(r.x, &values[CHANNEL_X], sizeof(r.x));
+            memcpy(r.u, &values[CHANNEL_U], sizeof(r.u));
+            r.agl = values[CHANNEL_AGL];
+            for (uint8_t k=0; k<FlightRecorder::MAX_MOTORS; ++k) {
+                r.motors[k] = k < r.motorCount ? (float)values[CHANNEL_MOTORS+k] : 0;
+            }
+
+            return true;
+        }
+
+}; // class LogCodec
+
+class LogEncoder {
+
+    private:
+
+        FILE * _fp = NULL;
+
+        LogCodec::config_t _config = {};
+
+        double _scale[LogCodec::CHANNEL_COUNT] = {};
+
+        uint32_t _blockRecords = 0;
+
+        int _compressionLevel = 0;
+
+        LogCodec::Predictor _predictor;
+
+        std::vector<uint8_t> _raw;
+        std::vector<uint8_t> _stored;
+
+        uint8_t * _end = NULL;
+
+        LogCodec::block_header_t _block = {};
+
+        uint64_t _rawBytes = 0;
+        uint64_t _storedBytes = 0;
+
+        void flushBlock(void)
+        {
+            if (_block.recordCount == 0) {
+                return;
+            }
+
+            _block.sync = LogCodec::BLOCK_SYNC;
+            _block.rawSize = (uint32_t)(_end - &_raw[0]);
+
+            const uint8_t * payload = &_raw[0];
+            _block.compression = LogCodec::COMPRESSION_NONE;
+            _block.storedSize = _block.rawSize;
+
+#ifdef MULTICOPTERSIM_ZSTD
+            if (_compressionLevel > 0) {
+                size_t size = ZSTD_compress(&_stored[0], _stored.size(), &_raw[0], _block.rawSize, _compressionLevel);
+                if (!ZSTD_isError(size) && size < _block.rawSize) {
+                    payload = &_stored[0];
+                    _block.compression = LogCodec::COMPRESSION_ZSTD;
+                    _block.storedSize = (uint32_t)size;
+                }
+            }
+#endif
+
+            fwrite(&_block, sizeof(_block), 1, _fp);
+            fwrite(payload, 1, _block.storedSize, _fp);
+
+            _rawBytes += _block.recordCount * sizeof(FlightRecorder::record_t);
+            _storedBytes += sizeof(_block) + _block.storedSize;
+
+            memset(&_block, 0, sizeof(_block));
+            _end = &_raw[0];
+            _predictor.reset();
+        }
+
+    public:
+
+        /**
+         * Opens a log file for writing.
+         * @param filename output file
+         * @param config channel precisions
+         * @param compressionLevel zstd level, or zero for none; ignored without MULTICOPTERSIM_ZSTD
+         * @param blockRecords records per block
+         * @return true on success, false if file could not be opened
+         */
+        bool open(const char * filename, const LogCodec::config_t & config=LogCodec::defaultConfig(),
+                int compressionLevel=3, uint32_t blockRecords=LogCodec::DEFAULT_BLOCK_RECORDS)
+        {
+            close();
+
+            _fp = fopen(filename, "wb");
+
+            if (!_fp) {
+                return false;
+            }
+
+            _config = config;
+            _blockRecords = blockRecords;
+            _compressionLevel = compressionLevel;
+
+            for (uint8_t k=0; k<LogCodec::CHANNEL_COUNT; ++k) {
+                _scale[k] = config.quantum[k] > 0 ? 1 / config.quantum[k] : 0;
+            }
+
+            _raw.resize(blockRecords * LogCodec::MAX_RECORD_BYTES);
+#ifdef MULTICOPTERSIM_ZSTD
+            _stored.resize(ZSTD_compressBound(_raw.size()));
+#endif
+            _end = &_raw[0];
+
+            memset(&_block, 0, sizeof(_block));
+            _predictor.reset();
+            _rawBytes = 0;
+            _storedBytes = 0;
+
+            LogCodec::header_t header = {};
+            memcpy(header.magic, LogCodec::magic(), 8);
+            header.version = LogCodec::VERSION;
+            header.channelCount = LogCodec::CHANNEL_COUNT;
+            header.blockRecords = blockRecords;
+            memcpy(header.quantum, config.quantum, sizeof(header.quantum));
+            memcpy(header.order, config.order, sizeof(header.order));
+
+            fwrite(&header, sizeof(header), 1, _fp);
+
+            return true;
+        }
+
+        // Returns false, skipping the record, if its vehicle ID or motor count is out of range
+        bool write(const FlightRecorder::record_t & record)
+        {
+            if (!LogCodec::encodeRecord(_config, _scale, _predictor, record, _end)) {
+                return false;
+            }
+
+            if (_block.recordCount == 0) {
+                _block.startTime = record.time;
+            }
+
+            _block.endTime = record.time;
+
+            if (++_block.recordCount == _blockRecords) {
+                flushBlock();
+            }
+
+            return true;
+        }
+
+        void close(void)
+        {
+            if (_fp) {
+                flushBlock();
+                fclose(_fp);
+                _fp = NULL;
+            }
+        }
+
+        // Uncompressed (FlightRecorder) size of records written so far, over bytes written for them
+        double getRatio(void)
+        {
+            return _storedBytes ? (double)_rawBytes / _storedBytes : 0;
+        }
+
+        ~LogEncoder(void)
+        {
+            close();
+        }
+
+}; // class LogEncoder
+
+class LogDecoder {
+
+    private:
+
+        LogCodec::config_t _config = {};
+
+        LogCodec::Predictor _predictor;
+
+        std::vector<uint8_t> _raw;
+
+        const uint8_t * _next = NULL;
+        const uint8_t * _end = NULL;
+
+        uint32_t _remaining = 0;
+
+        const uint8_t * _data = NULL;
+        size_t          _size = 0;
+        size_t          _offset = 0;
+
+    public:
+
+        /**
+         * Attaches the decoder to a whole log file in memory (e.g., memory-mapped), reporting errors on stderr.
+         * @return true on success, false if data is not a compatible log
+         */
+        bool open(const uint8_t * data, size_t size)
+        {
+            LogCodec::header_t header = {};
+
+            if (size < sizeof(header)) {
+                fprintf(stderr, "Log is too short\n");
+                return false;
+            }
+
+            memcpy(&header, data, sizeof(header));
+
+            if (memcmp(header.magic, LogCodec::magic(), 8) || header.version != LogCodec::VERSION ||
+                    header.channelCount != LogCodec::CHANNEL_COUNT) {
+                fprintf(stderr, "Not a version %u compressed log\n", LogCodec::VERSION);
+                return false;
+            }
+
+            memcpy(_config.quantum, header.quantum, sizeof(_config.quantum));
+            memcpy(_config.order, header.order, sizeof(_config.order));
+
+            _raw.resize(header.blockRecords * LogCodec::MAX_RECORD_BYTES);
+
+            _data = data;
+            _size = size;
+            _offset = sizeof(header);
+            _remaining = 0;
+
+            return true;
+        }
+
+        // Offset of the first block
+        static size_t firstBlock(void)
+        {
+            return sizeof(LogCodec::header_t);
+        }
+
+        /**
+         * Positions the decoder at a block boundary.
+         * @param offset byte offset of a block header, e.g. from a previous tell() or an index
+         */
+        void seek(size_t offset)
+        {
+            _offset = offset;
+            _remaining = 0;
+        }
+
+        // Offset of the next block to be loaded
+        size_t tell(void)
+        {
+            return _offset;
+        }
+
+        /**
+         * Loads the next block, returning its header; false at end of data or on a bad block.
+         */
+        bool nextBlock(LogCodec::block_header_t & block)
+        {
+            if (_offset + sizeof(block) > _size) {
+                return false;
+            }
+
+            memcpy(&block, _data + _offset, sizeof(block));
+
+            if (block.sync != LogCodec::BLOCK_SYNC || _offset + sizeof(block) + block.storedSize > _size ||
+                    block.rawSize > _raw.size() ||
+                    (block.compression == LogCodec::COMPRESSION_NONE && block.rawSize != block.storedSize)) {
+                return false;
+            }
+
+            const uint8_t * payload = _data + _offset + sizeof(block);
+
+            switch (block.compression) {
+
+                case LogCodec::COMPRESSION_NONE:
+                    _next = payload;
+                    break;
+
+#ifdef MULTICOPTERSIM_ZSTD
+                case LogCodec::COMPRESSION_ZSTD:
+                    if (ZSTD_decompress(&_raw[0], _raw.size(), payload, block.storedSize) != block.rawSize) {
+                        return false;
+                    }
+                    _next = &_raw[0];
+                    break;
+#endif
+
+                default:
+                    fprintf(stderr, "Unsupported block compression %u\n", block.compression);
+                    return false;
+            }
+
+            _end = _next + block.rawSize;
+
+            _offset += sizeof(block) + block.storedSize;
+            _remaining = block.recordCount;
+            _predictor.reset();
+
+            return true;
+        }
+
+        // Decodes the next record, loading blocks as needed; false at end or on a corrupt record
+        bool read(FlightRecorder::record_t & record)
+        {
+            if (_remaining == 0) {
+                LogCodec::block_header_t block = {};
+                do {
+                    if (!nextBlock(block)) {
+                        return false;
+                    }
+                } while (_remaining == 0);
+            }
+
+            if (!LogCodec::decodeRecord(_config, _predictor, _next, _end, record)) {
+                fprintf(stderr, "Corrupt record in block ending at offset %llu\n", (unsigned long long)_offset);
+                _remaining = 0;
+                _offset = _size;
+                return false;
+            }
+
+            _remaining--;
+
+            return true;
+        }
+
+        const LogCodec::config_t & getConfig(void)
+        {
+            return _config;
+        }
+
+}; // class LogDecoder
@@ -0,0 +1,271 @@
+/*
+ * Header-only loop-period statistics for MulticopterSim threads
+ *
+ * Written by a single thread (the loop being measured); readable from any
+ * other thread without locks.  Each field is its own atomic, so a reader
+ * never sees a torn value.  The count is stored with release and read with
+ * acquire ordering, so the sums read after it are at least as recent as the
+ * count; they may already include a later iteration.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+class LoopStats {
+
+    public:
+
+        // Histogram bin k counts periods in [2^k, 2^(k+1)) microseconds; bin 0 also holds sub-microsecond periods
+        static const uint8_t HISTOGRAM_BINS = 20;
+
+        // Default budget of one millisecond, i.e., a 1 kHz loop
+        static constexpr double DEFAULT_BUDGET = 1e-3;
+
+        /**
+         * Plain-data copy of the statistics, for reporting
+         */
+        typedef struct {
+
+            uint64_t count;              // measured periods
+            uint64_t overruns;           // periods over budget
+            double   minPeriod;          // seconds
+            double   maxPeriod;          // seconds
+            double   meanPeriod;         // seconds
+            double   meanJitter;         // mean absolute change in period between iterations, seconds
+            double   longestStallTime;   // loop time at which the longest period ended, seconds
+            uint64_t histogram[HISTOGRAM_BINS];
+
+        } snapshot_t;
+
+    private:
+
+        // Everything is kept in integer nanoseconds so that updates are plain loads and stores
+        std::atomic<uint64_t> _count;
+        std::atomic<uint64_t> _overruns;
+        std::atomic<uint64_t> _minNsec;
+        std::atomic<uint64_t> _maxNsec;
+        std::atomic<uint64_t> _sumNsec;
+        std::atomic<uint64_t> _sumJitterNsec;
+        std::atomic<uint64_t> _jitterCount;     // periods with a previous period to compare against
+        std::atomic<uint64_t> _longestStallTimeNsec;
+        std::atomic<uint64_t> _histogram[HISTOGRAM_BINS];
+
+        std::atomic<uint64_t> _budgetNsec;
+
+        // Writer-only state
+        double   _previousTime = -1;
+        uint64_t _previousNsec = 0;
+        bool     _havePreviousNsec = false;
+
+        static uint64_t load(const std::atomic<uint64_t> & a)
+        {
+            return a.load(std::memory_order_relaxed);
+        }
+
+        static void store(std::atomic<uint64_t> & a, uint64_t value)
+        {
+            a.store(value, std::memory_order_relaxed);
+        }
+
+        // Single writer, so increment does not need a read-modify-write
+        static void increment(std::atomic<uint64_t> & a, uint64_t value=1)
+        {
+            store(a, load(a) + value);
+        }
+
+        static uint8_t bin(uint64_t nsec)
+        {
+            uint64_t usec = nsec >> 10; // close enough to /1000 for binning
+
+            if (usec == 0) {
+                return 0;
+            }
+
+#ifdef _MSC_VER
+            unsigned long k = 0;
+            _BitScanReverse64(&k, usec);
+#else
+            uint8_t k = 63 - __builtin_clzll(usec);
+#endif
+
+            return k < HISTOGRAM_BINS ? (uint8_t)k : HISTOGRAM_BINS - 1;
+        }
+
+        static double seconds(uint64_t nsec)
+        {
+            return nsec / 1e9;
+        }
+
+    public:
+
+        LoopStats(double budget=DEFAULT_BUDGET)
+        {
+            store(_budgetNsec, (uint64_t)(budget * 1e9));
+
+            reset();
+        }
+
+        /**
+         * Sets the per-iteration budget used for counting overruns.
+         * @param budget seconds; zero disables overrun counting
+         */
+        void setBudget(double budget)
+        {
+            store(_budgetNsec, (uint64_t)(budget * 1e9));
+        }
+
+        double getBudget(void) const
+        {
+            return seconds(load(_budgetNsec));
+        }
+
+        /**
+         * Zeroes the statistics.  Should be called from the writer thread,
+         * or before the writer starts.
+         */
+        void reset(void)
+        {
+            store(_count, 0);
+            store(_overruns, 0);
+            store(_minNsec, UINT64_MAX);
+            store(_maxNsec, 0);
+            store(_sumNsec, 0);
+            store(_sumJitterNsec, 0);
+            store(_jitterCount, 0);
+            store(_longestStallTimeNsec, 0);
+
+            for (uint8_t k=0; k<HISTOGRAM_BINS; ++k) {
+                store(_histogram[k], 0);
+            }
+
+            _previousTime = -1;
+            _previousNsec = 0;
+            _havePreviousNsec = false;
+        }
+
+        /**
+         * Forgets the previous iteration, so that a deliberate pause in the
+         * loop is not counted as a period, nor the period before it compared
+         * with the next for jitter.  Call from the writer thread.
+         */
+        void resume(void)
+        {
+            _previousTime = -1;
+            _havePreviousNsec = false;
+        }
+
+        /**
+         * Called once per iteration by the measured thread, with the time at
+         * the start of the iteration.  The first call only sets the reference.
+         *
+         * @param currentTime seconds
+         */
+        void update(double currentTime)
+        {
+            if (_previousTime < 0) {
+                _previousTime = currentTime;
+                return;
+            }
+
+            uint64_t nsec = (uint64_t)((currentTime - _previousTime) * 1e9);
+
+            _previousTime = currentTime;
+
+            if (nsec < load(_minNsec)) {
+                store(_minNsec, nsec);
+            }
+
+            if (nsec > load(_maxNsec)) {
+                store(_maxNsec, nsec);
+                store(_longestStallTimeNsec, (uint64_t)(currentTime * 1e9));
+            }
+
+            uint64_t budget = load(_budgetNsec);
+            if (budget && nsec > budget) {
+                increment(_overruns);
+            }
+
+            if (_havePreviousNsec) {
+                increment(_sumJitterNsec, nsec > _previousNsec ? nsec - _previousNsec : _previousNsec - nsec);
+                increment(_jitterCount);
+            }
+            _previousNsec = nsec;
+            _havePreviousNsec = true;
+
+            increment(_sumNsec, nsec);
+
+            increment(_histogram[bin(nsec)]);
+
+            // Count goes last, released, so a reader that acquires it sees sums at least this recent
+            _count.store(load(_count) + 1, std::memory_order_release);
+        }
+
+        uint64_t getCount(void) const
+        {
+            return _count.load(std::memory_order_acquire);
+        }
+
+        uint64_t getOverruns(void) const
+        {
+            return load(_overruns);
+        }
+
+        double getMinPeriod(void) const
+        {
+            return getCount() ? seconds(load(_minNsec)) : 0;
+        }
+
+        double getMaxPeriod(void) const
+        {
+            return seconds(load(_maxNsec));
+        }
+
+        double getMeanPeriod(void) const
+        {
+            uint64_t count = getCount();
+            return count ? seconds(load(_sumNsec)) / count : 0;
+        }
+
+        double getMeanJitter(void) const
+        {
+            uint64_t count = getCount();
+            uint64_t jitterCount = load(_jitterCount);
+            return count > 1 && jitterCount > 0 ? seconds(load(_sumJitterNsec)) / jitterCount : 0;
+        }
+
+        double getLongestStallTime(void) const
+        {
+            return seconds(load(_longestStallTimeNsec));
+        }
+
+        uint64_t getHistogram(uint8_t k) const
+        {
+            return k < HISTOGRAM_BINS ? load(_histogram[k]) : 0;
+        }
+
+        void snapshot(snapshot_t & s) const
+        {
+            s.count            = getCount();
+            s.overruns         = getOverruns();
+            s.minPeriod        = getMinPeriod();
+            s.maxPeriod        = getMaxPeriod();
+            s.meanPeriod       = getMeanPeriod();
+            s.meanJitter       = getMeanJitter();
+            s.longestStallTime = getLongestStallTime();
+
+            for (uint8_t k=0; k<HISTOGRAM_BINS; ++k) {
+                s.histogram[k] = getHistogram(k);
+            }
+        }
+
+}; // class LoopStats
@@ -3,6 +3,22 @@
 #include "MainModule.h"
 #include "Modules/ModuleManager.h"
 
-IMPLEMENT_PRIMARY_GAME_MODULE( FDefaultGameModuleImpl, MainModule, "MainModule" );
+#include "Trace.hpp"
+#include "FlightRecorder.hpp"
+
+// Closes any trace or recording still open at exit, e.g. when quitting without ending play
+class FMainModule : public FDefaultGameModuleImpl {
+
+    public:
+
+        virtual void ShutdownModule() override
+        {
+            FlightRecorder::stop();
+            Trace::stop();
+        }
+
+}; // class FMainModule
+
+IMPLEMENT_PRIMARY_GAME_MODULE( FMainModule, MainModule, "MainModule" );
 
 DEFINE_LOG_CATEGORY(LogMulticopterSim)
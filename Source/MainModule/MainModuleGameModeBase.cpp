@@ -3,9 +3,15 @@
 
 #include "MainModuleGameModeBase.h"
 
+#include "VehicleAssets.hpp"
+
 AMainModuleGameModeBase::AMainModuleGameModeBase()
 {
 }
 
+void AMainModuleGameModeBase::InitGame(const FString& MapName, const FString& Options, FString& ErrorMessage)
+{
+	VehicleAssets::preloadForMap(Options);
 
-
+	Super::InitGame(MapName, Options, ErrorMessage);
+}
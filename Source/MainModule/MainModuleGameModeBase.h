@@ -16,4 +16,7 @@ class MAINMODULE_API AMainModuleGameModeBase : public AGameModeBase
 	
 public:
 	AMainModuleGameModeBase();
+
+	// Starts streaming in the vehicles the map asks for, before its pawns are spawned
+	virtual void InitGame(const FString& MapName, const FString& Options, FString& ErrorMessage) override;
 };
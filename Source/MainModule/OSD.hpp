@@ -8,6 +8,25 @@
 
 #pragma once
 
+#ifdef MULTICOPTERSIM_NATIVE
+
+// Without a viewport, messages go to the console
+#include <stdio.h>
+
+static void osd(char * buf, bool err=false, bool overwrite=false)
+{
+    (void)overwrite;
+
+    fprintf(err ? stderr : stdout, "%s\n", buf);
+}
+
+static void osdHud(char * buf)
+{
+    (void)buf;
+}
+
+#else
+
 #include "Engine.h"
 
 static float _min(float a, float b)
@@ -33,3 +52,17 @@ static void osd(char * buf, bool err=false, bool overwrite=false)
         GEngine->AddOnScreenDebugMessage(overwrite ? 0 : -1, 5.f, TEXT_COLOR, FString(buf), true, FVector2D(textScale,textScale));
     }
 }
+
+// Compact heads-up display: a single message slot, separate from the one used by osd(..., overwrite=true),
+// that expires if it stops being refreshed
+static void osdHud(char * buf)
+{
+    if (GEngine && GEngine->GameViewport) {
+
+        static const int32 HUD_KEY = 1;
+
+        GEngine->AddOnScreenDebugMessage(HUD_KEY, 0.5f, FColor::Green, FString(buf), false, FVector2D(1,1));
+    }
+}
+
+#endif
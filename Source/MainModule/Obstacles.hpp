@@ -0,0 +1,1025 @@
+/*
+ * Header-only spatial index of static obstacles for MulticopterSim
+ *
+ * A two-level bounding-volume hierarchy over world geometry: one BVH of
+ * triangles per mesh, and one over the meshes.  Meshes are keyed by a hash of
+ * their world-space triangles, so when the map changes, ObstacleBuilder
+ * rebuilds only the meshes that moved or changed and reuses the rest, from
+ * memory or from a cache file.
+ *
+ * A built Obstacles object is immutable.  Its queries (sphere and capsule
+ * overlap, ray distance) are const, use no engine calls, and never allocate,
+ * so the physics thread can run them at any rate while the game thread
+ * publishes a new map.  Readers pin the current map with an Obstacles::Reader,
+ * which records the publication epoch it started in; a replaced map is freed
+ * only once every reader that started before its replacement has finished.
+ *
+ * Coordinates are world meters with Z up.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class Obstacles {
+
+    public:
+
+        typedef struct {
+
+            double point[3];     // closest point on the obstacle
+            double normal[3];    // unit vector from that point toward the query shape's axis
+            double distance;     // from the query shape's surface; negative for penetration
+
+        } contact_t;
+
+        typedef struct {
+
+            float    min[3];
+            float    max[3];
+            uint32_t first;      // leaf: first item; interior: right child (left child follows this node)
+            uint32_t count;      // leaf: number of items; interior: 0
+
+        } node_t;
+
+        // Triangles of one mesh with their BVH; immutable once built
+        class Mesh {
+
+            public:
+
+                static const uint32_t LEAF_SIZE = 4;
+
+                uint64_t key = 0;
+
+                std::vector<float>  triangles;   // nine floats per triangle, in BVH leaf order
+                std::vector<node_t> nodes;
+
+                uint32_t triangleCount(void) const
+                {
+                    return (uint32_t)(triangles.size() / 9);
+                }
+
+                // FNV-1a over the world-space geometry
+                static uint64_t hash(const float * vertices, uint32_t vertexCount, const uint32_t * indices, uint32_t triangleCount)
+                {
+                    uint64_t h = 14695981039346656037ULL;
+
+                    const uint8_t * p = (const uint8_t *)vertices;
+                    for (size_t k=0; k<vertexCount*3*sizeof(float); ++k) {
+                        h = (h ^ p[k]) * 1099511628211ULL;
+                    }
+
+                    p = (const uint8_t *)indices;
+                    for (size_t k=0; k<triangleCount*3*sizeof(uint32_t); ++k) {
+                        h = (h ^ p[k]) * 1099511628211ULL;
+                    }
+
+                    return h;
+                }
+
+                /**
+                 * Checks a BVH read from outside, e.g. a cache file: every leaf's
+                 * triangles in range, and every interior node's right child after
+                 * its left (the node that follows it) and within the tree, so
+                 * traversal stays in bounds and terminates.
+                 */
+                bool valid(void) const
+                {
+                    uint64_t count = triangleCount();
+
+                    if (nodes.empty() || triangles.size() != 9*count) {
+                        return false;
+                    }
+
+                    for (size_t k=0; k<nodes.size(); ++k) {
+
+                        const node_t & node = nodes[k];
+
+                        if (node.count > 0) {
+                            if ((uint64_t)node.first + node.count > count) {
+                                return false;
+                            }
+                        }
+
+                        else if (k+1 >= nodes.size() || node.first <= k+1 || node.first >= nodes.size()) {
+                            return false;
+                        }
+                    }
+
+                    return true;
+                }
+
+                void build(const float * vertices, const uint32_t * indices, uint32_t count)
+                {
+                    std::vector<float> bounds(count*6);
+                    std::vector<uint32_t> order(count);
+
+                    for (uint32_t t=0; t<count; ++t) {
+                        order[t] = t;
+                        float * b = &bounds[t*6];
+                        for (uint8_t a=0; a<3; ++a) {
+                            b[a] = b[3+a] = vertices[3*indices[3*t]+a];
+                            for (uint8_t v=1; v<3; ++v) {
+                                float c = vertices[3*indices[3*t+v]+a];
+                                b[a] = c < b[a] ? c : b[a];
+                                b[3+a] = c > b[3+a] ? c : b[3+a];
+                            }
+                        }
+                    }
+
+                    nodes.clear();
+                    if (count > 0) {
+                        nodes.reserve(2*count/LEAF_SIZE + 1);
+                        buildTree(nodes, bounds.data(), order.data(), 0, count, LEAF_SIZE);
+                    }
+
+                    triangles.resize(count*9);
+                    for (uint32_t t=0; t<count; ++t) {
+                        for (uint8_t v=0; v<3; ++v) {
+                            memcpy(&triangles[9*t+3*v], &vertices[3*indices[3*order[t]+v]], 3*sizeof(float));
+                        }
+                    }
+                }
+
+        }; // class Mesh
+
+        static const uint32_t STACK_SIZE = 64;
+
+    private:
+
+        std::vector<std::shared_ptr<const Mesh>> _meshes;  // in top-level leaf order
+
+        std::vector<node_t> _top;
+
+        uint64_t _triangleCount = 0;
+
+        // One per thread that has read a map
+        typedef struct {
+
+            std::atomic<uint64_t> epoch;   // publication epoch when its outermost Reader began; zero when not reading
+            uint32_t              depth;   // nested Readers; touched only by the owning thread
+
+        } reader_t;
+
+        // Process-wide current map, held in a function-local static so this can stay header-only
+        typedef struct {
+
+            std::atomic<const Obstacles *> current;
+            std::atomic<uint64_t>          epoch;     // bumped by each publish()
+            std::mutex                     mutex;     // guards readers and retired; taken by a thread's first Reader only
+            std::vector<reader_t *>        readers;   // never freed: a thread may exit at any time
+            std::vector<std::pair<const Obstacles *, uint64_t>> retired;   // with the epoch that replaced them
+
+        } state_t;
+
+        static state_t & state(void)
+        {
+            static state_t * s = newState();
+            return *s;
+        }
+
+        static state_t * newState(void)
+        {
+            state_t * s = new state_t();
+            s->epoch = 1;
+            return s;
+        }
+
+        static reader_t * localReader(void)
+        {
+            static thread_local reader_t * reader = NULL;
+
+            if (!reader) {
+                state_t & s = state();
+                std::lock_guard<std::mutex> lock(s.mutex);
+                reader = new reader_t();
+                s.readers.push_back(reader);
+            }
+
+            return reader;
+        }
+
+        // Builds a subtree over items [first, first+count) of order, given six bounds per item
+        static void buildTree(std::vector<node_t> & nodes, const float * bounds, uint32_t * order,
+                uint32_t first, uint32_t count, uint32_t leafSize)
+        {
+            uint32_t index = (uint32_t)nodes.size();
+            nodes.push_back(node_t());
+
+            float centroidMin[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+            float centroidMax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+            node_t node = {};
+            for (uint8_t a=0; a<3; ++a) {
+                node.min[a] = FLT_MAX;
+                node.max[a] = -FLT_MAX;
+            }
+
+            for (uint32_t k=first; k<first+count; ++k) {
+                const float * b = &bounds[order[k]*6];
+                for (uint8_t a=0; a<3; ++a) {
+                    node.min[a] = std::min(node.min[a], b[a]);
+                    node.max[a] = std::max(node.max[a], b[3+a]);
+                    float c = b[a] + b[3+a];
+                    centroidMin[a] = std::min(centroidMin[a], c);
+                    centroidMax[a] = std::max(centroidMax[a], c);
+                }
+            }
+
+            if (count <= leafSize) {
+                node.first = first;
+                node.count = count;
+                nodes[index] = node;
+                return;
+            }
+
+            // Median split along the axis where centroids spread most
+            uint8_t axis = 0;
+            for (uint8_t a=1; a<3; ++a) {
+                if (centroidMax[a]-centroidMin[a] > centroidMax[axis]-centroidMin[axis]) {
+                    axis = a;
+                }
+            }
+
+            uint32_t half = count / 2;
+            std::nth_element(order+first, order+first+half, order+first+count,
+                    [bounds, axis](uint32_t i, uint32_t j) {
+                        return bounds[i*6+axis] + bounds[i*6+3+axis] < bounds[j*6+axis] + bounds[j*6+3+axis];
+                    });
+
+            buildTree(nodes, bounds, order, first, half, leafSize);
+
+            node.first = (uint32_t)nodes.size();
+            node.count = 0;
+
+            buildTree(nodes, bounds, order, first+half, count-half, leafSize);
+
+            nodes[index] = node;
+        }
+
+        /*
+         * Depth-first walk of a BVH, visiting leaves whose boxes pass a test.
+         * boxTest(node) returns whether to descend; leaf(first, count) returns
+         * false to stop the walk.
+         */
+        template <typename BoxTest, typename Leaf>
+        static void traverse(const std::vector<node_t> & nodes, BoxTest boxTest, Leaf leaf)
+        {
+            if (nodes.empty()) {
+                return;
+            }
+
+            uint32_t stack[STACK_SIZE];
+            uint32_t depth = 0;
+            stack[depth++] = 0;
+
+            while (depth > 0) {
+
+                uint32_t index = stack[--depth];
+                const node_t & node = nodes[index];
+
+                if (!boxTest(node)) {
+                    continue;
+                }
+
+                if (node.count > 0) {
+                    if (!leaf(node.first, node.count)) {
+                        return;
+                    }
+                }
+
+                // Median splits keep depth near log2(n), far below the stack size
+                else if (depth+2 <= STACK_SIZE) {
+                    stack[depth++] = node.first;
+                    stack[depth++] = index + 1;
+                }
+            }
+        }
+
+        static double dot(const double a[3], const double b[3])
+        {
+            return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+        }
+
+        static void sub(const double a[3], const double b[3], double c[3])
+        {
+            c[0] = a[0] - b[0];
+            c[1] = a[1] - b[1];
+            c[2] = a[2] - b[2];
+        }
+
+        static void cross(const double a[3], const double b[3], double c[3])
+        {
+            c[0] = a[1]*b[2] - a[2]*b[1];
+            c[1] = a[2]*b[0] - a[0]*b[2];
+            c[2] = a[0]*b[1] - a[1]*b[0];
+        }
+
+        static void lerp(const double a[3], const double b[3], double t, double c[3])
+        {
+            c[0] = a[0] + t*(b[0]-a[0]);
+            c[1] = a[1] + t*(b[1]-a[1]);
+            c[2] = a[2] + t*(b[2]-a[2]);
+        }
+
+        static double clamp01(double t)
+        {
+            return t < 0 ? 0 : t > 1 ? 1 : t;
+        }
+
+        static double distanceSquared(const double a[3], const double b[3])
+        {
+            double d[3];
+            sub(a, b, d);
+            return dot(d, d);
+        }
+
+        // Closest point on triangle abc to p (Ericson, Real-Time Collision Detection, 5.1.5)
+        static void closestPointTriangle(const double p[3], const double a[3], const double b[3], const double c[3], double q[3])
+        {
+            double ab[3], ac[3], ap[3], bp[3], cp[3];
+            sub(b, a, ab);
+            sub(c, a, ac);
+            sub(p, a, ap);
+
+            double d1 = dot(ab, ap), d2 = dot(ac, ap);
+            if (d1 <= 0 && d2 <= 0) {
+                memcpy(q, a, 3*sizeof(double));
+                return;
+            }
+
+            sub(p, b, bp);
+            double d3 = dot(ab, bp), d4 = dot(ac, bp);
+            if (d3 >= 0 && d4 <= d3) {
+                memcpy(q, b, 3*sizeof(double));
+                return;
+            }
+
+            double vc = d1*d4 - d3*d2;
+            if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+                lerp(a, b, d1/(d1-d3), q);
+                return;
+            }
+
+            sub(p, c, cp);
+            double d5 = dot(ab, cp), d6 = dot(ac, cp);
+            if (d6 >= 0 && d5 <= d6) {
+                memcpy(q, c, 3*sizeof(double));
+                return;
+            }
+
+            double vb = d5*d2 - d1*d6;
+            if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+                lerp(a, c, d2/(d2-d6), q);
+                return;
+            }
+
+            double va = d3*d6 - d5*d4;
+            if (va <= 0 && (d4-d3) >= 0 && (d5-d6) >= 0) {
+                lerp(b, c, (d4-d3)/((d4-d3)+(d5-d6)), q);
+                return;
+            }
+
+            double denom = 1 / (va + vb + vc);
+            double v = vb * denom, w = vc * denom;
+            for (uint8_t k=0; k<3; ++k) {
+                q[k] = a[k] + ab[k]*v + ac[k]*w;
+            }
+        }
+
+        // Closest points between segments p1q1 and p2q2 (Ericson 5.1.9)
+        static void closestPointsSegments(const double p1[3], const double q1[3], const double p2[3], const double q2[3],
+                double c1[3], double c2[3])
+        {
+            double d1[3], d2[3], r[3];
+            sub(q1, p1, d1);
+            sub(q2, p2, d2);
+            sub(p1, p2, r);
+
+            double a = dot(d1, d1), e = dot(d2, d2), f = dot(d2, r);
+            double s = 0, t = 0;
+
+            if (a <= DBL_EPSILON && e <= DBL_EPSILON) {
+                s = t = 0;
+            }
+            else if (a <= DBL_EPSILON) {
+                t = clamp01(f / e);
+            }
+            else {
+                double c = dot(d1, r);
+                if (e <= DBL_EPSILON) {
+                    s = clamp01(-c / a);
+                }
+                else {
+                    double b = dot(d1, d2);
+                    double denom = a*e - b*b;
+                    s = denom > 0 ? clamp01((b*f - c*e) / denom) : 0;
+                    t = (b*s + f) / e;
+                    if (t < 0) {
+                        t = 0;
+                        s = clamp01(-c / a);
+                    }
+                    else if (t > 1) {
+                        t = 1;
+                        s = clamp01((b - c) / a);
+                    }
+                }
+            }
+
+            lerp(p1, q1, s, c1);
+            lerp(p2, q2, t, c2);
+        }
+
+        // Ray-triangle intersection (Moller-Trumbore); returns distance along dir or -1
+        static double rayTriangle(const double o[3], const double dir[3], const double a[3], const double b[3], const double c[3])
+        {
+            double e1[3], e2[3], p[3], s[3], q[3];
+            sub(b, a, e1);
+            sub(c, a, e2);
+            cross(dir, e2, p);
+
+            double det = dot(e1, p);
+            if (fabs(det) < 1e-12) {
+                return -1;
+            }
+
+            double inv = 1 / det;
+            sub(o, a, s);
+
+            double u = dot(s, p) * inv;
+            if (u < 0 || u > 1) {
+                return -1;
+            }
+
+            cross(s, e1, q);
+            double v = dot(dir, q) * inv;
+            if (v < 0 || u + v > 1) {
+                return -1;
+            }
+
+            return dot(e2, q) * inv;
+        }
+
+        /*
+         * Closest points between segment pq and triangle abc: c1 on the
+         * segment, c2 on the triangle.  Returns squared distance.
+         */
+        static double closestPointsSegmentTriangle(const double p[3], const double q[3],
+                const double a[3], const double b[3], const double c[3], double c1[3], double c2[3])
+        {
+            double dir[3];
+            sub(q, p, dir);
+
+            // Segment passes through the triangle
+            double t = rayTriangle(p, dir, a, b, c);
+            if (t >= 0 && t <= 1) {
+                lerp(p, q, t, c1);
+                memcpy(c2, c1, 3*sizeof(double));
+                return 0;
+            }
+
+            double best = DBL_MAX;
+            double s1[3], s2[3];
+
+            const double * ends[2] = {p, q};
+            for (uint8_t k=0; k<2; ++k) {
+                closestPointTriangle(ends[k], a, b, c, s2);
+                double d = distanceSquared(ends[k], s2);
+                if (d < best) {
+                    best = d;
+                    memcpy(c1, ends[k], 3*sizeof(double));
+                    memcpy(c2, s2, 3*sizeof(double));
+                }
+            }
+
+            const double * edges[3][2] = {{a, b}, {b, c}, {c, a}};
+            for (uint8_t k=0; k<3; ++k) {
+                closestPointsSegments(p, q, edges[k][0], edges[k][1], s1, s2);
+                double d = distanceSquared(s1, s2);
+                if (d < best) {
+                    best = d;
+                    memcpy(c1, s1, 3*sizeof(double));
+                    memcpy(c2, s2, 3*sizeof(double));
+                }
+            }
+
+            return best;
+        }
+
+        static void loadTriangle(const Mesh & mesh, uint32_t t, double a[3], double b[3], double c[3])
+        {
+            const float * f = &mesh.triangles[9*t];
+            for (uint8_t k=0; k<3; ++k) {
+                a[k] = f[k];
+                b[k] = f[3+k];
+                c[k] = f[6+k];
+            }
+        }
+
+        static bool boxOverlap(const node_t & node, const double min[3], const double max[3])
+        {
+            return node.min[0] <= max[0] && node.max[0] >= min[0] &&
+                node.min[1] <= max[1] && node.max[1] >= min[1] &&
+                node.min[2] <= max[2] && node.max[2] >= min[2];
+        }
+
+        // Slab test; true if the ray enters the box before maxDistance
+        static bool rayBox(const node_t & node, const double o[3], const double inv[3], double maxDistance)
+        {
+            double t0 = 0, t1 = maxDistance;
+
+            for (uint8_t a=0; a<3; ++a) {
+                double ta = (node.min[a] - o[a]) * inv[a];
+                double tb = (node.max[a] - o[a]) * inv[a];
+                if (ta > tb) {
+                    std::swap(ta, tb);
+                }
+                t0 = ta > t0 ? ta : t0;
+                t1 = tb < t1 ? tb : t1;
+                if (t0 > t1) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+    public:
+
+        /**
+         * Builds the top level over a set of meshes.
+         * @param meshes built meshes, shared with other maps
+         */
+        Obstacles(const std::vector<std::shared_ptr<const Mesh>> & meshes)
+        {
+            uint32_t count = (uint32_t)meshes.size();
+
+            std::vector<float> bounds(count*6);
+            std::vector<uint32_t> order(count);
+
+            for (uint32_t m=0; m<count; ++m) {
+                order[m] = m;
+                const node_t & root = meshes[m]->nodes[0];
+                memcpy(&bounds[m*6], root.min, 3*sizeof(float));
+                memcpy(&bounds[m*6+3], root.max, 3*sizeof(float));
+                _triangleCount += meshes[m]->triangleCount();
+            }
+
+            if (count > 0) {
+                buildTree(_top, bounds.data(), order.data(), 0, count, 1);
+            }
+
+            for (uint32_t m=0; m<count; ++m) {
+                _meshes.push_back(meshes[order[m]]);
+            }
+        }
+
+        uint32_t meshCount(void) const
+        {
+            return (uint32_t)_meshes.size();
+        }
+
+        uint64_t triangleCount(void) const
+        {
+            return _triangleCount;
+        }
+
+        /**
+         * Finds the obstacle closest to a capsule, if within its radius.
+         * @param a one end of the capsule's axis
+         * @param b other end; same as a for a sphere
+         * @param radius meters
+         * @param contact output: closest contact, valid on success
+         * @return true if the capsule touches an obstacle, false otherwise
+         */
+        bool capsule(const double a[3], const double b[3], double radius, contact_t & contact) const
+        {
+            double min[3], max[3];
+            for (uint8_t k=0; k<3; ++k) {
+                min[k] = std::min(a[k], b[k]) - radius;
+                max[k] = std::max(a[k], b[k]) + radius;
+            }
+
+            double best = radius * radius;
+            bool found = false;
+
+            traverse(_top,
+                    [&](const node_t & node) { return boxOverlap(node, min, max); },
+                    [&](uint32_t first, uint32_t count) {
+
+                    for (uint32_t m=first; m<first+count; ++m) {
+
+                        const Mesh & mesh = *_meshes[m];
+
+                        traverse(mesh.nodes,
+                            [&](const node_t & node) { return boxOverlap(node, min, max); },
+                            [&](uint32_t tfirst, uint32_t tcount) {
+
+                            for (uint32_t t=tfirst; t<tfirst+tcount; ++t) {
+
+                                double p0[3], p1[3], p2[3], c1[3], c2[3];
+                                loadTriangle(mesh, t, p0, p1, p2);
+
+                                double d = closestPointsSegmentTriangle(a, b, p0, p1, p2, c1, c2);
+
+                                if (d <= best) {
+                                    best = d;
+                                    found = true;
+                                    memcpy(contact.point, c2, sizeof(c2));
+                                    sub(c1, c2, contact.normal);
+                                }
+                            }
+                            return true;
+                        });
+                    }
+                    return true;
+                });
+
+            if (found) {
+
+                double d = sqrt(best);
+
+                if (d > 0) {
+                    for (uint8_t k=0; k<3; ++k) {
+                        contact.normal[k] /= d;
+                    }
+                }
+
+                // Axis lies on the obstacle: no direction to push out, so use straight up
+                else {
+                    contact.normal[0] = contact.normal[1] = 0;
+                    contact.normal[2] = 1;
+                }
+
+                contact.distance = d - radius;
+            }
+
+            return found;
+        }
+
+        bool sphere(const double center[3], double radius, contact_t & contact) const
+        {
+            return capsule(center, center, radius, contact);
+        }
+
+        /**
+         * Casts a ray against all obstacles.
+         * @param origin start of ray
+         * @param direction unit vector
+         * @param maxDistance meters
+         * @return distance to first hit, or maxDistance if none
+         */
+        double ray(const double origin[3], const double direction[3], double maxDistance) const
+        {
+            double inv[3];
+            for (uint8_t k=0; k<3; ++k) {
+                inv[k] = direction[k] != 0 ? 1 / direction[k] : DBL_MAX;
+            }
+
+            double best = maxDistance;
+
+            traverse(_top,
+                    [&](const node_t & node) { return rayBox(node, origin, inv, best); },
+                    [&](uint32_t first, uint32_t count) {
+
+                    for (uint32_t m=first; m<first+count; ++m) {
+
+                        const Mesh & mesh = *_meshes[m];
+
+                        traverse(mesh.nodes,
+                            [&](const node_t & node) { return rayBox(node, origin, inv, best); },
+                            [&](uint32_t tfirst, uint32_t tcount) {
+
+                            for (uint32_t t=tfirst; t<tfirst+tcount; ++t) {
+                                double p0[3], p1[3], p2[3];
+                                loadTriangle(mesh, t, p0, p1, p2);
+                                double d = rayTriangle(origin, direction, p0, p1, p2);
+                                if (d >= 0 && d < best) {
+                                    best = d;
+                                }
+                            }
+                            return true;
+                        });
+                    }
+                    return true;
+                });
+
+            return best;
+        }
+
+        /**
+         * Makes a map current for all queries, taking ownership of it, and frees
+         * replaced maps that no Reader can still be using.  Call from the game thread.
+         * @param obstacles new map, or NULL for none
+         */
+        static void publish(const Obstacles * obstacles)
+        {
+            state_t & s = state();
+
+            // Sequentially consistent, like Reader, so a reader that sees the new epoch sees the new map
+            const Obstacles * previous = s.current.exchange(obstacles);
+            uint64_t replacedAt = s.epoch.fetch_add(1) + 1;
+
+            std::lock_guard<std::mutex> lock(s.mutex);
+
+            auto & retired = s.retired;
+
+            if (previous) {
+                retired.push_back(std::make_pair(previous, replacedAt));
+            }
+
+            uint64_t oldest = UINT64_MAX;
+
+            for (reader_t * reader : s.readers) {
+                uint64_t epoch = reader->epoch.load();
+                if (epoch && epoch < oldest) {
+                    oldest = epoch;
+                }
+            }
+
+            // A reader that began in the replacing epoch or later found the replacement
+            for (size_t k=0; k<retired.size(); ) {
+                if (retired[k].second <= oldest) {
+                    delete retired[k].first;
+                    retired[k] = retired.back();
+                    retired.pop_back();
+                }
+                else {
+                    ++k;
+                }
+            }
+        }
+
+        /**
+         * Pins the current map for as long as it is in scope, e.g. for a
+         * physics step's queries.  Any thread; Readers may nest.
+         */
+        class Reader {
+
+            private:
+
+                reader_t * _reader;
+
+                const Obstacles * _obstacles;
+
+            public:
+
+                Reader(void)
+                {
+                    state_t & s = state();
+
+                    _reader = localReader();
+
+                    if (_reader->depth++ == 0) {
+                        _reader->epoch.store(s.epoch.load());
+                    }
+
+                    _obstacles = s.current.load();
+                }
+
+                ~Reader(void)
+                {
+                    if (--_reader->depth == 0) {
+                        _reader->epoch.store(0, std::memory_order_release);
+                    }
+                }
+
+                Reader(const Reader &) = delete;
+                Reader & operator=(const Reader &) = delete;
+
+                // Current map when this Reader began, or NULL if none
+                const Obstacles * get(void) const
+                {
+                    return _obstacles;
+                }
+
+        }; // class Reader
+
+}; // class Obstacles
+
+/**
+ * Collects world geometry mesh by mesh and builds an Obstacles map from it,
+ * reusing meshes unchanged since the last build or found in the cache file.
+ * Cache file layout (native byte order):
+ *
+ *   header_t
+ *   per mesh: mesh_header_t, float[9*triangleCount], Obstacles::node_t[nodeCount]
+ */
+class ObstacleBuilder {
+
+    public:
+
+        static const uint32_t VERSION = 1;
+
+        // Identifies the file type; eight bytes including the terminating zero
+        static const char * magic(void)
+        {
+            return "MSIMOBS";
+        }
+
+        typedef struct {
+
+            char     magic[8];
+            uint32_t version;
+            uint32_t meshCount;
+
+        } header_t;
+
+        typedef struct {
+
+            uint64_t key;
+            uint32_t triangleCount;
+            uint32_t nodeCount;
+
+        } mesh_header_t;
+
+    private:
+
+        typedef std::shared_ptr<const Obstacles::Mesh> mesh_ptr;
+
+        std::unordered_map<uint64_t, mesh_ptr> _cache;
+
+        std::vector<mesh_ptr> _meshes;
+
+        uint32_t _builtCount = 0;
+        uint32_t _reusedCount = 0;
+
+    public:
+
+        // Starts collecting geometry for a new map
+        void begin(void)
+        {
+            _meshes.clear();
+            _builtCount = 0;
+            _reusedCount = 0;
+        }
+
+        /**
+         * Adds a mesh, building its BVH unless an identical one is cached.
+         * @param vertices three floats per vertex, world meters
+         * @param vertexCount number of vertices
+         * @param indices three vertex indices per triangle
+         * @param triangleCount number of triangles
+         */
+        void addMesh(const float * vertices, uint32_t vertexCount, const uint32_t * indices, uint32_t triangleCount)
+        {
+            if (triangleCount == 0) {
+                return;
+            }
+
+            uint64_t key = Obstacles::Mesh::hash(vertices, vertexCount, indices, triangleCount);
+
+            auto found = _cache.find(key);
+
+            if (found != _cache.end()) {
+                _meshes.push_back(found->second);
+                _reusedCount++;
+                return;
+            }
+
+            Obstacles::Mesh * mesh = new Obstacles::Mesh();
+            mesh->key = key;
+            mesh->build(vertices, indices, triangleCount);
+
+            mesh_ptr ptr(mesh);
+            _cache[key] = ptr;
+            _meshes.push_back(ptr);
+            _builtCount++;
+        }
+
+        /**
+         * Builds the map from the meshes added since begin(), and drops cached
+         * meshes it does not use.
+         * @return new map, owned by the caller (see Obstacles::publish())
+         */
+        Obstacles * finish(void)
+        {
+            std::unordered_map<uint64_t, mesh_ptr> used;
+            for (const mesh_ptr & mesh : _meshes) {
+                used[mesh->key] = mesh;
+            }
+            _cache.swap(used);
+
+            return new Obstacles(_meshes);
+        }
+
+        // Meshes built and reused by the last build
+        uint32_t getBuiltCount(void)
+        {
+            return _builtCount;
+        }
+
+        uint32_t getReusedCount(void)
+        {
+            return _reusedCount;
+        }
+
+        /**
+         * Adds meshes from a cache file to those available for reuse.  Meshes
+         * whose sizes don't fit the file or whose BVH is malformed end the load.
+         * @return true on success, false if the file is missing, unreadable, or invalid
+         */
+        bool load(const char * filename)
+        {
+            FILE * fp = fopen(filename, "rb");
+
+            if (!fp) {
+                return false;
+            }
+
+            fseek(fp, 0, SEEK_END);
+            uint64_t fileSize = (uint64_t)ftell(fp);
+            fseek(fp, 0, SEEK_SET);
+
+            header_t header = {};
+
+            bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+                !memcmp(header.magic, magic(), 8) &&
+                header.version == VERSION;
+
+            for (uint32_t m=0; ok && m<header.meshCount; ++m) {
+
+                mesh_header_t mh = {};
+
+                // A BVH of n triangles has fewer than 2n nodes
+                if (fread(&mh, sizeof(mh), 1, fp) != 1 || mh.nodeCount == 0 ||
+                        mh.nodeCount >= 2*(uint64_t)mh.triangleCount ||
+                        (uint64_t)ftell(fp) + 9*sizeof(float)*(uint64_t)mh.triangleCount +
+                        sizeof(Obstacles::node_t)*(uint64_t)mh.nodeCount > fileSize) {
+                    ok = false;
+                    break;
+                }
+
+                Obstacles::Mesh * mesh = new Obstacles::Mesh();
+                mesh->key = mh.key;
+                mesh->triangles.resize(9*(size_t)mh.triangleCount);
+                mesh->nodes.resize(mh.nodeCount);
+
+                ok = fread(mesh->triangles.data(), 9*sizeof(float), mh.triangleCount, fp) == mh.triangleCount &&
+                    fread(mesh->nodes.data(), sizeof(Obstacles::node_t), mh.nodeCount, fp) == mh.nodeCount &&
+                    mesh->valid();
+
+                if (ok) {
+                    _cache[mh.key] = mesh_ptr(mesh);
+                }
+                else {
+                    delete mesh;
+                }
+            }
+
+            fclose(fp);
+
+            return ok;
+        }
+
+        /**
+         * Writes the meshes of the last build to a cache file.
+         * @return true on success, false otherwise
+         */
+        bool save(const char * filename)
+        {
+            FILE * fp = fopen(filename, "wb");
+
+            if (!fp) {
+                return false;
+            }
+
+            header_t header = {};
+            memcpy(header.magic, magic(), 8);
+            header.version = VERSION;
+            header.meshCount = (uint32_t)_cache.size();
+
+            bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+
+            for (auto & entry : _cache) {
+
+                const Obstacles::Mesh & mesh = *entry.second;
+
+                mesh_header_t mh = {};
+                mh.key = mesh.key;
+                mh.triangleCount = mesh.triangleCount();
+                mh.nodeCount = (uint32_t)mesh.nodes.size();
+
+                ok = ok && fwrite(&mh, sizeof(mh), 1, fp) == 1 &&
+                    fwrite(mesh.triangles.data(), 9*sizeof(float), mh.triangleCount, fp) == mh.triangleCount &&
+                    fwrite(mesh.nodes.data(), sizeof(Obstacles::node_t), mh.nodeCount, fp) == mh.nodeCount;
+            }
+
+            return !fclose(fp) && ok;
+        }
+
+}; // class ObstacleBuilder
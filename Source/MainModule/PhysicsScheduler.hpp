@@ -0,0 +1,748 @@
+/*
+ * Header-only physics scheduler for MulticopterSim
+ *
+ * Steps every registered task (normally a vehicle's flight manager) at a
+ * common fixed rate on a small pool of worker threads, instead of giving
+ * each vehicle its own busy-looping thread.  On each tick the clock thread
+ * hands out batches of consecutive tasks; it wakes only as many workers as
+ * there are batches to share, and workers sleep between ticks, so CPU use
+ * tracks the amount of stepping to be done rather than the number of threads.
+ *
+ * A tick runs in phases, each finishing on every thread before the next
+ * begins: vehicles step in PHASE_STEP, and later phases can then read every
+ * vehicle's new state, e.g. to find vehicles near each other.
+ *
+ * A PHASE_STEP task with nothing to do (e.g., a vehicle at rest on the
+ * ground) can go to sleep.  It is then moved off the list of tasks stepped
+ * each tick, so the cost of a tick follows the number of awake tasks.  A
+ * sleeping task is polled every POLL_INTERVAL ticks, sleepers spread evenly
+ * across ticks, and wakes when its poll says so or when wake() is called.
+ *
+ * For level-of-detail physics, each PHASE_STEP task is in an update-rate
+ * tier (see tier_t).  A task in a lower tier is stepped only every few ticks,
+ * with the time of the tick it steps on, so its time step grows with its
+ * interval and a change of tier leaves its trajectory unbroken.  Tasks in
+ * the same tier are staggered across ticks so that each tick steps about the
+ * same number of them.
+ *
+ * Options (see PlatformOptions): -simphysicshz=HZ (default 1000),
+ * -simworkers=N (default: half the hardware threads, at most 8).
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Platform.hpp"
+#include "Trace.hpp"
+#include "FlightRecorder.hpp"
+
+class PhysicsScheduler {
+
+    public:
+
+        // Something to be stepped at the physics rate
+        class Task {
+
+            public:
+
+                /**
+                 * Runs one step, on one of the scheduler's threads.
+                 * @param time seconds since the task was added, a whole number of periods
+                 * @return false to go to sleep (PHASE_STEP only), true otherwise
+                 */
+                virtual bool step(double time) = 0;
+
+                /**
+                 * Checks whether a sleeping task should wake, on one of the
+                 * scheduler's threads; much cheaper than a step, ideally.
+                 * @param time as for step()
+                 * @return true to be stepped again from the next tick on
+                 */
+                virtual bool poll(double time)
+                {
+                    (void)time;
+                    return false;
+                }
+
+                /**
+                 * Called between ticks, on the clock thread, when the task's tier
+                 * has changed; its next step comes at the new interval.
+                 * @param tier the new tier
+                 * @param interval seconds between its steps from now on
+                 */
+                virtual void tierChanged(uint8_t tier, double interval)
+                {
+                    (void)tier;
+                    (void)interval;
+                }
+
+                virtual ~Task(void) { }
+
+        }; // class Task
+
+        static constexpr double DEFAULT_RATE = 1000;
+
+        static const uint32_t MAX_WORKERS = 8;
+
+        typedef enum {
+
+            PHASE_STEP,       // vehicles
+            PHASE_GATHER,     // after every vehicle has stepped
+            PHASE_INDEX,      // after PHASE_GATHER, e.g. to build what PHASE_PROCESS reads
+            PHASE_PROCESS,    // after PHASE_INDEX
+            PHASE_COUNT
+
+        } phase_t;
+
+        // Tasks handed to a worker at a time in PHASE_STEP; later phases hand out one at a time
+        static const uint32_t BATCH_SIZE = 8;
+
+        // Delay before a new task's first step, giving its owner time to finish setting up
+        static constexpr double START_DELAY = 0.5;
+
+        // Ticks between polls of a sleeping task
+        static const uint32_t POLL_INTERVAL = 16;
+
+        // Update-rate tiers for PHASE_STEP tasks
+        typedef enum {
+
+            TIER_FULL,        // every tick
+            TIER_REDUCED,     // every fourth tick
+            TIER_BACKGROUND,  // every sixteenth tick
+            TIER_COUNT
+
+        } tier_t;
+
+        // Ticks between steps of a task in a tier; a power of two
+        static uint32_t getTierInterval(uint8_t tier)
+        {
+            static const uint32_t intervals[TIER_COUNT] = {1, 4, 16};
+            return intervals[tier < TIER_COUNT ? tier : (uint8_t)TIER_FULL];
+        }
+
+    private:
+
+        typedef struct {
+
+            Task *   task;
+            uint64_t startTick;
+            uint32_t mask;       // stepped on ticks where (tick + offset) & mask is zero
+            uint32_t offset;
+            uint8_t  tier;
+
+        } entry_t;
+
+        typedef struct {
+
+            Task *   task;
+            uint8_t  phase;
+            uint8_t  tier;
+
+        } request_t;
+
+        class Worker : public PlatformThread {
+
+            public:
+
+                uint32_t index = 0;
+
+            protected:
+
+                virtual void threadMain(void) override
+                {
+                    PhysicsScheduler::workerMain(index);
+                }
+
+        }; // class Worker
+
+        // Process-wide state, never freed since the threads wait on it until exit
+        typedef struct {
+
+            std::mutex              mutex;
+            std::condition_variable wake;      // workers wait here for a tick
+            std::condition_variable done;      // clock thread waits here for the workers
+            std::condition_variable requests;  // idle clock thread waits here for add()
+            std::condition_variable changed;   // remove() waits here for its removal to be applied
+
+            // Touched only by the clock thread, between ticks
+            std::vector<entry_t>    entries[PHASE_COUNT];
+            std::vector<entry_t>    sleeping;     // PHASE_STEP tasks
+
+            // Set by the thread stepping or polling each task, read by the clock thread between ticks
+            std::vector<uint8_t>    sleepy;       // parallel to entries[PHASE_STEP]
+            std::vector<uint8_t>    woken;        // parallel to sleeping
+
+            // Registration requests, under mutex
+            std::vector<request_t>  adds;
+            std::vector<Task *>     removes;
+            std::vector<Task *>     wakes;
+            std::vector<request_t>  tiers;     // phase unused
+            uint64_t                applied;   // number of times requests were applied
+            bool                    idle;      // clock thread has nothing to step
+
+            // Current tick and phase, published under mutex
+            uint64_t                tick;
+            uint8_t                 phase;
+            uint32_t                batchSize;
+            uint32_t                batchCount;
+            uint32_t                stepBatches;  // the rest poll sleeping[pollFirst .. pollFirst+pollCount-1]
+            uint32_t                pollFirst;
+            uint32_t                pollCount;
+            uint32_t                tokens;    // workers still to join this tick
+            std::atomic<uint32_t>   nextBatch;
+            std::atomic<uint32_t>   active;    // threads still stepping this tick
+
+            Worker *                workers;   // never freed, so no thread is left joinable at exit
+            uint32_t                workerCount;
+            bool                    configured;
+
+            double                  period;
+
+            // Ticks on which stepping took longer than the period
+            std::atomic<uint32_t>   overruns;
+
+            std::atomic<uint32_t>   sleepingCount;
+
+            // Awake PHASE_STEP tasks in each tier as of the last tick
+            std::atomic<uint32_t>   tierCounts[TIER_COUNT];
+
+            // Staggers the ticks on which tasks in a tier step
+            uint32_t                nextOffset;
+
+        } state_t;
+
+        static state_t & state(void)
+        {
+            static state_t * s = new state_t();
+            return *s;
+        }
+
+        static void configure(state_t & s)
+        {
+            if (s.configured) {
+                return;
+            }
+
+            double rate = DEFAULT_RATE;
+            PlatformOptions::get("simphysicshz=", rate);
+
+            double workers = std::thread::hardware_concurrency() / 2;
+            PlatformOptions::get("simworkers=", workers);
+
+            s.period = 1 / (rate > 0 ? rate : DEFAULT_RATE);
+            s.workerCount = workers < 1 ? 1 : workers > MAX_WORKERS ? MAX_WORKERS : (uint32_t)workers;
+            s.configured = true;
+        }
+
+        // Steps batches of the current phase until there are none left, then checks out
+        static void runBatches(state_t & s, uint64_t tick, uint8_t phase, uint32_t batchSize)
+        {
+            const std::vector<entry_t> & entries = s.entries[phase];
+
+            uint32_t count = (uint32_t)entries.size();
+
+            while (true) {
+
+                uint32_t batch = s.nextBatch.fetch_add(1, std::memory_order_relaxed);
+
+                if (batch >= s.batchCount) {
+                    break;
+                }
+
+                if (batch < s.stepBatches) {
+
+                    uint32_t first = batch * batchSize;
+                    uint32_t last = first + batchSize < count ? first + batchSize : count;
+
+                    for (uint32_t k=first; k<last; ++k) {
+                        const entry_t & entry = entries[k];
+                        if (tick < entry.startTick || ((tick + entry.offset) & entry.mask)) {
+                            continue;
+                        }
+                        if (!entry.task->step((tick - entry.startTick + 1) * s.period)) {
+                            if (phase == PHASE_STEP) {
+                                s.sleepy[k] = 1;
+                            }
+                        }
+                    }
+                }
+
+                else {
+
+                    uint32_t first = s.pollFirst + (batch - s.stepBatches) * batchSize;
+                    uint32_t end = s.pollFirst + s.pollCount;
+                    uint32_t last = first + batchSize < end ? first + batchSize : end;
+
+                    for (uint32_t k=first; k<last; ++k) {
+                        const entry_t & entry = s.sleeping[k];
+                        if (entry.task->poll((tick - entry.startTick + 1) * s.period)) {
+                            s.woken[k] = 1;
+                        }
+                    }
+                }
+            }
+
+            if (s.active.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lock(s.mutex);
+                s.done.notify_one();
+            }
+        }
+
+        // Moves a sleeping task back to the stepped list, by swapping in the last sleeper
+        static void wakeSleeper(state_t & s, size_t k)
+        {
+            s.entries[PHASE_STEP].push_back(s.sleeping[k]);
+            s.sleepy.push_back(0);
+
+            s.sleeping[k] = s.sleeping.back();
+            s.woken[k] = s.woken.back();
+            s.sleeping.pop_back();
+            s.woken.pop_back();
+        }
+
+        static bool taskLess(const request_t & a, const request_t & b)
+        {
+            return a.task < b.task;
+        }
+
+        static void setEntryTier(state_t & s, entry_t & entry, uint8_t tier)
+        {
+            entry.tier = tier < TIER_COUNT ? tier : (uint8_t)TIER_FULL;
+            entry.mask = getTierInterval(entry.tier) - 1;
+            entry.offset = s.nextOffset++;
+
+            entry.task->tierChanged(entry.tier, getTierInterval(entry.tier) * s.period);
+        }
+
+        // Moves tasks to their requested tiers, in one pass over the tasks however many have changed
+        static void applyTiers(state_t & s)
+        {
+            if (s.tiers.empty()) {
+                return;
+            }
+
+            // Sorted by task, with each task's latest request last among its own
+            std::stable_sort(s.tiers.begin(), s.tiers.end(), taskLess);
+
+            for (std::vector<entry_t> * entries : {&s.entries[PHASE_STEP], &s.sleeping}) {
+
+                for (entry_t & entry : *entries) {
+
+                    request_t key = {entry.task, 0, 0};
+
+                    std::vector<request_t>::iterator found = std::upper_bound(s.tiers.begin(), s.tiers.end(), key, taskLess);
+
+                    if (found != s.tiers.begin() && (found-1)->task == entry.task && (found-1)->tier != entry.tier) {
+                        setEntryTier(s, entry, (found-1)->tier);
+                    }
+                }
+            }
+
+            s.tiers.clear();
+        }
+
+        // Applies registration requests; called by the clock thread with the mutex held
+        static void applyRequests(state_t & s, uint64_t tick)
+        {
+            applyTiers(s);
+
+            for (Task * task : s.wakes) {
+                for (size_t k=0; k<s.sleeping.size(); ++k) {
+                    if (s.sleeping[k].task == task) {
+                        wakeSleeper(s, k);
+                        break;
+                    }
+                }
+            }
+
+            s.wakes.clear();
+
+            if (s.adds.empty() && s.removes.empty()) {
+                return;
+            }
+
+            uint64_t delayTicks = (uint64_t)(START_DELAY / s.period);
+
+            for (const request_t & request : s.adds) {
+                entry_t entry = {request.task, tick + delayTicks, 0, 0, TIER_FULL};
+                if (request.phase == PHASE_STEP && request.tier != TIER_FULL) {
+                    setEntryTier(s, entry, request.tier);
+                }
+                s.entries[request.phase].push_back(entry);
+                if (request.phase == PHASE_STEP) {
+                    s.sleepy.push_back(0);
+                }
+            }
+
+            for (Task * task : s.removes) {
+
+                for (uint8_t phase=0; phase<PHASE_COUNT; ++phase) {
+                    std::vector<entry_t> & entries = s.entries[phase];
+                    for (size_t k=0; k<entries.size(); ++k) {
+                        if (entries[k].task == task) {
+                            entries.erase(entries.begin() + k);
+                            if (phase == PHASE_STEP) {
+                                s.sleepy.erase(s.sleepy.begin() + k);
+                            }
+                            break;
+                        }
+                    }
+                }
+
+                for (size_t k=0; k<s.sleeping.size(); ++k) {
+                    if (s.sleeping[k].task == task) {
+                        s.sleeping.erase(s.sleeping.begin() + k);
+                        s.woken.erase(s.woken.begin() + k);
+                        break;
+                    }
+                }
+            }
+
+            s.adds.clear();
+            s.removes.clear();
+            s.applied++;
+            s.changed.notify_all();
+        }
+
+        static bool empty(state_t & s)
+        {
+            for (const std::vector<entry_t> & entries : s.entries) {
+                if (!entries.empty()) {
+                    return false;
+                }
+            }
+            return s.sleeping.empty();
+        }
+
+        /**
+         * After PHASE_STEP, moves the tasks that asked to sleep off the stepped
+         * list, and the sleepers whose poll asked to wake back onto it.
+         * Touches only the stepped list and the polled sleepers.
+         */
+        static void settle(state_t & s)
+        {
+            // Woken first, while the polled range still holds the sleepers polled
+            for (uint32_t k=s.pollFirst+s.pollCount; k>s.pollFirst; --k) {
+                if (s.woken[k-1]) {
+                    wakeSleeper(s, k-1);
+                }
+            }
+
+            std::vector<entry_t> & entries = s.entries[PHASE_STEP];
+
+            size_t kept = 0;
+
+            uint32_t tierCounts[TIER_COUNT] = {};
+
+            for (size_t k=0; k<entries.size(); ++k) {
+
+                if (s.sleepy[k]) {
+                    s.sleeping.push_back(entries[k]);
+                    s.woken.push_back(0);
+                    continue;
+                }
+
+                tierCounts[entries[k].tier]++;
+
+                entries[kept] = entries[k];
+                s.sleepy[kept] = 0;
+                kept++;
+            }
+
+            entries.resize(kept);
+            s.sleepy.resize(kept);
+
+            s.sleepingCount.store((uint32_t)s.sleeping.size(), std::memory_order_relaxed);
+
+            for (uint8_t tier=0; tier<TIER_COUNT; ++tier) {
+                s.tierCounts[tier].store(tierCounts[tier], std::memory_order_relaxed);
+            }
+        }
+
+        // Runs one phase of a tick on the clock thread and as many workers as it can use
+        static void runPhase(state_t & s, uint64_t tick, uint8_t phase)
+        {
+            uint32_t batchSize = phase == PHASE_STEP ? BATCH_SIZE : 1;
+
+            uint32_t stepBatches = (uint32_t)((s.entries[phase].size() + batchSize - 1) / batchSize);
+
+            // This tick's share of the sleepers
+            uint32_t pollFirst = 0;
+            uint32_t pollCount = 0;
+            if (phase == PHASE_STEP) {
+                uint64_t sleepers = s.sleeping.size();
+                uint32_t slot = (uint32_t)(tick % POLL_INTERVAL);
+                pollFirst = (uint32_t)(sleepers * slot / POLL_INTERVAL);
+                pollCount = (uint32_t)(sleepers * (slot+1) / POLL_INTERVAL) - pollFirst;
+            }
+
+            uint32_t batchCount = stepBatches + (pollCount + batchSize - 1) / batchSize;
+
+            if (batchCount == 0) {
+                return;
+            }
+
+            uint32_t helpers = 0;
+
+            {
+                std::lock_guard<std::mutex> lock(s.mutex);
+
+                s.tick = tick;
+                s.phase = phase;
+                s.batchSize = batchSize;
+                s.batchCount = batchCount;
+                s.stepBatches = stepBatches;
+                s.pollFirst = pollFirst;
+                s.pollCount = pollCount;
+                s.nextBatch = 0;
+
+                // Wake only as many workers as there are batches to share
+                helpers = batchCount - 1 < s.workerCount - 1 ? batchCount - 1 : s.workerCount - 1;
+                s.tokens = helpers;
+                s.active = helpers + 1;
+            }
+
+            for (uint32_t k=0; k<helpers; ++k) {
+                s.wake.notify_one();
+            }
+
+            runBatches(s, tick, phase, batchSize);
+
+            {
+                std::unique_lock<std::mutex> lock(s.mutex);
+                s.done.wait(lock, [&s] { return s.active.load(std::memory_order_acquire) == 0; });
+            }
+
+            if (phase == PHASE_STEP) {
+                settle(s);
+            }
+        }
+
+        static void clockMain(state_t & s)
+        {
+            Trace::setThreadName("PhysicsScheduler");
+
+            FlightRecorder::attachThread();
+
+            double start = PlatformTime::seconds();
+
+            for (uint64_t tick=0; ; ++tick) {
+
+                // Sleep until the tick is due; tasks get the nominal tick time, so
+                // oversleeping delays a step without changing its time step
+                double wait = start + tick * s.period - PlatformTime::seconds();
+                if (wait > 0) {
+                    PlatformTime::sleep(wait);
+                }
+
+                {
+                    std::unique_lock<std::mutex> lock(s.mutex);
+
+                    applyRequests(s, tick);
+
+                    // Nothing to step or poll: sleep until there is, then keep time from there
+                    if (empty(s)) {
+                        s.idle = true;
+                        s.requests.wait(lock, [&s] { return !s.adds.empty(); });
+                        s.idle = false;
+                        applyRequests(s, tick);
+                        start = PlatformTime::seconds() - tick * s.period;
+                    }
+                }
+
+                {
+                    TRACE_SCOPE("PhysicsScheduler::tick");
+
+                    for (uint8_t phase=0; phase<PHASE_COUNT; ++phase) {
+                        runPhase(s, tick, phase);
+                    }
+                }
+
+                // Overran: skip the ticks we missed rather than stepping in a burst
+                double late = PlatformTime::seconds() - (start + (tick+1) * s.period);
+                if (late > 0) {
+                    s.overruns.fetch_add(1, std::memory_order_relaxed);
+                    start += s.period * (uint64_t)(late / s.period + 1);
+                }
+            }
+        }
+
+        static void workerMain(uint32_t index)
+        {
+            state_t & s = state();
+
+            if (index == 0) {
+                clockMain(s);
+                return;
+            }
+
+            Trace::setThreadName("PhysicsWorker");
+
+            FlightRecorder::attachThread();
+
+            while (true) {
+
+                uint64_t tick = 0;
+                uint8_t phase = 0;
+                uint32_t batchSize = 0;
+
+                {
+                    std::unique_lock<std::mutex> lock(s.mutex);
+                    s.wake.wait(lock, [&s] { return s.tokens > 0; });
+                    s.tokens--;
+                    tick = s.tick;
+                    phase = s.phase;
+                    batchSize = s.batchSize;
+                }
+
+                TRACE_SCOPE("PhysicsScheduler::batch");
+
+                runBatches(s, tick, phase, batchSize);
+            }
+        }
+
+    public:
+
+        /**
+         * Registers a task, starting the scheduler's threads the first time.
+         * Safe to call from any thread but the scheduler's.
+         * @param task the task
+         * @param phase part of each tick in which to step it; see phase_t
+         */
+        static void add(Task * task, phase_t phase=PHASE_STEP)
+        {
+            state_t & s = state();
+
+            std::lock_guard<std::mutex> lock(s.mutex);
+
+            configure(s);
+
+            if (!s.workers) {
+                s.workers = new Worker[s.workerCount];
+                for (uint32_t k=0; k<s.workerCount; ++k) {
+                    s.workers[k].index = k;
+                    s.workers[k].startThread(k ? "PhysicsWorker" : "PhysicsScheduler");
+                }
+            }
+
+            request_t request = {task, (uint8_t)phase, TIER_FULL};
+            s.adds.push_back(request);
+
+            s.requests.notify_one();
+        }
+
+        /**
+         * Unregisters a task, returning once the scheduler will no longer step
+         * it.  Safe to call from any thread but the scheduler's.
+         */
+        static void remove(Task * task)
+        {
+            state_t & s = state();
+
+            std::unique_lock<std::mutex> lock(s.mutex);
+
+            // Not yet picked up by the clock thread
+            for (size_t k=0; k<s.adds.size(); ++k) {
+                if (s.adds[k].task == task) {
+                    s.adds.erase(s.adds.begin() + k);
+                    return;
+                }
+            }
+
+            // Clock thread has nothing registered, so this is not either
+            if (s.idle || !s.workers) {
+                return;
+            }
+
+            s.removes.push_back(task);
+
+            uint64_t applied = s.applied;
+
+            s.changed.wait(lock, [&s, applied] { return s.applied != applied; });
+        }
+
+        /**
+         * Wakes a sleeping task from the next tick on; does nothing if it is
+         * awake.  Safe to call from any thread.
+         */
+        static void wake(Task * task)
+        {
+            state_t & s = state();
+
+            std::lock_guard<std::mutex> lock(s.mutex);
+
+            s.wakes.push_back(task);
+        }
+
+        /**
+         * Moves a PHASE_STEP task to an update-rate tier from the next tick on.
+         * Safe to call from any thread.
+         * @param task the task
+         * @param tier see tier_t
+         */
+        static void setTier(Task * task, tier_t tier)
+        {
+            state_t & s = state();
+
+            std::lock_guard<std::mutex> lock(s.mutex);
+
+            // Not yet picked up by the clock thread
+            for (request_t & request : s.adds) {
+                if (request.task == task) {
+                    request.tier = (uint8_t)tier;
+                    return;
+                }
+            }
+
+            request_t request = {task, PHASE_STEP, (uint8_t)tier};
+            s.tiers.push_back(request);
+        }
+
+        // Seconds between steps
+        static double getPeriod(void)
+        {
+            state_t & s = state();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            configure(s);
+            return s.period;
+        }
+
+        // Threads that step tasks, the clock thread included
+        static uint32_t getWorkerCount(void)
+        {
+            state_t & s = state();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            configure(s);
+            return s.workerCount;
+        }
+
+        // Tasks asleep as of the last tick
+        static uint32_t getSleepingCount(void)
+        {
+            return state().sleepingCount.load(std::memory_order_relaxed);
+        }
+
+        // Awake tasks in a tier as of the last tick
+        static uint32_t getTierCount(tier_t tier)
+        {
+            return state().tierCounts[tier].load(std::memory_order_relaxed);
+        }
+
+        // Ticks on which stepping took longer than the period
+        static uint32_t getOverruns(void)
+        {
+            return state().overruns.load(std::memory_order_relaxed);
+        }
+
+}; // class PhysicsScheduler
@@ -0,0 +1,27 @@
+/*
+ * Platform abstraction for MulticopterSim: time and threads
+ *
+ * Builds against Unreal Engine by default.  Define MULTICOPTERSIM_NATIVE to
+ * build the engine-independent classes (FThreadedManager, FFlightManager,
+ * Camera image pipeline) with a standard C++ backend instead, e.g. for
+ * running headless on Linux.
+ *
+ * Each backend provides:
+ *
+ *   PlatformTime::seconds()  high-resolution monotonic time in seconds
+ *   PlatformTime::sleep(s)   sleep for s seconds
+ *   PlatformThread           base class whose threadMain() runs on its own thread
+ *   PlatformOptions::get()   numeric option from the command line, where there is one
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#ifdef MULTICOPTERSIM_NATIVE
+#include "platform/NativePlatform.hpp"
+#else
+#include "platform/UnrealPlatform.hpp"
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Abstract pose output for MulticopterSim: where the vehicle pose computed
+ * by the dynamics goes for display (a UE4 pawn, a log file, ...)
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#include "Dynamics.hpp"
+
+class PoseOutput {
+
+    public:
+
+        /**
+         * @param location meters from starting location, NED
+         * @param rotation Euler angles phi, theta, psi in radians
+         */
+        virtual void setPose(const double location[3], const double rotation[3]) = 0;
+
+        virtual ~PoseOutput(void) { }
+
+        // Extracts pose from dynamics state
+        static void fromDynamics(Dynamics * dynamics, double location[3], double rotation[3])
+        {
+            location[0] = dynamics->x(Dynamics::STATE_X);
+            location[1] = dynamics->x(Dynamics::STATE_Y);
+            location[2] = dynamics->x(Dynamics::STATE_Z);
+
+            rotation[0] = dynamics->x(Dynamics::STATE_PHI);
+            rotation[1] = dynamics->x(Dynamics::STATE_THETA);
+            rotation[2] = dynamics->x(Dynamics::STATE_PSI);
+        }
+
+}; // class PoseOutput
+
+// Writes each pose as a CSV line: x,y,z,phi,theta,psi
+class CsvPoseOutput : public PoseOutput {
+
+    private:
+
+        FILE * _fp = NULL;
+
+    public:
+
+        CsvPoseOutput(FILE * fp)
+        {
+            _fp = fp;
+        }
+
+        virtual void setPose(const double location[3], const double rotation[3]) override
+        {
+            fprintf(_fp, "%f,%f,%f,%f,%f,%f\n", 
+                    location[0], location[1], location[2], rotation[0], rotation[1], rotation[2]);
+        }
+
+}; // class CsvPoseOutput
@@ -0,0 +1,138 @@
+/*
+ * Header-only rate-monotonic task scheduler for MulticopterSim
+ *
+ * Runs periodic tasks (sensor sampling, receiver polling, a firmware loop) at
+ * their own rates on the simulation clock, so that they keep those rates
+ * whether the simulation runs slower or faster than real time.  The owner
+ * calls next() with the current simulation time, normally once per dynamics
+ * step, and runs each task it returns until it returns NONE.
+ *
+ * Task n of a given rate is released at n periods after the first call.  As
+ * with rate-monotonic priorities, when several tasks are due at once the one
+ * with the highest rate comes first, and tasks of the same rate come in the
+ * order they were added.  A task whose releases have gone by without a call
+ * (e.g., the caller steps more coarsely than the task's rate) runs once, and
+ * the releases it skipped are counted as missed.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+class RateScheduler {
+
+    public:
+
+        static const uint8_t MAX_TASKS = 8;
+
+        // Returned by next() when nothing more is due
+        static const uint8_t NONE = 0xFF;
+
+    private:
+
+        // Allows for rounding in step times that should land on a release
+        static constexpr double TOLERANCE = 1e-9;
+
+        typedef struct {
+
+            uint8_t  id;
+            double   period;     // seconds; zero to run on every call
+            uint64_t releases;   // run or skipped so far
+            double   lastTime;   // of the last run
+
+        } task_t;
+
+        task_t _tasks[MAX_TASKS] = {};
+
+        uint8_t _count = 0;
+
+        bool   _started = false;
+        double _startTime = 0;
+
+        uint64_t _missed = 0;
+
+    public:
+
+        /**
+         * Adds a task, ahead of those with lower rates.
+         * @param id the owner's name for the task, returned by next()
+         * @param rate Hz; zero or less to run on every call
+         */
+        void add(uint8_t id, double rate)
+        {
+            if (_count == MAX_TASKS) {
+                return;
+            }
+
+            double period = rate > 0 ? 1 / rate : 0;
+
+            uint8_t k = _count++;
+
+            while (k > 0 && _tasks[k-1].period > period) {
+                _tasks[k] = _tasks[k-1];
+                k--;
+            }
+
+            _tasks[k].id = id;
+            _tasks[k].period = period;
+            _tasks[k].releases = 0;
+            _tasks[k].lastTime = 0;
+        }
+
+        /**
+         * Takes the highest-priority task due at a time.
+         * @param time simulation time in seconds, never decreasing
+         * @return the task's id, or NONE once every task due has been taken
+         */
+        uint8_t next(double time)
+        {
+            if (!_started) {
+                _startTime = time;
+                _started = true;
+            }
+
+            double elapsed = time - _startTime + TOLERANCE;
+
+            for (uint8_t k=0; k<_count; ++k) {
+
+                task_t & task = _tasks[k];
+
+                if (task.period == 0) {
+
+                    // Once per time
+                    if (task.releases == 0 || time > task.lastTime) {
+                        task.releases++;
+                        task.lastTime = time;
+                        return task.id;
+                    }
+
+                    continue;
+                }
+
+                if (elapsed >= task.releases * task.period) {
+
+                    uint64_t latest = (uint64_t)(elapsed / task.period);
+
+                    _missed += latest - task.releases;
+
+                    task.releases = latest + 1;
+                    task.lastTime = time;
+
+                    return task.id;
+                }
+            }
+
+            return NONE;
+        }
+
+        // Releases skipped because no call came between them, over all tasks
+        uint64_t getMissed(void)
+        {
+            return _missed;
+        }
+
+}; // class RateScheduler
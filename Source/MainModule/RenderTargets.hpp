@@ -0,0 +1,155 @@
+/*
+ * Pooled render targets for MulticopterSim cameras, of any size
+ *
+ * A camera acquires a render target of its image size when its vehicle
+ * begins play, and releases it when the vehicle ends play, to a free list for
+ * that size that the next camera of the same size takes from.  Nothing is
+ * loaded or created until a camera asks for it.
+ *
+ * Targets for the sizes the project has assets for (640x480, 1280x720 and
+ * 1920x1080, ten apiece in /Game/MulticopterSim/RenderTargets) come from
+ * those assets while they last.  Other sizes, and cameras beyond the assets,
+ * get created targets with the assets' 8-bit RGBA format: reading back a
+ * target of the default floating-point format converts every pixel, which is
+ * what made created targets read about half as fast as the assets.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "Engine/TextureRenderTarget2D.h"
+
+#include "Utils.hpp"
+
+class RenderTargets {
+
+    private:
+
+        // Render-target assets for each size that has them
+        static const uint8_t ASSET_COUNT = 10;
+
+        // Process-wide, and never freed, like the rooted targets it holds
+        typedef struct {
+
+            // Free targets by size
+            TMap<uint32_t, TArray<UTextureRenderTarget2D *>> free;
+
+            // Assets taken so far by size
+            TMap<uint32_t, uint8_t> assetsUsed;
+
+            uint32_t count;
+            uint32_t inUse;
+
+        } state_t;
+
+        static state_t & state(void)
+        {
+            static state_t * s = new state_t();
+            return *s;
+        }
+
+        static uint32_t key(uint16_t cols, uint16_t rows)
+        {
+            return (uint32_t)cols << 16 | rows;
+        }
+
+        static bool hasAssets(uint16_t cols, uint16_t rows)
+        {
+            return (cols == 640 && rows == 480) || (cols == 1280 && rows == 720) || (cols == 1920 && rows == 1080);
+        }
+
+        static UTextureRenderTarget2D * load(uint16_t cols, uint16_t rows, uint8_t index)
+        {
+            char name[100];
+            SPRINTF(name, "renderTarget_%dx%d_%d", cols, rows, index+1);
+
+            char path[200];
+            SPRINTF(path, "/Game/MulticopterSim/RenderTargets/%s.%s", name, name);
+
+            return LoadObject<UTextureRenderTarget2D>(NULL, UTF8_TO_TCHAR(path), NULL, LOAD_NoWarn);
+        }
+
+        static UTextureRenderTarget2D * create(uint16_t cols, uint16_t rows)
+        {
+            UTextureRenderTarget2D * target = NewObject<UTextureRenderTarget2D>(GetTransientPackage());
+
+            // Same format as the assets, so that reading pixels needs no conversion
+            target->RenderTargetFormat = RTF_RGBA8;
+            target->bAutoGenerateMips = false;
+            target->ClearColor = FLinearColor::Black;
+            target->InitAutoFormat(cols, rows);
+            target->UpdateResourceImmediate(true);
+
+            return target;
+        }
+
+    public:
+
+        /**
+         * Takes a render target from the pool, loading or creating one if
+         * none of this size is free.  Call from the game thread.
+         * @param cols image width in pixels
+         * @param rows image height in pixels
+         * @return the target, for this caller's use until release()
+         */
+        static UTextureRenderTarget2D * acquire(uint16_t cols, uint16_t rows)
+        {
+            state_t & s = state();
+
+            s.inUse++;
+
+            TArray<UTextureRenderTarget2D *> & free = s.free.FindOrAdd(key(cols, rows));
+
+            if (free.Num() > 0) {
+                return free.Pop();
+            }
+
+            UTextureRenderTarget2D * target = NULL;
+
+            if (hasAssets(cols, rows)) {
+                uint8_t & used = s.assetsUsed.FindOrAdd(key(cols, rows));
+                if (used < ASSET_COUNT) {
+                    target = load(cols, rows, used++);
+                }
+            }
+
+            if (!target) {
+                target = create(cols, rows);
+            }
+
+            // Kept for the pool's lifetime, whether or not a camera is using it
+            target->AddToRoot();
+
+            s.count++;
+
+            return target;
+        }
+
+        // Returns a target from acquire() to the pool.  Call from the game thread.
+        static void release(UTextureRenderTarget2D * target)
+        {
+            state_t & s = state();
+
+            s.free.FindOrAdd(key((uint16_t)target->SizeX, (uint16_t)target->SizeY)).Add(target);
+
+            s.inUse--;
+        }
+
+        // Render targets loaded or created so far
+        static uint32_t getCount(void)
+        {
+            return state().count;
+        }
+
+        // Render targets acquired and not yet released
+        static uint32_t getInUseCount(void)
+        {
+            return state().inUse;
+        }
+
+}; // class RenderTargets
@@ -0,0 +1,386 @@
+/*
+ * Header-only deterministic replay for MulticopterSim
+ *
+ * ReplayRecorder journals the exact inputs of every physics step (time, dt,
+ * integrator, AGL, disturbance, motor values) together with a state keyframe every N
+ * steps.  ReplayPlayer feeds those inputs back into a fresh Dynamics object,
+ * reproducing the original run bit for bit when built the same way.
+ *
+ * File layout (native byte order):
+ *
+ *   header_t
+ *   chunk 0: keyframe_t, step_t[keyframeInterval]
+ *   chunk 1: keyframe_t, step_t[keyframeInterval]
+ *   ...                                     (last chunk may be short)
+ *
+ * Chunks have a fixed size, so seeking to a step needs no index.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Dynamics.hpp"
+
+class Replay {
+
+    public:
+
+        static const uint8_t MAX_MOTORS = 16;
+
+        static const uint32_t VERSION = 2;
+
+        static const uint32_t DEFAULT_KEYFRAME_INTERVAL = 1000;
+
+        // Identifies the file type; eight bytes including the terminating zero
+        static const char * magic(void)
+        {
+            return "MSIMRPL";
+        }
+
+        typedef struct {
+
+            char     magic[8];
+            uint32_t version;
+            uint32_t keyframeInterval;
+            uint32_t motorCount;
+            uint32_t reserved;
+            char     vehicle[32];     // name understood by the replay tool, e.g. "phantom"
+
+            Dynamics::vehicle_params_t params;
+
+        } header_t;
+
+        typedef struct {
+
+            uint64_t              step;
+            Dynamics::snapshot_t  state;   // before this step
+
+        } keyframe_t;
+
+        typedef struct {
+
+            double time;
+            double dt;
+            double agl;
+            double disturbance[3];
+            double motors[MAX_MOTORS];
+            uint32_t integrator;   // Dynamics::integrator_t
+            uint32_t reserved;
+
+        } step_t;
+
+        static long chunkSize(uint32_t keyframeInterval)
+        {
+            return (long)(sizeof(keyframe_t) + keyframeInterval * sizeof(step_t));
+        }
+
+        // Same state as far as update() is concerned; inputs are overwritten every step
+        static bool sameState(const Dynamics::snapshot_t & a, const Dynamics::snapshot_t & b)
+        {
+            return !memcmp(a.x, b.x, sizeof(a.x)) && a.airborne == b.airborne;
+        }
+
+}; // class Replay
+
+class ReplayRecorder {
+
+    private:
+
+        // Large stdio buffer, so the physics thread rarely makes a system call
+        static const size_t FILE_BUFFER_SIZE = 1<<20;
+
+        FILE *   _fp = NULL;
+        char *   _fileBuffer = NULL;
+        uint32_t _keyframeInterval = 0;
+        uint8_t  _motorCount = 0;
+        uint64_t _step = 0;
+
+    public:
+
+        /**
+         * Opens a replay file.
+         * @param filename output file
+         * @param vehicle name of vehicle, for the replay tool to recreate its dynamics
+         * @param dynamics vehicle dynamics to be recorded
+         * @param keyframeInterval steps between state keyframes
+         * @return true on success, false if file could not be opened
+         */
+        bool open(const char * filename, const char * vehicle, Dynamics * dynamics,
+                uint32_t keyframeInterval=Replay::DEFAULT_KEYFRAME_INTERVAL)
+        {
+            close();
+
+            _fp = fopen(filename, "wb");
+
+            if (!_fp) {
+                return false;
+            }
+
+            _fileBuffer = new char[FILE_BUFFER_SIZE];
+            setvbuf(_fp, _fileBuffer, _IOFBF, FILE_BUFFER_SIZE);
+
+            _keyframeInterval = keyframeInterval;
+            _motorCount = dynamics->motorCount() < Replay::MAX_MOTORS ? dynamics->motorCount() : Replay::MAX_MOTORS;
+            _step = 0;
+
+            Replay::header_t header = {};
+            memcpy(header.magic, Replay::magic(), 8);
+            header.version = Replay::VERSION;
+            header.keyframeInterval = keyframeInterval;
+            header.motorCount = _motorCount;
+            snprintf(header.vehicle, sizeof(header.vehicle), "%s", vehicle);
+            memcpy(&header.params, &dynamics->params(), sizeof(header.params));
+
+            fwrite(&header, sizeof(header), 1, _fp);
+
+            return true;
+        }
+
+        /**
+         * Records one step.  Call after setAgl(), setDisturbance() and setMotors(), just before update().
+         * @param dynamics vehicle dynamics
+         * @param time seconds
+         * @param dt seconds, as passed to update()
+         * @param integrator as passed to update()
+         * @param motorvals as passed to setMotors()
+         */
+        void record(Dynamics * dynamics, double time, double dt, Dynamics::integrator_t integrator, const double * motorvals)
+        {
+            if (!_fp) {
+                return;
+            }
+
+            Dynamics::snapshot_t snapshot = {};
+            dynamics->getSnapshot(snapshot);
+
+            if (_step % _keyframeInterval == 0) {
+                Replay::keyframe_t keyframe = {};
+                keyframe.step = _step;
+                keyframe.state = snapshot;
+                fwrite(&keyframe, sizeof(keyframe), 1, _fp);
+            }
+
+            Replay::step_t step = {};
+            step.time = time;
+            step.dt = dt;
+            step.integrator = (uint32_t)integrator;
+            step.agl = snapshot.agl;
+            memcpy(step.disturbance, snapshot.disturbance, sizeof(step.disturbance));
+            memcpy(step.motors, motorvals, _motorCount*sizeof(double));
+
+            fwrite(&step, sizeof(step), 1, _fp);
+
+            _step++;
+        }
+
+        void close(void)
+        {
+            if (_fp) {
+                fclose(_fp);
+                _fp = NULL;
+            }
+
+            delete[] _fileBuffer;
+            _fileBuffer = NULL;
+        }
+
+        uint64_t getStepCount(void)
+        {
+            return _step;
+        }
+
+        ~ReplayRecorder(void)
+        {
+            close();
+        }
+
+}; // class ReplayRecorder
+
+class ReplayPlayer {
+
+    private:
+
+        FILE * _fp = NULL;
+
+        Replay::header_t _header = {};
+
+        uint64_t _stepCount = 0;
+
+        // Next step to be played
+        uint64_t _step = 0;
+
+        long chunkOffset(uint64_t chunk)
+        {
+            return (long)(sizeof(Replay::header_t) + chunk * Replay::chunkSize(_header.keyframeInterval));
+        }
+
+        bool readKeyframe(uint64_t chunk, Replay::keyframe_t & keyframe)
+        {
+            return !fseek(_fp, chunkOffset(chunk), SEEK_SET) && fread(&keyframe, sizeof(keyframe), 1, _fp) == 1;
+        }
+
+    public:
+
+        /**
+         * Opens a replay file, reporting errors on stderr.
+         * @return true on success, false otherwise
+         */
+        bool open(const char * filename)
+        {
+            _fp = fopen(filename, "rb");
+
+            if (!_fp) {
+                fprintf(stderr, "Unable to open replay file %s\n", filename);
+                return false;
+            }
+
+            if (fread(&_header, sizeof(_header), 1, _fp) != 1 ||
+                    memcmp(_header.magic, Replay::magic(), 8) ||
+                    _header.version != Replay::VERSION ||
+                    _header.keyframeInterval == 0 ||
+                    _header.motorCount > Replay::MAX_MOTORS) {
+                fprintf(stderr, "%s is not a version %u replay file\n", filename, Replay::VERSION);
+                return false;
+            }
+
+            // Count whole steps, allowing for a file cut short mid-chunk
+            fseek(_fp, 0, SEEK_END);
+            long size = ftell(_fp) - (long)sizeof(Replay::header_t);
+            long chunk = Replay::chunkSize(_header.keyframeInterval);
+            long rest = size % chunk;
+            _stepCount = (uint64_t)(size / chunk) * _header.keyframeInterval;
+            if (rest > (long)sizeof(Replay::keyframe_t)) {
+                _stepCount += (rest - sizeof(Replay::keyframe_t)) / sizeof(Replay::step_t);
+            }
+
+            return true;
+        }
+
+        const Replay::header_t & getHeader(void)
+        {
+            return _header;
+        }
+
+        uint64_t getStepCount(void)
+        {
+            return _stepCount;
+        }
+
+        // Index of the next step to be played
+        uint64_t getStep(void)
+        {
+            return _step;
+        }
+
+        /**
+         * Restores dynamics to the state before a given step, from the nearest keyframe.
+         * @param dynamics fresh dynamics of the recorded vehicle
+         * @param step step index
+         * @return true on success, false if step is out of range
+         */
+        bool seek(Dynamics * dynamics, uint64_t step)
+        {
+            if (step >= _stepCount) {
+                return false;
+            }
+
+            uint64_t chunk = step / _header.keyframeInterval;
+
+            Replay::keyframe_t keyframe = {};
+            if (!readKeyframe(chunk, keyframe)) {
+                return false;
+            }
+
+            dynamics->setSnapshot(keyframe.state);
+
+            _step = chunk * _header.keyframeInterval;
+
+            // Play forward from the keyframe
+            while (_step < step) {
+                if (!next(dynamics)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        /**
+         * Plays the next step.
+         * @param dynamics vehicle dynamics
+         * @param step optional output: the step's recorded inputs
+         * @return true on success, false at end of file
+         */
+        bool next(Dynamics * dynamics, Replay::step_t * step=NULL)
+        {
+            if (_step >= _stepCount) {
+                return false;
+            }
+
+            uint64_t chunk = _step / _header.keyframeInterval;
+            uint64_t index = _step % _header.keyframeInterval;
+
+            long offset = chunkOffset(chunk) + (long)sizeof(Replay::keyframe_t) + (long)(index * sizeof(Replay::step_t));
+
+            // Reading sequentially, we are already there unless we just crossed a keyframe
+            if (ftell(_fp) != offset) {
+                fseek(_fp, offset, SEEK_SET);
+            }
+
+            Replay::step_t s = {};
+            if (fread(&s, sizeof(s), 1, _fp) != 1) {
+                return false;
+            }
+
+            double motors[Replay::MAX_MOTORS] = {};
+            memcpy(motors, s.motors, sizeof(motors));
+
+            dynamics->setAgl(s.agl);
+            dynamics->setDisturbance(s.disturbance);
+            dynamics->setMotors(motors);
+            dynamics->update(s.dt, (Dynamics::integrator_t)s.integrator);
+
+            if (step) {
+                *step = s;
+            }
+
+            _step++;
+
+            return true;
+        }
+
+        /**
+         * Gets the recorded state before the next step, if that step starts a chunk.
+         * @return true if there is a keyframe there, false otherwise
+         */
+        bool getKeyframe(Dynamics::snapshot_t & state)
+        {
+            if (_step % _header.keyframeInterval || _step >= _stepCount) {
+                return false;
+            }
+
+            Replay::keyframe_t keyframe = {};
+            if (!readKeyframe(_step / _header.keyframeInterval, keyframe)) {
+                return false;
+            }
+
+            state = keyframe.state;
+
+            return true;
+        }
+
+        ~ReplayPlayer(void)
+        {
+            if (_fp) {
+                fclose(_fp);
+            }
+        }
+
+}; // class ReplayPlayer
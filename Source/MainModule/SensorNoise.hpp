@@ -0,0 +1,260 @@
+/*
+ * Header-only sensor error model for MulticopterSim
+ *
+ * Turns true three-axis readings (gyro rates, accelerations) into what an
+ * inertial sensor would report: scale-factor error, a turn-on bias that then
+ * drifts as a random walk, white noise, saturation at full scale, and
+ * quantization to the sensor's resolution.
+ *
+ * The noise comes from NoiseGenerator, eight interleaved xoshiro128++
+ * streams stepped in lockstep.  Each block refill runs the same integer
+ * operations on all eight lanes, which compilers turn into SIMD, and makes a
+ * normal deviate from the sum of four 16-bit uniforms (Irwin-Hall): unit
+ * variance, tails cut off at about 3.5 sigma, and no logs or trig.  A
+ * generator seeded with the same value always produces the same noise, so a
+ * vehicle's sensor errors are reproducible from its seed.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+class NoiseGenerator {
+
+    public:
+
+        // Interleaved streams; a block is filled this many deviates at a time
+        static const uint32_t LANES = 8;
+
+    private:
+
+        uint32_t _s0[LANES] = {};
+        uint32_t _s1[LANES] = {};
+        uint32_t _s2[LANES] = {};
+        uint32_t _s3[LANES] = {};
+
+        static uint64_t splitmix64(uint64_t & x)
+        {
+            uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+
+        static uint32_t rotl(uint32_t x, uint32_t k)
+        {
+            return (x << k) | (x >> (32 - k));
+        }
+
+        // One xoshiro128++ step of one lane
+        static uint32_t next(uint32_t & s0, uint32_t & s1, uint32_t & s2, uint32_t & s3)
+        {
+            uint32_t out = rotl(s0 + s3, 7) + s0;
+
+            uint32_t t = s1 << 9;
+
+            s2 ^= s0;
+            s3 ^= s1;
+            s1 ^= s2;
+            s0 ^= s3;
+
+            s2 ^= t;
+
+            s3 = rotl(s3, 11);
+
+            return out;
+        }
+
+    public:
+
+        NoiseGenerator(uint64_t seed=0)
+        {
+            this->seed(seed);
+        }
+
+        // Restarts every lane from the seed, through splitmix64 as the xoshiro authors recommend
+        void seed(uint64_t seed)
+        {
+            uint64_t x = seed;
+
+            for (uint32_t j=0; j<LANES; ++j) {
+
+                uint64_t a = splitmix64(x);
+                uint64_t b = splitmix64(x);
+
+                _s0[j] = (uint32_t)a;
+                _s1[j] = (uint32_t)(a >> 32);
+                _s2[j] = (uint32_t)b;
+                _s3[j] = (uint32_t)(b >> 32) | 1; // never all zero
+            }
+        }
+
+        /**
+         * Fills a block with standard normal deviates.
+         * @param out the block
+         * @param count a multiple of LANES
+         */
+        void fillNormal(float * out, uint32_t count)
+        {
+            // Sum of four uniforms on [0,1) has mean 2 and variance 1/3
+            static constexpr float SCALE = 1.7320508f / 65536;
+            static const int32_t MEAN = 2 * 65536;
+
+            // Local copies of the state, which the compiler can keep in vector registers
+            uint32_t s0[LANES], s1[LANES], s2[LANES], s3[LANES];
+
+            for (uint32_t j=0; j<LANES; ++j) {
+                s0[j] = _s0[j];
+                s1[j] = _s1[j];
+                s2[j] = _s2[j];
+                s3[j] = _s3[j];
+            }
+
+            for (uint32_t k=0; k<count; k+=LANES) {
+
+                for (uint32_t j=0; j<LANES; ++j) {
+
+                    uint32_t a = next(s0[j], s1[j], s2[j], s3[j]);
+                    uint32_t b = next(s0[j], s1[j], s2[j], s3[j]);
+
+                    int32_t sum = (int32_t)((a & 0xFFFF) + (a >> 16) + (b & 0xFFFF) + (b >> 16));
+
+                    out[k+j] = (float)(sum - MEAN) * SCALE;
+                }
+            }
+
+            for (uint32_t j=0; j<LANES; ++j) {
+                _s0[j] = s0[j];
+                _s1[j] = s1[j];
+                _s2[j] = s2[j];
+                _s3[j] = s3[j];
+            }
+        }
+
+}; // class NoiseGenerator
+
+class SensorNoise {
+
+    public:
+
+        // Error magnitudes for one kind of sensor, as on its data sheet; zero turns each term off
+        typedef struct {
+
+            double noiseDensity;    // white noise, units/sqrt(Hz)
+            double biasRandomWalk;  // bias drift, units/s/sqrt(Hz)
+            double turnOnBias;      // standard deviation of the starting bias, units
+            double scaleFactor;     // standard deviation of the scale-factor error, as a fraction
+            double resolution;      // one count, units
+            double range;           // full scale, units
+
+        } params_t;
+
+        // MEMS gyro along the lines of an MPU-6000 at +/-2000 deg/s, rad/s
+        static params_t gyro(void)
+        {
+            params_t params = { 8.7e-5, 2.0e-5, 0.005, 0.005, 0.00106, 34.9 };
+            return params;
+        }
+
+        // MEMS accelerometer along the lines of an MPU-6000 at +/-16 g, m/s^2
+        static params_t accel(void)
+        {
+            params_t params = { 3.9e-3, 1.0e-4, 0.05, 0.005, 0.0048, 156.9 };
+            return params;
+        }
+
+    private:
+
+        static const uint32_t BLOCK = 32 * NoiseGenerator::LANES;
+
+        params_t _params = {};
+
+        NoiseGenerator _generator;
+
+        float    _block[BLOCK] = {};
+        uint32_t _used = BLOCK;
+
+        double _bias[3] = {};
+        double _scale[3] = {};
+
+        float normal(void)
+        {
+            if (_used == BLOCK) {
+                _generator.fillNormal(_block, BLOCK);
+                _used = 0;
+            }
+
+            return _block[_used++];
+        }
+
+    public:
+
+        /**
+         * @param params error magnitudes
+         * @param seed the same seed gives the same errors
+         * @param magnitude multiplies every error term; 0 for a perfect sensor
+         */
+        SensorNoise(const params_t & params, uint64_t seed, double magnitude=1)
+        {
+            _params = params;
+
+            _params.noiseDensity *= magnitude;
+            _params.biasRandomWalk *= magnitude;
+            _params.turnOnBias *= magnitude;
+            _params.scaleFactor *= magnitude;
+
+            if (magnitude == 0) {
+                _params.resolution = 0;
+                _params.range = 0;
+            }
+
+            _generator.seed(seed);
+
+            // Fixed for the life of the sensor
+            for (uint8_t i=0; i<3; ++i) {
+                _bias[i] = _params.turnOnBias * normal();
+                _scale[i] = 1 + _params.scaleFactor * normal();
+            }
+        }
+
+        /**
+         * Produces one three-axis reading.
+         * @param truth true values
+         * @param measured output: what the sensor reports
+         * @param dt seconds since the last reading
+         */
+        void apply(const double truth[3], double measured[3], double dt)
+        {
+            double walk = _params.biasRandomWalk * sqrt(dt);
+            double white = dt > 0 ? _params.noiseDensity / sqrt(dt) : 0;
+
+            for (uint8_t i=0; i<3; ++i) {
+
+                _bias[i] += walk * normal();
+
+                double value = _scale[i] * truth[i] + _bias[i] + white * normal();
+
+                if (_params.range > 0) {
+                    value = value > _params.range ? _params.range : value < -_params.range ? -_params.range : value;
+                }
+
+                if (_params.resolution > 0) {
+                    value = _params.resolution * floor(value / _params.resolution + 0.5);
+                }
+
+                measured[i] = value;
+            }
+        }
+
+        // Current bias of each axis, units
+        double getBias(uint8_t axis)
+        {
+            return _bias[axis];
+        }
+
+}; // class SensorNoise
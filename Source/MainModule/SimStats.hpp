@@ -0,0 +1,60 @@
+/*
+ * UE4 stat group for MulticopterSim hot paths
+ *
+ * Type "stat MulticopterSim" in the console to view.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "Stats/Stats.h"
+
+#include "Utils.hpp"
+
+DECLARE_STATS_GROUP(TEXT("MulticopterSim"), STATGROUP_MulticopterSim, STATCAT_Advanced);
+
+// Game-thread work in Vehicle::Tick()
+DECLARE_CYCLE_STAT(TEXT("Vehicle Tick"), STAT_VehicleTick, STATGROUP_MulticopterSim);
+DECLARE_CYCLE_STAT(TEXT("setPlayerCameraView"), STAT_SetPlayerCameraView, STATGROUP_MulticopterSim);
+DECLARE_CYCLE_STAT(TEXT("updateKinematics"), STAT_UpdateKinematics, STATGROUP_MulticopterSim);
+DECLARE_CYCLE_STAT(TEXT("grabImages"), STAT_GrabImages, STATGROUP_MulticopterSim);
+DECLARE_CYCLE_STAT(TEXT("scanLidars"), STAT_ScanLidars, STATGROUP_MulticopterSim);
+DECLARE_CYCLE_STAT(TEXT("animateActuators"), STAT_AnimateActuators, STATGROUP_MulticopterSim);
+DECLARE_CYCLE_STAT(TEXT("agl"), STAT_Agl, STATGROUP_MulticopterSim);
+DECLARE_CYCLE_STAT(TEXT("Heightfield paging"), STAT_HeightfieldPaging, STATGROUP_MulticopterSim);
+DECLARE_CYCLE_STAT(TEXT("Obstacle map build"), STAT_ObstacleBuild, STATGROUP_MulticopterSim);
+DECLARE_CYCLE_STAT(TEXT("Swarm render"), STAT_SwarmRender, STATGROUP_MulticopterSim);
+
+// Values reported by the flight-manager threads: counter stats are cleared each frame, so
+// per-vehicle values are summed over vehicles, or set to the worst vehicle's so far
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Physics Hz (all vehicles)"), STAT_PhysicsHz, STATGROUP_MulticopterSim);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Controller latency, worst vehicle (usec)"), STAT_ControllerLatency, STATGROUP_MulticopterSim);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Max physics period, worst vehicle (msec)"), STAT_MaxPhysicsPeriod, STATGROUP_MulticopterSim);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Physics overruns (all vehicles)"), STAT_PhysicsOverruns, STATGROUP_MulticopterSim);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Scheduler overruns"), STAT_SchedulerOverruns, STATGROUP_MulticopterSim);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Sleeping vehicles"), STAT_SleepingVehicles, STATGROUP_MulticopterSim);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Swarm-rendered vehicles"), STAT_SwarmRenderedVehicles, STATGROUP_MulticopterSim);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Render targets"), STAT_RenderTargets, STATGROUP_MulticopterSim);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Render targets in use"), STAT_RenderTargetsInUse, STATGROUP_MulticopterSim);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Full-rate vehicles"), STAT_FullRateVehicles, STATGROUP_MulticopterSim);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Reduced-rate vehicles"), STAT_ReducedRateVehicles, STATGROUP_MulticopterSim);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Background-rate vehicles"), STAT_BackgroundRateVehicles, STATGROUP_MulticopterSim);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Obstacle contacts (all vehicles)"), STAT_ObstacleContacts, STATGROUP_MulticopterSim);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Vehicle collisions (all vehicles)"), STAT_VehicleCollisions, STATGROUP_MulticopterSim);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Near misses (all vehicles)"), STAT_NearMisses, STATGROUP_MulticopterSim);
+
+// Per-camera stats are created at runtime, one for each camera added to a vehicle
+static TStatId makeCameraStatId(uint8_t index)
+{
+#if STATS
+    char name[50];
+    SPRINTF(name, "grabImage camera %d", index+1);
+    return FDynamicStats::CreateStatId<FStatGroup_STATGROUP_MulticopterSim>(FName(name));
+#else
+    (void)index;
+    return TStatId();
+#endif
+}
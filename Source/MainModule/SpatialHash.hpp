@@ -0,0 +1,402 @@
+/*
+ * Header-only uniform-grid spatial hash for MulticopterSim
+ *
+ * Buckets points (normally vehicle positions) into cubic cells, rebuilt from
+ * scratch each physics step with a counting sort: one pass to hash and count,
+ * a prefix sum, and one pass to scatter the points into a flat array ordered
+ * by bucket.  Points in a bucket are contiguous, so a neighbor query reads a
+ * few short runs of memory instead of chasing pointers, and a rebuild never
+ * allocates once the arrays have grown to the largest point count seen.
+ *
+ * Cells are found by hashing their integer coordinates into a table of about
+ * twice as many buckets as points, so the grid is unbounded and its memory
+ * follows the point count rather than the extent of the world.  Each point
+ * keeps its cell's key, so distinct cells that share a bucket never mix.
+ *
+ * A rebuild can be split across threads: prepare() hashes the points on one
+ * thread, then scatter() on each of several threads at once counts, sums and
+ * scatters the points of its own range of buckets, so the threads write
+ * disjoint parts of the arrays.  build() does both on the calling thread.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+
+class SpatialHash {
+
+    public:
+
+        // Two points closer than the query distance; a < b
+        typedef struct {
+
+            uint32_t a;
+            uint32_t b;
+            float    distance;
+
+        } pair_t;
+
+    private:
+
+        typedef struct {
+
+            float    position[3];
+            uint32_t id;
+            uint64_t cell;
+
+        } point_t;
+
+        // Cell coordinates are packed 21 bits apiece, so the grid spans about a million cells each way
+        static const int32_t CELL_BIAS = 1 << 20;
+        static const uint64_t CELL_MASK = (1 << 21) - 1;
+
+        static const uint32_t MIN_BUCKETS = 64;
+
+        float _cellSize = 1;
+        float _inverseCellSize = 1;
+
+        uint32_t _bucketShift = 0;
+
+        uint32_t _count = 0;
+
+        // Bucket b holds _points[_starts[b]] .. _points[_starts[b+1]-1]
+        std::vector<uint32_t> _starts;
+        std::vector<point_t>  _points;
+
+        // Bucket and cell key of each input point, from prepare() for scatter()
+        std::vector<uint32_t> _buckets;
+        std::vector<uint64_t> _keys;
+
+        const float * _positions = NULL;
+
+        uint32_t _bucketCount = 0;
+        uint32_t _bucketBits = 0;
+
+        // Parts of the bucket table scattered separately, the points before each part,
+        // and the input points grouped by part
+        uint32_t _partCount = 1;
+        std::vector<uint32_t> _partStarts;
+        std::vector<uint32_t> _partCursors;
+        std::vector<uint32_t> _partPoints;
+
+        uint32_t partOf(uint32_t b) const
+        {
+            return (uint32_t)(((uint64_t)b * _partCount) >> _bucketBits);
+        }
+
+        // First bucket of a part; the inverse of partOf()
+        uint32_t partFirst(uint32_t part) const
+        {
+            return (uint32_t)((((uint64_t)part << _bucketBits) + _partCount - 1) / _partCount);
+        }
+
+        // Floor without a library call, which would dominate the rebuild
+        int32_t cellCoordinate(float x) const
+        {
+            float scaled = x * _inverseCellSize;
+            int32_t truncated = (int32_t)scaled;
+            return truncated - (scaled < truncated);
+        }
+
+        static uint64_t cellKey(int32_t cx, int32_t cy, int32_t cz)
+        {
+            return ((uint64_t)((cx + CELL_BIAS) & CELL_MASK) << 42) |
+                   ((uint64_t)((cy + CELL_BIAS) & CELL_MASK) << 21) |
+                    (uint64_t)((cz + CELL_BIAS) & CELL_MASK);
+        }
+
+        // Fibonacci hashing: the top bits of the product mix all of the key's bits
+        uint32_t bucket(uint64_t key) const
+        {
+            return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> _bucketShift);
+        }
+
+        static float distanceSquared(const float a[3], const float b[3])
+        {
+            float dx = a[0] - b[0];
+            float dy = a[1] - b[1];
+            float dz = a[2] - b[2];
+            return dx*dx + dy*dy + dz*dz;
+        }
+
+        // Calls visit(k) for each point index k in a cell
+        template <typename Visit>
+        void visitCell(uint64_t key, Visit visit) const
+        {
+            uint32_t b = bucket(key);
+
+            for (uint32_t k=_starts[b]; k<_starts[b+1]; ++k) {
+                if (_points[k].cell == key) {
+                    visit(k);
+                }
+            }
+        }
+
+    public:
+
+        static constexpr double DEFAULT_CELL_SIZE = 4.0;
+
+        /**
+         * @param cellSize edge of a cell in meters; queries are fastest with a
+         * radius of half this or a little less
+         */
+        SpatialHash(double cellSize=DEFAULT_CELL_SIZE)
+        {
+            setCellSize(cellSize);
+        }
+
+        // Takes effect at the next build()
+        void setCellSize(double cellSize)
+        {
+            _cellSize = (float)cellSize;
+            _inverseCellSize = (float)(1 / cellSize);
+        }
+
+        double getCellSize(void) const
+        {
+            return _cellSize;
+        }
+
+        /**
+         * First step of a rebuild: sizes the table and hashes every point.
+         * @param positions x,y,z of each point, in meters; must stay unchanged until the last scatter()
+         * @param count number of points; a point's index is its id in query results
+         * @param parts number of scatter() calls to follow, one per part
+         */
+        void prepare(const float * positions, uint32_t count, uint32_t parts=1)
+        {
+            // Power-of-two table with at least twice as many buckets as points
+            uint32_t bucketCount = MIN_BUCKETS;
+            uint32_t bits = 6;
+            while (bucketCount < 2 * count) {
+                bucketCount <<= 1;
+                bits++;
+            }
+            _bucketShift = 64 - bits;
+            _bucketBits = bits;
+            _bucketCount = bucketCount;
+
+            _partCount = parts < 1 ? 1 : parts > bucketCount ? bucketCount : parts;
+
+            if (_starts.size() < bucketCount + 1) {
+                _starts.resize(bucketCount + 1);
+            }
+
+            if (_points.size() < count) {
+                _points.resize(count);
+                _buckets.resize(count);
+                _keys.resize(count);
+                _partPoints.resize(count);
+            }
+
+            _partStarts.assign(_partCount + 1, 0);
+
+            // Hash, counting points per part, shifted up one so the prefix sum yields each part's first point
+            for (uint32_t k=0; k<count; ++k) {
+                const float * p = &positions[3*k];
+                uint64_t key = cellKey(cellCoordinate(p[0]), cellCoordinate(p[1]), cellCoordinate(p[2]));
+                uint32_t b = bucket(key);
+                _keys[k] = key;
+                _buckets[k] = b;
+                _partStarts[partOf(b)+1]++;
+            }
+
+            for (uint32_t part=0; part<_partCount; ++part) {
+                _partStarts[part+1] += _partStarts[part];
+            }
+
+            // Group points by part, so each scatter() reads only its own
+            if (_partCount > 1) {
+
+                _partCursors.assign(_partStarts.begin(), _partStarts.end() - 1);
+
+                for (uint32_t k=0; k<count; ++k) {
+                    _partPoints[_partCursors[partOf(_buckets[k])]++] = k;
+                }
+            }
+
+            _positions = positions;
+            _count = count;
+        }
+
+        /**
+         * Second step of a rebuild: counts, sums and scatters the points of one
+         * part of the table.  The parts may run at once on different threads.
+         * @param part from zero to one less than the parts given to prepare()
+         */
+        void scatter(uint32_t part)
+        {
+            if (part >= _partCount || _bucketCount == 0) {
+                return;
+            }
+
+            uint32_t first = partFirst(part);
+            uint32_t last = partFirst(part+1);
+
+            // _starts[b+1] counts bucket b, then holds its start as a cursor, and
+            // once scattered its end, which is where bucket b+1 starts
+            for (uint32_t b=first; b<last; ++b) {
+                _starts[b+1] = 0;
+            }
+
+            if (part == 0) {
+                _starts[0] = 0;
+            }
+
+            // Points of this part: all of them when there is just one
+            uint32_t begin = _partStarts[part];
+            uint32_t end = _partStarts[part+1];
+            const uint32_t * order = _partCount > 1 ? &_partPoints[0] : NULL;
+
+            for (uint32_t j=begin; j<end; ++j) {
+                _starts[_buckets[order ? order[j] : j]+1]++;
+            }
+
+            uint32_t start = begin;
+            for (uint32_t b=first; b<last; ++b) {
+                uint32_t n = _starts[b+1];
+                _starts[b+1] = start;
+                start += n;
+            }
+
+            for (uint32_t j=begin; j<end; ++j) {
+                uint32_t k = order ? order[j] : j;
+                const float * p = &_positions[3*k];
+                point_t & point = _points[_starts[_buckets[k]+1]++];
+                point.position[0] = p[0];
+                point.position[1] = p[1];
+                point.position[2] = p[2];
+                point.id = k;
+                point.cell = _keys[k];
+            }
+        }
+
+        /**
+         * Rebuilds the grid from scratch on the calling thread.
+         * @param positions x,y,z of each point, in meters
+         * @param count number of points; a point's index is its id in query results
+         */
+        void build(const float * positions, uint32_t count)
+        {
+            prepare(positions, count, 1);
+            scatter(0);
+        }
+
+        uint32_t size(void) const
+        {
+            return _count;
+        }
+
+        /**
+         * Finds the points within a distance of a position.
+         * @param center x,y,z in meters
+         * @param radius meters
+         * @param ids output: ids of points found, in no particular order
+         * @param maxIds capacity of ids
+         * @return number of points found, which may exceed maxIds
+         */
+        uint32_t query(const float center[3], float radius, uint32_t * ids, uint32_t maxIds) const
+        {
+            uint32_t found = 0;
+
+            if (_count == 0) {
+                return 0;
+            }
+
+            float radiusSquared = radius * radius;
+
+            int32_t lo[3] = {}, hi[3] = {};
+            for (uint8_t i=0; i<3; ++i) {
+                lo[i] = cellCoordinate(center[i] - radius);
+                hi[i] = cellCoordinate(center[i] + radius);
+            }
+
+            for (int32_t cx=lo[0]; cx<=hi[0]; ++cx) {
+                for (int32_t cy=lo[1]; cy<=hi[1]; ++cy) {
+                    for (int32_t cz=lo[2]; cz<=hi[2]; ++cz) {
+                        visitCell(cellKey(cx, cy, cz), [&](uint32_t k) {
+                            if (distanceSquared(_points[k].position, center) <= radiusSquared) {
+                                if (found < maxIds) {
+                                    ids[found] = _points[k].id;
+                                }
+                                found++;
+                            }
+                        });
+                    }
+                }
+            }
+
+            return found;
+        }
+
+        /**
+         * Finds every pair of points within a distance of each other.  The work
+         * can be split among threads by giving each a share of [0, size()),
+         * each with its own output.
+         * @param radius meters
+         * @param out output, appended to
+         * @param first first point, by position in the grid rather than id
+         * @param last one past the last point
+         */
+        void pairs(float radius, std::vector<pair_t> & out, uint32_t first, uint32_t last) const
+        {
+            float radiusSquared = radius * radius;
+
+            for (uint32_t j=first; j<last && j<_count; ++j) {
+
+                const point_t & p = _points[j];
+
+                // Only the cells the sphere around the point reaches: at most
+                // eight when the radius is no more than half a cell
+                int32_t lo[3] = {}, hi[3] = {};
+                for (uint8_t i=0; i<3; ++i) {
+                    lo[i] = cellCoordinate(p.position[i] - radius);
+                    hi[i] = cellCoordinate(p.position[i] + radius);
+                }
+
+                for (int32_t cx=lo[0]; cx<=hi[0]; ++cx) {
+                    for (int32_t cy=lo[1]; cy<=hi[1]; ++cy) {
+                        for (int32_t cz=lo[2]; cz<=hi[2]; ++cz) {
+
+                            uint64_t key = cellKey(cx, cy, cz);
+
+                            // Each point of a pair finds the other, so a pair in two cells
+                            // is kept from the cell with the lower key, and a pair in one
+                            // cell from the point that comes first in the grid
+                            if (key < p.cell) {
+                                continue;
+                            }
+
+                            visitCell(key, [&](uint32_t k) {
+
+                                if (key == p.cell && k <= j) {
+                                    return;
+                                }
+
+                                float d2 = distanceSquared(p.position, _points[k].position);
+
+                                if (d2 <= radiusSquared) {
+                                    uint32_t a = p.id, b = _points[k].id;
+                                    pair_t pair = { a < b ? a : b, a < b ? b : a, sqrtf(d2) };
+                                    out.push_back(pair);
+                                }
+                            });
+                        }
+                    }
+                }
+            }
+        }
+
+        // Finds every pair of points within a distance of each other, on the calling thread
+        void pairs(float radius, std::vector<pair_t> & out) const
+        {
+            pairs(radius, out, 0, _count);
+        }
+
+}; // class SpatialHash
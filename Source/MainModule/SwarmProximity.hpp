@@ -0,0 +1,432 @@
+/*
+ * Header-only vehicle-to-vehicle proximity for MulticopterSim swarms
+ *
+ * Once every vehicle has stepped, a PhysicsScheduler PHASE_GATHER task
+ * collects their positions and hashes them into a SpatialHash.  Then one
+ * PHASE_INDEX task per scheduler thread scatters its share of the grid's
+ * buckets, and one PHASE_PROCESS task per thread searches its share of the
+ * grid for pairs closer than their near-miss distance.  The next tick's
+ * gather compares those pairs with the tick before and tells each member
+ * when it comes within near-miss range of another vehicle, or touches one.
+ *
+ * Timed one part after another on a 1-vCPU VM with 10,000 vehicles, the
+ * gather (report, positions and hashing) takes about 0.3 ms, the scatter
+ * 0.1 ms and the search 1.3 to 1.5 ms.  Only the gather is serial, so with
+ * four scheduler threads a step's proximity work comes to about 0.7 ms; on
+ * one thread it is about 1.8 ms, over the 1 ms budget.
+ *
+ * Options (see PlatformOptions): -simnearmiss=M, the gap between two
+ * vehicles' bounding spheres that counts as a near miss (default 1).
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "Platform.hpp"
+#include "Trace.hpp"
+#include "PhysicsScheduler.hpp"
+#include "SpatialHash.hpp"
+
+class SwarmProximity {
+
+    public:
+
+        typedef enum {
+
+            EVENT_NEAR_MISS,
+            EVENT_COLLISION
+
+        } event_type_t;
+
+        typedef struct {
+
+            uint8_t  type;       // event_type_t
+            uint32_t other;      // id of the other vehicle
+            float    distance;   // between centers, meters
+
+        } event_t;
+
+        // A vehicle in the swarm; its methods are called on scheduler threads
+        class Member {
+
+            public:
+
+                // Current world position in meters, Z up
+                virtual void getSwarmPosition(float position[3]) = 0;
+
+                // Another vehicle has come within near-miss range, or touched this one
+                virtual void swarmEvent(const event_t & event) = 0;
+
+                virtual ~Member(void) { }
+
+        }; // class Member
+
+        static constexpr double DEFAULT_NEAR_MISS = 1.0;
+
+    private:
+
+        typedef struct {
+
+            Member * member;
+            uint32_t id;
+            float    radius;
+
+        } entry_t;
+
+        // Pair of member ids as a sortable key, with how close they were
+        typedef struct {
+
+            uint64_t key;
+            uint8_t  level;     // 1: near miss, 2: contact
+            uint32_t a;         // grid ids
+            uint32_t b;
+            float    distance;
+
+        } contact_t;
+
+        class Gather : public PhysicsScheduler::Task {
+
+            public:
+
+                virtual bool step(double time) override
+                {
+                    (void)time;
+                    SwarmProximity::gather();
+                    return true;
+                }
+
+        }; // class Gather
+
+        class Index : public PhysicsScheduler::Task {
+
+            public:
+
+                uint32_t share = 0;
+
+                virtual bool step(double time) override
+                {
+                    (void)time;
+                    SwarmProximity::state().grid.scatter(share);
+                    return true;
+                }
+
+        }; // class Index
+
+        class Search : public PhysicsScheduler::Task {
+
+            public:
+
+                uint32_t share = 0;
+
+                std::vector<SpatialHash::pair_t> pairs;
+
+                virtual bool step(double time) override
+                {
+                    (void)time;
+                    SwarmProximity::search(*this);
+                    return true;
+                }
+
+        }; // class Search
+
+        // Process-wide state, never freed since the scheduler's tasks point into it
+        typedef struct {
+
+            // Guards members and the snapshot's member pointers
+            std::mutex            mutex;
+
+            // Serializes add() and remove(), which register the tasks while members are present
+            std::mutex            registration;
+            bool                  registered;
+
+            std::vector<entry_t>  members;
+            uint32_t              nextId;
+            bool                  membersChanged;   // since the snapshot was taken
+
+            float                 nearMiss;
+
+            // Tasks, stepped by the scheduler while there are members
+            Gather                gather;
+            Index *               indexes;
+            Search *              searches;
+            uint32_t              searchCount;   // of each of indexes and searches
+
+            // Written by gather() only; read-only in the other phases
+            SpatialHash           grid;
+            std::vector<entry_t>  snapshot;   // members as of the grid, indexed by grid id
+            std::vector<float>    positions;
+            float                 searchRadius;
+
+            // Touched by gather() only
+            std::vector<contact_t> contacts;
+            std::vector<contact_t> previous;
+
+        } state_t;
+
+        static state_t & state(void)
+        {
+            static state_t * s = new state_t();
+            return *s;
+        }
+
+        static uint64_t pairKey(uint32_t a, uint32_t b)
+        {
+            return a < b ? (uint64_t)a << 32 | b : (uint64_t)b << 32 | a;
+        }
+
+        static bool keyLess(const contact_t & a, const contact_t & b)
+        {
+            return a.key < b.key;
+        }
+
+        static void notify(const entry_t & a, const entry_t & b, const contact_t & contact)
+        {
+            event_t event = {};
+            event.type = contact.level > 1 ? EVENT_COLLISION : EVENT_NEAR_MISS;
+            event.distance = contact.distance;
+
+            event.other = b.id;
+            a.member->swarmEvent(event);
+
+            event.other = a.id;
+            b.member->swarmEvent(event);
+        }
+
+        // Turns the last search's pairs into events for pairs that have come closer since the tick before
+        static void report(state_t & s)
+        {
+            s.contacts.clear();
+
+            for (uint32_t k=0; k<s.searchCount; ++k) {
+
+                for (const SpatialHash::pair_t & pair : s.searches[k].pairs) {
+
+                    const entry_t & a = s.snapshot[pair.a];
+                    const entry_t & b = s.snapshot[pair.b];
+
+                    // Removed since the search
+                    if (!a.member || !b.member) {
+                        continue;
+                    }
+
+                    float touching = a.radius + b.radius;
+
+                    // Still further apart than their near-miss range
+                    if (pair.distance > touching + s.nearMiss) {
+                        continue;
+                    }
+
+                    contact_t contact = {pairKey(a.id, b.id), (uint8_t)(pair.distance <= touching ? 2 : 1), pair.a, pair.b, pair.distance};
+                    s.contacts.push_back(contact);
+                }
+            }
+
+            std::sort(s.contacts.begin(), s.contacts.end(), keyLess);
+
+            // Both lists sorted by key, so one walk finds each pair's level on the tick before
+            size_t prior = 0;
+
+            for (const contact_t & contact : s.contacts) {
+
+                while (prior < s.previous.size() && s.previous[prior].key < contact.key) {
+                    prior++;
+                }
+
+                uint8_t priorLevel = prior < s.previous.size() && s.previous[prior].key == contact.key ? s.previous[prior].level : 0;
+
+                if (contact.level > priorLevel) {
+                    notify(s.snapshot[contact.a], s.snapshot[contact.b], contact);
+                }
+            }
+
+            s.previous.swap(s.contacts);
+        }
+
+        static void gather(void)
+        {
+            TRACE_SCOPE("SwarmProximity::gather");
+
+            state_t & s = state();
+
+            std::lock_guard<std::mutex> lock(s.mutex);
+
+            report(s);
+
+            // Copied only when add() or remove() has changed the members
+            if (s.membersChanged) {
+                s.snapshot.assign(s.members.begin(), s.members.end());
+                s.membersChanged = false;
+            }
+
+            uint32_t count = (uint32_t)s.snapshot.size();
+
+            s.positions.resize(3 * count);
+
+            float maxRadius = 0;
+
+            for (uint32_t k=0; k<count; ++k) {
+                s.snapshot[k].member->getSwarmPosition(&s.positions[3*k]);
+                maxRadius = std::max(maxRadius, s.snapshot[k].radius);
+            }
+
+            // Cells twice the search radius, so each search looks at no more than eight
+            s.searchRadius = 2 * maxRadius + s.nearMiss;
+            s.grid.setCellSize(2 * s.searchRadius);
+
+            // The Index tasks scatter the grid, one part each
+            s.grid.prepare(s.positions.data(), count, s.searchCount);
+        }
+
+        static void search(Search & search)
+        {
+            TRACE_SCOPE("SwarmProximity::search");
+
+            state_t & s = state();
+
+            uint32_t count = s.grid.size();
+
+            search.pairs.clear();
+
+            s.grid.pairs(s.searchRadius, search.pairs,
+                    (uint32_t)((uint64_t)count * search.share / s.searchCount),
+                    (uint32_t)((uint64_t)count * (search.share+1) / s.searchCount));
+        }
+
+    public:
+
+        /**
+         * Adds a vehicle to the swarm.  Safe to call from any thread but the scheduler's.
+         * @param member the vehicle
+         * @param radius of its bounding sphere, meters
+         * @return id by which other members' events will refer to it
+         */
+        static uint32_t add(Member * member, double radius)
+        {
+            state_t & s = state();
+
+            std::lock_guard<std::mutex> registrationLock(s.registration);
+
+            entry_t entry = {};
+
+            {
+                std::lock_guard<std::mutex> lock(s.mutex);
+
+                if (!s.searches) {
+
+                    double nearMiss = DEFAULT_NEAR_MISS;
+                    PlatformOptions::get("simnearmiss=", nearMiss);
+                    s.nearMiss = (float)nearMiss;
+
+                    s.searchCount = PhysicsScheduler::getWorkerCount();
+                    s.indexes = new Index[s.searchCount];
+                    s.searches = new Search[s.searchCount];
+
+                    for (uint32_t k=0; k<s.searchCount; ++k) {
+                        s.indexes[k].share = k;
+                        s.searches[k].share = k;
+                    }
+                }
+
+                entry.member = member;
+                entry.id = s.nextId++;
+                entry.radius = (float)radius;
+
+                s.members.push_back(entry);
+                s.membersChanged = true;
+            }
+
+            // Outside the lock, which the gather task takes
+            if (!s.registered) {
+
+                PhysicsScheduler::add(&s.gather, PhysicsScheduler::PHASE_GATHER);
+
+                for (uint32_t k=0; k<s.searchCount; ++k) {
+                    PhysicsScheduler::add(&s.indexes[k], PhysicsScheduler::PHASE_INDEX);
+                    PhysicsScheduler::add(&s.searches[k], PhysicsScheduler::PHASE_PROCESS);
+                }
+
+                s.registered = true;
+            }
+
+            return entry.id;
+        }
+
+        /**
+         * Removes a vehicle from the swarm, returning once no scheduler thread
+         * will call it.  Safe to call from any thread but the scheduler's.
+         */
+        static void remove(Member * member)
+        {
+            state_t & s = state();
+
+            std::lock_guard<std::mutex> registrationLock(s.registration);
+
+            bool empty = false;
+
+            {
+                std::lock_guard<std::mutex> lock(s.mutex);
+
+                for (size_t k=0; k<s.members.size(); ++k) {
+                    if (s.members[k].member == member) {
+                        s.members.erase(s.members.begin() + k);
+                        s.membersChanged = true;
+                        break;
+                    }
+                }
+
+                for (entry_t & entry : s.snapshot) {
+                    if (entry.member == member) {
+                        entry.member = NULL;
+                    }
+                }
+
+                empty = s.members.empty();
+            }
+
+            // Stop ticking for an empty swarm, so an idle scheduler can sleep
+            if (empty && s.registered) {
+
+                PhysicsScheduler::remove(&s.gather);
+
+                for (uint32_t k=0; k<s.searchCount; ++k) {
+                    PhysicsScheduler::remove(&s.indexes[k]);
+                    PhysicsScheduler::remove(&s.searches[k]);
+                }
+
+                s.registered = false;
+            }
+        }
+
+        /**
+         * Finds the vehicles near a position as of the end of the previous
+         * tick.  Call only from a task stepped in PhysicsScheduler::PHASE_STEP,
+         * while nothing else changes the grid.
+         * @param center x,y,z in meters, Z up
+         * @param radius meters
+         * @param ids output: ids of the vehicles found
+         * @param maxIds capacity of ids
+         * @return number of vehicles found, which may exceed maxIds
+         */
+        static uint32_t neighbors(const float center[3], float radius, uint32_t * ids, uint32_t maxIds)
+        {
+            state_t & s = state();
+
+            uint32_t found = s.grid.query(center, radius, ids, maxIds);
+
+            // Grid ids => member ids
+            for (uint32_t k=0; k<found && k<maxIds; ++k) {
+                ids[k] = s.snapshot[ids[k]].id;
+            }
+
+            return found;
+        }
+
+}; // class SwarmProximity
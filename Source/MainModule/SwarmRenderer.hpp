@@ -0,0 +1,351 @@
+/*
+ * Instanced rendering for large MulticopterSim swarms
+ *
+ * Draws the parts of every swarm-rendered vehicle as instances, with one
+ * instanced static-mesh component per part mesh (frame, prop, motor, ...),
+ * instead of each vehicle moving a dozen or so components of its own.
+ * Vehicles hand in their poses as they tick; once every vehicle has ticked,
+ * each part mesh's instance transforms are updated in a single batched call.
+ *
+ * The components are plain rather than hierarchical instanced static meshes:
+ * every instance moves every frame, and a hierarchical component would
+ * rebuild its cluster tree each time.
+ *
+ * Props spin in the prop material when it supports it: each prop instance
+ * carries its spin in per-instance custom data 0, in turns per second and
+ * signed by rotor direction, for a world-position-offset rotation about the
+ * instance's Z axis (e.g., RotateAboutAxis with angle = spin * Time).
+ * Otherwise the spin is folded into the prop instances' batched transforms.
+ *
+ * Options: -simswarmrender turns swarm rendering on for multirotors;
+ * -simpropwpo says the prop materials spin the props themselves.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "Components/InstancedStaticMeshComponent.h"
+
+#include "SimStats.hpp"
+
+class SwarmRenderer {
+
+    public:
+
+        // Prop spin while motors are running, turns per second; 200 degrees per frame at 60 fps, as before
+        static constexpr float PROP_SPIN = 33.3f;
+
+    private:
+
+        typedef struct {
+
+            uint32_t   vehicle;    // index into _vehicles
+            FTransform relative;   // to the vehicle's frame
+            float      direction;  // props: +1 or -1 by rotor direction
+
+        } instance_t;
+
+        // All instances of one part mesh
+        typedef struct {
+
+            UStaticMesh *                   mesh;
+            bool                            prop;
+            UInstancedStaticMeshComponent * component;
+            TArray<instance_t>              instances;
+            TArray<FTransform>              transforms;   // world, parallel to instances
+            bool                            changed;      // instances added or removed since the last flush
+
+        } batch_t;
+
+        typedef struct {
+
+            FTransform pose;
+            float      propSpin;    // turns per second
+            float      propAngle;   // degrees, when spin goes into the transforms
+            bool       active;
+
+        } vehicle_t;
+
+        // Runs flush() once a frame, after the vehicles have ticked
+        class FlushTick : public FTickFunction {
+
+            public:
+
+                SwarmRenderer * renderer = NULL;
+
+                virtual void ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread,
+                        const FGraphEventRef & MyCompletionGraphEvent) override
+                {
+                    renderer->flush(DeltaTime);
+                }
+
+                virtual FString DiagnosticMessage(void) override
+                {
+                    return TEXT("SwarmRenderer::flush");
+                }
+
+        }; // class FlushTick
+
+        AActor * _actor = NULL;
+
+        FlushTick _tick;
+
+        bool _propMaterialSpins = false;
+
+        // TArray rather than std::vector, which need not honor FTransform's alignment
+        TArray<batch_t>   _batches;
+        TArray<vehicle_t> _vehicles;
+        TArray<uint32_t>  _freeVehicles;
+        uint32_t          _activeCount = 0;
+
+        // One renderer at a time, for the world the swarm-rendered vehicles are in
+        static SwarmRenderer *& current(void)
+        {
+            static SwarmRenderer * renderer;
+            return renderer;
+        }
+
+        SwarmRenderer(UWorld * world)
+        {
+            _propMaterialSpins = FParse::Param(FCommandLine::Get(), TEXT("simpropwpo"));
+
+            // Instances are in world space, so the components stay at the origin
+            _actor = world->SpawnActor<AActor>();
+            USceneComponent * root = NewObject<USceneComponent>(_actor);
+            _actor->SetRootComponent(root);
+            root->RegisterComponent();
+
+            _tick.renderer = this;
+            _tick.bCanEverTick = true;
+            _tick.bStartWithTickEnabled = true;
+            _tick.TickGroup = TG_PostUpdateWork;
+            _tick.RegisterTickFunction(world->PersistentLevel);
+        }
+
+        ~SwarmRenderer(void)
+        {
+            _tick.UnRegisterTickFunction();
+
+            _actor->Destroy();
+        }
+
+        batch_t & getBatch(UStaticMeshComponent * part, bool prop)
+        {
+            UStaticMesh * mesh = part->GetStaticMesh();
+
+            for (batch_t & batch : _batches) {
+                if (batch.mesh == mesh && batch.prop == prop) {
+                    return batch;
+                }
+            }
+
+            UInstancedStaticMeshComponent * component = NewObject<UInstancedStaticMeshComponent>(_actor);
+            component->SetStaticMesh(mesh);
+            component->SetMobility(EComponentMobility::Movable);
+            component->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+            component->SetupAttachment(_actor->GetRootComponent());
+
+            // Materials as on the first vehicle's part
+            for (int32 k=0; k<part->GetNumMaterials(); ++k) {
+                component->SetMaterial(k, part->GetMaterial(k));
+            }
+
+            if (prop && _propMaterialSpins) {
+                component->SetNumCustomDataFloats(1);
+            }
+
+            component->RegisterComponent();
+
+            batch_t batch = {};
+            batch.mesh = mesh;
+            batch.prop = prop;
+            batch.component = component;
+
+            return _batches[_batches.Add(batch)];
+        }
+
+        void addPart(uint32_t vehicle, UStaticMeshComponent * part, const FTransform & frameTransform, float direction)
+        {
+            batch_t & batch = getBatch(part, direction != 0);
+
+            instance_t instance = {vehicle, part->GetComponentTransform().GetRelativeTransform(frameTransform), direction};
+            batch.instances.Add(instance);
+            batch.changed = true;
+        }
+
+        void flush(float deltaSeconds)
+        {
+            SCOPE_CYCLE_COUNTER(STAT_SwarmRender);
+
+            if (!_propMaterialSpins) {
+                for (vehicle_t & vehicle : _vehicles) {
+                    vehicle.propAngle = FMath::Fmod(vehicle.propAngle + 360 * vehicle.propSpin * deltaSeconds, 360.f);
+                }
+            }
+
+            for (batch_t & batch : _batches) {
+
+                int32 count = batch.instances.Num();
+
+                batch.transforms.SetNum(count, false);
+
+                for (int32 k=0; k<count; ++k) {
+
+                    const instance_t & instance = batch.instances[k];
+                    const vehicle_t & vehicle = _vehicles[instance.vehicle];
+
+                    if (batch.prop && !_propMaterialSpins) {
+                        FTransform spun(FRotator(0, vehicle.propAngle * instance.direction, 0));
+                        batch.transforms[k] = spun * instance.relative * vehicle.pose;
+                    }
+                    else {
+                        batch.transforms[k] = instance.relative * vehicle.pose;
+                    }
+                }
+
+                // Added or removed instances are rare, so just start over
+                if (batch.changed) {
+                    batch.component->ClearInstances();
+                    for (const FTransform & transform : batch.transforms) {
+                        batch.component->AddInstanceWorldSpace(transform);
+                    }
+                    batch.changed = false;
+                }
+
+                if (batch.prop && _propMaterialSpins) {
+                    for (int32 k=0; k<count; ++k) {
+                        const instance_t & instance = batch.instances[k];
+                        batch.component->SetCustomDataValue(k, 0, _vehicles[instance.vehicle].propSpin * instance.direction, false);
+                    }
+                }
+
+                if (count > 0) {
+                    batch.component->BatchUpdateInstancesTransforms(0, batch.transforms, true, true, true);
+                }
+            }
+        }
+
+    public:
+
+        // True when swarm rendering was asked for on the command line
+        static bool enabled(void)
+        {
+            return FParse::Param(FCommandLine::Get(), TEXT("simswarmrender"));
+        }
+
+        /**
+         * Starts drawing a vehicle as instances: its frame, and every visible
+         * static mesh attached below the frame.  The frame component is hidden,
+         * keeping its collision; the other parts are detached and unregistered,
+         * so that moving the vehicle no longer moves them.  Call from the game thread.
+         * @param frame the vehicle's root mesh
+         * @param props prop components, which spin
+         * @param propDirections +1 or -1 for each prop
+         * @param propCount number of props
+         * @return id for setPose() and remove()
+         */
+        static uint32_t add(UStaticMeshComponent * frame, UStaticMeshComponent ** props, const int8_t * propDirections, uint8_t propCount)
+        {
+            SwarmRenderer *& renderer = current();
+
+            if (!renderer) {
+                renderer = new SwarmRenderer(frame->GetWorld());
+            }
+
+            uint32_t id = 0;
+
+            if (renderer->_freeVehicles.Num() == 0) {
+                id = (uint32_t)renderer->_vehicles.AddDefaulted();
+            }
+            else {
+                id = renderer->_freeVehicles.Pop();
+            }
+
+            vehicle_t & vehicle = renderer->_vehicles[id];
+            vehicle.pose = frame->GetComponentTransform();
+            vehicle.propSpin = 0;
+            vehicle.propAngle = 0;
+            vehicle.active = true;
+            renderer->_activeCount++;
+
+            FTransform frameTransform = frame->GetComponentTransform();
+
+            renderer->addPart(id, frame, frameTransform, 0);
+
+            TArray<USceneComponent *> children;
+            frame->GetChildrenComponents(true, children);
+
+            for (USceneComponent * child : children) {
+
+                UStaticMeshComponent * part = Cast<UStaticMeshComponent>(child);
+
+                if (!part || !part->GetStaticMesh() || !part->IsVisible()) {
+                    continue;
+                }
+
+                float direction = 0;
+                for (uint8_t k=0; k<propCount; ++k) {
+                    if (props[k] == part) {
+                        direction = propDirections[k] < 0 ? -1.f : +1.f;
+                    }
+                }
+
+                renderer->addPart(id, part, frameTransform, direction);
+
+                part->DetachFromComponent(FDetachmentTransformRules::KeepRelativeTransform);
+                part->UnregisterComponent();
+            }
+
+            frame->SetVisibility(false, false);
+
+            return id;
+        }
+
+        /**
+         * Sets a vehicle's pose and prop spin for this frame's flush.  Call from the game thread.
+         * @param id from add()
+         * @param pose frame's world transform
+         * @param propSpin turns per second
+         */
+        static void setPose(uint32_t id, const FTransform & pose, float propSpin)
+        {
+            vehicle_t & vehicle = current()->_vehicles[id];
+
+            vehicle.pose = pose;
+            vehicle.propSpin = propSpin;
+        }
+
+        // Stops drawing a vehicle; the last one out takes the renderer with it.  Call from the game thread.
+        static void remove(uint32_t id)
+        {
+            SwarmRenderer *& renderer = current();
+
+            for (batch_t & batch : renderer->_batches) {
+
+                // Keeps the order of the other instances
+                if (batch.instances.RemoveAll([id](const instance_t & instance) { return instance.vehicle == id; }) > 0) {
+                    batch.changed = true;
+                }
+            }
+
+            renderer->_vehicles[id].active = false;
+            renderer->_freeVehicles.Add(id);
+
+            if (--renderer->_activeCount == 0) {
+                delete renderer;
+                renderer = NULL;
+            }
+        }
+
+        // Vehicles being drawn as instances
+        static uint32_t getVehicleCount(void)
+        {
+            return current() ? current()->_activeCount : 0;
+        }
+
+}; // class SwarmRenderer
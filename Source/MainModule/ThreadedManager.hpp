@@ -8,16 +8,33 @@
 
 #pragma once
 
-#include "Runnable.h"
-#include "Utils.hpp"
+#include <stdint.h>
+#include <atomic>
 
-class FThreadedManager : public FRunnable {
+#include "Platform.hpp"
+#include "LoopStats.hpp"
+#include "Trace.hpp"
+#include "PhysicsScheduler.hpp"
+#include "FlightRecorder.hpp"
+
+class FThreadedManager : public PlatformThread, public PhysicsScheduler::Task {
+
+    public:
+
+        typedef enum {
+
+            MODE_SCHEDULED,   // stepped by the shared PhysicsScheduler at its fixed rate
+            MODE_THREAD,      // own thread, looping as fast as it can; for tasks that block
+            MODE_MANUAL       // owner calls iterate(), e.g. faster than real time with a simulated clock
+
+        } mode_t;
 
     private:
 
-        FRunnableThread * _thread = NULL;
+        mode_t _mode = MODE_SCHEDULED;
 
-        bool _running = false;
+        // Cleared by Stop() to end the thread loop
+        std::atomic<bool> _running;
 
         // Start-time offset so timing begins at zero
         double _startTime = 0;
@@ -25,6 +42,12 @@ class FThreadedManager : public FRunnable {
         // For FPS reporting
         uint32_t _count;
 
+        // Loop-period min/mean/max, jitter histogram, overruns, longest stall
+        LoopStats _loopStats;
+
+        // Scheduled mode: left unstepped until polled awake or woken; touched only by scheduler threads
+        bool _asleep = false;
+
     protected:
 
         // Implemented differently by each subclass
@@ -32,24 +55,103 @@ class FThreadedManager : public FRunnable {
 
         uint32_t getFps(void)
         {
-            return (uint32_t)(_count/(FPlatformTime::Seconds()-_startTime));
+            return (uint32_t)(_count/(PlatformTime::seconds()-_startTime));
+        }
+
+        virtual void threadMain(void) override
+        {
+            // Label this thread in timeline traces
+            Trace::setThreadName("FThreadedManager");
+
+            // Allocate recorder buffer up front, so recording never allocates on this thread;
+            // called directly, since a virtual hook here would race with subclass constructors
+            FlightRecorder::attachThread();
+
+            // Initial wait before starting
+            PlatformTime::sleep(0.5);
+
+            while (_running) {
+
+                // Get a high-fidelity current time value from the OS
+                iterate(PlatformTime::seconds() - _startTime);
+            }
+        }
+
+        // Scheduled mode: checked after each iteration; return true to stop being stepped until poll() or wake()
+        virtual bool canSleep(void)
+        {
+            return false;
+        }
+
+        // Scheduled mode: called on waking, before the first iteration
+        virtual void resume(double currentTime)
+        {
+            (void)currentTime;
+        }
+
+        // Called by the scheduler on one of its threads
+        virtual bool step(double time) override
+        {
+            if (_asleep) {
+                _asleep = false;
+                _loopStats.resume();
+                resume(time);
+            }
+
+            // The tick's time is nominal, so measure the period from when the step actually runs
+            iterate(time, PlatformTime::seconds() - _startTime);
+
+            _asleep = canSleep();
+
+            return !_asleep;
+        }
+
+        // Called by the scheduler between ticks: budget each iteration for the new interval
+        virtual void tierChanged(uint8_t tier, double interval) override
+        {
+            (void)tier;
+            _loopStats.setBudget(interval);
+            _loopStats.resume();
         }
 
     public:
 
-        FThreadedManager(void)
+        /**
+         * @param mode how performTask() gets called; see mode_t
+         */
+        FThreadedManager(mode_t mode)
         {
-            _thread = FRunnableThread::Create(this, TEXT("FThreadedManage"), 0, TPri_BelowNormal); 
+            _mode = mode;
+
+            _running = true;
 
-            _startTime = FPlatformTime::Seconds();
+            _startTime = PlatformTime::seconds();
 
             _count = 0;
+
+            if (mode == MODE_THREAD) {
+                startThread("FThreadedManager");
+            }
+
+            // As with starting our own thread, the first step comes after a delay
+            // (PhysicsScheduler::START_DELAY) that lets the subclass finish constructing
+            if (mode == MODE_SCHEDULED) {
+                PhysicsScheduler::add(this);
+            }
         }
 
+        /**
+         * @param threaded true to have the physics scheduler call performTask() at its fixed
+         * rate; false to have the owner call iterate() instead
+         */
+        FThreadedManager(bool threaded=true)
+            : FThreadedManager(threaded ? MODE_SCHEDULED : MODE_MANUAL)
+        {
+        }
 
-        ~FThreadedManager()
+        virtual ~FThreadedManager()
         {
-            delete _thread;
+            Stop();
         }
 
         uint32_t getCount(void)
@@ -57,55 +159,94 @@ class FThreadedManager : public FRunnable {
             return _count;
         }
 
-        static void stopThread(FThreadedManager ** worker)
+        mode_t getMode(void)
         {
-            if (*worker) {
-                (*worker)->Stop();
-                delete *worker;
-            }
-
-            *worker = NULL;
+            return _mode;
         }
 
-        // FRunnable interface.
+        // Scheduled mode: if asleep, steps again from the next tick; safe to call from any thread
+        void wake(void)
+        {
+            if (_mode == MODE_SCHEDULED) {
+                PhysicsScheduler::wake(this);
+            }
+        }
 
-        virtual bool Init() override
+        /**
+         * Scheduled mode: sets how often performTask() is called, from the next
+         * tick on.  Safe to call from any thread.
+         * @param tier see PhysicsScheduler::tier_t
+         */
+        void setTier(PhysicsScheduler::tier_t tier)
         {
-            _running = false;
+            if (_mode == MODE_SCHEDULED) {
+                PhysicsScheduler::setTier(this, tier);
+            }
+        }
 
-			return FRunnable::Init();
+        // Safe to call from any thread
+        const LoopStats & getLoopStats(void)
+        {
+            return _loopStats;
         }
 
-        virtual uint32_t Run() override
+        void setLoopBudget(double seconds)
         {
-            // Initial wait before starting
-            FPlatformProcess::Sleep(0.5);
+            _loopStats.setBudget(seconds);
+        }
 
-            _running = true;
+        /**
+         * Runs one iteration of the task; called repeatedly by the thread, or directly when unthreaded.
+         * @param currentTime seconds since start
+         */
+        void iterate(double currentTime)
+        {
+            // Measure period since previous iteration, reusing the time value passed in
+            iterate(currentTime, currentTime);
+        }
 
-            while (_running) {
+        /**
+         * Runs one iteration of the task.
+         * @param currentTime seconds since start, passed to the task
+         * @param measuredTime seconds since start by the clock, for the loop statistics
+         */
+        void iterate(double currentTime, double measuredTime)
+        {
+            _loopStats.update(measuredTime);
 
-                // Get a high-fidelity current time value from the OS
-                double currentTime = FPlatformTime::Seconds() - _startTime;
+            // Pass current time to task implementation
+            performTask(currentTime);
 
-                // Pass current time to task implementation
-                performTask(currentTime);
+            // Increment count for FPS reporting
+            _count++;
+        }
 
-                // Increment count for FPS reporting
-                _count++;
+        static void stopThread(FThreadedManager ** worker)
+        {
+            if (*worker) {
+                (*worker)->Stop();
+                delete *worker;
             }
 
-			return 0;
+            *worker = NULL;
         }
 
-        virtual void Stop() override
+        void Stop(void)
         {
-            _running = false;
+            if (!_running.exchange(false)) {
+                return;
+            }
 
-            // Final wait after stopping
-            FPlatformProcess::Sleep(0.03);
+            // Wait for current iteration to finish
+            if (_mode == MODE_SCHEDULED) {
+                PhysicsScheduler::remove(this);
+            }
+            else {
+                joinThread();
+            }
 
-			FRunnable::Stop();
+            // Final wait after stopping
+            PlatformTime::sleep(0.03);
         }
 
-}; // class FThreadedManage
+}; // class FThreadedManager
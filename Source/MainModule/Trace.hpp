@@ -0,0 +1,329 @@
+/*
+ * Header-only timeline tracing for MulticopterSim threads
+ *
+ * Scoped events are written by each thread into its own lock-free ring
+ * buffer and flushed by a background thread to a Chrome Trace Event JSON
+ * file, which can be opened in chrome://tracing or https://ui.perfetto.dev.
+ *
+ * Usage:
+ *
+ *   Trace::start("sim.trace.json");
+ *   ...
+ *   { TRACE_SCOPE("Dynamics::update"); ... }
+ *   ...
+ *   Trace::stop();
+ *
+ * When tracing is off, a scope costs one relaxed atomic load.  Event names
+ * must be string literals (or otherwise outlive the trace).  The file uses
+ * the JSON Array Format, whose closing bracket is optional, so a trace cut
+ * short by quitting the sim is still readable.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Trace {
+
+    private:
+
+        typedef struct {
+
+            const char * name;
+            uint64_t     begin; // steady-clock nanoseconds
+            uint64_t     end;
+
+        } event_t;
+
+        // Single-producer (traced thread), single-consumer (flusher) ring
+        class Buffer {
+
+            public:
+
+                static const uint32_t CAPACITY = 1<<14; // power of two
+
+                event_t events[CAPACITY];
+
+                std::atomic<uint32_t> head; // written by producer
+                std::atomic<uint32_t> tail; // written by consumer
+                std::atomic<uint32_t> dropped;
+
+                uint32_t    threadId = 0;
+                const char * threadName = NULL;
+                bool        named = false;
+
+                Buffer(uint32_t id)
+                {
+                    head = 0;
+                    tail = 0;
+                    dropped = 0;
+                    threadId = id;
+                }
+
+                void push(const char * name, uint64_t begin, uint64_t end)
+                {
+                    uint32_t h = head.load(std::memory_order_relaxed);
+
+                    if (h - tail.load(std::memory_order_acquire) >= CAPACITY) {
+                        dropped.store(dropped.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+                        return;
+                    }
+
+                    event_t & e = events[h & (CAPACITY-1)];
+                    e.name = name;
+                    e.begin = begin;
+                    e.end = end;
+
+                    head.store(h+1, std::memory_order_release);
+                }
+
+        }; // class Buffer
+
+        // Flush interval for background writer
+        static constexpr double FLUSH_PERIOD = 0.1;
+
+        // Process-wide state, held in function-local statics so this can stay header-only
+        typedef struct {
+
+            std::atomic<bool>      enabled;
+            std::atomic<bool>      flushing;
+            std::mutex             mutex;     // guards buffers list and file; never taken on hot path
+            std::vector<Buffer *>  buffers;   // never freed: threads may outlive a trace session
+            std::thread            flusher;
+            FILE *                 file;
+            bool                   firstEvent;
+            uint64_t               epoch;     // steady-clock nanoseconds at start; read and written with mutex held
+
+        } state_t;
+
+        // Never freed, so that a session still running at exit doesn't destroy a joinable flusher
+        static state_t & state(void)
+        {
+            static state_t * s = new state_t();
+            return *s;
+        }
+
+        static Buffer * & localBuffer(void)
+        {
+            static thread_local Buffer * buffer = NULL;
+            return buffer;
+        }
+
+        static const char * & localName(void)
+        {
+            static thread_local const char * name = NULL;
+            return name;
+        }
+
+        // Buffers are allocated on a thread's first traced event, so untraced threads cost nothing
+        static Buffer * getBuffer(void)
+        {
+            Buffer * & buffer = localBuffer();
+
+            if (!buffer) {
+                state_t & s = state();
+                std::lock_guard<std::mutex> lock(s.mutex);
+                buffer = new Buffer((uint32_t)s.buffers.size() + 1);
+                buffer->threadName = localName();
+                s.buffers.push_back(buffer);
+            }
+
+            return buffer;
+        }
+
+        // Called with mutex held
+        static void drain(state_t & s)
+        {
+            for (Buffer * b : s.buffers) {
+
+                if (b->threadName && !b->named) {
+                    fprintf(s.file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}\n",
+                            s.firstEvent ? "" : ",", b->threadId, b->threadName);
+                    s.firstEvent = false;
+                    b->named = true;
+                }
+
+                uint32_t t = b->tail.load(std::memory_order_relaxed);
+                uint32_t h = b->head.load(std::memory_order_acquire);
+
+                for (; t != h; ++t) {
+
+                    const event_t & e = b->events[t & (Buffer::CAPACITY-1)];
+
+                    // Begun before this session started
+                    if (e.begin < s.epoch) {
+                        continue;
+                    }
+
+                    fprintf(s.file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}\n",
+                            s.firstEvent ? "" : ",", e.name, b->threadId, (e.begin-s.epoch)/1e3, (e.end-e.begin)/1e3);
+                    s.firstEvent = false;
+                }
+
+                b->tail.store(t, std::memory_order_release);
+            }
+        }
+
+        static void flushLoop(void)
+        {
+            state_t & s = state();
+
+            while (s.flushing.load(std::memory_order_relaxed)) {
+
+                std::this_thread::sleep_for(std::chrono::duration<double>(FLUSH_PERIOD));
+
+                std::lock_guard<std::mutex> lock(s.mutex);
+                drain(s);
+            }
+        }
+
+    public:
+
+        /**
+         * Starts tracing to a file, or restarts it if already running.
+         * @param filename Chrome Trace Event JSON output file
+         * @return true on success, false if file could not be opened
+         */
+        static bool start(const char * filename)
+        {
+            stop();
+
+            state_t & s = state();
+
+            {
+                std::lock_guard<std::mutex> lock(s.mutex);
+
+                s.file = fopen(filename, "w");
+                if (!s.file) {
+                    return false;
+                }
+
+                // Discard anything left over from a previous session
+                for (Buffer * b : s.buffers) {
+                    b->tail.store(b->head.load(std::memory_order_acquire), std::memory_order_release);
+                    b->dropped = 0;
+                    b->named = false;
+                }
+
+                fprintf(s.file, "[\n");
+                s.firstEvent = true;
+                s.epoch = now();
+            }
+
+            s.flushing = true;
+            s.flusher = std::thread(flushLoop);
+
+            s.enabled.store(true, std::memory_order_release);
+
+            return true;
+        }
+
+        /**
+         * Stops tracing, flushing any remaining events and closing the file.
+         */
+        static void stop(void)
+        {
+            state_t & s = state();
+
+            if (!s.enabled.exchange(false)) {
+                return;
+            }
+
+            s.flushing = false;
+            if (s.flusher.joinable()) {
+                s.flusher.join();
+            }
+
+            std::lock_guard<std::mutex> lock(s.mutex);
+
+            drain(s);
+
+            fprintf(s.file, "]\n");
+            fclose(s.file);
+            s.file = NULL;
+        }
+
+        static bool enabled(void)
+        {
+            return state().enabled.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Names the calling thread in the timeline.
+         * @param name string literal
+         */
+        static void setThreadName(const char * name)
+        {
+            localName() = name;
+
+            if (localBuffer()) {
+                localBuffer()->threadName = name;
+            }
+        }
+
+        // Events dropped because a ring buffer was full
+        static uint32_t droppedCount(void)
+        {
+            state_t & s = state();
+            std::lock_guard<std::mutex> lock(s.mutex);
+            uint32_t count = 0;
+            for (Buffer * b : s.buffers) {
+                count += b->dropped.load(std::memory_order_relaxed);
+            }
+            return count;
+        }
+
+        // Steady-clock nanoseconds; events are stamped with this and made relative to the session's start when written
+        static uint64_t now(void)
+        {
+            return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        static void record(const char * name, uint64_t begin, uint64_t end)
+        {
+            getBuffer()->push(name, begin, end);
+        }
+
+}; // class Trace
+
+class TraceScope {
+
+    private:
+
+        const char * _name = NULL;
+        uint64_t     _begin = 0;
+
+    public:
+
+        TraceScope(const char * name)
+        {
+            if (Trace::enabled()) {
+                _name = name;
+                _begin = Trace::now();
+            }
+        }
+
+        ~TraceScope(void)
+        {
+            // Skip events whose session ended while they were open
+            if (_name && Trace::enabled()) {
+                Trace::record(_name, _begin, Trace::now());
+            }
+        }
+
+}; // class TraceScope
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(_traceScope, __LINE__)(name)
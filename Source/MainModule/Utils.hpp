@@ -23,12 +23,14 @@
 #define SPRINTF sprintf
 #endif
 
+#ifndef MULTICOPTERSIM_NATIVE
 static const FName makeName(const char * prefix, const uint8_t index, const char * suffix="")
 {
     char name[200];
     SPRINTF(name, "%s%d%s", prefix, index+1, suffix);
     return FName(name);
 }
+#endif
 
 static void debug(const char * fmt, ...)
 {
@@ -50,6 +52,16 @@ static void debugline(const char * fmt, ...)
 	va_end(ap);
 }
 
+static void hud(const char * fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	char buf[400];
+	vsnprintf(buf, 400, fmt, ap);
+	osdHud(buf);
+	va_end(ap);
+}
+
 static void error(const char * fmt, ...)
 {
 	va_list ap;
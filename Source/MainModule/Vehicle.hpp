@@ -3,7 +3,8 @@
  *
  * This class peforms the following functions:
  *
- * (1) Statically builds meshes, cameras, and other UE4 objects
+ * (1) Statically builds cameras and other UE4 objects, with meshes streamed in
+ *     through the VehicleAssets manifest when a pawn is spawned
  *
  * (2) Provides basic support for displaying vehicle kinematics
  *
@@ -20,8 +21,16 @@
 #include "Dynamics.hpp"
 #include "FlightManager.hpp"
 #include "Camera.hpp"
+#include "Lidar.hpp"
+#include "SimStats.hpp"
+#include "PoseOutput.hpp"
+#include "Heightfield.hpp"
+#include "LevelObstacles.hpp"
+#include "SwarmRenderer.hpp"
+#include "VehicleAssets.hpp"
 
 #include "Runtime/Engine/Classes/Kismet/KismetMathLibrary.h"
+#include "Engine/LevelBounds.h"
 
 #include <stdio.h>
 
@@ -33,14 +42,142 @@
 #define SPRINTF sprintf
 #endif
 
-// A macro for simplifying the declaration of static meshes
+// A macro for simplifying the declaration of static meshes, which go into the
+// vehicle asset manifest rather than being loaded up front
 #define DECLARE_STATIC_MESH(structname, assetstr, objname)   \
     struct structname {                                             \
-        ConstructorHelpers::FObjectFinderOptional<UStaticMesh> mesh;   \
-        structname() : mesh(TEXT("/Game/MulticopterSim/Meshes/" assetstr)) { } \
+        VehicleAssets::Mesh mesh;                                      \
+        structname() : mesh(assetstr) { }                              \
     };                                                                     \
     static structname objname;
 
+// Displays pose kinematically by moving a pawn relative to its starting location
+class PawnPoseOutput : public PoseOutput {
+
+    private:
+
+        APawn * _pawn = NULL;
+
+        FVector _startLocation = {};
+
+    public:
+
+        void begin(APawn * pawn)
+        {
+            _pawn = pawn;
+            _startLocation = pawn->GetActorLocation();
+        }
+
+        virtual void setPose(const double location[3], const double rotation[3]) override
+        {
+            // m => cm; negate Z for NED
+            _pawn->SetActorLocation(_startLocation + 100 * FVector(location[0], location[1], -location[2]));
+
+            _pawn->SetActorRotation(FMath::RadiansToDegrees(FRotator(rotation[1], rotation[2], rotation[0])));
+        }
+
+}; // class PawnPoseOutput
+
+// Samples heightfield tiles with line traces against static world geometry
+class TraceHeightfieldSource : public HeightfieldSource {
+
+    private:
+
+        APawn * _pawn = NULL;
+
+        double _top = 0;
+        double _bottom = 0;
+
+        // Rows of samples traced per getTile() call; zero for the whole tile
+        uint32_t _rowsPerCall = 0;
+
+        // Tile being traced over several calls
+        int32_t  _tx = 0;
+        int32_t  _ty = 0;
+        uint32_t _nextRow = 0;
+        bool     _busy = false;
+        float    _samples[Heightfield::TILE_SAMPLES] = {};
+
+    public:
+
+        /**
+         * @param pawn pawn to be ignored by traces
+         * @param top world Z in meters from which traces start, above everything in the level
+         * @param bottom world Z in meters at which traces give up looking for ground
+         */
+        void begin(APawn * pawn, double top, double bottom)
+        {
+            _pawn = pawn;
+            _top = top;
+            _bottom = bottom;
+            _busy = false;
+        }
+
+        /**
+         * Spreads each tile over several getTile() calls, bounding the traces per call.
+         * @param rows rows of samples per call; zero for the whole tile at once
+         */
+        void setRowsPerCall(uint32_t rows)
+        {
+            _rowsPerCall = rows;
+        }
+
+        virtual bool getTile(int32_t tx, int32_t ty, double spacing, uint32_t cells, float * heights) override
+        {
+            if (cells != Heightfield::TILE_CELLS) {
+                return false;
+            }
+
+            // A different tile is wanted now: what was traced of the last one is dropped
+            if (!_busy || tx != _tx || ty != _ty) {
+                _tx = tx;
+                _ty = ty;
+                _nextRow = 0;
+                _busy = true;
+            }
+
+            FCollisionQueryParams traceParams(FName(TEXT("Heightfield Trace")), false, _pawn);
+            FCollisionObjectQueryParams objectParams(ECC_WorldStatic);
+
+            uint32_t lastRow = _rowsPerCall > 0 && _nextRow + _rowsPerCall <= cells ? _nextRow + _rowsPerCall : cells + 1;
+
+            for (uint32_t j=_nextRow; j<lastRow; ++j) {
+
+                for (uint32_t i=0; i<=cells; ++i) {
+
+                    // m => cm
+                    double x = 100 * ((double)tx * cells + i) * spacing;
+                    double y = 100 * ((double)ty * cells + j) * spacing;
+
+                    FVector startPoint(x, y, 100 * _top);
+                    FVector endPoint(x, y, 100 * _bottom);
+
+                    FHitResult hit;
+                    _samples[j*(cells+1) + i] = _pawn->GetWorld()->LineTraceSingleByObjectType(hit, startPoint, endPoint, objectParams, traceParams) ?
+                        hit.ImpactPoint.Z / 100 : NAN;
+                }
+            }
+
+            _nextRow = lastRow;
+
+            if (_nextRow <= cells) {
+                return false;
+            }
+
+            _busy = false;
+
+            memcpy(heights, _samples, sizeof(_samples));
+
+            return true;
+        }
+
+        virtual bool busy(void) override
+        {
+            return _busy;
+        }
+
+}; // class TraceHeightfieldSource
+
 class Vehicle {
 
     private:
@@ -74,7 +211,6 @@ class Vehicle {
         static constexpr float SETTLING_TIME = 1.0;
 
         // UE4 objects that must be built statically
-        UStaticMesh* _frameMesh = NULL;
         UStaticMesh* _motorMesh = NULL;
         USoundCue* _soundCue = NULL;
         USpringArmComponent* _gimbalSpringArm = NULL;
@@ -89,40 +225,132 @@ class Vehicle {
         // PlayerController for getting keyboard events
         APlayerController * _playerController = NULL;
 
+        // Components whose meshes are streaming in, set once they have loaded
+        typedef struct {
+
+            UStaticMeshComponent *      component;
+            const VehicleAssets::Mesh * mesh;
+
+        } pending_mesh_t;
+
+        TArray<pending_mesh_t> _pendingMeshes;
+
+        TSharedPtr<FStreamableHandle> _meshLoad;
+
         // Cameras
         Camera* _cameras[Camera::MAX_CAMERAS];
-        uint8_t  _cameraCount;
+        uint8_t  _cameraCount = 0;
+
+        // LiDARs
+        Lidar * _lidars[Lidar::MAX_LIDARS];
+        uint8_t _lidarCount = 0;
 
         // For computing AGL
         float _aglOffset = 0;
 
+        // Terrain cached for AGL on the physics thread, paged in around the vehicle
+        static const int32_t HEIGHTFIELD_RADIUS = 1;      // tiles on each side of the vehicle's
+        static const uint32_t HEIGHTFIELD_TILES = 16;     // at least (2*radius+1)^2
+        static const int32_t HEIGHTFIELD_BAKE_RADIUS = 8; // tiles around the start baked into a new file
+        static const uint32_t HEIGHTFIELD_ROWS_PER_FRAME = 4; // rows of a tile traced per frame while paging
+        static constexpr double HEIGHTFIELD_DEPTH = 1e5;  // meters traced below the start without level bounds
+        Heightfield * _heightfield = NULL;
+        TraceHeightfieldSource _traceSource;
+        HeightfieldFile _heightfieldFile;
+        bool _heightfieldAgl = false;
+        double _heightfieldOffset = 0;  // start height above the terrain there, meters
+
         // Countdown for zeroing-out velocity during final phase of landing
         float _settlingCountdown = 0;
 
         // Starting location, for kinematic offset
         FVector _startLocation = {};
 
+        // Moves pawn to match dynamics
+        PawnPoseOutput _poseOutput;
+
+        // Optional heads-up display of sim performance, toggled by H key
+        bool _hudEnabled = false;
+
+        // For computing physics rate on the game thread
+        uint32_t _previousPhysicsCount = 0;
+
+        // Physics level of detail, chosen from the distance to the player's camera unless fixed
+        static constexpr float TIER_REDUCED_METERS = 50;
+        static constexpr float TIER_BACKGROUND_METERS = 200;
+        static constexpr float TIER_HYSTERESIS = 1.2f;  // distance ratio past a boundary before dropping a tier
+        PhysicsScheduler::tier_t _physicsTier = PhysicsScheduler::TIER_FULL;
+        PhysicsScheduler::tier_t _fixedPhysicsTier = PhysicsScheduler::TIER_FULL;
+        bool _physicsTierFixed = false;
+
+        static PhysicsScheduler::tier_t tierAtDistance(float meters)
+        {
+            return meters < TIER_REDUCED_METERS ? PhysicsScheduler::TIER_FULL :
+                meters < TIER_BACKGROUND_METERS ? PhysicsScheduler::TIER_REDUCED :
+                PhysicsScheduler::TIER_BACKGROUND;
+        }
+
+        void updatePhysicsTier(void)
+        {
+            PhysicsScheduler::tier_t tier = _physicsTier;
+
+            if (_physicsTierFixed) {
+                tier = _fixedPhysicsTier;
+            }
+
+            // A vehicle with cameras of its own needs full-rate poses for their images
+            else if (_cameraCount > 0) {
+                tier = PhysicsScheduler::TIER_FULL;
+            }
+
+            else if (_playerController->PlayerCameraManager) {
+
+                // cm => m
+                float meters = FVector::Dist(_playerController->PlayerCameraManager->GetCameraLocation(), _pawn->GetActorLocation()) / 100;
+
+                // Drop a tier only when a little past its boundary, so a vehicle hovering there keeps one rate
+                PhysicsScheduler::tier_t nearer = tierAtDistance(meters);
+                PhysicsScheduler::tier_t farther = tierAtDistance(meters / TIER_HYSTERESIS);
+
+                tier = farther > _physicsTier ? farther : nearer < _physicsTier ? nearer : _physicsTier;
+            }
+
+            if (tier != _physicsTier) {
+                _flightManager->setTier(tier);
+                _physicsTier = tier;
+            }
+        }
+
         // Retrieves kinematics from dynamics computed in another thread, returning true if vehicle is airborne, false otherwise.
         void updateKinematics(void)
         {
+            SCOPE_CYCLE_COUNTER(STAT_UpdateKinematics);
+
             // Set vehicle pose in animation
-            _pawn->SetActorLocation(_startLocation +
-                100 * FVector(_dynamics->x(Dynamics::STATE_X), 
-                              _dynamics->x(Dynamics::STATE_Y),
-                              -_dynamics->x(Dynamics::STATE_Z))); // Negate Z for NED
-            _pawn->SetActorRotation(
-                    FMath::RadiansToDegrees(FRotator(_dynamics->x(Dynamics::STATE_THETA),
-                                                     _dynamics->x(Dynamics::STATE_PSI),
-                                                     _dynamics->x(Dynamics::STATE_PHI))));
+            double location[3] = {};
+            double rotation[3] = {};
+            PoseOutput::fromDynamics(_dynamics, location, rotation);
+            _poseOutput.setPose(location, rotation);
         }
 
         void grabImages(void)
         {
+            SCOPE_CYCLE_COUNTER(STAT_GrabImages);
+
             for (uint8_t i = 0; i < _cameraCount; ++i) {
                 _cameras[i]->grabImage();
             }
         }
 
+        void scanLidars(void)
+        {
+            SCOPE_CYCLE_COUNTER(STAT_ScanLidars);
+
+            for (uint8_t i = 0; i < _lidarCount; ++i) {
+                _lidars[i]->scan();
+            }
+        }
+
         void buildPlayerCameras(float distanceMeters, float elevationMeters)
         {
             _bodyHorizontalSpringArm = _pawn->CreateDefaultSubobject<USpringArmComponent>(TEXT("BodyHorizontalSpringArm"));
@@ -209,17 +437,98 @@ class Vehicle {
         // Also set in constructor, but purely for visual effect
         int8_t _rotorDirections[FFlightManager::MAX_MOTORS] = {};
 
+        // Drawn by the SwarmRenderer instead of by our own components; props spin at _swarmPropSpin
+        bool _swarmRendered = false;
+        uint32_t _swarmRenderId = 0;
+        float _swarmPropSpin = 0;
+
         virtual void animateActuators(void) = 0;
 
+        // Vehicles whose only moving parts are spinning props can be swarm-rendered
+        virtual bool canSwarmRender(void)
+        {
+            return false;
+        }
+
+        void applyMeshes(void)
+        {
+            for (const pending_mesh_t & pending : _pendingMeshes) {
+                pending.component->SetStaticMesh(pending.mesh->resolve());
+            }
+
+            _pendingMeshes.Empty();
+        }
+
+        // Streams in this vehicle's meshes, unless they are in memory already
+        void requestMeshes(void)
+        {
+            TArray<FSoftObjectPath> paths;
+
+            for (const pending_mesh_t & pending : _pendingMeshes) {
+                if (!pending.mesh->resolve()) {
+                    paths.AddUnique(pending.mesh->getPath());
+                }
+            }
+
+            if (paths.Num() == 0) {
+                applyMeshes();
+                return;
+            }
+
+            _meshLoad = VehicleAssets::request(paths, FStreamableDelegate::CreateLambda([this]() { applyMeshes(); }));
+        }
+
+        // By BeginPlay() the meshes are needed for bounds, collision and swarm rendering
+        void finishMeshes(void)
+        {
+            if (_meshLoad.IsValid()) {
+                _meshLoad->WaitUntilComplete();
+            }
+
+            applyMeshes();
+        }
+
+        void cancelMeshes(void)
+        {
+            if (_meshLoad.IsValid()) {
+                _meshLoad->CancelHandle();
+                _meshLoad.Reset();
+            }
+
+            _pendingMeshes.Empty();
+        }
+
+    protected:
+
+        /**
+         * Gives a component its mesh.  A spawned vehicle's meshes are set once
+         * they have streamed in; the class default object, which is never
+         * drawn, gets none outside the editor.
+         * @param component the component
+         * @param mesh the mesh, from DECLARE_STATIC_MESH
+         */
+        void setMesh(UStaticMeshComponent * component, const VehicleAssets::Mesh & mesh)
+        {
+            // The editor draws placed vehicles from their class defaults, so it loads as before
+            if (GIsEditor) {
+                component->SetStaticMesh(mesh.load());
+            }
+
+            // Set after construction, so that the class defaults do not overwrite it
+            if (!_pawn->HasAnyFlags(RF_ClassDefaultObject)) {
+                pending_mesh_t pending = {component, &mesh};
+                _pendingMeshes.Add(pending);
+            }
+        }
+
     public:
 
-        void build(APawn* pawn, UStaticMesh* frameMesh)
+        void build(APawn* pawn, const VehicleAssets::Mesh & frameMesh)
         {
             _pawn = pawn;
-            _frameMesh = frameMesh;
 
             _frameMeshComponent = _pawn->CreateDefaultSubobject<UStaticMeshComponent>(TEXT("FrameMesh"));
-            _frameMeshComponent->SetStaticMesh(_frameMesh);
+            setMesh(_frameMeshComponent, frameMesh);
             _frameMeshComponent->SetCollisionResponseToAllChannels(ECollisionResponse::ECR_Overlap);
             
             _pawn->SetRootComponent(_frameMeshComponent);
@@ -227,7 +536,7 @@ class Vehicle {
             _propCount = 0;
         }
 
-        void buildFull(APawn* pawn, UStaticMesh* frameMesh, float chaseCameraDistanceMeters=1.5, 
+        void buildFull(APawn* pawn, const VehicleAssets::Mesh & frameMesh, float chaseCameraDistanceMeters=1.5, 
                 float chaseCameraElevationMeters=0.5)
         {
             build(pawn, frameMesh);
@@ -256,29 +565,34 @@ class Vehicle {
             _gimbalSpringArm->TargetArmLength = 0.f;
         }
 
-        void addMesh(UStaticMesh* mesh, const char* name, const FVector& location, const FRotator rotation, const FVector& scale)
+        void addMesh(const VehicleAssets::Mesh & mesh, const char* name, const FVector& location, const FRotator rotation, const FVector& scale)
         {
             UStaticMeshComponent* meshComponent =
                 _pawn->CreateDefaultSubobject<UStaticMeshComponent>(FName(name));
-            meshComponent->SetStaticMesh(mesh);
+            setMesh(meshComponent, mesh);
             meshComponent->SetupAttachment(_frameMeshComponent, USpringArmComponent::SocketName);
             meshComponent->AddRelativeLocation(location * 100); // m => cm
             meshComponent->AddLocalRotation(rotation);
             meshComponent->SetRelativeScale3D(scale);
         }
 
-        void addMesh(UStaticMesh* mesh, const char* name, const FVector& location, const FRotator rotation)
+        void addMesh(const VehicleAssets::Mesh & mesh, const char* name, const FVector& location, const FRotator rotation)
         {
             addMesh(mesh, name, location, rotation, FVector(1, 1, 1));
         }
 
-        void addMesh(UStaticMesh* mesh, const char* name)
+        void addMesh(const VehicleAssets::Mesh & mesh, const char* name)
         {
             addMesh(mesh, name, FVector(0, 0, 0), FRotator(0, 0, 0));
         }
 
         void addCamera(Camera* camera)
         {
+            if (_cameraCount == Camera::MAX_CAMERAS) {
+                error("Too many cameras");
+                return;
+            }
+
             // Add camera to spring arm
             camera->addToVehicle(_pawn, _gimbalSpringArm, _cameraCount);
 
@@ -286,6 +600,18 @@ class Vehicle {
             _cameras[_cameraCount++] = camera;
         }
 
+        void addLidar(Lidar * lidar)
+        {
+            if (_lidarCount == Lidar::MAX_LIDARS) {
+                error("Too many LiDARs");
+                return;
+            }
+
+            lidar->addToVehicle(_pawn);
+
+            _lidars[_lidarCount++] = lidar;
+        }
+
         Vehicle(void)
         {
             _dynamics = NULL;
@@ -303,14 +629,70 @@ class Vehicle {
             _flightManager = NULL;
         }
 
+        /**
+         * Fixes the vehicle's physics update rate, instead of choosing it from
+         * its distance to the player's camera.  Call from the game thread.
+         * @param tier see PhysicsScheduler::tier_t
+         */
+        void setPhysicsTier(PhysicsScheduler::tier_t tier)
+        {
+            _fixedPhysicsTier = tier;
+            _physicsTierFixed = true;
+        }
+
+        // Goes back to choosing the physics update rate from the camera distance
+        void setAutomaticPhysicsTier(void)
+        {
+            _physicsTierFixed = false;
+        }
+
+        void EndPlay(void)
+        {
+            cancelMeshes();
+
+            for (uint8_t i = 0; i < _cameraCount; ++i) {
+                _cameras[i]->releaseRenderTarget();
+            }
+
+            for (uint8_t i = 0; i < _lidarCount; ++i) {
+                _lidars[i]->removeFromVehicle();
+            }
+
+            if (_swarmRendered) {
+                SwarmRenderer::remove(_swarmRenderId);
+                _swarmRendered = false;
+            }
+
+            // The last vehicle out, its flight manager already stopped, flushes and closes them
+            if (playingCount() > 0 && --playingCount() == 0) {
+                stopSessions();
+            }
+        }
+
         virtual ~Vehicle(void)
         {
+            cancelMeshes();
+
+            // Flight manager has been stopped by EndPlay()
+            delete _heightfield;
         }
 
         void BeginPlay(FFlightManager* flightManager)
         {
             _flightManager = flightManager;
 
+            // The first vehicle in play starts the world's tracing and recording
+            if (playingCount()++ == 0) {
+                startSessions();
+            }
+
+            finishMeshes();
+
+            // Cameras take render targets only while in play, never for the class default object or in the editor
+            for (uint8_t i = 0; i < _cameraCount; ++i) {
+                _cameras[i]->acquireRenderTarget();
+            }
+
             // Player controller is useful for getting keyboard events, switching cameas, etc.
             _playerController = UGameplayStatics::GetPlayerController(_pawn->GetWorld(), 0);
 
@@ -346,10 +728,27 @@ class Vehicle {
 
             // Get vehicle ground-truth location for kinematic offset
             _startLocation = _pawn->GetActorLocation();
+            _poseOutput.begin(_pawn);
+
+            // Draw as instances with the rest of the swarm if requested on the command line
+            if (SwarmRenderer::enabled() && canSwarmRender()) {
+                _swarmRenderId = SwarmRenderer::add(_frameMeshComponent, _propellerMeshComponents, _rotorDirections, _propCount);
+                _swarmRendered = true;
+            }
 
             // AGL offset will be set to a positve value the first time agl() is called
             _aglOffset = 0;
 
+            // Page in terrain around the start, so the physics thread has AGL from the first step
+            startHeightfield();
+
+            // Static obstacles for the physics thread to check against
+            startObstacles();
+
+            // Other vehicles, for counting near misses and collisions; cm => m
+            _flightManager->joinSwarm(_frameMeshComponent->Bounds.SphereRadius / 100,
+                    _startLocation.X / 100, _startLocation.Y / 100, _startLocation.Z / 100);
+
             // Get vehicle ground-truth rotation to initialize flight manager
             FRotator startRotation = _pawn->GetActorRotation();
 
@@ -372,10 +771,27 @@ class Vehicle {
 
             _view = VIEW_CHASE;
             setView();
+
+            // Journal physics-step inputs for deterministic replay if requested, one file per vehicle:
+            // -simreplay=flight.simreplay gives flight.ID.simreplay, ID as in the flight recorder
+            FString replayFilename;
+            if (FParse::Value(FCommandLine::Get(), TEXT("simreplay="), replayFilename)) {
+                replayFilename = FPaths::GetBaseFilename(replayFilename, false) +
+                    FString::Printf(TEXT(".%u"), _flightManager->getRecorderId()) +
+                    FPaths::GetExtension(replayFilename, true);
+                if (_flightManager->startReplayRecording(TCHAR_TO_ANSI(*replayFilename), replayVehicleName())) {
+                    debug("Recording replay to %s", TCHAR_TO_ANSI(*replayFilename));
+                }
+                else {
+                    error("Unable to open replay file %s", TCHAR_TO_ANSI(*replayFilename));
+                }
+            }
         }
 
         void Tick(float DeltaSeconds)
         {
+            SCOPE_CYCLE_COUNTER(STAT_VehicleTick);
+
             // Quit on ESCape key
             if (hitKey(EKeys::Escape)) {
                 RequestEngineExit("User hit ESC");
@@ -385,18 +801,131 @@ class Vehicle {
             if (_mapSelected != MAP_NONE) {
 
                 // Use 1/2/3 keys to switch player-camera view
-                setPlayerCameraView();
+                {
+                    SCOPE_CYCLE_COUNTER(STAT_SetPlayerCameraView);
+                    setPlayerCameraView();
+                }
+
+                // Use T key to start/stop timeline tracing
+                toggleTrace();
+
+                // Use R key to start/stop flight recording
+                toggleRecording();
 
                 // Check for keypad presses
                 //checkKeypadKey();
 
                 updateKinematics();
 
+                if (_flightManager) {
+                    updatePhysicsTier();
+                }
+
                 grabImages();
 
-                animateActuators();
+                scanLidars();
+
+                {
+                    SCOPE_CYCLE_COUNTER(STAT_AnimateActuators);
+                    animateActuators();
+                }
+
+                if (_swarmRendered) {
+                    SwarmRenderer::setPose(_swarmRenderId, _frameMeshComponent->GetComponentTransform(), _swarmPropSpin);
+                }
+
+                // Keep terrain paged in around the vehicle; trace for AGL only where it has no tile yet
+                if (_flightManager) {
+                    updateHeightfield();
+                }
+
+                // Use H key to show/hide performance HUD
+                toggleHud();
 
-                _dynamics->setAgl(agl());
+                reportStats(DeltaSeconds);
+            }
+        }
+
+        void toggleHud(void)
+        {
+            // avoid registering multiple H presses
+            static bool didhit;
+
+            if (hitKey(EKeys::H)) {
+                if (!didhit) {
+                    _hudEnabled = !_hudEnabled;
+                }
+                didhit = true;
+            }
+            else {
+                didhit = false;
+            }
+        }
+
+        // Worst per-vehicle values over the vehicles reported so far in a frame; game thread only
+        typedef struct {
+
+            uint64_t frame;
+            float    latencyUsec;
+            float    maxPeriodMsec;
+
+        } frame_maxima_t;
+
+        static frame_maxima_t & frameMaxima(void)
+        {
+            static frame_maxima_t maxima;
+            return maxima;
+        }
+
+        // Publishes flight-thread counters to "stat MulticopterSim" and the optional HUD
+        void reportStats(float DeltaSeconds)
+        {
+            if (!_flightManager) {
+                return;
+            }
+
+            uint32_t physicsCount = _flightManager->getCount();
+            float physicsHz = DeltaSeconds > 0 ? (physicsCount - _previousPhysicsCount) / DeltaSeconds : 0;
+            _previousPhysicsCount = physicsCount;
+
+            const LoopStats & loopStats = _flightManager->getLoopStats();
+
+            float latencyUsec = _flightManager->getControllerLatency() * 1e6;
+            float maxPeriodMsec = loopStats.getMaxPeriod() * 1e3;
+            uint32_t overruns = (uint32_t)loopStats.getOverruns();
+
+            // Summed over the vehicles ticked so far this frame
+            INC_FLOAT_STAT_BY(STAT_PhysicsHz, physicsHz);
+            INC_DWORD_STAT_BY(STAT_PhysicsOverruns, overruns);
+            INC_DWORD_STAT_BY(STAT_ObstacleContacts, _flightManager->getObstacleContacts());
+            INC_DWORD_STAT_BY(STAT_VehicleCollisions, _flightManager->getVehicleCollisions());
+            INC_DWORD_STAT_BY(STAT_NearMisses, _flightManager->getNearMisses());
+
+            // Worst of the vehicles ticked so far this frame
+            frame_maxima_t & maxima = frameMaxima();
+            if (maxima.frame != GFrameCounter) {
+                maxima.frame = GFrameCounter;
+                maxima.latencyUsec = 0;
+                maxima.maxPeriodMsec = 0;
+            }
+            maxima.latencyUsec = FMath::Max(maxima.latencyUsec, latencyUsec);
+            maxima.maxPeriodMsec = FMath::Max(maxima.maxPeriodMsec, maxPeriodMsec);
+            SET_FLOAT_STAT(STAT_ControllerLatency, maxima.latencyUsec);
+            SET_FLOAT_STAT(STAT_MaxPhysicsPeriod, maxima.maxPeriodMsec);
+
+            // The same for every vehicle
+            SET_DWORD_STAT(STAT_SchedulerOverruns, PhysicsScheduler::getOverruns());
+            SET_DWORD_STAT(STAT_SleepingVehicles, PhysicsScheduler::getSleepingCount());
+            SET_DWORD_STAT(STAT_SwarmRenderedVehicles, SwarmRenderer::getVehicleCount());
+            SET_DWORD_STAT(STAT_RenderTargets, RenderTargets::getCount());
+            SET_DWORD_STAT(STAT_RenderTargetsInUse, RenderTargets::getInUseCount());
+            SET_DWORD_STAT(STAT_FullRateVehicles, PhysicsScheduler::getTierCount(PhysicsScheduler::TIER_FULL));
+            SET_DWORD_STAT(STAT_ReducedRateVehicles, PhysicsScheduler::getTierCount(PhysicsScheduler::TIER_REDUCED));
+            SET_DWORD_STAT(STAT_BackgroundRateVehicles, PhysicsScheduler::getTierCount(PhysicsScheduler::TIER_BACKGROUND));
+
+            if (_hudEnabled) {
+                hud("frame %5.2f ms | physics %6.0f Hz | controller %6.1f us | worst period %6.2f ms at %.1f s | overruns %u",
+                        DeltaSeconds * 1e3, physicsHz, latencyUsec, maxPeriodMsec, loopStats.getLongestStallTime(), overruns);
             }
         }
 
@@ -438,9 +967,282 @@ class Vehicle {
         }
 
 
+        void toggleTrace(void)
+        {
+            // avoid registering multiple T presses
+            static bool didhit;
+
+            if (hitKey(EKeys::T)) {
+                if (!didhit) {
+                    if (Trace::enabled()) {
+                        Trace::stop();
+                        debug("Trace stopped");
+                    }
+                    else {
+                        startTrace();
+                    }
+                }
+                didhit = true;
+            }
+            else {
+                didhit = false;
+            }
+        }
+
+        // Vehicles between BeginPlay() and EndPlay(), across the world; game thread only
+        static uint32_t & playingCount(void)
+        {
+            static uint32_t count;
+            return count;
+        }
+
+        // Timeline tracing and flight recording requested on the command line, once for the world
+        static void startSessions(void)
+        {
+            FString traceFilename;
+            if (FParse::Value(FCommandLine::Get(), TEXT("simtrace="), traceFilename)) {
+                startTrace();
+            }
+
+            FString recordFilename;
+            if (FParse::Value(FCommandLine::Get(), TEXT("simrecord="), recordFilename)) {
+                startRecording();
+            }
+        }
+
+        static void stopSessions(void)
+        {
+            Trace::stop();
+
+            if (FlightRecorder::enabled()) {
+                FlightRecorder::stop();
+                debug("Recording stopped: %llu records, %u dropped",
+                        (unsigned long long)FlightRecorder::writtenCount(), FlightRecorder::droppedCount());
+            }
+        }
+
+        // Traces to the file given by -simtrace=FILE on the command line, or to Saved/MulticopterSim.trace.json
+        static void startTrace(void)
+        {
+            FString filename = FPaths::ProjectSavedDir() + TEXT("MulticopterSim.trace.json");
+            FParse::Value(FCommandLine::Get(), TEXT("simtrace="), filename);
+
+            if (Trace::start(TCHAR_TO_ANSI(*filename))) {
+                debug("Tracing to %s", TCHAR_TO_ANSI(*filename));
+            }
+            else {
+                error("Unable to open trace file %s", TCHAR_TO_ANSI(*filename));
+            }
+        }
+
+        void toggleRecording(void)
+        {
+            // avoid registering multiple R presses
+            static bool didhit;
+
+            if (hitKey(EKeys::R)) {
+                if (!didhit) {
+                    if (FlightRecorder::enabled()) {
+                        FlightRecorder::stop();
+                        debug("Recording stopped: %llu records, %u dropped", 
+                                (unsigned long long)FlightRecorder::writtenCount(), FlightRecorder::droppedCount());
+                    }
+                    else {
+                        startRecording();
+                    }
+                }
+                didhit = true;
+            }
+            else {
+                didhit = false;
+            }
+        }
+
+        // Records to the file given by -simrecord=FILE on the command line, or to Saved/MulticopterSim.simrec
+        static void startRecording(void)
+        {
+            FString filename = FPaths::ProjectSavedDir() + TEXT("MulticopterSim.simrec");
+            FParse::Value(FCommandLine::Get(), TEXT("simrecord="), filename);
+
+            if (FlightRecorder::start(TCHAR_TO_ANSI(*filename))) {
+                debug("Recording to %s", TCHAR_TO_ANSI(*filename));
+            }
+            else {
+                error("Unable to open recording file %s", TCHAR_TO_ANSI(*filename));
+            }
+        }
+
+        // Vehicle name for the replay tool (see Extras/headless/Vehicles.hpp), from the pawn class name
+        const char * replayVehicleName(void)
+        {
+            static const char * names[] = {"phantom", "tinywhoop", "ingenuity", "rocket"};
+
+            FString className = _pawn->GetClass()->GetName().ToLower();
+
+            for (const char * name : names) {
+                if (className.Contains(name)) {
+                    return name;
+                }
+            }
+
+            return "unknown";
+        }
+
+        /**
+         * Builds the terrain cache from which the physics thread computes AGL.
+         * With -simheightfield=FILE on the command line, tiles are read from
+         * FILE, which is first baked from line traces around the start if it
+         * does not exist; otherwise they are traced as the vehicle goes.
+         */
+        void startHeightfield(void)
+        {
+            delete _heightfield;
+            _heightfield = NULL;
+            _heightfieldAgl = false;
+
+            // Trace down through the whole level, so that roofs and platforms are ground
+            // wherever the vehicle goes; under an overhang, agl() traces from the vehicle
+            FBox bounds = ALevelBounds::CalculateLevelBounds(_pawn->GetWorld()->PersistentLevel);
+            if (bounds.IsValid) {
+                _traceSource.begin(_pawn, bounds.Max.Z / 100 + 1, bounds.Min.Z / 100 - 1);
+            }
+            else {
+                _traceSource.begin(_pawn, _startLocation.Z / 100 + 1, _startLocation.Z / 100 - HEIGHTFIELD_DEPTH);
+            }
+
+            // Whole tiles at the start, where a hitch is hidden by the level loading
+            _traceSource.setRowsPerCall(0);
+
+            HeightfieldSource * source = &_traceSource;
+            double spacing = Heightfield::DEFAULT_SPACING;
+
+            double x0 = _startLocation.X / 100;
+            double y0 = _startLocation.Y / 100;
+
+            FString filename;
+            if (FParse::Value(FCommandLine::Get(), TEXT("simheightfield="), filename)) {
+
+                if (!_heightfieldFile.open(TCHAR_TO_ANSI(*filename))) {
+
+                    double tileSize = spacing * Heightfield::TILE_CELLS;
+                    int32_t tx = (int32_t)floor(x0 / tileSize);
+                    int32_t ty = (int32_t)floor(y0 / tileSize);
+
+                    int64_t count = HeightfieldFile::save(TCHAR_TO_ANSI(*filename), &_traceSource, spacing,
+                            tx-HEIGHTFIELD_BAKE_RADIUS, ty-HEIGHTFIELD_BAKE_RADIUS, tx+HEIGHTFIELD_BAKE_RADIUS, ty+HEIGHTFIELD_BAKE_RADIUS);
+
+                    if (count < 0) {
+                        error("Unable to write heightfield file %s", TCHAR_TO_ANSI(*filename));
+                    }
+                    else {
+                        debug("Baked %lld heightfield tiles to %s", (long long)count, TCHAR_TO_ANSI(*filename));
+                    }
+                }
+
+                if (_heightfieldFile.open(TCHAR_TO_ANSI(*filename))) {
+                    source = &_heightfieldFile;
+                    spacing = _heightfieldFile.getSpacing();
+                }
+            }
+
+            _heightfield = new Heightfield(source, spacing, HEIGHTFIELD_TILES);
+
+            _heightfield->update(x0, y0, HEIGHTFIELD_RADIUS, HEIGHTFIELD_TILES);
+
+            // A few rows a frame from now on
+            _traceSource.setRowsPerCall(HEIGHTFIELD_ROWS_PER_FRAME);
+
+            double height = 0;
+            if (_heightfield->getHeight(x0, y0, height)) {
+                _flightManager->setHeightfield(_heightfield, x0, y0, height);
+                _heightfieldAgl = true;
+                _heightfieldOffset = _startLocation.Z / 100 - height;
+            }
+
+            // Fallback traces measure from the start, like the heightfield
+            agl();
+        }
+
+        void updateHeightfield(void)
+        {
+            FVector location = _pawn->GetActorLocation() / 100;
+
+            if (_heightfield) {
+                SCOPE_CYCLE_COUNTER(STAT_HeightfieldPaging);
+                _heightfield->update(location.X, location.Y, HEIGHTFIELD_RADIUS);
+            }
+
+            // AGL is applied on the physics thread at the start of its next step.  It
+            // uses this value only where the heightfield has no tile or the terrain is
+            // an overhang; then we trace, and otherwise pass on the heightfield's AGL,
+            // so that the value is current on passing under an overhang.
+            double height = 0;
+            if (_heightfieldAgl && _heightfield->getHeight(location.X, location.Y, height)) {
+                double heightfieldAgl = location.Z - height - _heightfieldOffset;
+                if (heightfieldAgl > -FFlightManager::OVERHANG_DEPTH) {
+                    _flightManager->setAgl(heightfieldAgl);
+                    return;
+                }
+            }
+
+            _flightManager->setAgl(agl());
+        }
+
+        /**
+         * Builds the static-obstacle map for this level if no vehicle has yet,
+         * and has the physics thread check the vehicle's bounding sphere
+         * against it.  Meshes unchanged since the last build, or found in the
+         * cache file (-simobstacles=FILE, or Saved/MulticopterSim.obstacles),
+         * are reused rather than rebuilt.
+         */
+        void startObstacles(void)
+        {
+            static ObstacleBuilder builder;
+            static TWeakObjectPtr<UWorld> builtWorld;
+            static bool cacheLoaded;
+
+            UWorld * world = _pawn->GetWorld();
+
+            if (builtWorld.Get() != world) {
+
+                SCOPE_CYCLE_COUNTER(STAT_ObstacleBuild);
+
+                FString filename = FPaths::ProjectSavedDir() + TEXT("MulticopterSim.obstacles");
+                FParse::Value(FCommandLine::Get(), TEXT("simobstacles="), filename);
+
+                if (!cacheLoaded) {
+                    builder.load(TCHAR_TO_ANSI(*filename));
+                    cacheLoaded = true;
+                }
+
+                LevelObstacles level;
+                builder.begin();
+                level.scan(world, builder);
+                Obstacles * obstacles = builder.finish();
+
+                debug("Obstacles: %u meshes, %llu triangles; %u built, %u reused", obstacles->meshCount(),
+                        (unsigned long long)obstacles->triangleCount(), builder.getBuiltCount(), builder.getReusedCount());
+
+                Obstacles::publish(obstacles);
+
+                if (builder.getBuiltCount() > 0 && !builder.save(TCHAR_TO_ANSI(*filename))) {
+                    error("Unable to write obstacle cache %s", TCHAR_TO_ANSI(*filename));
+                }
+
+                builtWorld = world;
+            }
+
+            // cm => m
+            _flightManager->setObstacleRadius(_frameMeshComponent->Bounds.SphereRadius / 100,
+                    _startLocation.X / 100, _startLocation.Y / 100, _startLocation.Z / 100);
+        }
+
         // Returns AGL when vehicle is level above ground, "infinity" otherwise
         float agl(void)
         {
+            TRACE_SCOPE("Vehicle::agl");
+            SCOPE_CYCLE_COUNTER(STAT_Agl);
+
             // Start at the center of the vehicle
             FVector startPoint = _pawn->GetActorLocation();
             startPoint.Z += 100;
@@ -496,6 +1298,9 @@ class Vehicle {
 
         void PostInitializeComponents()
         {
+            // Stream in the meshes while the rest of the level initializes
+            requestMeshes();
+
             // Add "Vehicle" tag for use by level blueprint
             _pawn->Tags.Add(FName("Vehicle"));
 
@@ -0,0 +1,69 @@
+/*
+ * Vehicle asset manifest for MulticopterSim: the one instance, shared by all modules
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#include "VehicleAssets.hpp"
+
+#include "MainModule.h"
+
+// Never freed, since meshes are declared during static initialization
+VehicleAssets::state_t & VehicleAssets::state(void)
+{
+    static state_t * s = new state_t();
+    return *s;
+}
+
+void VehicleAssets::preloadVehicle(const char * vehicle, size_t length)
+{
+    state_t & s = state();
+
+    TArray<FSoftObjectPath> paths;
+
+    for (const Mesh * mesh : s.manifest) {
+        if (mesh->isPartOf(vehicle, length)) {
+            paths.AddUnique(mesh->getPath());
+        }
+    }
+
+    if (paths.Num() == 0) {
+        UE_LOG(LogMulticopterSim, Warning, TEXT("No meshes to preload for vehicle %s"), *FString((int32)length, vehicle));
+        return;
+    }
+
+    s.preloads.Add(streamable().RequestAsyncLoad(paths, FStreamableDelegate(), FStreamableManager::AsyncLoadHighPriority));
+}
+
+void VehicleAssets::preload(const char * vehicles)
+{
+    while (*vehicles) {
+
+        const char * comma = strchr(vehicles, ',');
+
+        size_t length = comma ? (size_t)(comma - vehicles) : strlen(vehicles);
+
+        if (length > 0) {
+            preloadVehicle(vehicles, length);
+        }
+
+        vehicles += comma ? length + 1 : length;
+    }
+}
+
+void VehicleAssets::preloadForMap(const FString & options)
+{
+    FString vehicles;
+
+    if (FParse::Value(FCommandLine::Get(), TEXT("simpreload="), vehicles, false)) {
+        preload(TCHAR_TO_ANSI(*vehicles));
+    }
+
+    vehicles = UGameplayStatics::ParseOption(options, TEXT("SimPreload"));
+
+    if (!vehicles.IsEmpty()) {
+        preload(TCHAR_TO_ANSI(*vehicles));
+    }
+}
@@ -0,0 +1,139 @@
+/*
+ * Vehicle asset manifest for MulticopterSim, streamed in on demand
+ *
+ * Each DECLARE_STATIC_MESH in a vehicle header adds a soft reference to the
+ * manifest, filed under the vehicle's directory in /Game/MulticopterSim/Meshes
+ * (e.g., "Phantom").  Nothing is loaded until a pawn of that vehicle is
+ * spawned: its Vehicle then asks for its meshes here, and they stream in
+ * asynchronously while the level finishes loading.
+ *
+ * A preload hint starts streaming vehicles before any pawn asks for them,
+ * e.g. those a map spawns from its level blueprint: -simpreload=Phantom,Ingenuity
+ * on the command line, or ?SimPreload=Phantom,Ingenuity in the map URL.
+ *
+ * The meshes are declared in the pawn modules and the preload runs in this
+ * one, so the manifest lives in VehicleAssets.cpp rather than in a static
+ * of this header, which each module would get its own copy of.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <string.h>
+
+#include "Engine/StaticMesh.h"
+#include "Engine/StreamableManager.h"
+#include "Kismet/GameplayStatics.h"
+
+class MAINMODULE_API VehicleAssets {
+
+    public:
+
+        // A vehicle part's mesh, by soft reference
+        class Mesh {
+
+            private:
+
+                const char * _asset = NULL;   // e.g. "Phantom/Frame.Frame"
+
+            public:
+
+                Mesh(const char * asset)
+                {
+                    _asset = asset;
+
+                    VehicleAssets::state().manifest.Add(this);
+                }
+
+                FSoftObjectPath getPath(void) const
+                {
+                    return FSoftObjectPath(FString("/Game/MulticopterSim/Meshes/") + _asset);
+                }
+
+                // True for the meshes of the named vehicle
+                bool isPartOf(const char * vehicle, size_t length) const
+                {
+                    return strncmp(_asset, vehicle, length) == 0 && _asset[length] == '/';
+                }
+
+                // The mesh if it is in memory, else NULL
+                UStaticMesh * resolve(void) const
+                {
+                    return Cast<UStaticMesh>(getPath().ResolveObject());
+                }
+
+                // The mesh, loading it on this thread if need be
+                UStaticMesh * load(void) const
+                {
+                    return Cast<UStaticMesh>(getPath().TryLoad());
+                }
+
+        }; // class Mesh
+
+    private:
+
+        // Process-wide, and never freed, since meshes are declared during static initialization
+        typedef struct {
+
+            TArray<const Mesh *> manifest;
+
+            // Made on first use, since the engine is not up yet when the manifest is built
+            FStreamableManager * streamable;
+
+            // Keep preloaded vehicles in memory until exit
+            TArray<TSharedPtr<FStreamableHandle>> preloads;
+
+        } state_t;
+
+        // Defined in VehicleAssets.cpp, so that every module shares one manifest
+        static state_t & state(void);
+
+        static FStreamableManager & streamable(void)
+        {
+            state_t & s = state();
+
+            if (!s.streamable) {
+                s.streamable = new FStreamableManager();
+            }
+
+            return *s.streamable;
+        }
+
+        static void preloadVehicle(const char * vehicle, size_t length);
+
+    public:
+
+        /**
+         * Starts streaming in meshes.  Call from the game thread.
+         * @param paths meshes to load
+         * @param loaded called on the game thread once all have loaded, unless the handle is cancelled first
+         * @return handle, which keeps the meshes in memory while it lasts
+         */
+        static TSharedPtr<FStreamableHandle> request(const TArray<FSoftObjectPath> & paths, FStreamableDelegate loaded)
+        {
+            return streamable().RequestAsyncLoad(paths, loaded);
+        }
+
+        /**
+         * Starts streaming in every mesh of some vehicles.  Call from the game thread.
+         * @param vehicles comma-separated names, as in the mesh directories; e.g. "Phantom,Ingenuity"
+         */
+        static void preload(const char * vehicles);
+
+        /**
+         * Starts streaming in the vehicles named on the command line and in
+         * the map URL options.  Call from the game mode's InitGame().
+         * @param options the map URL options
+         */
+        static void preloadForMap(const FString & options);
+
+        // Meshes declared by the vehicles compiled in
+        static uint32_t getManifestCount(void)
+        {
+            return (uint32_t)state().manifest.Num();
+        }
+
+}; // class VehicleAssets
@@ -0,0 +1,77 @@
+/*
+ * Standard C++ backend for MulticopterSim platform abstraction
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <chrono>
+#include <thread>
+
+class PlatformTime {
+
+    public:
+
+        static double seconds(void)
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        static void sleep(double seconds)
+        {
+            std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        }
+
+}; // class PlatformTime
+
+class PlatformThread {
+
+    private:
+
+        std::thread _thread;
+
+    protected:
+
+        // Runs on the new thread
+        virtual void threadMain(void) = 0;
+
+    public:
+
+        void startThread(const char * name)
+        {
+            (void)name;
+
+            _thread = std::thread([this] { threadMain(); });
+        }
+
+        // Waits for threadMain() to return
+        void joinThread(void)
+        {
+            if (_thread.joinable()) {
+                _thread.join();
+            }
+        }
+
+        virtual ~PlatformThread(void)
+        {
+            joinThread();
+        }
+
+}; // class PlatformThread
+
+class PlatformOptions {
+
+    public:
+
+        // Native programs have their own argument parsing, so there are no options here
+        static bool get(const char * name, double & value)
+        {
+            (void)name;
+            (void)value;
+            return false;
+        }
+
+}; // class PlatformOptions
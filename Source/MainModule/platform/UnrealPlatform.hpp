@@ -0,0 +1,103 @@
+/*
+ * Unreal Engine backend for MulticopterSim platform abstraction
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "Runnable.h"
+#include "HAL/RunnableThread.h"
+
+class PlatformTime {
+
+    public:
+
+        static double seconds(void)
+        {
+            return FPlatformTime::Seconds();
+        }
+
+        static void sleep(double seconds)
+        {
+            FPlatformProcess::Sleep(seconds);
+        }
+
+}; // class PlatformTime
+
+class PlatformThread {
+
+    private:
+
+        // Adapts FRunnable::Run() to threadMain()
+        class Runnable : public FRunnable {
+
+            private:
+
+                PlatformThread * _owner = NULL;
+
+            public:
+
+                Runnable(PlatformThread * owner)
+                {
+                    _owner = owner;
+                }
+
+                virtual uint32 Run() override
+                {
+                    _owner->threadMain();
+                    return 0;
+                }
+
+        }; // class Runnable
+
+        Runnable * _runnable = NULL;
+
+        FRunnableThread * _thread = NULL;
+
+    protected:
+
+        // Runs on the new thread
+        virtual void threadMain(void) = 0;
+
+    public:
+
+        void startThread(const char * name)
+        {
+            _runnable = new Runnable(this);
+            _thread = FRunnableThread::Create(_runnable, ANSI_TO_TCHAR(name), 0, TPri_BelowNormal); 
+        }
+
+        // Waits for threadMain() to return
+        void joinThread(void)
+        {
+            if (_thread) {
+                _thread->WaitForCompletion();
+                delete _thread;
+                _thread = NULL;
+            }
+
+            delete _runnable;
+            _runnable = NULL;
+        }
+
+        virtual ~PlatformThread(void)
+        {
+            joinThread();
+        }
+
+}; // class PlatformThread
+
+class PlatformOptions {
+
+    public:
+
+        // Reads a numeric option from the command line, e.g. get("simphysicshz=", hz)
+        static bool get(const char * name, double & value)
+        {
+            return FParse::Value(FCommandLine::Get(), ANSI_TO_TCHAR(name), value);
+        }
+
+}; // class PlatformOptions
@@ -20,17 +20,17 @@ class MultirotorVehicle : public Vehicle {
             _nmotors = nmotors;
         }
 
-        UStaticMeshComponent * addComponent(UStaticMesh * mesh, FName name, float x=0, float y=0, float z=0, float yaw_angle=0)
+        UStaticMeshComponent * addComponent(const VehicleAssets::Mesh & mesh, FName name, float x=0, float y=0, float z=0, float yaw_angle=0)
         {
             UStaticMeshComponent* meshComponent = _pawn->CreateDefaultSubobject<UStaticMeshComponent>(name);
-            meshComponent->SetStaticMesh(mesh);
+            setMesh(meshComponent, mesh);
             meshComponent->SetupAttachment(_frameMeshComponent, USpringArmComponent::SocketName);
             meshComponent->AddRelativeLocation(FVector(x, y, z) * 100); // m => cm
             meshComponent->SetRelativeRotation(FRotator(0, yaw_angle, 0));
             return meshComponent;
         }
 
-        UStaticMeshComponent * addProp(UStaticMesh* propMesh, float x, float y, float z, float angle)
+        UStaticMeshComponent * addProp(const VehicleAssets::Mesh & propMesh, float x, float y, float z, float angle)
         {
             UStaticMeshComponent * propMeshComponent = addComponent(propMesh, makeName("Prop", _propCount, "Mesh"), x, y, z, angle);
             _propellerMeshComponents[_propCount] = propMeshComponent;
@@ -38,7 +38,7 @@ class MultirotorVehicle : public Vehicle {
             return propMeshComponent;
         }
 
-        void addProp(UStaticMesh* propMesh, float x, float y, float z)
+        void addProp(const VehicleAssets::Mesh & propMesh, float x, float y, float z)
         {
             addProp(propMesh, x, y, z, propStartAngle(x,y));
         }
@@ -51,6 +51,11 @@ class MultirotorVehicle : public Vehicle {
 
     protected:
 
+        virtual bool canSwarmRender(void) override
+        {
+            return true;
+        }
+
         virtual void animateActuators(void) override
         {
             // Get motor values from dynamics
@@ -63,7 +68,10 @@ class MultirotorVehicle : public Vehicle {
             }
 
             // Rotate props. For visual effect, we can ignore actual motor values, and just keep increasing the rotation.
-            if (motorsum > 0) {
+            if (_swarmRendered) {
+                _swarmPropSpin = motorsum > 0 ? SwarmRenderer::PROP_SPIN : 0;
+            }
+            else if (motorsum > 0) {
                 rotateProps(_rotorDirections);
             }
 
@@ -37,7 +37,7 @@ class Ornithopter : public Vehicle {
         {
         }
 
-        void addWing(UStaticMesh * wingMesh, UStaticMesh * hingeMesh, float hingeX, float hingeY, float wingY, float yawStart, float yawRelative)
+        void addWing(const VehicleAssets::Mesh & wingMesh, const VehicleAssets::Mesh & hingeMesh, float hingeX, float hingeY, float wingY, float yawStart, float yawRelative)
         {
             // Add a new wing structure for animation
             _wings[_propCount].yawRelative = yawRelative;
@@ -49,7 +49,7 @@ class Ornithopter : public Vehicle {
             // Add the actual wing to the hinge
             UStaticMeshComponent* wingMeshComponent =
                 _pawn->CreateDefaultSubobject<UStaticMeshComponent>(makeName("Wing", _propCount, "Mesh"));
-            wingMeshComponent->SetStaticMesh(wingMesh);
+            setMesh(wingMeshComponent, wingMesh);
             wingMeshComponent->SetupAttachment(hingeMeshComponent, USpringArmComponent::SocketName);
             wingMeshComponent->AddRelativeLocation(FVector(+.025, wingY, -.05) * 100); // m => cm
         }
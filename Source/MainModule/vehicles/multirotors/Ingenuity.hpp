@@ -76,12 +76,12 @@ class Ingenuity {
         // Threaded worker for flight control
         FFlightManager * _flightManager = NULL;
 
-        void addRotor(UStaticMesh* propMesh, float z)
+        void addRotor(const VehicleAssets::Mesh & propMesh, float z)
         {
             vehicle.addProp(propMesh, 0, 0, z);
         }
 
-        void addLeg(uint8_t index, UStaticMesh * bracketMesh, UStaticMesh * topMesh, UStaticMesh * bottomMesh)
+        void addLeg(uint8_t index, const VehicleAssets::Mesh & bracketMesh, const VehicleAssets::Mesh & topMesh, const VehicleAssets::Mesh & bottomMesh)
         {
 
             vehicle.addComponent(bracketMesh, makeName("LegBracket", index, "Mesh"));
@@ -94,23 +94,23 @@ class Ingenuity {
         void build(APawn * pawn)
         {
             // Build the frame
-            vehicle.buildFull(pawn, BodyStatics.mesh.Get()); // Restore for cameras, audio
-            // vehicle.build(pawn, BodyStatics.mesh.Get());
+            vehicle.buildFull(pawn, BodyStatics.mesh); // Restore for cameras, audio
+            // vehicle.build(pawn, BodyStatics.mesh);
 
             // Add rotors
-            addRotor(RotorTopStatics.mesh.Get(), .250);
-            addRotor(RotorBottomStatics.mesh.Get(), .170);
+            addRotor(RotorTopStatics.mesh, .250);
+            addRotor(RotorBottomStatics.mesh, .170);
 
             // Add mast, solar panel, antenna
-            vehicle.addComponent(MastStatics.mesh.Get(), makeName("Mast", 1, "Mesh"));
-            vehicle.addComponent(SolarPanelStatics.mesh.Get(), makeName("SolarPanel", 1, "Mesh"));
-            vehicle.addComponent(AntennaStatics.mesh.Get(), makeName("Antenna", 1, "Mesh"));
+            vehicle.addComponent(MastStatics.mesh, makeName("Mast", 1, "Mesh"));
+            vehicle.addComponent(SolarPanelStatics.mesh, makeName("SolarPanel", 1, "Mesh"));
+            vehicle.addComponent(AntennaStatics.mesh, makeName("Antenna", 1, "Mesh"));
 
             // Add legs
-            addLeg(1, Leg1BracketStatics.mesh.Get(), Leg1TopStatics.mesh.Get(), Leg1BottomStatics.mesh.Get());
-            addLeg(2, Leg2BracketStatics.mesh.Get(), Leg2TopStatics.mesh.Get(), Leg2BottomStatics.mesh.Get());
-            addLeg(3, Leg3BracketStatics.mesh.Get(), Leg3TopStatics.mesh.Get(), Leg3BottomStatics.mesh.Get());
-            addLeg(4, Leg4BracketStatics.mesh.Get(), Leg4TopStatics.mesh.Get(), Leg4BottomStatics.mesh.Get());
+            addLeg(1, Leg1BracketStatics.mesh, Leg1TopStatics.mesh, Leg1BottomStatics.mesh);
+            addLeg(2, Leg2BracketStatics.mesh, Leg2TopStatics.mesh, Leg2BottomStatics.mesh);
+            addLeg(3, Leg3BracketStatics.mesh, Leg3TopStatics.mesh, Leg3BottomStatics.mesh);
+            addLeg(4, Leg4BracketStatics.mesh, Leg4TopStatics.mesh, Leg4BottomStatics.mesh);
 
             // Flight manager will be set in BeginPlay()
             _flightManager = NULL;
@@ -131,6 +131,8 @@ class Ingenuity {
         void EndPlay(void)
         {
             FThreadedManager::stopThread((FThreadedManager **)&_flightManager);
+
+            vehicle.EndPlay();
         }
 
         void Tick(float DeltaSeconds)
@@ -143,4 +145,9 @@ class Ingenuity {
             vehicle.addCamera(camera);
         }
 
+        void addLidar(Lidar * lidar)
+        {
+            vehicle.addLidar(lidar);
+        }
+
 }; // class Ingenuity 
@@ -58,7 +58,7 @@ class Phantom {
 
         void build(APawn * pawn)
         {
-            vehicle.buildFull(pawn, FrameStatics.mesh.Get());
+            vehicle.buildFull(pawn, FrameStatics.mesh);
 
             // Add propellers
             addProp(+1, +1);
@@ -84,6 +84,8 @@ class Phantom {
         void EndPlay(void)
         {
             FThreadedManager::stopThread((FThreadedManager **)&_flightManager);
+
+            vehicle.EndPlay();
         }
 
         void Tick(float DeltaSeconds)
@@ -96,9 +98,14 @@ class Phantom {
             vehicle.addCamera(camera);
         }
 
+        void addLidar(Lidar * lidar)
+        {
+            vehicle.addLidar(lidar);
+        }
+
         void addProp(int8_t dx, int8_t dy)
         {
-            vehicle.addProp(PropStatics.mesh.Get(), dx*0.12, dy*0.12, 0.17);
+            vehicle.addProp(PropStatics.mesh, dx*0.12, dy*0.12, 0.17);
         }
 
 }; // class Phantom 
@@ -65,6 +65,12 @@ class Rocket {
             {
             }
 
+            // The nozzle moves, so the instances could not show it
+            virtual bool canSwarmRender(void) override
+            {
+                return false;
+            }
+
             virtual void animateActuators(void) override
             {
                 MultirotorVehicle::animateActuators();
@@ -76,14 +82,15 @@ class Rocket {
         // Threaded worker for flight control
         FFlightManager * _flightManager = NULL;
 
-        void addRotor(UStaticMesh* mesh, float z)
+        void addRotor(const VehicleAssets::Mesh & mesh, float z)
         {
             _vehicle->addProp(mesh, 0, 0, z);
         }
 
-        float meshHeightMeters(UStaticMesh * mesh) 
+        // Loads the mesh on the spot, since the dynamics depend on it
+        float meshHeightMeters(const VehicleAssets::Mesh & mesh) 
         {
-            FBox box = mesh->GetBoundingBox();
+            FBox box = mesh.load()->GetBoundingBox();
 
             return (box.Max.Z - box.Min.Z) / 100; // cm => m
         }
@@ -97,7 +104,7 @@ class Rocket {
         void build(APawn * pawn)
         {
             // Get height of barrel for dynamics
-            float barrelHeight = meshHeightMeters(BodyStatics.mesh.Get());
+            float barrelHeight = meshHeightMeters(BodyStatics.mesh);
 
             // Create dynamics
             dynamics = new ThrustVectorDynamics(vparams, NOZZLE_MAX_ANGLE);
@@ -106,14 +113,14 @@ class Rocket {
             _vehicle = new NozzleVehicle(dynamics);
 
             // Add barrel mesh to vehicle
-            _vehicle->buildFull(pawn, BodyStatics.mesh.Get());
+            _vehicle->buildFull(pawn, BodyStatics.mesh);
 
             // Add rotors
-            addRotor(Rotor1Statics.mesh.Get(), ROTOR1_Z);
-            addRotor(Rotor2Statics.mesh.Get(), ROTOR2_Z);
+            addRotor(Rotor1Statics.mesh, ROTOR1_Z);
+            addRotor(Rotor2Statics.mesh, ROTOR2_Z);
 
             // Add nozzle
-            _vehicle->nozzleMeshComponent = _vehicle->addComponent(NozzleStatics.mesh.Get(), FName("Nozzle"), 0, 0, NOZZLE_Z, 0);
+            _vehicle->nozzleMeshComponent = _vehicle->addComponent(NozzleStatics.mesh, FName("Nozzle"), 0, 0, NOZZLE_Z, 0);
 
             _flightManager = NULL;
         }
@@ -133,6 +140,8 @@ class Rocket {
         void EndPlay(void)
         {
             FThreadedManager::stopThread((FThreadedManager **)&_flightManager);
+
+            _vehicle->EndPlay();
         }
 
         void Tick(float DeltaSeconds)
@@ -145,5 +154,10 @@ class Rocket {
             _vehicle->addCamera(camera);
         }
 
+        void addLidar(Lidar * lidar)
+        {
+            _vehicle->addLidar(lidar);
+        }
+
 
 }; // class Rocket 
@@ -68,7 +68,7 @@ class TinyWhoop {
         FFlightManager * _flightManager = NULL;
 
         // Adds simulated motor barrel to frame
-        void addMotor(UStaticMesh * motorMesh, uint8_t id)
+        void addMotor(const VehicleAssets::Mesh & motorMesh, uint8_t id)
         {
             char meshName[10];
             SPRINTF(meshName, "Motor%d", id);
@@ -77,7 +77,7 @@ class TinyWhoop {
 
         void addProp(float x, float y)
         {
-            vehicle.addProp(PropCCWStatics.mesh.Get(), x, y, 0.04);
+            vehicle.addProp(PropCCWStatics.mesh, x, y, 0.04);
         }
 
     public:
@@ -85,7 +85,7 @@ class TinyWhoop {
         void build(APawn * pawn)
         {
             // Build the frame
-            vehicle.buildFull(pawn, FrameStatics.mesh.Get());
+            vehicle.buildFull(pawn, FrameStatics.mesh);
 
             // Add propellers
             float x13 = -.0470, x24 = +.0430, y14 = -.020, y23 = +.070;
@@ -95,20 +95,20 @@ class TinyWhoop {
             addProp(x24, y14);
 
             // Add motor barrels
-            addMotor(Motor1Statics.mesh.Get(), 1);
-            addMotor(Motor2Statics.mesh.Get(), 2);
-            addMotor(Motor3Statics.mesh.Get(), 3);
-            addMotor(Motor4Statics.mesh.Get(), 4);
+            addMotor(Motor1Statics.mesh, 1);
+            addMotor(Motor2Statics.mesh, 2);
+            addMotor(Motor3Statics.mesh, 3);
+            addMotor(Motor4Statics.mesh, 4);
 
             // Add battery, camera, etc.
-            vehicle.addMesh(BatteryStatics.mesh.Get(), "BatteryMesh");
-            vehicle.addMesh(CameraMountStatics.mesh.Get(), "CameraMountMesh");
-            vehicle.addMesh(CameraStatics.mesh.Get(), "CameraMesh");
-            vehicle.addMesh(WhoopFCStatics.mesh.Get(), "WhoopFCMesh");
-            vehicle.addMesh(Screw1Statics.mesh.Get(), "Screw1Mesh");
-            vehicle.addMesh(Screw2Statics.mesh.Get(), "Screw2Mesh");
-            vehicle.addMesh(Screw3Statics.mesh.Get(), "Screw3Mesh");
-            vehicle.addMesh(Screw4Statics.mesh.Get(), "Screw4Mesh");
+            vehicle.addMesh(BatteryStatics.mesh, "BatteryMesh");
+            vehicle.addMesh(CameraMountStatics.mesh, "CameraMountMesh");
+            vehicle.addMesh(CameraStatics.mesh, "CameraMesh");
+            vehicle.addMesh(WhoopFCStatics.mesh, "WhoopFCMesh");
+            vehicle.addMesh(Screw1Statics.mesh, "Screw1Mesh");
+            vehicle.addMesh(Screw2Statics.mesh, "Screw2Mesh");
+            vehicle.addMesh(Screw3Statics.mesh, "Screw3Mesh");
+            vehicle.addMesh(Screw4Statics.mesh, "Screw4Mesh");
 
             // Flight manager will be set in BeginPlay()
             _flightManager = NULL;
@@ -129,6 +129,8 @@ class TinyWhoop {
         void EndPlay(void)
         {
             FThreadedManager::stopThread((FThreadedManager **)&_flightManager);
+
+            vehicle.EndPlay();
         }
 
         void Tick(float DeltaSeconds)
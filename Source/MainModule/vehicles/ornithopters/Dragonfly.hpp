@@ -49,7 +49,7 @@ class Dragonfly {
 
         void addWing(float hingeX, float hingeY, float startAngle, float relativeAngle)
         {
-            ornithopter.addWing(WingStatics.mesh.Get(), HingeStatics.mesh.Get(), hingeX, hingeY, +0.3, startAngle, relativeAngle);
+            ornithopter.addWing(WingStatics.mesh, HingeStatics.mesh, hingeX, hingeY, +0.3, startAngle, relativeAngle);
         }
 
     public:
@@ -60,15 +60,15 @@ class Dragonfly {
 
         void build(APawn * pawn)
         {
-            ornithopter.buildFull(pawn, BodyStatics.mesh.Get());
+            ornithopter.buildFull(pawn, BodyStatics.mesh);
 
             addWing(+0.20, +0.05, -20,  -20);
             addWing(+0.15, -0.05, +160, -20);
             addWing(+0.25, -0.05, -160, +20);
             addWing(+0.10, +0.05, +20,  +20);
 
-            ornithopter.addMesh(EyeLeftStatics.mesh.Get(),  "EyeLeft");
-            ornithopter.addMesh(EyeRightStatics.mesh.Get(), "EyeRight");
+            ornithopter.addMesh(EyeLeftStatics.mesh,  "EyeLeft");
+            ornithopter.addMesh(EyeRightStatics.mesh, "EyeRight");
 
             _flightManager = NULL;
         }
@@ -88,6 +88,8 @@ class Dragonfly {
         void EndPlay(void)
         {
             FThreadedManager::stopThread((FThreadedManager **)&_flightManager);
+
+            ornithopter.EndPlay();
         }
 
         void Tick(float DeltaSeconds)
@@ -100,4 +102,9 @@ class Dragonfly {
             ornithopter.addCamera(camera);
         }
 
+        void addLidar(Lidar * lidar)
+        {
+            ornithopter.addLidar(lidar);
+        }
+
 }; // class Dragonfly 
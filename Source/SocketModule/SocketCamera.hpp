@@ -10,27 +10,26 @@
 
 #include "../MainModule/Camera.hpp"
 
+#include "SocketPorts.hpp"
+
 #include "sockets/TcpClientSocket.hpp"
 
 class SocketCamera : public Camera {
 
     private:
 
-        // Comms
-        static constexpr char * HOST = "127.0.0.1"; // localhost
-        static constexpr uint16_t PORT = 5002;
-
         // Camera params
         static constexpr Resolution_t RES = RES_640x480;
         static constexpr float FOV = 135;
 
-        // Create one-way TCP socket server for images out
-        TcpClientSocket imageSocket = TcpClientSocket(HOST, PORT);
+        // One-way TCP socket client for images out
+        TcpClientSocket imageSocket;
 
     public:
 
-        SocketCamera(float x=Camera::X, float y=Camera::Y, float z=Camera::Z)
-            : Camera(FOV, RES, x, y, z)
+        SocketCamera(float x=Camera::X, float y=Camera::Y, float z=Camera::Z,
+                const char * host=SocketPorts::host(), uint16_t port=SocketPorts::camera())
+            : Camera(FOV, RES, x, y, z), imageSocket(host, port)
         {
             // Open image socket's connection to host
             imageSocket.openConnection();
@@ -41,6 +40,7 @@ class SocketCamera : public Camera {
         virtual void processImageBytes(uint8_t * bytes) override
         { 
             // Send image data
+            TRACE_SCOPE("TcpClientSocket::sendData");
             imageSocket.sendData(bytes, _rows*_cols*4);
         }
 
@@ -10,25 +10,28 @@
 #include "../MainModule/Dynamics.hpp"
 #include "sockets/TwoWayUdp.hpp"
 #include "SocketCamera.hpp"
+#include "SocketLidar.hpp"
+#include "SocketPorts.hpp"
 
 class FSocketFlightManager : public FFlightManager {
 
     private:
 
-		const char * HOST = "127.0.0.1";
-        const short MOTOR_PORT = 5000;
-		const short TELEM_PORT = 5001;
-
         TwoWayUdp * _twoWayUdp = NULL;
 
         bool _running = false;
 
     public:
 
-        FSocketFlightManager(Dynamics * dynamics) : 
-            FFlightManager(dynamics)
+        // Endpoints default to those given on the command line (see SocketPorts.hpp).
+        // Runs on its own thread, since it waits on the network every step.
+        FSocketFlightManager(Dynamics * dynamics, 
+                const char * host=SocketPorts::host(), 
+                uint16_t motorPort=SocketPorts::motor(), 
+                uint16_t telemPort=SocketPorts::telemetry()) : 
+            FFlightManager(dynamics, MODE_THREAD)
         {
-            _twoWayUdp = new TwoWayUdp(HOST, TELEM_PORT, MOTOR_PORT);
+            _twoWayUdp = new TwoWayUdp(host, telemPort, motorPort);
 
             _running = true;
         }
@@ -58,10 +61,16 @@ class FSocketFlightManager : public FFlightManager {
                 telemetry[k+1] = _dynamics->x(k);
             }
 
-			_twoWayUdp->send(telemetry, sizeof(telemetry));
+            {
+                TRACE_SCOPE("TwoWayUdp::send");
+                _twoWayUdp->send(telemetry, sizeof(telemetry));
+            }
 
 			// Get motor values from control program
-			_twoWayUdp->receive(motorvals, 8 * _nmotors);
+            {
+                TRACE_SCOPE("TwoWayUdp::receive");
+                _twoWayUdp->receive(motorvals, 8 * _nmotors);
+            }
 
 			// Control program sends a -1 to halt
 			if (motorvals[0] == -1) {
@@ -0,0 +1,54 @@
+/*
+ * LiDAR class for MulticopterSim using socket communication
+ *
+ * Sends each packet of points (see Lidar::header_t) as it comes in, a few
+ * columns of the sweep per frame.
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include "../MainModule/Lidar.hpp"
+
+#include "SocketPorts.hpp"
+
+#include "sockets/TcpClientSocket.hpp"
+
+class SocketLidar : public Lidar {
+
+    private:
+
+        // LiDAR params: 16 beams from -15 to +15 degrees, every 0.4 degrees, ten sweeps a second
+        static const uint16_t CHANNELS = 16;
+        static const uint16_t COLUMNS = 900;
+        static constexpr float MIN_ELEVATION = -15;
+        static constexpr float MAX_ELEVATION = +15;
+        static constexpr float SWEEP_RATE = 10;
+        static constexpr float MAX_RANGE = 100;
+
+        // One-way TCP socket client for points out
+        TcpClientSocket pointSocket;
+
+    public:
+
+        SocketLidar(float x=0, float y=0, float z=0,
+                const char * host=SocketPorts::host(), uint16_t port=SocketPorts::lidar())
+            : Lidar(CHANNELS, COLUMNS, MIN_ELEVATION, MAX_ELEVATION, SWEEP_RATE, MAX_RANGE, x, y, z), pointSocket(host, port)
+        {
+            // Open point socket's connection to host
+            pointSocket.openConnection();
+        }
+
+    protected:
+
+        virtual void processPacket(const uint8_t * bytes, uint32_t size) override
+        {
+            // Send point data
+            TRACE_SCOPE("TcpClientSocket::sendData");
+            pointSocket.sendData((void *)bytes, size);
+        }
+
+}; // class SocketLidar
@@ -0,0 +1,72 @@
+/*
+ * Per-instance socket endpoints for MulticopterSim
+ *
+ * By default the flight manager receives motor values on port 5000, sends
+ * telemetry to port 5001, the camera sends images to port 5002, and the
+ * LiDAR sends points to port 5003, all on localhost.  To run more than one
+ * simulator on a machine, give each a different base port on the command line:
+ *
+ *   -simport=6000     motors on 6000, telemetry to 6001, images to 6002, points to 6003
+ *   -simhost=10.0.0.2 controller host
+ *
+ * Copyright (C) 2021 Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+class SocketPorts {
+
+    public:
+
+        static constexpr uint16_t DEFAULT_BASE = 5000;
+
+        static constexpr char * DEFAULT_HOST = "127.0.0.1"; // localhost
+
+        static uint16_t base(void)
+        {
+            int32 base = DEFAULT_BASE;
+            FParse::Value(FCommandLine::Get(), TEXT("simport="), base);
+            return (uint16_t)base;
+        }
+
+        static uint16_t motor(void)
+        {
+            return base();
+        }
+
+        static uint16_t telemetry(void)
+        {
+            return base() + 1;
+        }
+
+        static uint16_t camera(void)
+        {
+            return base() + 2;
+        }
+
+        static uint16_t lidar(void)
+        {
+            return base() + 3;
+        }
+
+        static const char * host(void)
+        {
+            static char host[64];
+
+            FString value;
+            if (FParse::Value(FCommandLine::Get(), TEXT("simhost="), value)) {
+                snprintf(host, sizeof(host), "%s", TCHAR_TO_ANSI(*value));
+            }
+            else {
+                snprintf(host, sizeof(host), "%s", DEFAULT_HOST);
+            }
+
+            return host;
+        }
+
+}; // class SocketPorts
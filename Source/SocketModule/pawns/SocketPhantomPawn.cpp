@@ -13,6 +13,8 @@ ASocketPhantomPawn::ASocketPhantomPawn()
     _phantom.build(this);
 
     _phantom.addCamera(&_camera);
+
+    _phantom.addLidar(&_lidar);
 }
 
 void ASocketPhantomPawn::PostInitializeComponents()
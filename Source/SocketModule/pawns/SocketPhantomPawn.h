@@ -30,6 +30,9 @@ class SOCKETMODULE_API ASocketPhantomPawn : public APawn {
         // Camera
         SocketCamera _camera;
 
+        // LiDAR, on top of the frame
+        SocketLidar _lidar = SocketLidar(0, 0, 0.25);
+
     protected:
 
         // AActor overrides